@@ -0,0 +1,226 @@
+/*
+	batch_util.c
+	작은 파일 여러개를 목차와 이어붙인 내용으로 이루어진 스트림 하나로 묶고 푸는 함수들입니다.
+	클라이언트는 묶음을 메모리 파일(memfd)로 만들어 일반 업로드처럼 보내므로
+	전송 방식마다 따로 만들 것이 없고, 파일마다 쓰레드와 채널을 만드는 비용이 묶음 하나로 줄어듭니다.
+	서버는 이름 없는 임시 파일로 받은 뒤 한번에 읽어가며 디렉토리에 풀어줍니다.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "batch_util.h"
+
+static const char* batch_basename(const char* path)
+{
+	const char* name = strrchr(path, '/');
+	return name? name + 1: path;
+}
+
+static int write_all(int fd, const void* buf, size_t len)
+{
+	const char* src = (const char*)buf;
+	while (len > 0)
+	{
+		ssize_t n = write(fd, src, len);
+		if (n <= 0)
+			return -1;
+		src += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// BATCH_FILE_MAX 이하의 파일들을 순서대로 묶음에 나누어 넣습니다.
+// batch_of 에 파일마다 묶음 번호를 넣고(묶지 않으면 -1) 묶음 수를 돌려줍니다.
+int batch_plan(char** paths, int count, int* batch_of)
+{
+	int batch = 0, files = 0;
+	size_t bytes = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		struct stat st;
+		batch_of[i] = -1;
+		if (stat(paths[i], &st) < 0 || !S_ISREG(st.st_mode) || st.st_size > BATCH_FILE_MAX)
+			continue;
+
+		size_t need = sizeof(struct batch_entry) + strlen(batch_basename(paths[i])) + st.st_size;
+		if (files && (files == BATCH_FILES_MAX || bytes + need > BATCH_BYTES_MAX))
+		{
+			batch++;
+			files = 0;
+			bytes = 0;
+		}
+		batch_of[i] = batch;
+		files++;
+		bytes += need;
+	}
+
+	return files? batch + 1: 0;
+}
+
+// batch 번째 묶음의 파일들을 메모리 파일 하나에 묶어서 fd 를 돌려줍니다.
+// 파일을 읽지 못하면 -1 을 돌려줍니다.
+int batch_pack(char** paths, const int* batch_of, int count, int batch)
+{
+	struct batch_hdr hdr;
+	hdr.magic = BATCH_MAGIC;
+	hdr.count = 0;
+	hdr.toc_len = sizeof(hdr);
+
+	int* fds = (int*)malloc(count * sizeof(int));
+	struct batch_entry* entries = (struct batch_entry*)malloc(count * sizeof(struct batch_entry));
+	const char** names = (const char**)malloc(count * sizeof(char*));
+	int out = -1;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (batch_of[i] != batch)
+			continue;
+
+		struct stat st;
+		int fd = open(paths[i], O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) < 0 || st.st_size > BATCH_FILE_MAX)
+		{
+			if (fd >= 0)
+				close(fd);
+			goto cleanup;
+		}
+
+		struct batch_entry* e = &entries[hdr.count];
+		names[hdr.count] = batch_basename(paths[i]);
+		e->size = st.st_size;
+		e->name_len = strlen(names[hdr.count]);
+		e->reserved = 0;
+		fds[hdr.count++] = fd;
+		hdr.toc_len += sizeof(struct batch_entry) + e->name_len;
+	}
+
+	out = memfd_create("batch", 0);
+	if (out < 0)
+		goto cleanup;
+
+	int failed = write_all(out, &hdr, sizeof(hdr)) < 0 || write_all(out, entries, hdr.count * sizeof(struct batch_entry)) < 0;
+	for (uint32_t i = 0; !failed && i < hdr.count; i++)
+		failed = write_all(out, names[i], entries[i].name_len) < 0;
+
+	char buffer[BATCH_FILE_MAX];
+	for (uint32_t i = 0; !failed && i < hdr.count; i++)
+	{
+		// 크기를 잰 뒤 파일이 줄어들었으면 목차와 맞지 않으므로 실패입니다.
+		failed = pread(fds[i], buffer, entries[i].size, 0) != (ssize_t)entries[i].size
+			|| write_all(out, buffer, entries[i].size) < 0;
+	}
+
+	if (failed)
+	{
+		close(out);
+		out = -1;
+	}
+
+cleanup:
+	for (uint32_t i = 0; i < hdr.count; i++)
+		close(fds[i]);
+	free(fds);
+	free(entries);
+	free(names);
+	return out;
+}
+
+// 묶음을 받을 이름 없는 임시 파일을 dir 에 만듭니다.
+// O_TMPFILE 을 지원하지 않는 파일 시스템이면 만든 뒤 바로 지웁니다.
+int batch_tmpfile(const char* dir)
+{
+	int fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+	if (fd >= 0)
+		return fd;
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s/.batch_XXXXXX", dir);
+	fd = mkstemp(path);
+	if (fd >= 0)
+		unlink(path);
+	return fd;
+}
+
+// 이름은 dir 바로 아래의 파일이어야 합니다.
+static int batch_name_ok(const char* name, int len)
+{
+	if (!len || memchr(name, '/', len) || memchr(name, '\0', len))
+		return 0;
+	if ((len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.'))
+		return 0;
+	return 1;
+}
+
+// fd 에 받은 묶음을 검사하고 dir 에 풀어줍니다.
+// 푼 파일 수를 돌려주며, 형식이 맞지 않으면 -1, 파일을 쓰지 못하면 -2 입니다.
+int batch_unpack(int fd, const char* dir)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct batch_hdr))
+		return -1;
+
+	size_t total = st.st_size;
+	const char* map = (const char*)mmap(NULL, total, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise((void*)map, total, MADV_SEQUENTIAL);
+
+	struct batch_hdr hdr;
+	memcpy(&hdr, map, sizeof(hdr));
+
+	int result = -1;
+	size_t entries_end = sizeof(hdr) + (size_t)hdr.count * sizeof(struct batch_entry);
+	if (hdr.magic != BATCH_MAGIC || hdr.count > BATCH_FILES_MAX || entries_end > hdr.toc_len || hdr.toc_len > total)
+		goto done;
+
+	// 목차를 모두 확인한 뒤에 풀어서, 잘못된 묶음이 파일 일부만 남기지 않도록 합니다.
+	const struct batch_entry* entries = (const struct batch_entry*)(map + sizeof(hdr));
+	size_t name_off = entries_end, data_off = hdr.toc_len;
+	for (uint32_t i = 0; i < hdr.count; i++)
+	{
+		if (name_off + entries[i].name_len > hdr.toc_len || !batch_name_ok(map + name_off, entries[i].name_len))
+			goto done;
+		name_off += entries[i].name_len;
+		data_off += entries[i].size;
+	}
+	if (name_off != hdr.toc_len || data_off != total)
+		goto done;
+
+	name_off = entries_end;
+	data_off = hdr.toc_len;
+	for (uint32_t i = 0; i < hdr.count; i++)
+	{
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%.*s", dir, entries[i].name_len, map + name_off);
+
+		int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (out < 0 || write_all(out, map + data_off, entries[i].size) < 0)
+		{
+			if (out >= 0)
+				close(out);
+			result = -2;
+			goto done;
+		}
+		close(out);
+
+		name_off += entries[i].name_len;
+		data_off += entries[i].size;
+	}
+	result = hdr.count;
+
+done:
+	munmap((void*)map, total);
+	return result;
+}
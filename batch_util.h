@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// 묶음 스트림에 대한 정의들
+#define BATCH_MAGIC			0x48435442	// "BTCH"
+
+// 이 크기 이하의 업로드 파일만 묶습니다.
+#define BATCH_FILE_MAX		(64 * 1024)
+// 묶음 하나에 담을 최대 크기와 파일 수
+#define BATCH_BYTES_MAX		(4 * 1024 * 1024)
+#define BATCH_FILES_MAX		4096
+
+// 묶음 스트림은 [batch_hdr][batch_entry * count][이름들][내용들] 로 이루어집니다.
+// toc_len 은 내용들이 시작하는 위치이고, 내용들은 목차 순서대로 빈틈없이 붙어 있습니다.
+struct batch_hdr
+{
+	uint32_t magic;
+	uint32_t count;
+	uint64_t toc_len;
+};
+
+struct batch_entry
+{
+	uint32_t size;
+	uint16_t name_len;
+	uint16_t reserved;
+};
+
+int batch_plan(char** paths, int count, int* batch_of);
+int batch_pack(char** paths, const int* batch_of, int count, int batch);
+
+int batch_tmpfile(const char* dir);
+int batch_unpack(int fd, const char* dir);
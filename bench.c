@@ -0,0 +1,602 @@
+/*
+	bench.c
+	전송 방식들의 성능을 같은 조건에서 재서 CSV 로 남기는 벤치마크 프로그램입니다.
+	전송 방식, 파일 크기, 동시 전송 수, 조각 크기의 조합마다 서버를 자식 프로세스로 새로 띄우고,
+	클라이언트로 업로드와 다운로드를 한번씩 돌린 뒤 서버를 끝냅니다.
+	서버를 조합마다 새로 띄우므로 서버의 metrics 소켓(metrics.c)에서 읽은 분포는 그 조합의 값만 담깁니다.
+
+	한 줄에 남기는 값은 다음과 같습니다.
+		- 걸린 시간과 처리량(클라이언트를 띄운 때부터 거둘 때까지)
+		- 전송 하나의 지연 p50/p99(서버의 ipc_transfer_duration_seconds)
+		- 1GB 당 클라이언트/서버의 CPU 시간
+		- 클라이언트/서버의 read/write 계열 시스템 콜 수(/proc/<pid>/io 의 syscr + syscw)와 문맥 교환 수
+	메세지 큐나 futex 같은 시스템 콜은 /proc 에서 셀 수 없으므로, 그만큼 잠드는 횟수는 문맥 교환 수로 봅니다.
+	결과 파일이 이미 있으면 뒤에 이어 쓰므로, -l 에 커밋 이름을 주면 커밋마다 같은 파일에 쌓아서 비교할 수 있습니다.
+
+	새 전송 방식은 transports 표에 서버/클라이언트 이름과 조각 크기를 받는지만 넣으면 됩니다.
+ */
+
+// wait4, usleep, clock_getcpuclockid
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "file_util.h"
+
+#define BENCH_MAX_LIST		32
+// 서버가 metrics 소켓을 열 때까지 기다리는 최대 시간
+#define BENCH_START_MS		5000
+#define BENCH_GEN_BLOCK		(1024 * 1024)
+
+typedef struct transport
+{
+	const char* name;
+	// 클라이언트가 chunk N 인자를 받는지
+	int has_chunk;
+} transport;
+
+static const transport transports[] =
+{
+	{ "mp", 1 },
+	{ "pipe", 0 },
+	{ "shm", 0 },
+};
+
+// 프로세스 하나의 누적값
+typedef struct proc_counters
+{
+	double cpu_s;
+	uint64_t syscalls;
+	uint64_t ctxsw;
+} proc_counters;
+
+// 한 단계(업로드나 다운로드)의 결과
+typedef struct phase_result
+{
+	int ok;
+	double seconds;
+	double p50_ms, p99_ms;
+	proc_counters client, server;
+} phase_result;
+
+static char work_dir[256];
+static char bin_dir[256];
+static const char* label = "";
+// -x 를 주면 클라이언트에 checksum 인자를 넘겨서 CRC32C 로 확인하는 비용까지 잽니다.
+static int use_checksum;
+
+static double now_s()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 1K, 64M, 8G 처럼 1024 단위 접미사를 붙인 크기를 읽습니다.
+static long long parse_size(const char* s)
+{
+	char* end;
+	long long v = strtoll(s, &end, 10);
+	switch(*end)
+	{
+		case 'k': case 'K': v <<= 10; break;
+		case 'm': case 'M': v <<= 20; break;
+		case 'g': case 'G': v <<= 30; break;
+		case '\0': break;
+		default: return -1;
+	}
+	return v;
+}
+
+// 쉼표로 나눈 목록을 읽습니다. 읽은 개수를 돌려주고 잘못된 값이 있으면 -1 입니다.
+static int parse_list(const char* arg, long long* out)
+{
+	char* buffer = strdup(arg);
+	int cnt = 0;
+	for (char* token = strtok(buffer, ","); token != NULL && cnt < BENCH_MAX_LIST; token = strtok(NULL, ","))
+		if ((out[cnt++] = parse_size(token)) < 0)
+		{
+			free(buffer);
+			return -1;
+		}
+	free(buffer);
+	return cnt;
+}
+
+static void read_task_ctxsw(const char* path, uint64_t* ctxsw)
+{
+	char line[256];
+	unsigned long long v;
+	FILE* fp = fopen(path, "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "voluntary_ctxt_switches: %llu", &v) == 1 || sscanf(line, "nonvoluntary_ctxt_switches: %llu", &v) == 1)
+			*ctxsw += v;
+	fclose(fp);
+}
+
+// 시스템 콜 수는 /proc/<pid>/io 에서 읽습니다. 프로세스의 모든 쓰레드(끝난 쓰레드 포함)의 합입니다.
+static void read_proc_io(pid_t pid, uint64_t* syscalls)
+{
+	char path[64], line[256];
+	unsigned long long v;
+	*syscalls = 0;
+	sprintf(path, "/proc/%d/io", (int)pid);
+	FILE* fp = fopen(path, "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "syscr: %llu", &v) == 1 || sscanf(line, "syscw: %llu", &v) == 1)
+			*syscalls += v;
+	fclose(fp);
+}
+
+// 돌고 있는 서버의 누적값입니다. 문맥 교환 수는 쓰레드마다 따로 있으므로 모두 더합니다.
+static void read_proc_counters(pid_t pid, proc_counters* c)
+{
+	char path[300];
+	memset(c, 0, sizeof(proc_counters));
+
+	// /proc/<pid>/stat 의 utime, stime 은 틱(보통 10ms) 단위라 작은 조합에서는 0 이 되므로,
+	// 서버 프로세스의 CPU 시간 시계를 나노초 단위로 읽습니다. 끝난 쓰레드의 시간도 들어 있습니다.
+	clockid_t clock;
+	struct timespec ts;
+	if (clock_getcpuclockid(pid, &clock) == 0 && clock_gettime(clock, &ts) == 0)
+		c->cpu_s = ts.tv_sec + ts.tv_nsec / 1e9;
+
+	read_proc_io(pid, &c->syscalls);
+
+	sprintf(path, "/proc/%d/task", (int)pid);
+	DIR* dir = opendir(path);
+	if (dir)
+	{
+		struct dirent* ent;
+		while ((ent = readdir(dir)) != NULL)
+		{
+			if (ent->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "/proc/%d/task/%s/status", (int)pid, ent->d_name);
+			read_task_ctxsw(path, &c->ctxsw);
+		}
+		closedir(dir);
+	}
+}
+
+static void counters_diff(proc_counters* out, const proc_counters* before, const proc_counters* after)
+{
+	out->cpu_s = after->cpu_s - before->cpu_s;
+	out->syscalls = after->syscalls - before->syscalls;
+	out->ctxsw = after->ctxsw - before->ctxsw;
+}
+
+// dir 에서 출력을 버리고 프로그램을 띄웁니다.
+static pid_t spawn(const char* dir, char** argv)
+{
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+
+	int null_fd = open("/dev/null", O_WRONLY);
+	if (chdir(dir) < 0 || null_fd < 0)
+		_exit(127);
+	dup2(null_fd, STDOUT_FILENO);
+	dup2(null_fd, STDERR_FILENO);
+	execv(argv[0], argv);
+	_exit(127);
+}
+
+// 서버의 metrics 소켓에서 한번 읽습니다. 읽은 본문은 free 해야 합니다.
+static char* scrape(const char* sock_path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return NULL;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	size_t cap = 8192, len = 0;
+	char* body = (char*)malloc(cap);
+	ssize_t n;
+	while ((n = read(fd, body + len, cap - len - 1)) > 0)
+	{
+		len += n;
+		if (cap - len - 1 == 0)
+			body = (char*)realloc(body, cap *= 2);
+	}
+	close(fd);
+	body[len] = '\0';
+	return body;
+}
+
+// 본문에서 name{transport="..",labels} 인 값을 찾습니다. 없으면 -1 입니다.
+static double metric_value(const char* body, const char* name, const char* tname, const char* labels)
+{
+	char key[256];
+	snprintf(key, sizeof(key), "%s{transport=\"%s\",%s} ", name, tname, labels);
+	const char* p = body? strstr(body, key): NULL;
+	return p? strtod(p + strlen(key), NULL): -1;
+}
+
+static pid_t start_server(const transport* tp, const char* run_dir, const char* sock_path)
+{
+	char server_path[300];
+	snprintf(server_path, sizeof(server_path), "%s/server_%s", bin_dir, tp->name);
+	char* argv[] = { server_path, "-m", (char*)sock_path, NULL };
+
+	pid_t pid = spawn(run_dir, argv);
+	if (pid < 0)
+		return -1;
+
+	// metrics 소켓이 열리면 요청을 받을 준비가 끝난 것입니다.
+	for (int waited = 0; waited < BENCH_START_MS; waited += 10)
+	{
+		struct stat st;
+		if (stat(sock_path, &st) == 0)
+			return pid;
+		if (waitpid(pid, NULL, WNOHANG) == pid)
+			return -1;
+		usleep(10 * 1000);
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	return -1;
+}
+
+static void stop_server(pid_t pid)
+{
+	// 서버는 SIGINT 를 받으면 요청 큐/FIFO 를 지우고 끝납니다.
+	kill(pid, SIGINT);
+	waitpid(pid, NULL, 0);
+}
+
+// 크기가 size 인 파일이 dir 에 name0..name(cnt-1) 로 모두 있는지 봅니다.
+static int check_files(const char* dir, int cnt, long long size)
+{
+	char path[512];
+	for (int i = 0; i < cnt; i++)
+	{
+		struct stat st;
+		snprintf(path, sizeof(path), "%s/f%d", dir, i);
+		if (stat(path, &st) < 0 || st.st_size != size)
+			return 0;
+	}
+	return 1;
+}
+
+// 크기별 원본 파일들을 만들어 둡니다. 이미 있으면 다시 만들지 않습니다.
+// 압축이나 중복 제거가 끼어들어도 값이 바뀌지 않도록 xorshift 로 채웁니다.
+static int generate_sources(const char* dir, int cnt, long long size)
+{
+	char path[512];
+	char* block = (char*)malloc(BENCH_GEN_BLOCK);
+	uint64_t x = 0x9E3779B97F4A7C15ull ^ (uint64_t)size;
+
+	if (!is_dir(dir))
+		mkdir(dir, 0755);
+
+	for (int i = 0; i < cnt; i++)
+	{
+		struct stat st;
+		snprintf(path, sizeof(path), "%s/f%d", dir, i);
+		if (stat(path, &st) == 0 && st.st_size == size)
+			continue;
+
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+		{
+			free(block);
+			return -1;
+		}
+		for (long long left = size; left > 0; )
+		{
+			size_t n = left < BENCH_GEN_BLOCK? left: BENCH_GEN_BLOCK;
+			for (size_t j = 0; j + 8 <= n; j += 8)
+			{
+				x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+				memcpy(block + j, &x, 8);
+			}
+			if (write(fd, block, n) != (ssize_t)n)
+			{
+				close(fd);
+				free(block);
+				return -1;
+			}
+			left -= n;
+		}
+		close(fd);
+	}
+	free(block);
+	return 0;
+}
+
+// 클라이언트를 한번 돌립니다. 끝난 뒤 거두기 전에 /proc 에서 시스템 콜 수를 읽고,
+// CPU 시간과 문맥 교환 수는 wait4 의 rusage 로 받습니다.
+static int run_client(const char* run_dir, char** argv, proc_counters* c)
+{
+	memset(c, 0, sizeof(proc_counters));
+	pid_t pid = spawn(run_dir, argv);
+	if (pid < 0)
+		return -1;
+
+	siginfo_t info;
+	if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == 0)
+		read_proc_io(pid, &c->syscalls);
+
+	int status;
+	struct rusage ru;
+	if (wait4(pid, &status, 0, &ru) < 0)
+		return -1;
+	c->cpu_s = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	c->ctxsw = ru.ru_nvcsw + ru.ru_nivcsw;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0? 0: -1;
+}
+
+static void run_phase(const transport* tp, int download, const char* run_dir, const char* sock_path, pid_t server,
+		int cnt, long long size, long long chunk, phase_result* r)
+{
+	char client_path[300], threads[16], chunk_arg[32], dpath[300], upath[300];
+	char* names = (char*)malloc(cnt * 12 + 1);
+	char* argv[12];
+	int argc = 0;
+
+	names[0] = '\0';
+	for (int i = 0; i < cnt; i++)
+		sprintf(names + strlen(names), "%sf%d", i? ",": "", i);
+
+	snprintf(client_path, sizeof(client_path), "%s/client_%s", bin_dir, tp->name);
+	snprintf(threads, sizeof(threads), "%d", cnt);
+	snprintf(chunk_arg, sizeof(chunk_arg), "%lld", chunk);
+	snprintf(dpath, sizeof(dpath), "%s/d", run_dir);
+	snprintf(upath, sizeof(upath), "%s/file", run_dir);
+
+	argv[argc++] = client_path;
+	argv[argc++] = "threads";
+	argv[argc++] = threads;
+	if (chunk > 0)
+	{
+		argv[argc++] = "chunk";
+		argv[argc++] = chunk_arg;
+	}
+	if (use_checksum)
+		argv[argc++] = "checksum";
+	argv[argc++] = download? "download": "upload";
+	argv[argc++] = names;
+	if (download)
+	{
+		argv[argc++] = "dpath";
+		argv[argc++] = dpath;
+	}
+	argv[argc] = NULL;
+
+	proc_counters server_before, server_after;
+	read_proc_counters(server, &server_before);
+	double start = now_s();
+	int rc = run_client(run_dir, argv, &r->client);
+	r->seconds = now_s() - start;
+	read_proc_counters(server, &server_after);
+	counters_diff(&r->server, &server_before, &server_after);
+	free(names);
+
+	// 클라이언트는 실패해도 0 으로 끝날 수 있으므로 받은 쪽의 파일과 서버의 실패 수로 확인합니다.
+	const char* direction = download? "download": "upload";
+	char labels[96];
+	char* body = scrape(sock_path);
+
+	snprintf(labels, sizeof(labels), "direction=\"%s\"", direction);
+	double failed = metric_value(body, "ipc_transfer_errors_total", tp->name, labels);
+	r->ok = rc == 0 && failed == 0 && check_files(download? dpath: upath, cnt, size);
+
+	snprintf(labels, sizeof(labels), "direction=\"%s\",quantile=\"0.5\"", direction);
+	r->p50_ms = metric_value(body, "ipc_transfer_duration_seconds", tp->name, labels) * 1e3;
+	snprintf(labels, sizeof(labels), "direction=\"%s\",quantile=\"0.99\"", direction);
+	r->p99_ms = metric_value(body, "ipc_transfer_duration_seconds", tp->name, labels) * 1e3;
+	free(body);
+}
+
+static void write_row(FILE* csv, const transport* tp, const char* direction, long long size, int cnt, long long chunk, const phase_result* r)
+{
+	double gb = (double)size * cnt / (1024.0 * 1024 * 1024);
+	double mbps = r->seconds > 0? (double)size * cnt / r->seconds / (1024 * 1024): 0;
+
+	fprintf(csv, "%s,%s,%s,%lld,%d,%lld,%d,%.6f,%.2f,%.3f,%.3f,%.4f,%.4f,%llu,%llu,%llu,%llu\n",
+			label, tp->name, direction, size, cnt, chunk, r->ok, r->seconds, mbps, r->p50_ms, r->p99_ms,
+			gb > 0? r->client.cpu_s / gb: 0, gb > 0? r->server.cpu_s / gb: 0,
+			(unsigned long long)r->client.syscalls, (unsigned long long)r->server.syscalls,
+			(unsigned long long)r->client.ctxsw, (unsigned long long)r->server.ctxsw);
+	fflush(csv);
+
+	printf(">> bench(%s,%s,size=%lld,conc=%d,chunk=%lld) %s %.1f MB/s p50=%.3f ms p99=%.3f ms\n",
+			tp->name, direction, size, cnt, chunk, r->ok? "ok": "FAIL", mbps, r->p50_ms, r->p99_ms);
+}
+
+// 조합 하나를 돌립니다. 실행 디렉토리는 조합마다 비우고 원본 파일은 심볼릭 링크로 둡니다.
+static int run_cell(FILE* csv, const transport* tp, long long size, int cnt, long long chunk)
+{
+	char run_dir[300], src_dir[300], path[600], target[600], sock_path[400], cmd[700];
+
+	snprintf(src_dir, sizeof(src_dir), "%s/src_%lld", work_dir, size);
+	snprintf(run_dir, sizeof(run_dir), "%s/run", work_dir);
+	snprintf(sock_path, sizeof(sock_path), "%s/metrics.sock", run_dir);
+
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", run_dir);
+	system(cmd);
+	mkdir(run_dir, 0755);
+	snprintf(path, sizeof(path), "%s/d", run_dir);
+	mkdir(path, 0755);
+	for (int i = 0; i < cnt; i++)
+	{
+		snprintf(target, sizeof(target), "%s/f%d", src_dir, i);
+		snprintf(path, sizeof(path), "%s/f%d", run_dir, i);
+		if (symlink(target, path) < 0)
+			return -1;
+	}
+
+	pid_t server = start_server(tp, run_dir, sock_path);
+	if (server < 0)
+	{
+		printf(">> bench(%s): fail to start server\n", tp->name);
+		return -1;
+	}
+
+	phase_result r;
+	run_phase(tp, 0, run_dir, sock_path, server, cnt, size, chunk, &r);
+	write_row(csv, tp, "upload", size, cnt, chunk, &r);
+	run_phase(tp, 1, run_dir, sock_path, server, cnt, size, chunk, &r);
+	write_row(csv, tp, "download", size, cnt, chunk, &r);
+
+	stop_server(server);
+	return 0;
+}
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+			"usage: %s [-t transports] [-s sizes] [-c concurrency] [-k chunks] [-x] [-L bytes per run] [-d work dir] [-o csv] [-l label]\n"
+			"  defaults: -t mp,pipe,shm -s 1K,1M,64M -c 1,16,256 -k 0 -L 1G -d ./bench_work -o bench.csv\n"
+			"  full matrix: -s 1K,64K,1M,64M,1G,8G -c 1,4,16,64,256 -k 0,4096,65536 -L 64G\n"
+			"  chunk 0 is the client default; chunk sizes only apply to transports whose client takes 'chunk N'.\n"
+			"  -x passes 'checksum' to every client so transfers are verified with CRC32C.\n"
+			"  runs whose size x concurrency is over -L are skipped.\n", prog);
+}
+
+int main(int argc, char** argv)
+{
+	const char* transport_arg = "mp,pipe,shm";
+	const char* out_path = "bench.csv";
+	const char* dir_arg = "./bench_work";
+	long long sizes[BENCH_MAX_LIST], concs[BENCH_MAX_LIST], chunks[BENCH_MAX_LIST];
+	int size_cnt = parse_list("1K,1M,64M", sizes);
+	int conc_cnt = parse_list("1,16,256", concs);
+	int chunk_cnt = parse_list("0", chunks);
+	long long run_limit = 1ll << 30;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:s:c:k:xL:d:o:l:")) != -1)
+	{
+		switch(opt)
+		{
+			case 't': transport_arg = optarg; break;
+			case 's': size_cnt = parse_list(optarg, sizes); break;
+			case 'c': conc_cnt = parse_list(optarg, concs); break;
+			case 'k': chunk_cnt = parse_list(optarg, chunks); break;
+			case 'x': use_checksum = 1; break;
+			case 'L': run_limit = parse_size(optarg); break;
+			case 'd': dir_arg = optarg; break;
+			case 'o': out_path = optarg; break;
+			case 'l': label = optarg; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (size_cnt <= 0 || conc_cnt <= 0 || chunk_cnt <= 0 || run_limit <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	// 서버와 클라이언트는 이 프로그램과 같은 디렉토리에 있는 것을 씁니다.
+	char self[256];
+	ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (n < 0)
+	{
+		perror("fail to find bench binary..");
+		return 1;
+	}
+	self[n] = '\0';
+	*strrchr(self, '/') = '\0';
+	strcpy(bin_dir, self);
+
+	if (!is_dir(dir_arg))
+		mkdir(dir_arg, 0755);
+	if (!realpath(dir_arg, work_dir))
+	{
+		perror("fail to open work dir..");
+		return 1;
+	}
+
+	int new_file = access(out_path, F_OK) != 0;
+	FILE* csv = fopen(out_path, "a");
+	if (!csv)
+	{
+		perror("fail to open csv..");
+		return 1;
+	}
+	if (new_file)
+		fprintf(csv, "label,transport,direction,file_bytes,concurrency,chunk,ok,seconds,mb_per_s,p50_ms,p99_ms,"
+				"client_cpu_s_per_gb,server_cpu_s_per_gb,client_syscalls,server_syscalls,client_ctxsw,server_ctxsw\n");
+
+	// 출력이 파이프로 가도 진행 상황이 바로 보이도록 합니다.
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (int t = 0; t < (int)(sizeof(transports) / sizeof(transport)); t++)
+	{
+		const transport* tp = &transports[t];
+		char* list = strdup(transport_arg);
+		int selected = 0;
+		for (char* token = strtok(list, ","); token != NULL; token = strtok(NULL, ","))
+			selected |= strcmp(token, tp->name) == 0;
+		free(list);
+		if (!selected)
+			continue;
+
+		for (int s = 0; s < size_cnt; s++)
+		{
+			for (int c = 0; c < conc_cnt; c++)
+			{
+				if (concs[c] < 1 || sizes[s] * concs[c] > run_limit)
+				{
+					printf(">> bench(%s,size=%lld,conc=%lld) skip, over run limit\n", tp->name, sizes[s], concs[c]);
+					continue;
+				}
+
+				char src_dir[300];
+				snprintf(src_dir, sizeof(src_dir), "%s/src_%lld", work_dir, sizes[s]);
+				if (generate_sources(src_dir, (int)concs[c], sizes[s]) < 0)
+				{
+					perror("fail to generate files..");
+					fclose(csv);
+					return 1;
+				}
+
+				for (int k = 0; k < chunk_cnt; k++)
+				{
+					if (chunks[k] > 0 && !tp->has_chunk)
+						continue;
+					run_cell(csv, tp, sizes[s], (int)concs[c], chunks[k]);
+				}
+			}
+		}
+	}
+
+	fclose(csv);
+	return 0;
+}
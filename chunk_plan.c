@@ -0,0 +1,157 @@
+/*
+	chunk_plan.c
+	중복 제거 업로드에서 클라이언트와 서버가 같이 쓰는 조각 계획입니다.
+	둘은 요청의 파일 크기와 스트라이프로 같은 구간을 구하므로, 조각의 수와 위치도 따로 주고받지 않고 같게 계산합니다.
+	클라이언트는 조각마다 SHA-256 을 구해서 보내고, 서버는 가진 조각을 비트로 알려줍니다(chunk_store.c).
+	그 뒤로 보내는 데이터는 없는 조각들만 이어붙인 스트림이며, 양쪽 모두 스트림 위치를 파일 위치로 바꾸어 읽고 씁니다.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "chunk_plan.h"
+
+// 구간 offset 부터 len 만큼의 조각들을 준비합니다. 구간은 CHUNK_SIZE 의 배수에서 시작합니다(req_stripe_range).
+int chunk_plan_init(chunk_plan* p, uint64_t offset, uint64_t len)
+{
+	memset(p, 0, sizeof(chunk_plan));
+	p->offset = offset;
+	p->len = len;
+	p->first = offset / CHUNK_SIZE;
+	p->count = (len + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	if (!p->count)
+		return 0;
+
+	p->hashes = (uint8_t (*)[SHA256_SIZE])malloc((size_t)p->count * SHA256_SIZE);
+	p->have = (uint8_t*)calloc(p->count, 1);
+	p->missing = (uint32_t*)malloc((size_t)p->count * sizeof(uint32_t));
+	if (!p->hashes || !p->have || !p->missing)
+	{
+		chunk_plan_destroy(p);
+		return -1;
+	}
+	return 0;
+}
+
+void chunk_plan_destroy(chunk_plan* p)
+{
+	free(p->hashes);
+	free(p->have);
+	free(p->missing);
+	p->hashes = NULL;
+	p->have = NULL;
+	p->missing = NULL;
+}
+
+// 구간의 i 번째 조각의 파일 위치와 크기, 파일의 마지막 조각만 CHUNK_SIZE 보다 짧습니다.
+void chunk_plan_span(const chunk_plan* p, uint32_t i, off_t* offset, size_t* len)
+{
+	uint64_t at = (uint64_t)i * CHUNK_SIZE;
+	*offset = p->offset + at;
+	*len = p->len - at < CHUNK_SIZE? p->len - at: CHUNK_SIZE;
+}
+
+// 보내는 쪽이 구간의 조각들을 읽어서 해시를 구합니다. 끝까지 읽지 못하면 -1 입니다.
+int chunk_plan_hash_file(chunk_plan* p, int fd)
+{
+	char* buf = (char*)malloc(CHUNK_SIZE);
+	if (!buf)
+		return -1;
+
+	for (uint32_t i = 0; i < p->count; i++)
+	{
+		off_t at;
+		size_t len, done = 0;
+		chunk_plan_span(p, i, &at, &len);
+		while (done < len)
+		{
+			ssize_t n = pread(fd, buf + done, len - done, at + done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+			{
+				free(buf);
+				return -1;
+			}
+			done += n;
+		}
+		sha256(buf, len, p->hashes[i]);
+	}
+	free(buf);
+	return 0;
+}
+
+// 데이터 메세지 하나에 담을 해시 수입니다. 답으로 오는 비트들은 그보다 훨씬 작습니다.
+int chunk_plan_per_msg(int chunk_sz)
+{
+	return chunk_sz / SHA256_SIZE;
+}
+
+// from 부터 n 개 조각이 있는지를 비트로 담고 그 크기를 돌려줍니다.
+size_t chunk_plan_pack(const chunk_plan* p, uint32_t from, uint32_t n, void* bits)
+{
+	uint8_t* b = (uint8_t*)bits;
+	memset(b, 0, (n + 7) / 8);
+	for (uint32_t i = 0; i < n; i++)
+		if (p->have[from + i])
+			b[i / 8] |= 1 << (i % 8);
+	return (n + 7) / 8;
+}
+
+void chunk_plan_unpack(chunk_plan* p, uint32_t from, uint32_t n, const void* bits)
+{
+	const uint8_t* b = (const uint8_t*)bits;
+	for (uint32_t i = 0; i < n; i++)
+		p->have[from + i] = (b[i / 8] >> (i % 8)) & 1;
+}
+
+// 서버에 없는 조각들로 스트림을 정합니다.
+void chunk_plan_finish(chunk_plan* p)
+{
+	p->missing_cnt = 0;
+	p->stream_len = 0;
+	for (uint32_t i = 0; i < p->count; i++)
+		if (!p->have[i])
+		{
+			off_t at;
+			size_t len;
+			chunk_plan_span(p, i, &at, &len);
+			p->missing[p->missing_cnt++] = i;
+			p->stream_len += len;
+		}
+}
+
+// 스트림의 pos 에 해당하는 파일 위치를 돌려주고, room 에는 그 조각이 끝날 때까지 남은 크기를 담습니다.
+// 짧은 조각은 파일의 마지막 조각뿐이고 스트림에서도 맨 뒤에 오므로, 앞의 조각들은 모두 CHUNK_SIZE 입니다.
+off_t chunk_plan_map(const chunk_plan* p, uint64_t pos, size_t* room)
+{
+	uint32_t k = pos / CHUNK_SIZE;
+	size_t in = pos % CHUNK_SIZE;
+	off_t at;
+	size_t len;
+	chunk_plan_span(p, p->missing[k], &at, &len);
+	*room = len - in;
+	return at + in;
+}
+
+// 스트림의 pos 부터 len 만큼을 파일에서 읽습니다. 조각 경계에서 나누어 읽으며 읽은 크기를 돌려줍니다.
+ssize_t chunk_plan_pread(const chunk_plan* p, int fd, void* buf, size_t len, uint64_t pos)
+{
+	size_t done = 0;
+	while (done < len && pos + done < p->stream_len)
+	{
+		size_t room;
+		off_t at = chunk_plan_map(p, pos + done, &room);
+		ssize_t n = pread(fd, (char*)buf + done, len - done < room? len - done: room, at);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return done? (ssize_t)done: -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
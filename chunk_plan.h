@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "request_proto.h"
+#include "sha256.h"
+
+// 중복 제거 업로드가 파일을 나누는 조각의 크기입니다. 파일의 처음부터 고정된 크기로 나누며,
+// 스트라이프 경계와 같은 단위이므로 조각 하나가 두 스트라이프에 걸치지 않습니다.
+#define CHUNK_SIZE		REQ_STRIPE_ALIGN
+
+// 업로드 하나가 맡은 구간의 조각들과, 그 중 서버에 없어서 보내야 하는 조각들입니다.
+// 보내는 데이터(스트림)는 없는 조각들을 차례로 이어붙인 것이고, 스트림의 위치는 chunk_plan_map 으로 파일 위치가 됩니다.
+typedef struct chunk_plan
+{
+	uint64_t offset, len;
+	// 구간의 첫 조각이 파일에서 몇번째 조각인지와 구간의 조각 수
+	uint32_t first, count;
+	uint8_t (*hashes)[SHA256_SIZE];
+	// 조각마다 서버에 이미 있는지
+	uint8_t* have;
+	// 보낼 조각들의 구간 안 번호와 스트림의 크기
+	uint32_t* missing;
+	uint32_t missing_cnt;
+	uint64_t stream_len;
+} chunk_plan;
+
+int chunk_plan_init(chunk_plan* p, uint64_t offset, uint64_t len);
+void chunk_plan_destroy(chunk_plan* p);
+void chunk_plan_span(const chunk_plan* p, uint32_t i, off_t* offset, size_t* len);
+int chunk_plan_hash_file(chunk_plan* p, int fd);
+
+int chunk_plan_per_msg(int chunk_sz);
+size_t chunk_plan_pack(const chunk_plan* p, uint32_t from, uint32_t n, void* bits);
+void chunk_plan_unpack(chunk_plan* p, uint32_t from, uint32_t n, const void* bits);
+
+void chunk_plan_finish(chunk_plan* p);
+off_t chunk_plan_map(const chunk_plan* p, uint64_t pos, size_t* room);
+ssize_t chunk_plan_pread(const chunk_plan* p, int fd, void* buf, size_t len, uint64_t pos);
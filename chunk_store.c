@@ -0,0 +1,512 @@
+/*
+	chunk_store.c
+	중복 제거 업로드에서 서버가 가진 조각들의 색인입니다.
+	올라온 파일은 그대로 ./file/<이름> 에 두고, 조각(CHUNK_SIZE)마다의 SHA-256 목록을 ./file/.manifest/<이름> 에 따로 둡니다.
+	조각들을 따로 모아두지 않고 해시에서 (파일, 조각 번호)로 가는 색인만 메모리에 두므로, 디스크에 같은 데이터를 두번 두지 않습니다.
+	서버가 시작할 때 목록들을 읽어 색인을 만들고, 중복 제거 업로드가 끝날 때마다 그 목록을 쓰고 색인에 더합니다.
+	업로드할 조각이 이미 있으면 원본에서 읽어 해시를 다시 확인한 뒤 받는 파일의 자리에 놓습니다.
+	파일 시스템이 지원하면(btrfs, XFS) FICLONERANGE 로 블록을 나누어 쓰고, 아니면 복사합니다.
+	목록이 말하는 내용과 실제 파일이 다를 수 있으므로(다른 방식의 업로드로 덮어쓴 파일 등) 놓기 전에 항상 확인하며,
+	맞지 않는 색인 항목은 그때 지웁니다. 그래서 색인과 목록은 틀려도 보낼 조각이 늘어날 뿐 받은 파일이 틀리지 않습니다.
+	같은 이름으로 다시 올리는 파일은 색인보다 먼저 같은 자리의 옛 내용과 비교하므로, 바뀌지 않은 조각은 쓰지도 않습니다.
+	확인하지 않는 경우는 하나뿐입니다. 파일 전체를 한번에 올린 뒤로 파일이 바뀌지 않았으면(inode, 크기, 수정 시각),
+	나누지 않고 다시 올릴 때 목록이 가리키는 같은 자리의 조각은 읽어보지도 않습니다.
+	스트라이프 하나가 쓴 목록은 파일의 일부만 말하므로 파일을 기억하지 않고, 나누어 올리는 동안에는 항상 확인합니다.
+	이름을 잊으면(chunk_store_forget) 세대를 올려서 그 이름을 가리키던 색인 항목들을 한번에 버립니다.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "chunk_store.h"
+#include "metrics.h"
+
+// 조각이 들어 있는 파일의 이름입니다. 이름 수는 적고 색인 항목들이 가리키므로 지우지 않습니다.
+// valid 이면 dev 부터 mtime 까지가 파일 전체의 목록을 마지막으로 쓰거나 읽을 때의 파일입니다.
+// gen 은 이름을 잊을 때마다 올라가며, 세대가 다른 색인 항목은 없는 것으로 봅니다.
+typedef struct chunk_source
+{
+	struct chunk_source* next;
+	char* name;
+	int valid;
+	uint32_t gen;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+} chunk_source;
+
+// 색인 항목 하나, 같은 해시는 하나만 두며 가장 최근에 올라온 자리를 가리킵니다.
+typedef struct chunk_ref
+{
+	struct chunk_ref* next;
+	uint8_t hash[SHA256_SIZE];
+	chunk_source* src;
+	uint32_t gen;
+	uint32_t idx;
+	uint32_t len;
+} chunk_ref;
+
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static char store_root[256] = "./file";
+static chunk_source* sources;
+// 해시는 이미 고르게 퍼져 있으므로 앞 8바이트를 그대로 버킷 번호로 씁니다.
+static chunk_ref** buckets;
+static size_t bucket_cnt, ref_cnt;
+static unsigned long query_cnt, in_place_cnt, clone_cnt, copy_cnt, stale_cnt, reused_bytes;
+
+static size_t bucket_of(const uint8_t* hash, size_t cnt)
+{
+	uint64_t v;
+	memcpy(&v, hash, sizeof(v));
+	return v & (cnt - 1);
+}
+
+static chunk_source* find_source(const char* name)
+{
+	chunk_source* s;
+	for (s = sources; s; s = s->next)
+		if (!strcmp(s->name, name))
+			return s;
+	return NULL;
+}
+
+static chunk_source* intern(const char* name)
+{
+	chunk_source* s = find_source(name);
+	if (s)
+		return s;
+	if (!(s = (chunk_source*)calloc(1, sizeof(chunk_source))) || !(s->name = strdup(name)))
+	{
+		free(s);
+		return NULL;
+	}
+	s->next = sources;
+	sources = s;
+	return s;
+}
+
+static void remember_file(chunk_source* s, const struct stat* st)
+{
+	s->valid = 1;
+	s->dev = st->st_dev;
+	s->ino = st->st_ino;
+	s->size = st->st_size;
+	s->mtime = st->st_mtim;
+}
+
+static int same_file(const chunk_source* s, const struct stat* st)
+{
+	return s->valid && s->dev == st->st_dev && s->ino == st->st_ino && s->size == st->st_size &&
+		s->mtime.tv_sec == st->st_mtim.tv_sec && s->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// 항목이 버킷 수보다 많아지면 버킷을 두배로 늘립니다. 늘리지 못하면 그대로 길게 씁니다.
+static void grow()
+{
+	size_t cnt = bucket_cnt? bucket_cnt * 2: 1024;
+	chunk_ref** next = (chunk_ref**)calloc(cnt, sizeof(chunk_ref*));
+	if (!next)
+		return;
+	for (size_t b = 0; b < bucket_cnt; b++)
+		while (buckets[b])
+		{
+			chunk_ref* r = buckets[b];
+			buckets[b] = r->next;
+			r->next = next[bucket_of(r->hash, cnt)];
+			next[bucket_of(r->hash, cnt)] = r;
+		}
+	free(buckets);
+	buckets = next;
+	bucket_cnt = cnt;
+}
+
+static chunk_ref** find(const uint8_t* hash)
+{
+	if (!bucket_cnt)
+		return NULL;
+	chunk_ref** pr = &buckets[bucket_of(hash, bucket_cnt)];
+	while (*pr && memcmp((*pr)->hash, hash, SHA256_SIZE))
+		pr = &(*pr)->next;
+	return pr;
+}
+
+// 잠금을 잡고 부릅니다.
+static void index_add(const uint8_t* hash, chunk_source* src, uint32_t idx, uint32_t len)
+{
+	if (ref_cnt >= bucket_cnt)
+		grow();
+	chunk_ref** pr = find(hash);
+	if (!pr)
+		return;
+	if (!*pr)
+	{
+		chunk_ref* r = (chunk_ref*)malloc(sizeof(chunk_ref));
+		if (!r)
+			return;
+		memcpy(r->hash, hash, SHA256_SIZE);
+		r->next = NULL;
+		*pr = r;
+		ref_cnt++;
+	}
+	(*pr)->src = src;
+	(*pr)->gen = src->gen;
+	(*pr)->idx = idx;
+	(*pr)->len = len;
+}
+
+static int index_lookup(const uint8_t* hash, size_t len, chunk_source** src, uint32_t* idx)
+{
+	pthread_mutex_lock(&store_lock);
+	chunk_ref** pr = find(hash);
+	// 이름을 잊기 전에 더한 항목은 여기서 지웁니다.
+	if (pr && *pr && (*pr)->gen != (*pr)->src->gen)
+	{
+		chunk_ref* r = *pr;
+		*pr = r->next;
+		free(r);
+		ref_cnt--;
+	}
+	int found = pr && *pr && (*pr)->len == len;
+	if (found)
+	{
+		*src = (*pr)->src;
+		*idx = (*pr)->idx;
+	}
+	pthread_mutex_unlock(&store_lock);
+	return found;
+}
+
+// 확인해보니 내용이 다른 항목을 지웁니다. 그 사이 다른 업로드가 고쳐 쓴 항목은 그대로 둡니다.
+static void index_drop(const uint8_t* hash, chunk_source* src, uint32_t idx)
+{
+	pthread_mutex_lock(&store_lock);
+	chunk_ref** pr = find(hash);
+	if (pr && *pr && (*pr)->src == src && (*pr)->idx == idx)
+	{
+		chunk_ref* r = *pr;
+		*pr = r->next;
+		free(r);
+		ref_cnt--;
+	}
+	stale_cnt++;
+	pthread_mutex_unlock(&store_lock);
+}
+
+static int read_full(int fd, void* buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+	while (done < len)
+	{
+		ssize_t n = pread(fd, (char*)buf + done, len - done, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void* buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+	while (done < len)
+	{
+		ssize_t n = pwrite(fd, (const char*)buf + done, len - done, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
+
+static void manifest_path(char* path, size_t cap, const char* name)
+{
+	snprintf(path, cap, "%s/%s/%s", store_root, CHUNK_STORE_DIR, name);
+}
+
+// 조각 목록 하나를 색인에 더합니다. 목록의 크기가 지금 파일과 다르면 옛 목록이므로 넘어갑니다.
+// 크기는 같아도 목록을 쓴 뒤로 바뀐 파일일 수 있으므로, 그때는 같은 자리의 조각도 읽어서 확인하게 둡니다.
+static void load_manifest(const char* name)
+{
+	char path[512];
+	struct chunk_manifest_hdr hdr;
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/%s", store_root, name);
+	if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+	manifest_path(path, sizeof(path), name);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (read_full(fd, &hdr, sizeof(hdr), 0) < 0 || hdr.magic != CHUNK_STORE_MAGIC || hdr.chunk_size != CHUNK_SIZE || hdr.filesize != (uint64_t)st.st_size)
+	{
+		close(fd);
+		return;
+	}
+
+	static const uint8_t zero[SHA256_SIZE];
+	uint32_t count = (hdr.filesize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	uint8_t (*hashes)[SHA256_SIZE] = (uint8_t (*)[SHA256_SIZE])malloc((size_t)count * SHA256_SIZE + 1);
+	if (hashes && read_full(fd, hashes, (size_t)count * SHA256_SIZE, sizeof(hdr)) == 0)
+	{
+		pthread_mutex_lock(&store_lock);
+		chunk_source* src = intern(name);
+		if (src && hdr.ino == (uint64_t)st.st_ino && hdr.mtime_sec == st.st_mtim.tv_sec && hdr.mtime_nsec == st.st_mtim.tv_nsec)
+			remember_file(src, &st);
+		for (uint32_t i = 0; src && i < count; i++)
+			if (memcmp(hashes[i], zero, SHA256_SIZE))
+			{
+				uint64_t at = (uint64_t)i * CHUNK_SIZE;
+				index_add(hashes[i], src, i, hdr.filesize - at < CHUNK_SIZE? hdr.filesize - at: CHUNK_SIZE);
+			}
+		pthread_mutex_unlock(&store_lock);
+	}
+	free(hashes);
+	close(fd);
+}
+
+// root 아래의 조각 목록들로 색인을 만들고 색인한 조각 수를 돌려줍니다. 목록 폴더를 만들지 못하면 -1 입니다.
+int chunk_store_init(const char* root)
+{
+	char path[512];
+	snprintf(store_root, sizeof(store_root), "%s", root);
+	snprintf(path, sizeof(path), "%s/%s", store_root, CHUNK_STORE_DIR);
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+		return -1;
+
+	DIR* dir = opendir(path);
+	if (!dir)
+		return -1;
+	struct dirent* ent;
+	while ((ent = readdir(dir)) != NULL)
+		if (ent->d_name[0] != '.')
+			load_manifest(ent->d_name);
+	closedir(dir);
+
+	pthread_mutex_lock(&store_lock);
+	int cnt = (int)ref_cnt;
+	pthread_mutex_unlock(&store_lock);
+	return cnt;
+}
+
+// 받는 파일 fd 에 조각들을 놓을 준비를 합니다. old 는 받기 전의 파일이고, 없던 파일이면 NULL 입니다.
+// whole 은 파일을 나누지 않고 받는지입니다. 나누어 받으면 다른 스트라이프가 먼저 파일을 바꾸므로 old 를 믿지 않습니다.
+// 원본 조각과 놓은 조각을 같이 담도록 버퍼는 조각 두개입니다.
+int chunk_placer_init(chunk_placer* c, int fd, const char* name, const struct stat* old, int whole)
+{
+	memset(c, 0, sizeof(chunk_placer));
+	c->fd = fd;
+	c->name = name;
+	c->old_size = old? old->st_size: 0;
+	c->src_fd = -1;
+
+	pthread_mutex_lock(&store_lock);
+	chunk_source* self = find_source(name);
+	if (self && old && whole && same_file(self, old))
+		c->self = self;
+	pthread_mutex_unlock(&store_lock);
+
+	c->buf = (char*)malloc(2 * CHUNK_SIZE);
+	return c->buf? 0: -1;
+}
+
+void chunk_placer_destroy(chunk_placer* c)
+{
+	if (c->src_fd >= 0)
+		close(c->src_fd);
+	free(c->buf);
+	c->buf = NULL;
+}
+
+static int open_source(chunk_placer* c, chunk_source* src)
+{
+	if (c->src == src)
+		return c->src_fd;
+	if (c->src_fd >= 0)
+		close(c->src_fd);
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s", store_root, src->name);
+	c->src = src;
+	c->src_fd = open(path, O_RDONLY);
+	return c->src_fd;
+}
+
+static void count_reuse(unsigned long* kind, size_t len)
+{
+	pthread_mutex_lock(&store_lock);
+	(*kind)++;
+	reused_bytes += len;
+	pthread_mutex_unlock(&store_lock);
+}
+
+// 해시가 hash 인 조각을 받는 파일의 offset 에 놓습니다. 놓았으면 1, 가진 조각이 아니면 0 입니다.
+// 놓지 못한 조각은 클라이언트가 보내므로 실패도 0 으로 돌려줍니다.
+int chunk_place(chunk_placer* c, const uint8_t hash[SHA256_SIZE], off_t offset, size_t len)
+{
+	uint8_t check[SHA256_SIZE];
+	char* data = c->buf;
+
+	pthread_mutex_lock(&store_lock);
+	query_cnt++;
+	pthread_mutex_unlock(&store_lock);
+
+	chunk_source* src;
+	uint32_t idx;
+	int found = index_lookup(hash, len, &src, &idx);
+	off_t src_off = (off_t)idx * CHUNK_SIZE;
+
+	// 색인이 바로 이 자리를 가리키고 파일 전체의 목록을 쓴 뒤로 파일이 바뀌지 않았으면 이미 있는 것입니다.
+	if (found && src == c->self && src_off == offset)
+	{
+		count_reuse(&in_place_cnt, len);
+		c->placed++;
+		return 1;
+	}
+
+	// 같은 이름으로 다시 올리는 파일은 그 자리에 이미 같은 내용이 있을 수 있습니다.
+	if (offset + (off_t)len <= c->old_size && read_full(c->fd, data, len, offset) == 0)
+	{
+		sha256(data, len, check);
+		if (!memcmp(check, hash, SHA256_SIZE))
+		{
+			count_reuse(&in_place_cnt, len);
+			c->placed++;
+			return 1;
+		}
+	}
+
+	if (!found)
+		return 0;
+	int src_fd = open_source(c, src);
+	if (src_fd < 0 || read_full(src_fd, data, len, src_off) < 0)
+	{
+		index_drop(hash, src, idx);
+		return 0;
+	}
+	sha256(data, len, check);
+	if (memcmp(check, hash, SHA256_SIZE))
+	{
+		index_drop(hash, src, idx);
+		return 0;
+	}
+
+	// 블록을 나누어 쓸 수 있으면 복사하지 않습니다. 확인한 뒤에 원본이 바뀌었을 수 있으므로 놓은 것을 다시 비교합니다.
+	struct file_clone_range clone = { .src_fd = src_fd, .src_offset = src_off, .src_length = len, .dest_offset = offset };
+	if (ioctl(c->fd, FICLONERANGE, &clone) == 0 && read_full(c->fd, c->buf + CHUNK_SIZE, len, offset) == 0 &&
+		!memcmp(data, c->buf + CHUNK_SIZE, len))
+	{
+		count_reuse(&clone_cnt, len);
+		c->placed++;
+		return 1;
+	}
+	if (write_full(c->fd, data, len, offset) < 0)
+		return 0;
+	count_reuse(&copy_cnt, len);
+	c->placed++;
+	return 1;
+}
+
+// 중복 제거 업로드가 끝난 뒤 맡은 구간의 해시들을 조각 목록에 쓰고 색인에 더합니다.
+// 스트라이프들은 같은 헤더와 서로 다른 자리의 해시들을 쓰므로 같은 목록에 동시에 써도 됩니다.
+// 파일 전체를 받았을 때만 지금 파일을 기억하고 헤더에 적습니다. 스트라이프의 목록은 다른 스트라이프가
+// 아직 쓰지 않은 자리의 옛 해시를 가질 수 있으므로, inode 를 0 으로 적어서 다시 읽을 때도 믿지 않게 합니다.
+int chunk_store_commit(const char* name, uint64_t filesize, const chunk_plan* p)
+{
+	char path[512];
+	struct stat st;
+	snprintf(path, sizeof(path), "%s/%s", store_root, name);
+	if (stat(path, &st) < 0)
+		return -1;
+	manifest_path(path, sizeof(path), name);
+	int fd = open(path, O_WRONLY | O_CREAT, 0666);
+	if (fd < 0)
+		return -1;
+
+	int whole = p->offset == 0 && p->len == filesize;
+	struct chunk_manifest_hdr hdr = { CHUNK_STORE_MAGIC, CHUNK_SIZE, filesize, 0, 0, 0 };
+	if (whole)
+	{
+		hdr.ino = st.st_ino;
+		hdr.mtime_sec = st.st_mtim.tv_sec;
+		hdr.mtime_nsec = st.st_mtim.tv_nsec;
+	}
+	uint64_t count = (filesize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	if (ftruncate(fd, sizeof(hdr) + count * SHA256_SIZE) < 0 || write_full(fd, &hdr, sizeof(hdr), 0) < 0 ||
+		(p->count && write_full(fd, p->hashes, (size_t)p->count * SHA256_SIZE, sizeof(hdr) + (off_t)p->first * SHA256_SIZE) < 0))
+	{
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	pthread_mutex_lock(&store_lock);
+	chunk_source* src = intern(name);
+	if (src && whole)
+		remember_file(src, &st);
+	else if (src)
+		src->valid = 0;
+	for (uint32_t i = 0; src && i < p->count; i++)
+	{
+		off_t at;
+		size_t len;
+		chunk_plan_span(p, i, &at, &len);
+		index_add(p->hashes[i], src, p->first + i, len);
+	}
+	pthread_mutex_unlock(&store_lock);
+	return 0;
+}
+
+// 중복 제거 없이 덮어쓰거나 지워졌다가 새로 올리는 파일의 조각 목록을 지웁니다.
+// 세대를 올리므로 이 이름을 가리키던 색인 항목들은 다시 찾을 때 지웁니다.
+void chunk_store_forget(const char* name)
+{
+	char path[512];
+	manifest_path(path, sizeof(path), name);
+	unlink(path);
+
+	pthread_mutex_lock(&store_lock);
+	chunk_source* src = find_source(name);
+	if (src)
+	{
+		src->valid = 0;
+		src->gen++;
+	}
+	pthread_mutex_unlock(&store_lock);
+}
+
+void chunk_store_write_metrics(FILE* out)
+{
+	pthread_mutex_lock(&store_lock);
+	unsigned long queries = query_cnt, in_place = in_place_cnt, cloned = clone_cnt, copied = copy_cnt, stale = stale_cnt, bytes = reused_bytes;
+	size_t refs = ref_cnt;
+	pthread_mutex_unlock(&store_lock);
+
+	metrics_header(out, "ipc_dedup_chunks_queried_total", "counter", "Chunks a deduplicating upload asked the server about.");
+	metrics_value(out, "ipc_dedup_chunks_queried_total", NULL, queries);
+	metrics_header(out, "ipc_dedup_chunks_reused_total", "counter", "Chunks the server already had, by how they were placed.");
+	metrics_value(out, "ipc_dedup_chunks_reused_total", "how=\"in_place\"", in_place);
+	metrics_value(out, "ipc_dedup_chunks_reused_total", "how=\"cloned\"", cloned);
+	metrics_value(out, "ipc_dedup_chunks_reused_total", "how=\"copied\"", copied);
+	metrics_header(out, "ipc_dedup_bytes_reused_total", "counter", "Upload bytes the client did not have to send.");
+	metrics_value(out, "ipc_dedup_bytes_reused_total", NULL, bytes);
+	metrics_header(out, "ipc_dedup_stale_refs_total", "counter", "Index entries dropped because the file no longer held that chunk.");
+	metrics_value(out, "ipc_dedup_stale_refs_total", NULL, stale);
+	metrics_header(out, "ipc_dedup_index_chunks", "gauge", "Distinct chunks in the server's index.");
+	metrics_value(out, "ipc_dedup_index_chunks", NULL, refs);
+}
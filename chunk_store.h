@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "chunk_plan.h"
+
+// 파일마다의 조각 목록(manifest)을 두는 곳, 업로드 폴더 안에 숨겨 둡니다.
+#define CHUNK_STORE_DIR		".manifest"
+#define CHUNK_STORE_MAGIC	0x31464d43	// "CMF1"
+
+// 조각 목록 파일의 헤더입니다. 뒤에 파일의 조각마다 SHA-256 이 차례로 붙고, 아직 모르는 조각은 0 입니다.
+// inode 와 수정 시각은 목록을 쓸 때의 파일이며, 다시 읽을 때 파일이 그 사이 바뀌었는지 봅니다.
+// 스트라이프 하나가 쓴 목록은 inode 가 0 이어서 그 목록의 조각은 항상 읽어서 확인합니다.
+struct chunk_manifest_hdr
+{
+	uint32_t magic;
+	uint32_t chunk_size;
+	uint64_t filesize;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+};
+
+// 업로드 하나가 받기 전에 가진 조각들을 제자리에 놓는 동안 쓰는 상태입니다.
+typedef struct chunk_placer
+{
+	// 받는 파일, 놓은 조각을 다시 읽어 확인하므로 읽고 쓸 수 있게 엽니다.
+	int fd;
+	const char* name;
+	// 받기 전의 파일 크기, 이 안의 조각은 색인보다 먼저 같은 자리의 옛 내용과 비교합니다.
+	off_t old_size;
+	// 나누지 않고 받는 파일이 전체의 목록을 쓴 뒤로 바뀌지 않았으면 그 파일의 색인 이름입니다.
+	const void* self;
+	// 마지막으로 연 원본 파일, 조각들은 같은 파일에서 이어서 가져오는 경우가 많으므로 열어둡니다.
+	const void* src;
+	int src_fd;
+	char* buf;
+	// 이 업로드에서 놓은 조각 수
+	uint32_t placed;
+} chunk_placer;
+
+int chunk_store_init(const char* root);
+int chunk_placer_init(chunk_placer* c, int fd, const char* name, const struct stat* old, int whole);
+int chunk_place(chunk_placer* c, const uint8_t hash[SHA256_SIZE], off_t offset, size_t len);
+void chunk_placer_destroy(chunk_placer* c);
+int chunk_store_commit(const char* name, uint64_t filesize, const chunk_plan* p);
+void chunk_store_forget(const char* name);
+void chunk_store_write_metrics(FILE* out);
@@ -0,0 +1,186 @@
+/*
+	client_jobs.c
+	클라이언트가 파일들을 전송 작업들로 나누고 결과를 파일마다 다시 모으는 함수들입니다.
+	파일 하나는 stripe N 인자로 N 개의 작업이 되고, batch 인자를 주면 작은 업로드 파일들은 묶음 작업 하나가 됩니다.
+	작업과 파일 사이의 대응은 전송 방식과 상관이 없으므로 세 클라이언트가 같이 쓰고,
+	클라이언트는 작업마다 채널을 열고 보내는 일만 합니다.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "client_jobs.h"
+#include "batch_util.h"
+
+// batch 가 0 이 아니면 업로드 파일 중 작은 것들을 묶음으로 모읍니다. 묶다가 파일을 읽지 못하면 -1 을 돌려줍니다.
+int job_table_init(job_table* t, int upload_cnt, char** upload_path, int download_cnt, char** download_path, int stripe_cnt, int batch)
+{
+	memset(t, 0, sizeof(job_table));
+	t->upload_cnt = upload_cnt;
+	t->upload_path = upload_path;
+	t->download_cnt = download_cnt;
+	t->download_path = download_path;
+	t->stripe_cnt = stripe_cnt;
+	t->batch_base = (upload_cnt + download_cnt) * stripe_cnt;
+	if (!batch)
+		return 0;
+
+	t->batch_of = (int*)malloc((upload_cnt > 0? upload_cnt: 1) * sizeof(int));
+	if (!t->batch_of)
+		return -1;
+	t->batch_cnt = batch_plan(upload_path, upload_cnt, t->batch_of);
+	t->batch_fds = (int*)malloc((t->batch_cnt > 0? t->batch_cnt: 1) * sizeof(int));
+	if (!t->batch_fds)
+		return -1;
+	for (int b = 0; b < t->batch_cnt; b++)
+		t->batch_fds[b] = -1;
+
+	for (int b = 0; b < t->batch_cnt; b++)
+		if ((t->batch_fds[b] = batch_pack(upload_path, t->batch_of, upload_cnt, b)) < 0)
+			return -1;
+	return 0;
+}
+
+void job_table_destroy(job_table* t)
+{
+	if (t->batch_fds)
+		for (int b = 0; b < t->batch_cnt; b++)
+			if (t->batch_fds[b] >= 0)
+				close(t->batch_fds[b]);
+	free(t->batch_fds);
+	free(t->batch_of);
+	t->batch_fds = NULL;
+	t->batch_of = NULL;
+}
+
+int job_table_count(const job_table* t)
+{
+	return t->batch_base + t->batch_cnt;
+}
+
+int job_is_upload(const job_table* t, int idx)
+{
+	return idx >= t->batch_base || idx / t->stripe_cnt < t->upload_cnt;
+}
+
+// 묶음에 들어가서 따로 보내지 않는 작업인지 확인합니다.
+int job_batched(const job_table* t, int idx)
+{
+	int file_idx = idx / t->stripe_cnt;
+	return t->batch_of && idx < t->batch_base && file_idx < t->upload_cnt && t->batch_of[file_idx] >= 0;
+}
+
+// 작업 idx 가 옮길 파일의 경로입니다. 묶음은 서버의 로그에만 쓰일 이름을 batch_name 에 만듭니다.
+char* job_path(const job_table* t, int idx, char* batch_name)
+{
+	int file_idx = idx / t->stripe_cnt;
+	if (idx >= t->batch_base)
+	{
+		sprintf(batch_name, "batch%d", idx - t->batch_base);
+		return batch_name;
+	}
+	if (file_idx < t->upload_cnt)
+		return t->upload_path[file_idx];
+	return t->download_path[file_idx - t->upload_cnt];
+}
+
+// 전송 작업 idx 가 맡은 구간입니다. 묶음은 나누지 않고 통째로 보냅니다.
+void job_range(const job_table* t, int idx, uint64_t filesize, uint64_t* offset, uint64_t* len)
+{
+	if (idx >= t->batch_base)
+		req_stripe_range(filesize, 0, 1, offset, len);
+	else
+		req_stripe_range(filesize, idx % t->stripe_cnt, t->stripe_cnt, offset, len);
+}
+
+// 업로드할 내용을 엽니다. 묶음이면 미리 묶어둔 메모리 파일입니다.
+int job_open_upload(const job_table* t, const char* filename, int idx)
+{
+	if (idx >= t->batch_base)
+		return dup(t->batch_fds[idx - t->batch_base]);
+	return open(filename, O_RDONLY);
+}
+
+// 전송 작업 idx 의 요청을 묶음 업로드로 바꿉니다.
+void job_batch_request(const job_table* t, int idx, req_view* v)
+{
+	struct stat st;
+	v->flags |= REQ_FLAG_UPLOAD | REQ_FLAG_BATCH;
+	v->stripe_idx = 0;
+	v->stripe_cnt = 1;
+	if (fstat(t->batch_fds[idx - t->batch_base], &st) == 0)
+		v->filesize = st.st_size;
+}
+
+// 파일 하나의 결과입니다. 조각 중 하나라도 실패하면 실패이고, 모두 끝나야 성공입니다.
+int job_file_result(const job_table* t, const int* results, int file_idx)
+{
+	if (file_idx < t->upload_cnt && t->batch_of && t->batch_of[file_idx] >= 0)
+		return results[t->batch_base + t->batch_of[file_idx]];
+
+	int result = 1;
+	for (int s = 0; s < t->stripe_cnt; s++)
+	{
+		int flag = results[file_idx * t->stripe_cnt + s];
+		if (flag < 0)
+			return flag;
+		if (flag == 0)
+			result = 0;
+	}
+	return result;
+}
+
+// 파일마다 조각들의 진행 상황을 모아서 그립니다. 묶음은 따로 한 항목으로 보여줍니다.
+// progress_wait 가 lock 을 잡고 부르므로 결과 배열을 그대로 읽습니다. 결과를 보여줄 글은 state 가 정합니다.
+void job_draw(const job_table* t, progress* p, char* (*state)(int result), int final)
+{
+	int cnt = t->upload_cnt + t->download_cnt, n = cnt + t->batch_cnt;
+	progress_item* items = (progress_item*)malloc((n > 0? n: 1) * sizeof(progress_item));
+	char (*batch_names)[32] = malloc((t->batch_cnt > 0? t->batch_cnt: 1) * sizeof(*batch_names));
+	if (!items || !batch_names)
+	{
+		free(items);
+		free(batch_names);
+		return;
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		progress_item* item = &items[i];
+		int first, jobs;
+		if (i < cnt)
+		{
+			first = i * t->stripe_cnt;
+			jobs = t->stripe_cnt;
+			item->name = i < t->upload_cnt? t->upload_path[i]: t->download_path[i - t->upload_cnt];
+			item->kind = i < t->upload_cnt? "upload": "download";
+			item->result = job_file_result(t, p->results, i);
+		}
+		else
+		{
+			first = t->batch_base + i - cnt;
+			jobs = 1;
+			sprintf(batch_names[i - cnt], "batch%d", i - cnt);
+			item->name = batch_names[i - cnt];
+			item->kind = "batch";
+			item->result = p->results[first];
+		}
+		item->state = state(item->result);
+		item->bytes = item->total = 0;
+		for (int j = first; j < first + jobs; j++)
+		{
+			item->bytes += progress_bytes(p, j);
+			item->total += progress_job_total(p, j);
+		}
+	}
+
+	progress_render(p, items, n, final);
+	free(batch_names);
+	free(items);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "request_proto.h"
+#include "progress.h"
+
+// 클라이언트가 파일들을 전송 작업들로 나눈 배치입니다. 전송 방식과 상관없이 세 클라이언트가 같이 씁니다.
+// 작업 idx 는 파일 idx / stripe_cnt 의 idx % stripe_cnt 번째 조각이고, 파일은 업로드들 뒤에 다운로드들이 옵니다.
+// 묶음(batch_util.c) b 는 파일 작업들 뒤의 작업 batch_base + b 이고, 묶인 파일의 작업들은 따로 보내지 않습니다.
+typedef struct job_table
+{
+	int upload_cnt, download_cnt;
+	char** upload_path;
+	char** download_path;
+	int stripe_cnt;
+
+	int batch_base, batch_cnt;
+	// 업로드 파일마다 들어간 묶음 번호, 묶지 않은 파일은 -1 입니다. 묶지 않으면 NULL 입니다.
+	int* batch_of;
+	// 미리 묶어둔 메모리 파일들
+	int* batch_fds;
+} job_table;
+
+int job_table_init(job_table* t, int upload_cnt, char** upload_path, int download_cnt, char** download_path, int stripe_cnt, int batch);
+void job_table_destroy(job_table* t);
+int job_table_count(const job_table* t);
+
+int job_is_upload(const job_table* t, int idx);
+int job_batched(const job_table* t, int idx);
+char* job_path(const job_table* t, int idx, char* batch_name);
+void job_range(const job_table* t, int idx, uint64_t filesize, uint64_t* offset, uint64_t* len);
+int job_open_upload(const job_table* t, const char* filename, int idx);
+void job_batch_request(const job_table* t, int idx, req_view* v);
+
+int job_file_result(const job_table* t, const int* results, int file_idx);
+void job_draw(const job_table* t, progress* p, char* (*state)(int result), int final);
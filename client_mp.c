@@ -8,9 +8,10 @@
 		4. 중복되는 이름은 서버/클라이언트에서 처리할 수 없습니다.
 	
 	위의 전제를 사용해 클라이언트는 서버에게 파일 전송을 요청하는 정보를 보낸 후,
-	이를 처리하는 쓰레드를 생성합니다.
-	송신단에서는 파이프의 크기제한을 고려하여 spinlock 이 필요하면 걸어줍니다.
-	수신단에서는 간단하게 값을 받아옵니다.
+	이를 처리하는 작업들을 워커 쓰레드(work_pool.c)에게 나누어 줍니다. 파일과 작업의 대응은 client_jobs.c 에 있습니다.
+	전송 큐는 IPC_PRIVATE 로 만들고 서버에게는 큐 아이디를 넘겨줍니다.
+	송신단에서는 블로킹 msgsnd 로 보내고, 서버의 ACK 를 받을 때까지 잠듭니다.
+	수신단에서는 값을 받아오면서 크레딧을 돌려주고, 끝나면 ACK 를 보냅니다.
 
 	이러한 동작은 서버가 요청을 받아서 문제없이 처리한다는 가정하에 이루어집니다.
  */
@@ -25,6 +26,7 @@
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include <fcntl.h>
+#include <stdint.h>
 
 #include <errno.h>
 #include <unistd.h>
@@ -48,6 +50,15 @@ if(x) \
 } 
 
 #include "file_util.h"
+#include "request_proto.h"
+#include "batch_util.h"
+#include "progress.h"
+#include "client_jobs.h"
+#include "mp_util.h"
+#include "crc32c.h"
+#include "lz_stage.h"
+#include "chunk_plan.h"
+#include "work_pool.h"
 
 void fatal(const char* msg)
 {
@@ -64,22 +75,65 @@ char *download_path_parent;
 int interpreted_input_cleanup();
 int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_path_ref, int* download_cnt_ref, char*** download_path_ref, char** download_path_parent_ref);
 
-pthread_t* threads;
+// 작업들은 고정된 수의 워커가 나누어 처리하고, 끝나면 join 으로 기다립니다. 기본은 코어 수입니다.
+work_pool pool;
+int worker_cnt;
+// 작업마다의 결과는 progress 가 가지고, result_flag 는 그 배열을 가리킵니다.
+// 작업 쓰레드는 progress_done 으로만 결과를 기록합니다.
+progress prog;
+int progress_mode = -1;
 int* result_flag;
 
+// 파일 하나를 stripe_cnt 개의 조각으로 나누어 조각마다 채널과 쓰레드를 따로 씁니다.
+int stripe_cnt = 1;
+// batch 인자를 주면 작은 업로드 파일들을 묶음(batch_util.c)으로 모아 전송 하나로 보냅니다.
+int use_batch;
+// 파일들과 전송 작업들의 대응입니다(client_jobs.c).
+job_table jobs;
+
 // MESSAGE PASSING 변수 및 함수, 정의
 #define REQ_MP_KEY 			60050
 #define REQ_MPQ_PERM 		0666
 
-#define IO_MP_KEY_BASE		60051
-#define IO_MPQ_PREM			0666
-
-#define IPC_KEY_LIMIT		60059
+#define IO_MPQ_PERM			0666
 
+// 전송마다 만든 큐의 아이디, 0 도 올바른 아이디이므로 없으면 -1 입니다.
 int msgq_cnt;
 int* msgq_ids;
 
+// 요청 메세지의 크기, 데이터 메세지의 크기는 요청마다 정합니다(mp_util.c).
 #define MSG_BUFFER_SZ		2048
+
+// 하나의 큐를 양방향으로 쓰기 때문에 mtype 으로 메세지 종류를 구분합니다.
+#define MSG_TYPE_DATA		1
+#define MSG_TYPE_CREDIT		2
+#define MSG_TYPE_ACK		3
+#define MSG_TYPE_GRANT		4
+#define MSG_TYPE_SUM		5
+#define MSG_TYPE_HAVE		6
+#define MSG_TYPE_GOT		7
+
+// MP_CREDIT_CHUNKS 개를 받을 때마다 서버에게 크레딧을 하나 돌려줍니다.
+#define MP_CREDIT_CHUNKS	8
+
+// 데이터 메세지 하나의 크기, chunk 인자로 정하며 기본은 msgmax 입니다.
+int chunk_sz;
+
+// compress 인자를 주면 모든 요청에 압축을 제안합니다.
+int use_compress;
+// dedup 인자를 주면 묶음이 아닌 업로드는 서버에 없는 조각만 보냅니다.
+int use_dedup;
+// checksum 인자를 주면 전송마다 맡은 구간의 CRC32C 를 주고받아 확인합니다.
+int use_checksum;
+
+// session 인자를 주면 큐 하나를 만들어 모든 전송을 mtype 으로 나누어 섞어 보냅니다.
+int use_session;
+int session_qid = -1;
+
+// 서버의 요청 큐입니다. lazy_request 이면 요청을 main 에서 모아 보내지 않고 워커가 하나씩 보냅니다.
+int request_qid = -1;
+int lazy_request;
+
 struct msg_buf
 {
 	long mtype;
@@ -87,18 +141,28 @@ struct msg_buf
 };
 
 // MESSAGE PASSING 자원 정리
+// IPC_PRIVATE 큐는 지우지 않으면 키로 다시 찾을 수 없으므로 남은 큐를 모두 지웁니다.
+// 실패한 전송에서 이미 지운 큐(EINVAL, EIDRM)는 넘어갑니다.
 void cleanup_msq()
 {
 	if (msgq_ids)
 	{
 		for (int i = 0; i < msgq_cnt; i++)
-			if (msgq_ids[i])
+			if (msgq_ids[i] >= 0)
 			{
 				struct msqid_ds msqstat;
-				if (msgctl(msgq_ids[i], IPC_RMID, &msqstat) == -1)
+				if (msgctl(msgq_ids[i], IPC_RMID, &msqstat) == -1 && errno != EINVAL && errno != EIDRM)
 					fprintf(stderr, "Fail to remove message queue..");
+				msgq_ids[i] = -1;
 			}
 	}
+
+	if (session_qid >= 0)
+	{
+		struct msqid_ds msqstat;
+		msgctl(session_qid, IPC_RMID, &msqstat);
+		session_qid = -1;
+	}
 }
 
 void signal_handler(int signal)
@@ -108,24 +172,111 @@ void signal_handler(int signal)
 }
 // MESSAGE PASSING 변수 및 함수, 정의
 
-int download(char* filename, int idx);
-int upload(char* filename, int idx);
+int download(char* filename, int idx, struct mp_msg* buffer);
+int upload(char* filename, int idx, struct mp_msg* buffer);
+int send_job_request(int idx);
 
 void* file_task(void* pidx)
 {
-	int idx = *(int*)pidx;
-	if (idx < upload_cnt)
-		result_flag[idx] = upload(upload_path[idx], idx);
-	else
-		result_flag[idx] = download(download_path[idx-upload_cnt], idx);
+	int idx = *(int*)pidx, file_idx = idx / stripe_cnt;
+	struct mp_msg* buffer = mp_msg_alloc(chunk_sz);
+	// 서버의 워커는 전송을 맡으면 데이터를 기다리며 잠들므로,
+	// 아직 시작하지 않은 작업의 요청을 미리 보내면 서버와 클라이언트의 워커가 서로를 기다릴 수 있습니다.
+	int result = lazy_request? send_job_request(idx): 0;
+	if (result == 0 && job_is_upload(&jobs, idx))
+		result = upload(idx < jobs.batch_base? upload_path[file_idx]: NULL, idx, buffer);
+	else if (result == 0)
+		result = download(download_path[file_idx-upload_cnt], idx, buffer);
+	progress_done(&prog, idx, result);
+	free(buffer);
 	free(pidx);
 
 	return NULL;
 }
 
 
+// 세션 모드에서는 큐 하나에 여러 전송을 섞으므로 전송마다 mtype 을 따로 씁니다.
+// 세션이 아니면 전송마다 큐가 따로 있으므로 메세지 종류만으로 구분합니다.
+long stream_mtype(int idx)
+{
+	return use_session? MP_STREAM_MTYPE(idx): 0;
+}
+
+// 전송이 끝난 큐를 정리합니다. 세션 큐는 다른 전송과 같이 쓰므로 끝날 때 한번에 지웁니다.
+void release_queue(int idx)
+{
+	struct msqid_ds msqstat;
+	if (!use_session)
+		msgctl(msgq_ids[idx], IPC_RMID, &msqstat);
+	msgq_ids[idx] = -1;
+}
+
+// 압축 쓰레드가 원래 데이터를 읽고 쓰는 파일과, 진행 상황을 더할 작업입니다.
+// 중복 제거 업로드면 plan 의 없는 조각들을 이어붙인 스트림을 읽으며, off 는 구간의 offset 부터 센 스트림 위치입니다.
+struct lz_file
+{
+	int fd;
+	int idx;
+	const chunk_plan* plan;
+	off_t offset;
+};
+
+ssize_t lz_file_read(void* ctx, void* buf, off_t off, size_t len)
+{
+	struct lz_file* f = (struct lz_file*)ctx;
+	ssize_t n = f->plan? chunk_plan_pread(f->plan, f->fd, buf, len, off - f->offset): pread(f->fd, buf, len, off);
+	if (n > 0)
+		progress_add(&prog, f->idx, n);
+	return n;
+}
+
+ssize_t lz_file_write(void* ctx, void* buf, off_t off, size_t len)
+{
+	struct lz_file* f = (struct lz_file*)ctx;
+	if (f->fd < 0)
+		return -1;
+	ssize_t n = pwrite(f->fd, buf, len, off);
+	if (n > 0)
+		progress_add(&prog, f->idx, n);
+	return n;
+}
+
+// 중복 제거 업로드/ 구간의 조각 해시들을 HAVE 로 나누어 보내고, 서버가 GOT 으로 답한 가진 조각들을 plan 에 담습니다.
+// 답을 받은 뒤에 다음 HAVE 를 보내므로 서버가 답을 보내지 못하고 막히지 않습니다.
+// 파일을 읽지 못하면 빈 HAVE 로 서버에게 그만둔다고 알리고 -2 를 돌려줍니다.
+int send_hashes(int idx, struct mp_msg* buffer, int file_fd, uint64_t offset, uint64_t len, chunk_plan* plan)
+{
+	int msgq_id = msgq_ids[idx];
+	long base = stream_mtype(idx);
+
+	if (file_fd < 0 || chunk_plan_init(plan, offset, len) < 0 || chunk_plan_hash_file(plan, file_fd) < 0)
+	{
+		buffer->mtype = base + MSG_TYPE_HAVE;
+		return msgsnd(msgq_id, buffer, 0, 0) < 0? -4: -2;
+	}
+
+	uint32_t per = chunk_plan_per_msg(chunk_sz);
+	for (uint32_t from = 0; from < plan->count; from += per)
+	{
+		uint32_t n = plan->count - from < per? plan->count - from: per;
+		buffer->mtype = base + MSG_TYPE_HAVE;
+		memcpy(buffer->message, plan->hashes[from], (size_t)n * SHA256_SIZE);
+		if (msgsnd(msgq_id, buffer, (size_t)n * SHA256_SIZE, 0) < 0)
+			return -4;
+		if (msgrcv(msgq_id, buffer, chunk_sz, base + MSG_TYPE_GOT, 0) != (n + 7) / 8)
+			return -5;
+		chunk_plan_unpack(plan, from, n, buffer->message);
+	}
+	chunk_plan_finish(plan);
+	return 0;
+}
+
 // 서버에서 MESSAGE QUEUE 로 데이터를 저장한 것을 받아와서 파일에 써줍니다.
-int download(char* filename, int idx)
+// 스트라이프 전송이면 크기 헤더로 맡은 구간을 구해서 그 위치에만 씁니다.
+// 받는 동안 크레딧을 돌려주고, 다 받으면 ACK 를 보냅니다. 큐는 서버가 정리합니다.
+// 세션 모드에서 파일에 쓰지 못하면, 큐에 남은 메세지가 다른 전송을 막지 않도록 끝까지 받아서 버립니다.
+// 서버가 압축해서 보내면 받은 메세지들을 블록으로 모아 압축 쓰레드에게 넘기고, 압축 쓰레드가 풀어서 씁니다.
+int download(char* filename, int idx, struct mp_msg* buffer)
 {
 	char path_buffer[512];
 	if (download_path_parent != NULL)
@@ -133,102 +284,327 @@ int download(char* filename, int idx)
 	else
 		sprintf(path_buffer, "%s", filename);
 
-	int msgq_id = msgq_ids[idx],
-		make_fd = open(path_buffer, O_RDWR | O_CREAT, 0666);
-
+	int msgq_id = msgq_ids[idx], result = 1;
+	long base = stream_mtype(idx);
 	if (msgq_id < 0)
 		return -1;
+
+	int make_fd = open(path_buffer, O_RDWR | O_CREAT, 0666);
 	if (make_fd < 0)
 	{
-		struct msqid_ds msqstat;
-		if (msgctl(msgq_id, IPC_RMID, &msqstat) == -1)
+		if (!use_session)
+		{
+			release_queue(idx);
 			return -2;
+		}
+		result = -2;
 	}
 
-	struct msg_buf buffer;
-	buffer.mtype = 1;
-	int read_len = 0, filesize = 0, accum = 0;
+	int read_len = 0, received = 0;
+	off_t filesize = 0, accum = 0;
 
-	if ((read_len = msgrcv(msgq_id, &buffer, 4, 0, MSG_NOERROR)) < 0)
+	if ((read_len = msgrcv(msgq_id, buffer, chunk_sz, base + MSG_TYPE_DATA, 0)) < 0)
 	{
-		struct msqid_ds msqstat;
-		msgctl(msgq_id, IPC_RMID, &msqstat);
+		release_queue(idx);
+		if (make_fd >= 0)
+			close(make_fd);
 		return -3;
 	}
-	filesize = *((int*)buffer.message);
+	filesize = *((int64_t*)buffer->message);
+	int use_lz = read_len >= (int)MP_SIZE_HDR_LZ && *(uint32_t*)(buffer->message + sizeof(int64_t)) == MP_COMPRESS_LZ;
 
-	struct msqid_ds msqstat;
-	while(1)
+	// 서버가 파일을 열지 못했습니다. 세션 모드에서는 큐를 지우는 대신 크기를 -1 로 알려줍니다.
+	if (filesize < 0)
 	{
-		buffer.mtype = buffer.mtype + 1;
-		read_len = msgrcv(msgq_id, &buffer, MSG_BUFFER_SZ, 0, MSG_NOERROR);
+		release_queue(idx);
+		if (make_fd >= 0)
+			close(make_fd);
+		return -7;
+	}
+
+	// 다른 조각이 이미 쓴 내용을 지우지 않도록 O_TRUNC 대신 최종 크기로 맞춥니다.
+	if (make_fd >= 0 && ftruncate(make_fd, filesize) < 0)
+	{
+		close(make_fd);
+		make_fd = -1;
+		result = -6;
+		if (!use_session)
+		{
+			release_queue(idx);
+			return result;
+		}
+	}
+
+	uint64_t offset, len;
+	req_stripe_range(filesize, idx % stripe_cnt, stripe_cnt, &offset, &len);
+	progress_total(&prog, idx, len);
+
+	lz_stage z;
+	struct lz_file lz_out = { make_fd, idx };
+	if (use_lz && lz_stage_start(&z, LZ_STAGE_DECODE, lz_file_write, &lz_out, offset, len) < 0)
+	{
+		release_queue(idx);
+		if (make_fd >= 0)
+			close(make_fd);
+		return -6;
+	}
+
+	uint32_t sum = 0;
+	while(accum < len)
+	{
+		read_len = msgrcv(msgq_id, buffer, chunk_sz, base + MSG_TYPE_DATA, 0);
 		if (!read_len) break;
-		if (read_len < 0)
+		// 형식이 맞지 않는 블록이 오면 더 받을 수 없으므로 큐를 지워서 서버도 끝나게 합니다.
+		if (read_len < 0 || (use_lz && lz_stage_feed(&z, buffer->message, read_len) < 0))
 		{
-			struct msqid_ds msqstat;
-			msgctl(msgq_id, IPC_RMID, &msqstat);
+			if (use_lz)
+				lz_stage_finish(&z);
+			release_queue(idx);
+			if (make_fd >= 0)
+				close(make_fd);
 			return -3;
 		}
-		write(make_fd, buffer.message, read_len);
-		accum += read_len;
+		// 압축된 데이터는 다 모은 블록들의 원래 크기만큼 받은 것입니다. CRC32C 와 쓰기는 압축 쓰레드가 합니다.
+		if (use_lz)
+			accum = z.fed;
+		else
+		{
+			if (use_checksum)
+				sum = crc32c_update(sum, buffer->message, read_len);
+			if (make_fd >= 0 && pwrite(make_fd, buffer->message, read_len, offset + accum) != read_len)
+			{
+				close(make_fd);
+				make_fd = -1;
+				result = -6;
+				if (!use_session)
+				{
+					release_queue(idx);
+					return result;
+				}
+			}
+			accum += read_len;
+			progress_add(&prog, idx, read_len);
+		}
 
-		if (accum == filesize)
-			break;
+		if (++received % MP_CREDIT_CHUNKS == 0)
+		{
+			buffer->mtype = base + MSG_TYPE_CREDIT;
+			if (msgsnd(msgq_id, buffer, 0, 0) < 0)
+			{
+				if (use_lz)
+					lz_stage_finish(&z);
+				if (make_fd >= 0)
+					close(make_fd);
+				return -4;
+			}
+		}
 	}
 
-	close(make_fd);
+	// 압축 쓰레드가 넘긴 블록을 모두 쓸 때까지 기다립니다.
+	if (use_lz)
+	{
+		int ret = lz_stage_finish(&z);
+		if (ret < 0 && result > 0)
+			result = ret == LZ_STAGE_EIO? -6: -3;
+		sum = z.sum;
+	}
+	if (make_fd >= 0)
+		close(make_fd);
+	// 서버가 빈 메세지로 일찍 끝을 알렸습니다.
+	if (accum < len && result > 0)
+		result = -3;
+
+	// 맡은 구간을 다 보낸 서버는 그 CRC32C 를 보냅니다.
+	if (use_checksum && accum >= len)
+	{
+		if (msgrcv(msgq_id, buffer, CRC32C_SIZE, base + MSG_TYPE_SUM, 0) != CRC32C_SIZE)
+		{
+			release_queue(idx);
+			return -3;
+		}
+		if (result > 0 && *(uint32_t*)buffer->message != sum)
+			result = -8;
+	}
 
-	// msg queue delete routine
-	msgctl(msgq_id, IPC_RMID, &msqstat);
+	buffer->mtype = base + MSG_TYPE_ACK;
+	if (msgsnd(msgq_id, buffer, 0, 0) < 0)
+		return -4;
+	msgq_ids[idx] = -1;
 
-	return 1;
+	return result;
 }
 
-// 파일에서 읽어서 MESSAGE QUEUE 에 데이터를 넣어줍니다. 사용할 크기가 부족하면 spinlock 처럼 기다립니다.
-int upload(char* filename, int idx)
+// 파일에서 읽어서 MESSAGE QUEUE 에 데이터를 넣어줍니다. 스트라이프 전송이면 맡은 구간만 보냅니다.
+// 큐가 가득 차면 msgsnd 가 커널에서 잠들고, 다 보낸 뒤에는 서버의 ACK 를 기다립니다.
+// 세션 모드에서는 서버가 이 전송을 맡았다는 GRANT 를 받은 뒤에 보내기 시작합니다.
+// 그래야 큐에 쌓인 데이터에는 항상 읽어갈 워커가 있어서, 대기 중인 전송이 큐를 막지 않습니다.
+// 압축을 제안했으면 압축 쓰레드가 읽어서 압축한 블록을 메세지로 나누어 보냅니다.
+int upload(char* filename, int idx, struct mp_msg* buffer)
 {
-	int file_fd = open(filename, O_RDONLY);
+	int file_fd = job_open_upload(&jobs, filename, idx);
 	int msgq_id = msgq_ids[idx];
+	long base = stream_mtype(idx);
 
-	if (file_fd < 0)
-		return -2;
 	if (msgq_id < 0)
 	{
-		close(file_fd);
+		if (file_fd >= 0)
+			close(file_fd);
 		return -1;
 	}
 
-	int sz = 0;
-	struct msg_buf buffer;
-	struct msqid_ds msqstat;
-	buffer.mtype = 1;
-	int read_len = 0;
-	while(1)
+	struct stat st;
+	if (file_fd < 0 || fstat(file_fd, &st) < 0)
 	{
-		read_len = read(file_fd, buffer.message, MSG_BUFFER_SZ);
-		if (!read_len) break;
-		if ( msgsnd(msgq_id, &buffer, read_len, 0) < 0)
+		// 요청의 크기는 이미 보냈으므로 빈 데이터라도 보내야 서버가 끝납니다.
+		// 세션이 아니면 큐를 지워서 서버에게 알립니다.
+		if (file_fd >= 0)
+			close(file_fd);
+		if (!use_session)
 		{
-			msgctl(msgq_id, IPC_RMID, &msqstat);
-			return -4;
+			release_queue(idx);
+			return -2;
 		}
-		buffer.mtype = buffer.mtype + 1;
+		st.st_size = 0;
 	}
 
-	close(file_fd);
+	if (use_session)
+	{
+		if (msgrcv(msgq_id, buffer, sizeof(int), base + MSG_TYPE_GRANT, 0) < 0)
+		{
+			if (file_fd >= 0)
+				close(file_fd);
+			return -5;
+		}
+		if (*(int*)buffer->message < 0)
+		{
+			if (file_fd >= 0)
+				close(file_fd);
+			msgq_ids[idx] = -1;
+			return -7;
+		}
+	}
 
+	uint64_t offset, len;
+	job_range(&jobs, idx, st.st_size, &offset, &len);
+	progress_total(&prog, idx, len);
 
-	while(1)
+	// 중복 제거 업로드는 조각 해시들을 먼저 주고받고, 그 뒤로는 서버에 없는 조각들을 이어붙인 want 바이트만 보냅니다.
+	// 서버에게 그만둔다고 알렸으면 데이터와 CRC32C 없이 ACK 만 받습니다.
+	chunk_plan plan = { 0 };
+	uint64_t want = len;
+	int dedup = use_dedup && idx < jobs.batch_base;
+	if (dedup)
 	{
-		if (msgctl(msgq_id, IPC_STAT, &msqstat) < 0)
+		int ret = send_hashes(idx, buffer, file_fd, offset, len, &plan);
+		if (ret == -4 || ret == -5)
 		{
-			msgctl(msgq_id, IPC_RMID, &msqstat);
-			return -5;
+			chunk_plan_destroy(&plan);
+			release_queue(idx);
+			if (file_fd >= 0)
+				close(file_fd);
+			return ret;
 		}
-		if (msqstat.__msg_cbytes == 0)
+		if (ret < 0)
+		{
+			if (file_fd >= 0)
+				close(file_fd);
+			file_fd = -1;
+			want = 0;
+		}
+		else
+		{
+			want = plan.stream_len;
+			progress_add(&prog, idx, len - want);
+		}
+	}
+
+	int read_len = 0;
+	off_t sent = 0;
+	uint32_t sum = 0;
+
+	// 압축 쓰레드를 시작하지 못하면 보내지 못한 것으로 끝내서 서버에게 알립니다.
+	lz_stage z;
+	struct lz_file lz_in = { file_fd, idx, dedup? &plan: NULL, offset };
+	int use_lz = use_compress && file_fd >= 0;
+	if (use_lz && lz_stage_start(&z, LZ_STAGE_ENCODE, lz_file_read, &lz_in, offset, want) < 0)
+	{
+		close(file_fd);
+		file_fd = -1;
+		use_lz = 0;
+	}
+	while(use_lz)
+	{
+		buffer->mtype = base + MSG_TYPE_DATA;
+		if ((read_len = lz_stage_emit(&z, buffer->message, chunk_sz)) <= 0)
 			break;
+		if (msgsnd(msgq_id, buffer, read_len, 0) < 0)
+		{
+			lz_stage_finish(&z);
+			chunk_plan_destroy(&plan);
+			release_queue(idx);
+			close(file_fd);
+			return -4;
+		}
+	}
+	// 블록을 끝까지 보냈으면 구간 전체를 보낸 것입니다. CRC32C 는 압축 쓰레드가 원래 데이터로 구했습니다.
+	if (use_lz)
+	{
+		if (lz_stage_finish(&z) == 0 && !read_len)
+			sent = want;
+		sum = z.sum;
 	}
 
+	while(!use_lz && file_fd >= 0 && sent < want)
+	{
+		buffer->mtype = base + MSG_TYPE_DATA;
+		size_t n = want - sent < chunk_sz? want - sent: chunk_sz;
+		read_len = dedup? chunk_plan_pread(&plan, file_fd, buffer->message, n, sent): pread(file_fd, buffer->message, n, offset + sent);
+		if (read_len <= 0) break;
+		if (use_checksum)
+			sum = crc32c_update(sum, buffer->message, read_len);
+		sent += read_len;
+		if ( msgsnd(msgq_id, buffer, read_len, 0) < 0)
+		{
+			chunk_plan_destroy(&plan);
+			release_queue(idx);
+			close(file_fd);
+			return -4;
+		}
+		progress_add(&prog, idx, read_len);
+	}
+
+	chunk_plan_destroy(&plan);
+	if (file_fd >= 0)
+		close(file_fd);
+
+	// 파일을 끝까지 보내지 못했으면 빈 메세지로 끝을 알리고, 다 보냈으면 서버가 확인하도록 CRC32C 를 보냅니다.
+	if (sent < want)
+	{
+		buffer->mtype = base + MSG_TYPE_DATA;
+		msgsnd(msgq_id, buffer, 0, 0);
+	}
+	else if (use_checksum && file_fd >= 0)
+	{
+		buffer->mtype = base + MSG_TYPE_SUM;
+		*(uint32_t*)buffer->message = sum;
+		msgsnd(msgq_id, buffer, CRC32C_SIZE, 0);
+	}
+
+	ssize_t ack_len = msgrcv(msgq_id, buffer, sizeof(int), base + MSG_TYPE_ACK, MSG_NOERROR);
+	if (ack_len < 0)
+	{
+		release_queue(idx);
+		return -5;
+	}
+	release_queue(idx);
+
+	if (file_fd < 0 || sent < want)
+		return -2;
+	// ACK 에 담긴 서버의 결과입니다.
+	if (ack_len == sizeof(int) && *(int*)buffer->message == -8)
+		return -8;
+	if (ack_len == sizeof(int) && *(int*)buffer->message < 0)
+		return -7;
 	return 1;
 }
 
@@ -249,7 +625,13 @@ char* flag_to_state(int flag)
 			case -4:
 				return "Fail to msgsnd..";
 			case -5:
-				return "Fail to clear message queue";
+				return "Fail to get ack..";
+			case -6:
+				return "Fail to write file..";
+			case -7:
+				return "Server fail to process file..";
+			case -8:
+				return "Checksum mismatch..";
 		}
 		return "Fail to process file";
 	}
@@ -257,16 +639,9 @@ char* flag_to_state(int flag)
 		return "Success!";
 }
 
-void print_current_state()
+void draw_state(progress* p, int final)
 {
-	for(int i = 0; i < upload_cnt; i++)
-	{
-		printf("upload %2d:%s:%s\n", i, upload_path[i], flag_to_state(result_flag[i]));
-	}
-	for(int i = 0; i < download_cnt; i++)
-	{
-		printf("download %2d:%s:%s\n", i, download_path[i], flag_to_state(result_flag[i + upload_cnt]));
-	}
+	job_draw(&jobs, p, flag_to_state, final);
 }
 
 char* get_last_filename(char* directory)
@@ -277,35 +652,92 @@ char* get_last_filename(char* directory)
 	return filename;
 }
 
-int get_msg_queue_io(int* ipc_key)
+// 전송마다 IPC_PRIVATE 로 새 큐를 만듭니다.
+// 키를 찾아다니지 않으므로 다른 클라이언트와 겹치지 않고, 큐 수는 커널의 msgmni 까지 늘어납니다.
+// 서버에게는 키 대신 큐 아이디를 넘겨줍니다.
+int get_msg_queue_io()
 {
-	int msgq = -1, index = 0, key = 0, fail = 0;
-	while(key = IO_MP_KEY_BASE + index, (msgq = msgget(IO_MP_KEY_BASE + index++, 0666 | IPC_CREAT | IPC_EXCL)) < 0)
-	{
-		if (index >= 10)
-		{
-			fail = 1;
-			break;
-		}
-	}
+	return msgget(IPC_PRIVATE, IO_MPQ_PERM | IPC_CREAT);
+}
 
-	if (!fail)
-	{
-		if (ipc_key)
-			*ipc_key = key;
-		return msgq;
-	}
-	else
-	{
+// 요청 MESSAGE QUEUE 로 모아둔 요청 프레임들을 보냅니다.
+struct request_sender
+{
+	int qid;
+	struct msg_buf* msg;
+};
+
+int send_requests(void* ctx, const char* buf, size_t len)
+{
+	struct request_sender* sender = (struct request_sender*)ctx;
+	return msgsnd(sender->qid, sender->msg, len, 0);
+}
+
+// 작업 i 의 전송 큐를 정하고 요청을 채웁니다. 묶음의 이름은 batch_name 에 만듭니다.
+// 세션 모드에서는 main 이 미리 만든 큐 하나를 모든 전송이 같이 씁니다.
+int job_request(int i, req_view* v, char* batch_name)
+{
+	int file_idx = i / stripe_cnt;
+	char* filepath = job_path(&jobs, i, batch_name);
+	char* filename = get_last_filename(filepath);
+
+	msgq_ids[i] = use_session? session_qid: get_msg_queue_io();
+	if (msgq_ids[i] < 0)
 		return -1;
+
+	// 데이터 메세지를 여러개 담을 수 있도록 큐를 늘려봅니다. 권한이 없으면 그대로 씁니다.
+	if (!use_session)
+		mp_grow_queue(msgq_ids[i], (size_t)chunk_sz * MP_QUEUE_CHUNKS);
+
+	struct stat st;
+	memset(v, 0, sizeof(req_view));
+	v->flags = (file_idx < upload_cnt? REQ_FLAG_UPLOAD: 0) | (use_session? REQ_FLAG_SESSION: 0) | (use_compress? REQ_FLAG_COMPRESS: 0) |
+		(use_dedup && file_idx < upload_cnt? REQ_FLAG_DEDUP: 0) | (use_checksum? REQ_FLAG_CHECKSUM: 0);
+	v->request_id = i;
+	v->stripe_idx = i % stripe_cnt;
+	v->stripe_cnt = stripe_cnt;
+	v->chunk_sz = chunk_sz;
+	if (file_idx < upload_cnt && stat(filepath, &st) == 0)
+		v->filesize = st.st_size;
+	v->name = filename;
+	v->name_len = strlen(filename);
+	v->key = (const char*)&msgq_ids[i];
+	v->key_len = sizeof(int);
+	if (i >= jobs.batch_base)
+		job_batch_request(&jobs, i, v);
+	return 0;
+}
+
+// 워커가 작업을 시작할 때 그 작업의 요청 하나만 보냅니다.
+int send_job_request(int idx)
+{
+	struct msg_buf buffer;
+	char batch_name[32];
+	req_view v;
+	if (job_request(idx, &v, batch_name) < 0)
+		return -1;
+
+	buffer.mtype = getpid();
+	struct request_sender sender = { request_qid, &buffer };
+	req_writer writer;
+	req_writer_init(&writer, buffer.message, MSG_BUFFER_SZ, send_requests, &sender);
+	if (req_writer_add(&writer, &v) < 0 || req_writer_flush(&writer) < 0)
+	{
+		release_queue(idx);
+		return -4;
 	}
+	return 0;
 }
 
 int main(int argc, char** argv)
 {
+	// 이 호스트에서 가장 빠른 데이터 메세지 크기를 재어서 보여줍니다.
+	if (argc == 2 && strcmp(argv[1], "sweep") == 0)
+		return mp_sweep_chunk(MP_SWEEP_BYTES, (size_t)mp_msgmax() * MP_QUEUE_CHUNKS) > 0? 0: 1;
+
 	if (argc < 3)
 	{
-		puts("usage: client_pipe ([upload|download] [filepath|filepath,..] )*");
+		puts("usage: client_mp sweep | client_mp [session] [compress] [dedup] [checksum] [batch] [json] [stripe N] [chunk N] [threads N] ([upload|download] [filepath|filepath,..] )*");
 		return 1;
 	}
 
@@ -316,100 +748,128 @@ int main(int argc, char** argv)
 
 	// 파일 경로 처리
 	interpret_input(argc, argv, &upload_cnt, &upload_path, &download_cnt, &download_path, &download_path_parent);
+	chunk_sz = mp_chunk_size(chunk_sz);
+
+	if (job_table_init(&jobs, upload_cnt, upload_path, download_cnt, download_path, stripe_cnt, use_batch) < 0)
+	{
+		perror("fail to pack small files..");
+		job_table_destroy(&jobs);
+		interpreted_input_cleanup();
+		return 1;
+	}
 
-	int cnt = msgq_cnt = upload_cnt + download_cnt;
+	int cnt = upload_cnt + download_cnt;
+	int job_cnt = msgq_cnt = job_table_count(&jobs);
 	struct msg_buf buffer;
 	memset(&buffer, 0, sizeof(struct msg_buf));
 	buffer.mtype = getpid();
 
-	result_flag = (int*)malloc(cnt * sizeof(int));
-	memset(result_flag, 0, sizeof(int) * cnt);
+	if (progress_mode < 0)
+		progress_mode = progress_default_mode();
+	progress_init(&prog, job_cnt, progress_mode);
+	result_flag = prog.results;
 
 	// MESSAGE PASSING 갹 큐의 아이디들
-	msgq_ids = (int*)malloc(cnt * sizeof(int));
-	memset(msgq_ids, 0, sizeof(int) * cnt);
+	msgq_ids = (int*)malloc(job_cnt * sizeof(int));
+	for (int i = 0; i < job_cnt; i++)
+		msgq_ids[i] = -1;
 
 	if (cnt > 0)
 	{
 		// 서버에서 요청 MSGQ 이 생성된 전제하에 단순히 열기만 합니다.
-		int rqmqid = msgget(REQ_MP_KEY, REQ_MPQ_PERM);
-		if (rqmqid < 0)
+		request_qid = msgget(REQ_MP_KEY, REQ_MPQ_PERM);
+		if (request_qid < 0)
 		{
 			perror("cannot open request message queue..");
 			goto cleanup;
 		}
 
-		printf("GET MSG Q: %x:%d\n", REQ_MP_KEY, rqmqid);
-	
-		int write_count = 0;
-		char* temp = buffer.message;	
+		printf("GET MSG Q: %x:%d\n", REQ_MP_KEY, request_qid);
+
+		// 세션 모드에서는 큐 하나를 처음에 만들어서 모든 전송이 같이 씁니다.
+		if (use_session)
+		{
+			if ((session_qid = get_msg_queue_io()) < 0)
+			{
+				fprintf(stderr, "Fail to get msg queue");
+				exit(1);
+			}
+			mp_grow_queue(session_qid, (size_t)chunk_sz * MP_QUEUE_CHUNKS);
+		}
+
+		// 작업마다 워커가 있으면 요청을 모두 모아서 먼저 보내고, 작업이 더 많으면 워커가 시작할 때 보냅니다.
+		if (worker_cnt <= 0)
+			worker_cnt = work_pool_default_workers();
+		if (worker_cnt > job_cnt)
+			worker_cnt = job_cnt;
+		lazy_request = job_cnt > worker_cnt;
+
+		// 요청이 메세지 하나에 다 들어가지 않으면 여러 메세지로 나누어 보냅니다.
+		struct request_sender sender = { request_qid, &buffer };
+		req_writer writer;
+		req_writer_init(&writer, buffer.message, MSG_BUFFER_SZ, send_requests, &sender);
 		
 		// CLI 레벨에서 들어온 데이터에 따라서 MSGQ 와 여러 것들을 초기화합니다.
-		for (int i = 0; i < cnt; i++)
+		for (int i = 0; i < job_cnt; i++)
 		{
-			char* filename;
-			if (i < upload_cnt)
-				filename = upload_path[i];
-			else
-				filename = download_path[i-upload_cnt];
-			filename = get_last_filename(filename);
-
-			int ipc_key;
-
-			// MESSAGE QUEUE 생성
-			msgq_ids[i] = get_msg_queue_io(&ipc_key);
+			// 묶음에 들어간 파일은 묶음 작업의 결과를 따릅니다.
+			if (job_batched(&jobs, i))
+			{
+				progress_done(&prog, i, 1);
+				continue;
+			}
+			if (lazy_request)
+				continue;
 
-			if (msgq_ids[i] < 0)
+			char batch_name[32];
+			req_view v;
+			if (job_request(i, &v, batch_name) < 0)
 			{
-				for (int j = 0; j < i; j++)
-				{
-					struct msqid_ds msqstat;
-					msgctl(msgq_ids[j], IPC_RMID, &msqstat);
-				}
+				cleanup_msq();
 				fprintf(stderr, "Fail to get msg queue");
 				exit(1);
 			}
 
-			int filesize = 0;
-			struct stat st;
-			stat(filename, &st);
-			filesize = st.st_size;
-
-			// request message <- 1/0: upload/download, file name, ipc_key for message pssing
-			int buffer_string_count = sprintf(temp, "%d %d %s %d\n", i < upload_cnt, filesize, filename, ipc_key);
-			temp = temp + buffer_string_count;
-			write_count += buffer_string_count;
+			// request frame <- upload flag, request id, filesize, file name, message queue id
+			if (req_writer_add(&writer, &v) < 0)
+			{
+				fprintf(stderr, "Fail to send request(%s)..\n", v.name);
+				cleanup_msq();
+				exit(1);
+			}
 		}
 
-		// 버퍼에 저장된 모든 요청 정보를 한꺼번에 보냅니다.
-		msgsnd(rqmqid, &buffer, write_count, 0);
+		// 남은 요청을 보냅니다.
+		if (req_writer_flush(&writer) < 0)
+		{
+			perror("fail to send request message..");
+			cleanup_msq();
+			exit(1);
+		}
 
-		threads = (pthread_t*)malloc(cnt * sizeof(pthread_t));
-		for (int i = 0; i < cnt; i++)
+		// 대기 작업 수를 작업 수로 잡아서 제출하는 main 은 잠들지 않습니다.
+		if (work_pool_init(&pool, worker_cnt, job_cnt, WORK_POOL_WAIT) < 0)
+		{
+			perror("fail to start workers..");
+			cleanup_msq();
+			exit(1);
+		}
+		for (int i = 0; i < job_cnt; i++)
 		{
+			if (job_batched(&jobs, i))
+				continue;
 			int *pi = (int*)malloc(sizeof(int));
 			*pi = i;
-			pthread_create(threads + i, NULL, file_task, pi);
+			work_pool_submit(&pool, file_task, pi);
 		}
 
-		// 처리 할 때까지 상태 출력하며 대기
-		while(1)
-		{
-			int check = 1;
-			for (int i = 0; i < cnt; i++)
-				if (result_flag[i] == 0)
-					check = 0;
-				
-			system("clear");
-			print_current_state();
-
-			if (check)	break;
-			else		sleep(1);
-		}
+		// 모든 작업이 끝날 때까지 잠들어 있다가 간격마다 진행 상황을 그립니다.
+		progress_wait(&prog, draw_state);
+		// 결과는 모두 기록되었고, 워커들이 자원을 놓고 끝날 때까지 기다립니다.
+		work_pool_shutdown(&pool);
 
-		system("clear");
-		// 처리 끝 난 후 출력
-		for (int i = 0; i < cnt; i++)
+		// 처리 끝 난 후 출력, JSON 모드에서는 끝난 파일들을 이미 출력했습니다.
+		for (int i = 0; prog.mode != PROGRESS_JSON && i < cnt; i++)
 		{
 			char* filename;
 
@@ -422,17 +882,18 @@ int main(int argc, char** argv)
 					i, 
 					(i < upload_cnt? "upload  ": "download"), 
 					filename, 
-					result_flag[i] == 1? "success!": "fail..");
+					job_file_result(&jobs, result_flag, i) == 1? "success!": "fail..");
 		}
 
-		close(rqmqid);
 	}
 
 cleanup:
-	SAFE_FREE(result_flag);
-	SAFE_FREE(threads);
+	cleanup_msq();
+	progress_destroy(&prog);
+	result_flag = NULL;
 	SAFE_FREE(msgq_ids);
 
+	job_table_destroy(&jobs);
 	interpreted_input_cleanup();
 
 	return 0;
@@ -451,7 +912,7 @@ int interpreted_input_cleanup()
 // 업로드 / 다운로드에 따라서 인자들을 원하는 메모리 레이아웃으로 매핑
 int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_path_ref, int* download_cnt_ref, char*** download_path_ref, char** download_path_parent_ref)
 {
-	char buffer[256];
+	char* buffer;
 	int state = 0;
 	for (int i = 1; i < argc; i++)
 	{
@@ -465,6 +926,24 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 					state = 2;
 				else if (strcmp(argv[i], "dpath") == 0)
 					state = 3;
+				else if (strcmp(argv[i], "json") == 0)
+					progress_mode = PROGRESS_JSON;
+				else if (strcmp(argv[i], "batch") == 0)
+					use_batch = 1;
+				else if (strcmp(argv[i], "stripe") == 0)
+					state = 4;
+				else if (strcmp(argv[i], "chunk") == 0)
+					state = 5;
+				else if (strcmp(argv[i], "session") == 0)
+					use_session = 1;
+				else if (strcmp(argv[i], "compress") == 0)
+					use_compress = 1;
+				else if (strcmp(argv[i], "dedup") == 0)
+					use_dedup = 1;
+				else if (strcmp(argv[i], "checksum") == 0)
+					use_checksum = 1;
+				else if (strcmp(argv[i], "threads") == 0)
+					state = 6;
 				else
 				{
 					fprintf(stderr, "Argument%d:%s is not behaviour..", i, argv[i]);
@@ -473,8 +952,8 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 				break;
 			case 1:
 				{
-					strcpy(buffer, item);
-					buffer[strlen(item)] = '\0';
+					// 파일 목록은 얼마든지 길 수 있으므로 복사해서 자릅니다.
+					buffer = strdup(item);
 					
 					char* token = strtok(buffer, ",");
 					int fd;
@@ -498,13 +977,14 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 						}
 						token = strtok(NULL, ",");
 					}
+					free(buffer);
 					state = 0;
 				}
 				break;
 			case 2:
 				{
-					strcpy(buffer, item);
-					buffer[strlen(item)] = '\0';
+					// 파일 목록은 얼마든지 길 수 있으므로 복사해서 자릅니다.
+					buffer = strdup(item);
 					
 					char* token = strtok(buffer, ",");
 					int fd;
@@ -528,6 +1008,7 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 						}
 						token = strtok(NULL, ",");
 					}
+					free(buffer);
 					state = 0;
 				}
 				break;
@@ -540,6 +1021,29 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 					state = 0;
 				}
 				break;
+			case 4:
+				stripe_cnt = atoi(item);
+				if (stripe_cnt < 1 || stripe_cnt > REQ_STRIPE_MAX)
+				{
+					fprintf(stderr, "stripe count must be 1..%d\n", REQ_STRIPE_MAX);
+					exit(1);
+				}
+				state = 0;
+				break;
+			case 5:
+				// msgmax 보다 크거나 너무 작은 값은 mp_chunk_size 가 맞춰줍니다.
+				chunk_sz = atoi(item);
+				state = 0;
+				break;
+			case 6:
+				worker_cnt = atoi(item);
+				if (worker_cnt < 1)
+				{
+					fprintf(stderr, "thread count must be at least 1\n");
+					exit(1);
+				}
+				state = 0;
+				break;
 		}
 
 	}
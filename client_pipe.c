@@ -8,9 +8,10 @@
 		4. 중복되는 이름은 서버/클라이언트에서 처리할 수 없습니다.
 	
 	위의 전제를 사용해 클라이언트는 서버에게 파일 전송을 요청하는 정보를 보낸 후,
-	이를 처리하는 쓰레드를 생성합니다.
-	송신단에서는 파이프의 크기제한을 고려하여 spinlock 이 필요하면 걸어줍니다.
-	수신단에서는 간단하게 값을 받아옵니다.
+	이를 처리하는 작업들을 워커 쓰레드(work_pool.c)에게 나누어 줍니다. 파일과 작업의 대응은 client_jobs.c 에 있습니다.
+	FIFO 는 방향에 맞게 연 뒤 논블로킹으로 바꾸고(fifo_util.c), 가득 차거나 비어 있으면 poll 로 잠듭니다.
+	기본으로는 파일과 FIFO 사이를 splice 로 옮기고, copy 인자를 주면 버퍼로 복사합니다.
+	송신단이 FIFO 를 닫으면 수신단은 남은 데이터를 읽은 뒤 EOF 를 받습니다.
 
 	이러한 동작은 서버가 요청을 받아서 문제없이 처리한다는 가정하에 이루어집니다.
  */
@@ -26,13 +27,13 @@
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <signal.h>
 
-#include <sys/ioctl.h>
 
 #define SAFE_FREE(x) \
 if(x) \
@@ -49,6 +50,14 @@ if(x) \
 } 
 
 #include "file_util.h"
+#include "fifo_util.h"
+#include "request_proto.h"
+#include "batch_util.h"
+#include "progress.h"
+#include "client_jobs.h"
+#include "work_pool.h"
+#include "file_map.h"
+#include "crc32c.h"
 
 void fatal(const char* msg)
 {
@@ -65,9 +74,24 @@ char *download_path_parent;
 int interpreted_input_cleanup();
 int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_path_ref, int* download_cnt_ref, char*** download_path_ref, char** download_path_parent_ref);
 
-pthread_t* threads;
+// 작업들은 고정된 수의 워커가 나누어 처리하고, 끝나면 join 으로 기다립니다. 기본은 코어 수입니다.
+// 세션의 .down 을 읽는 쓰레드는 풀 밖에서 따로 돌고, 세션을 닫은 뒤 join 합니다.
+work_pool pool;
+int worker_cnt;
+pthread_t session_receiver;
+// 작업마다의 결과는 progress 가 가지고, result_flag 는 그 배열을 가리킵니다.
+// 작업 쓰레드는 progress_done 으로만 결과를 기록합니다.
+progress prog;
+int progress_mode = -1;
 int* result_flag;
 
+// 파일 하나를 stripe_cnt 개의 조각으로 나누어 조각마다 채널과 쓰레드를 따로 씁니다.
+int stripe_cnt = 1;
+// batch 인자를 주면 작은 업로드 파일들을 묶음(batch_util.c)으로 모아 전송 하나로 보냅니다.
+int use_batch;
+// 파일들과 전송 작업들의 대응입니다(client_jobs.c).
+job_table jobs;
+
 // FIFO 변수 및 함수
 #define REQ_FIFO_PERM 		0666
 #define IO_FIFO_PERM		0666
@@ -75,9 +99,37 @@ int* result_flag;
 
 int fifo_cnt;
 char** fifo_paths;
+int* fifo_fds;
+
+// 0 이면 splice 를 쓰지 않고 버퍼로 복사합니다.
+int use_splice = 1;
+// checksum 인자를 주면 전송마다 맡은 구간의 CRC32C 를 주고받아 확인합니다.
+// splice 로 옮긴 구간은 확인하려고 한번 더 읽어야 하므로 기본으로는 쓰지 않습니다.
+int use_checksum;
+
+// session 인자를 주면 fifo_paths/fifo_fds 의 두 항목만 씁니다.
+int use_session;
+#define SESSION_UP			0
+#define SESSION_DOWN		1
+
+// .down 을 읽는 쓰레드가 다운로드 전송마다 가지는 상태입니다.
+struct session_stream
+{
+	int file;
+	uint64_t offset, remain;
+	uint32_t sum;
+};
+struct session_stream* session_streams;
+int session_job_cnt;
 
 void cleanup_fifo()
 {
+	if (fifo_fds)
+		for (int i = 0; i < fifo_cnt; i++)
+			if (fifo_fds[i] >= 0)
+				close(fifo_fds[i]);
+	SAFE_FREE(fifo_fds);
+
 	if (fifo_paths)
 		for (int i = 0; i < fifo_cnt; i++)
 			if (fifo_paths[i])
@@ -86,6 +138,33 @@ void cleanup_fifo()
 	SAFE_FREE_PTR_ARRAY(fifo_paths, fifo_cnt);
 }
 
+// splice 로 옮긴 파일의 offset 부터 len 만큼의 CRC32C 를 *sum 에 이어서 구합니다.
+// 방금 옮긴 페이지들이므로 매핑해서 페이지 캐시에서 읽고, 매핑할 수 없으면 pread 로 읽습니다.
+int crc_file_range(int fd, uint64_t offset, uint64_t len, uint32_t* sum)
+{
+	if (!len)
+		return 0;
+
+	file_map map;
+	if (file_map_open(&map, fd, offset, len) == 0)
+	{
+		int ret = file_map_crc32c(&map, 0, len, sum);
+		file_map_close(&map);
+		return ret;
+	}
+
+	char buffer[MSG_BUFFER_SZ];
+	for (uint64_t done = 0; done < len;)
+	{
+		ssize_t n = pread(fd, buffer, len - done < MSG_BUFFER_SZ? len - done: MSG_BUFFER_SZ, offset + done);
+		if (n <= 0)
+			return -1;
+		*sum = crc32c_update(*sum, buffer, n);
+		done += n;
+	}
+	return 0;
+}
+
 // 공유 자원을 전부 정리합니다.
 // 해당 소스에서는 FIFO 를 정리합니다.
 void signal_handler(int signal)
@@ -97,20 +176,28 @@ void signal_handler(int signal)
 
 int download(char* filename, int idx);
 int upload(char* filename, int idx);
+int session_upload(char* filename, int idx);
 
 void* file_task(void* pidx)
 {
-	int idx = *(int*)pidx;
-	if (idx < upload_cnt)
-		result_flag[idx] = upload(upload_path[idx], idx);
+	int idx = *(int*)pidx, file_idx = idx / stripe_cnt;
+	char* filename = idx < jobs.batch_base && file_idx < upload_cnt? upload_path[file_idx]: NULL;
+	if (use_session)
+	{
+		// 성공은 서버의 END 응답을 받은 .down 쓰레드가 기록합니다. 0 은 기록되지 않습니다.
+		progress_done(&prog, idx, session_upload(filename, idx));
+	}
+	else if (job_is_upload(&jobs, idx))
+		progress_done(&prog, idx, upload(filename, idx));
 	else
-		result_flag[idx] = download(download_path[idx-upload_cnt], idx);
+		progress_done(&prog, idx, download(download_path[file_idx-upload_cnt], idx));
 	free(pidx);
 
 	return NULL;
 }
 
 // 서버에서 FIFO로 데이터를 저장한 것을 받아와서 파일에 써줍니다.
+// 스트라이프 전송이면 크기 헤더로 맡은 구간을 구해서 그 위치에만 씁니다.
 int download(char* filename, int idx)
 {
 	char path_buffer[512];
@@ -119,27 +206,33 @@ int download(char* filename, int idx)
 	else
 		sprintf(path_buffer, "%s", filename);
 
-	int fifo_fd = open(fifo_paths[idx], O_RDWR, IO_FIFO_PERM),
-		make_fd = open(path_buffer, O_RDWR | O_CREAT, 0666);
-
-	if (fifo_fd < 0)
+	// 읽는 쪽은 요청을 보내기 전에 논블로킹으로 열어두었습니다.
+	// 서버가 쓰는 쪽을 열기 전에는 read 가 EOF 를 돌려주므로 먼저 첫 데이터를 기다립니다.
+	int fifo_fd = fifo_fds[idx];
+	fifo_fds[idx] = -1;
+	if (fifo_fd < 0 || fifo_wait(fifo_fd, POLLIN) < 0)
 	{
-		unlink(path_buffer);
+		if (fifo_fd >= 0)
+			close(fifo_fd);
 		unlink(fifo_paths[idx]);	
 		return -1;
 	}
+
+	int make_fd = open(path_buffer, O_RDWR | O_CREAT, 0666);
 	if (make_fd < 0)
 	{
 		close(fifo_fd);
-		unlink(path_buffer);
 		unlink(fifo_paths[idx]);	
 		return -2;
 	}
 
 	char buffer[MSG_BUFFER_SZ];
-	int read_len = 0, filesize = 0, accum = 0;
+	int read_len = 0;
+	int64_t filesize = 0;
+	off_t accum = 0;
+	uint32_t sum = 0, peer_sum;
 
-	if ((read_len = read(fifo_fd, buffer, 4)) < 0)
+	if (fifo_read_full(fifo_fd, &filesize, sizeof(int64_t)) < 0)
 	{
 		close(fifo_fd);
 		close(make_fd);
@@ -147,13 +240,25 @@ int download(char* filename, int idx)
 		unlink(fifo_paths[idx]);
 		return -3;
 	}
-	filesize = *((int*)buffer);
 
-	while(1)
+	// 다른 조각이 이미 쓴 내용을 지우지 않도록 O_TRUNC 대신 최종 크기로 맞춥니다.
+	if (ftruncate(make_fd, filesize) < 0)
 	{
-		read_len = read(fifo_fd, buffer, MSG_BUFFER_SZ);
-		if (!read_len) break;
-		if (read_len < 0)
+		close(fifo_fd);
+		close(make_fd);
+		unlink(fifo_paths[idx]);
+		return -4;
+	}
+
+	uint64_t offset, len;
+	req_stripe_range(filesize, idx % stripe_cnt, stripe_cnt, &offset, &len);
+	progress_total(&prog, idx, len);
+
+	if (use_splice)
+	{
+		loff_t file_off = offset;
+		ssize_t moved = fifo_splice_to_file(make_fd, &file_off, fifo_fd, len);
+		if (moved < 0 && moved != FIFO_SPLICE_UNSUPPORTED)
 		{
 			close(fifo_fd);
 			close(make_fd);
@@ -161,81 +266,155 @@ int download(char* filename, int idx)
 			unlink(fifo_paths[idx]);
 			return -3;
 		}
-		write(make_fd, buffer, read_len);
+		accum = file_off - offset;
+		if (use_checksum && crc_file_range(make_fd, offset, accum, &sum) < 0)
+		{
+			close(fifo_fd);
+			close(make_fd);
+			unlink(path_buffer);
+			unlink(fifo_paths[idx]);
+			return -4;
+		}
+		progress_add(&prog, idx, accum);
+	}
+
+	// splice 를 쓰지 않는 경우의 복사 경로
+	while(accum < len)
+	{
+		read_len = fifo_read_some(fifo_fd, buffer, len - accum < MSG_BUFFER_SZ? len - accum: MSG_BUFFER_SZ);
+		if (read_len <= 0)
+		{
+			close(fifo_fd);
+			close(make_fd);
+			unlink(path_buffer);
+			unlink(fifo_paths[idx]);
+			return -3;
+		}
+		if (pwrite(make_fd, buffer, read_len, offset + accum) != read_len)
+		{
+			close(fifo_fd);
+			close(make_fd);
+			unlink(path_buffer);
+			unlink(fifo_paths[idx]);
+			return -4;
+		}
+		if (use_checksum)
+			sum = crc32c_update(sum, buffer, read_len);
 		accum += read_len;
+		progress_add(&prog, idx, read_len);
+	}
 
-		if (accum == filesize)
-			break;
+	// checksum 요청이면 구간 뒤에 서버가 구한 CRC32C 가 옵니다.
+	int result = 1;
+	if (use_checksum)
+	{
+		if (fifo_read_full(fifo_fd, &peer_sum, CRC32C_SIZE) < 0)
+			result = -3;
+		else if (peer_sum != sum)
+			result = -8;
 	}
 
 	close(make_fd);
 	close(fifo_fd);
-	if (unlink(fifo_paths[idx]) < 0)
+	if (unlink(fifo_paths[idx]) < 0 && result > 0)
 		return -5;
 
-	return 1;
-}
-
-int get_max_fifo_size(int fifofd)
-{
-	return fcntl(fifofd, F_GETPIPE_SZ);
-}
-
-int get_used_fifo_size(int fifofd)
-{
-	int sz = 0;
-	ioctl(fifofd, FIONREAD, &sz);
-	return sz;
-}
-
-int get_remain_fifo_size(int fifofd)
-{
-	int sz = 0;
-	ioctl(fifofd, FIONREAD, &sz);
-	return fcntl(fifofd, F_GETPIPE_SZ) - sz;
+	return result;
 }
 
-// 파일에서 읽어서 FIFO 에 데이터를 넣어줍니다. 사용할 크기가 부족하면 spinlock 처럼 기다립니다.
+// 파일에서 읽어서 FIFO 에 데이터를 넣어줍니다. 공간이 부족하면 poll 로 잠듭니다.
+// 다 쓴 뒤 닫으면 서버는 남은 데이터를 읽고 EOF 를 받습니다.
+// 스트라이프 전송이면 맡은 구간만 보냅니다.
 int upload(char* filename, int idx)
 {
-	int file_fd = open(filename, O_RDONLY);
-	int fifo_fd = open(fifo_paths[idx], O_RDWR);
+	// 쓰는 쪽으로 열면 서버가 읽는 쪽으로 열 때까지 기다립니다.
+	int fifo_fd = open(fifo_paths[idx], O_WRONLY);
+	if (fifo_fd < 0)
+	{
+		unlink(fifo_paths[idx]);
+		return -1;
+	}
+	fifo_set_nonblock(fifo_fd);
 
+	int file_fd = job_open_upload(&jobs, filename, idx);
 	if (file_fd < 0)
 	{
+		close(fifo_fd);
 		unlink(fifo_paths[idx]);
 		return -2;
 	}
-	if (fifo_fd < 0)
+
+	struct stat st;
+	if (fstat(file_fd, &st) < 0)
 	{
-		unlink(fifo_paths[idx]);
 		close(file_fd);
-		return -1;
+		close(fifo_fd);
+		unlink(fifo_paths[idx]);
+		return -2;
 	}
 
+	uint64_t offset, len;
+	job_range(&jobs, idx, st.st_size, &offset, &len);
+	progress_total(&prog, idx, len);
+
+	loff_t file_off = offset;
+	uint32_t sum = 0;
+	if (use_splice)
+	{
+		ssize_t moved = fifo_splice_from_file(fifo_fd, file_fd, &file_off, len);
+		if (moved < 0 && moved != FIFO_SPLICE_UNSUPPORTED)
+		{
+			close(file_fd);
+			close(fifo_fd);
+			unlink(fifo_paths[idx]);
+			return -4;
+		}
+		if (use_checksum && crc_file_range(file_fd, offset, file_off - offset, &sum) < 0)
+		{
+			close(file_fd);
+			close(fifo_fd);
+			return -3;
+		}
+		progress_add(&prog, idx, file_off - offset);
+	}
+
+	// splice 를 쓰지 않는 경우의 복사 경로, splice 뒤에는 바로 구간의 끝입니다.
 	char buffer[MSG_BUFFER_SZ];
-	int sz = 0;
 	int read_len = 0;
-	while(1)
+	while(file_off < offset + len)
 	{
-		read_len = read(file_fd, buffer, MSG_BUFFER_SZ);
+		uint64_t remain = offset + len - file_off;
+		read_len = pread(file_fd, buffer, remain < MSG_BUFFER_SZ? remain: MSG_BUFFER_SZ, file_off);
 		if (!read_len) break;
 		if (read_len < 0)
 		{
+			close(file_fd);
+			close(fifo_fd);
 			return -3;
 		}
 
-		while (get_remain_fifo_size(fifo_fd) < read_len);
-
-		if (write(fifo_fd, buffer, read_len) < 0)
+		if (fifo_write_all(fifo_fd, buffer, read_len) < 0)
 		{
+			close(file_fd);
+			close(fifo_fd);
 			unlink(fifo_paths[idx]);
 			return -4;
 		}
+		if (use_checksum)
+			sum = crc32c_update(sum, buffer, read_len);
+		file_off += read_len;
+		progress_add(&prog, idx, read_len);
+	}
+
+	// 구간을 다 보냈으면 CRC32C 를 붙입니다. 모자라면 붙이지 않고 닫아서 서버가 실패로 처리합니다.
+	if (use_checksum && file_off == offset + len && fifo_write_all(fifo_fd, &sum, CRC32C_SIZE) < 0)
+	{
+		close(file_fd);
+		close(fifo_fd);
+		return -4;
 	}
 
 	close(file_fd);
-	while (get_used_fifo_size(fifo_fd));
 	close(fifo_fd);
 
 	return 1;
@@ -259,6 +438,10 @@ char* flag_to_state(int flag)
 				return "Fail to write..";
 			case -5:
 				return "Fail to clear fifo..";
+			case -7:
+				return "Server fail to process file..";
+			case -8:
+				return "Checksum mismatch..";
 		}
 		return "Fail to process file..";
 	}
@@ -266,12 +449,9 @@ char* flag_to_state(int flag)
 		return "Success!";
 }
 
-void print_current_state()
+void draw_state(progress* p, int final)
 {
-	for(int i = 0; i < upload_cnt; i++)
-		printf("upload %2d:%s:%s\n", i, upload_path[i], flag_to_state(result_flag[i]));
-	for(int i = 0; i < download_cnt; i++)
-		printf("download %2d:%s:%s\n", i, download_path[i], flag_to_state(result_flag[i + upload_cnt]));
+	job_draw(&jobs, p, flag_to_state, final);
 }
 
 char* get_last_filename(char* directory)
@@ -282,11 +462,246 @@ char* get_last_filename(char* directory)
 	return filename;
 }
 
+// 요청 FIFO 로 모아둔 요청 프레임들을 보냅니다.
+// MSG_BUFFER_SZ 는 PIPE_BUF 보다 작으므로 한번의 write 는 다른 클라이언트와 섞이지 않습니다.
+int send_requests(void* ctx, const char* buf, size_t len)
+{
+	int rqfifo_id = *(int*)ctx;
+	return write(rqfifo_id, buf, len) == (ssize_t)len? 0: -1;
+}
+
+// 세션/ 맡은 구간을 DATA 프레임으로 나누어 .up 에 쓰고 END 로 끝을 알립니다.
+// 프레임 하나는 한번에 쓰이므로 다른 업로드 쓰레드의 프레임과 섞이지 않습니다.
+int session_upload(char* filename, int idx)
+{
+	int up = fifo_fds[SESSION_UP];
+	int file_fd = job_open_upload(&jobs, filename, idx);
+	struct stat st;
+	if (file_fd < 0 || fstat(file_fd, &st) < 0)
+	{
+		if (file_fd >= 0)
+			close(file_fd);
+		// 서버가 스트림을 정리하도록 빈 채로 끝냅니다.
+		fifo_write_frame(up, idx, FIFO_FRAME_END, NULL, 0);
+		return -2;
+	}
+
+	uint64_t offset, len;
+	job_range(&jobs, idx, st.st_size, &offset, &len);
+	progress_total(&prog, idx, len);
+
+	char buffer[FIFO_FRAME_PAYLOAD_MAX];
+	uint64_t sent = 0;
+	uint32_t sum = 0;
+	while (sent < len)
+	{
+		uint64_t remain = len - sent;
+		ssize_t read_len = pread(file_fd, buffer, remain < FIFO_FRAME_PAYLOAD_MAX? remain: FIFO_FRAME_PAYLOAD_MAX, offset + sent);
+		if (read_len <= 0)
+			break;
+		if (fifo_write_frame(up, idx, FIFO_FRAME_DATA, buffer, read_len) < 0)
+		{
+			close(file_fd);
+			return -4;
+		}
+		if (use_checksum)
+			sum = crc32c_update(sum, buffer, read_len);
+		sent += read_len;
+		progress_add(&prog, idx, read_len);
+	}
+	close(file_fd);
+
+	// 구간을 다 보냈으면 END 에 CRC32C 를 담습니다.
+	if (fifo_write_frame(up, idx, FIFO_FRAME_END, &sum, sent < len || !use_checksum? 0: CRC32C_SIZE) < 0)
+		return -4;
+	return sent < len? -3: 0;
+}
+
+// 세션/ .down 에서 크기 프레임을 받으면 받을 파일을 열고 맡은 구간을 정합니다.
+int session_open_download(int idx, int64_t filesize)
+{
+	char path_buffer[512];
+	char* filename = get_last_filename(download_path[idx / stripe_cnt - upload_cnt]);
+	if (download_path_parent != NULL)
+		sprintf(path_buffer, "%s/%s", download_path_parent, filename);
+	else
+		sprintf(path_buffer, "%s", filename);
+
+	struct session_stream* ss = &session_streams[idx];
+	ss->file = open(path_buffer, O_RDWR | O_CREAT, 0666);
+	if (ss->file < 0)
+		return -2;
+
+	// 다른 조각이 이미 쓴 내용을 지우지 않도록 O_TRUNC 대신 최종 크기로 맞춥니다.
+	if (ftruncate(ss->file, filesize) < 0)
+		return -4;
+
+	req_stripe_range(filesize, idx % stripe_cnt, stripe_cnt, &ss->offset, &ss->remain);
+	ss->sum = 0;
+	progress_total(&prog, idx, ss->remain);
+	return 0;
+}
+
+void session_stream_done(int idx, int result)
+{
+	struct session_stream* ss = &session_streams[idx];
+	if (ss->file >= 0)
+	{
+		close(ss->file);
+		ss->file = -1;
+	}
+	progress_done(&prog, idx, result);
+}
+
+// 세션/ .down 을 읽는 쓰레드입니다. 프레임의 전송 번호로 다운로드 데이터를 나누어 쓰고,
+// 업로드/다운로드의 결과를 기록합니다. 서버가 .down 을 닫으면 끝나지 않은 전송은 실패입니다.
+void* session_receive(void* p)
+{
+	int down = fifo_fds[SESSION_DOWN];
+	struct fifo_frame_hdr hdr;
+	char payload[FIFO_FRAME_PAYLOAD_MAX];
+
+	// 서버가 쓰는 쪽을 열기 전에는 read 가 EOF 를 돌려주므로 먼저 첫 데이터를 기다립니다.
+	if (fifo_wait(down, POLLIN) == 0)
+	{
+		while (fifo_read_frame(down, &hdr, payload) == 0)
+		{
+			int idx = hdr.stream_id, result;
+			if (idx >= session_job_cnt)
+				continue;
+			struct session_stream* ss = &session_streams[idx];
+
+			switch(hdr.type)
+			{
+				case FIFO_FRAME_SIZE:
+					if (job_is_upload(&jobs, idx))
+						break;
+					{
+						int64_t filesize;
+						memcpy(&filesize, payload, sizeof(int64_t));
+						if ((result = session_open_download(idx, filesize)) < 0)
+							session_stream_done(idx, result);
+					}
+					break;
+				case FIFO_FRAME_DATA:
+					if (ss->file < 0)
+						break;
+					if (hdr.len > ss->remain || pwrite(ss->file, payload, hdr.len, ss->offset) != hdr.len)
+					{
+						session_stream_done(idx, -4);
+						break;
+					}
+					if (use_checksum)
+						ss->sum = crc32c_update(ss->sum, payload, hdr.len);
+					ss->offset += hdr.len;
+					ss->remain -= hdr.len;
+					progress_add(&prog, idx, hdr.len);
+					break;
+				case FIFO_FRAME_END:
+					// 다운로드의 END 에는 서버가 보낸 구간의 CRC32C 가 담겨 옵니다.
+					if (job_is_upload(&jobs, idx))
+						result = 1;
+					else if (ss->remain)
+						result = -3;
+					else if (!use_checksum)
+						result = 1;
+					else
+						result = hdr.len == CRC32C_SIZE && !memcmp(payload, &ss->sum, CRC32C_SIZE)? 1: -8;
+					session_stream_done(idx, result);
+					break;
+				case FIFO_FRAME_FAIL:
+					// 서버가 CRC32C 가 맞지 않아서 버린 업로드는 그대로 알려줍니다.
+					result = -7;
+					if (hdr.len == sizeof(int32_t))
+					{
+						int32_t code;
+						memcpy(&code, payload, sizeof(int32_t));
+						if (code == -8)
+							result = -8;
+					}
+					session_stream_done(idx, result);
+					break;
+			}
+		}
+	}
+
+	for (int i = 0; i < session_job_cnt; i++)
+		session_stream_done(i, -3);
+	return NULL;
+}
+
+// 세션 FIFO 한 쌍을 만들고 서버에 세션 요청을 보낸 뒤 .up 을 엽니다.
+// .down 의 읽는 쪽은 서버가 논블로킹으로 쓰는 쪽을 열 수 있도록 요청 전에 열어둡니다.
+int session_open(int rqfifo_id)
+{
+	char base[64], name[16], frame[MSG_BUFFER_SZ];
+	sprintf(base, "./fifo/%d_session", getpid());
+	sprintf(name, "%d", getpid());
+
+	fifo_cnt = 2;
+	fifo_paths = (char**)malloc(fifo_cnt * sizeof(char*));
+	fifo_fds = (int*)malloc(fifo_cnt * sizeof(int));
+	for (int i = 0; i < fifo_cnt; i++)
+	{
+		fifo_fds[i] = -1;
+		sprintf(frame, "%s.%s", base, i == SESSION_UP? "up": "down");
+		fifo_paths[i] = strdup(frame);
+		if (mkfifo(fifo_paths[i], IO_FIFO_PERM) < 0)
+		{
+			perror("cannot make session fifo..");
+			return -1;
+		}
+	}
+
+	if ((fifo_fds[SESSION_DOWN] = open(fifo_paths[SESSION_DOWN], O_RDONLY | O_NONBLOCK)) < 0)
+	{
+		perror("cannot open session fifo..");
+		return -1;
+	}
+
+	// 세션 요청의 이름은 로그에만 쓰이고, 키는 세션 FIFO 들의 공통 경로입니다.
+	req_view v;
+	memset(&v, 0, sizeof(v));
+	v.flags = REQ_FLAG_SESSION;
+	v.name = name;
+	v.name_len = strlen(name);
+	v.key = base;
+	v.key_len = strlen(base);
+
+	int frame_len = req_encode(frame, MSG_BUFFER_SZ, &v);
+	if (frame_len <= 0 || send_requests(&rqfifo_id, frame, frame_len) < 0)
+	{
+		perror("fail to send session request..");
+		return -1;
+	}
+
+	// 쓰는 쪽으로 열면 서버가 읽는 쪽으로 열 때까지 기다립니다.
+	if ((fifo_fds[SESSION_UP] = open(fifo_paths[SESSION_UP], O_WRONLY)) < 0)
+	{
+		perror("cannot open session fifo..");
+		return -1;
+	}
+	fifo_set_nonblock(fifo_fds[SESSION_UP]);
+	fifo_grow(fifo_fds[SESSION_UP], FIFO_PIPE_SZ);
+	return 0;
+}
+
+// 세션/ 전송마다 요청 프레임을 .up 에 먼저 씁니다.
+// 같은 FIFO 로 가므로 서버는 그 전송의 데이터보다 요청을 항상 먼저 받습니다.
+int session_send_request(int idx, const req_view* v)
+{
+	char frame[FIFO_FRAME_PAYLOAD_MAX];
+	int frame_len = req_encode(frame, sizeof(frame), v);
+	if (frame_len <= 0)
+		return -1;
+	return fifo_write_frame(fifo_fds[SESSION_UP], idx, FIFO_FRAME_REQUEST, frame, frame_len);
+}
+
 int main(int argc, char** argv)
 {
 	if (argc < 3)
 	{
-		puts("usage: client_pipe ([upload|download] [filepath|filepath,..] )*");
+		puts("usage: client_pipe [copy] [session] [checksum] [batch] [json] [stripe N] [threads N] ([upload|download] [filepath|filepath,..] )*");
 		return 1;
 	}
 
@@ -294,20 +709,36 @@ int main(int argc, char** argv)
 	signal(SIGABRT, signal_handler);
 	signal(SIGHUP, signal_handler);
 	signal(SIGKILL, signal_handler);
+	// 서버가 먼저 FIFO 를 닫아도 write 의 에러로 처리합니다.
+	signal(SIGPIPE, SIG_IGN);
 
 	// 파일 경로 처리
 	interpret_input(argc, argv, &upload_cnt, &upload_path, &download_cnt, &download_path, &download_path_parent);
 
-	int cnt = fifo_cnt = upload_cnt + download_cnt;
+	if (job_table_init(&jobs, upload_cnt, upload_path, download_cnt, download_path, stripe_cnt, use_batch) < 0)
+	{
+		perror("fail to pack small files..");
+		job_table_destroy(&jobs);
+		interpreted_input_cleanup();
+		return 1;
+	}
+
+	int cnt = upload_cnt + download_cnt;
+	int job_cnt = job_table_count(&jobs);
 	char buffer[MSG_BUFFER_SZ];
 
-	result_flag = (int*)malloc(cnt * sizeof(int));
-	memset(result_flag, 0, sizeof(int) * cnt);
+	if (progress_mode < 0)
+		progress_mode = progress_default_mode();
+	progress_init(&prog, job_cnt, progress_mode);
+	result_flag = prog.results;
 
-	// FIFO 경로 할당 및 설정
+	// FIFO 경로 할당 및 설정, 세션이면 session_open 에서 두개만 만듭니다.
+	fifo_cnt = use_session? 0: job_cnt;
 	fifo_paths = (char**)malloc(fifo_cnt * sizeof(char*));
+	fifo_fds = (int*)malloc(fifo_cnt * sizeof(int));
 	for (int i = 0; i < fifo_cnt; i++)
 	{
+		fifo_fds[i] = -1;
 		sprintf(buffer, "./fifo/%d_%d", getpid(), i);
 		fifo_paths[i] = (char*)malloc((strlen(buffer)+1) * sizeof(char));
 		strcpy(fifo_paths[i], buffer);
@@ -325,70 +756,121 @@ int main(int argc, char** argv)
 		}
 
 		printf("GET FIFO: ./fifo/requests:%d\n", rqfifo_id);
+
+		if (use_session)
+		{
+			SAFE_FREE(fifo_paths);
+			SAFE_FREE(fifo_fds);
+			session_job_cnt = job_cnt;
+			session_streams = (struct session_stream*)malloc(job_cnt * sizeof(struct session_stream));
+			for (int i = 0; i < job_cnt; i++)
+				session_streams[i].file = -1;
+			if (session_open(rqfifo_id) < 0)
+				goto cleanup;
+		}
 	
-		int write_count = 0;
-		char* temp = buffer;	
+		// 요청이 버퍼 하나에 다 들어가지 않으면 여러번 나누어 보냅니다.
+		req_writer writer;
+		req_writer_init(&writer, buffer, MSG_BUFFER_SZ, send_requests, &rqfifo_id);
+
 		// CLI 레벨에서 들어온 데이터에 따라서 FIFO 와 여러 것들을 초기화합니다.
-		for (int i = 0; i < cnt; i++)
+		for (int i = 0; i < job_cnt; i++)
 		{
-			char* filename;
-			if (i < upload_cnt)
-				filename = upload_path[i];
-			else
-				filename = download_path[i-upload_cnt];
-			filename = get_last_filename(filename);
+			// 묶음에 들어간 파일은 묶음 작업의 결과를 따릅니다.
+			if (job_batched(&jobs, i))
+			{
+				progress_done(&prog, i, 1);
+				continue;
+			}
+
+			int file_idx = i / stripe_cnt;
+			char batch_name[32];
+			char* filepath = job_path(&jobs, i, batch_name);
+			char* filename = get_last_filename(filepath);
 
 			// FIFO 생성
-			if (mkfifo(fifo_paths[i], IO_FIFO_PERM) < 0)
+			if (!use_session && mkfifo(fifo_paths[i], IO_FIFO_PERM) < 0)
 			{
 				perror("cannot make I/O fifo..");
 				goto cleanup;
 			}
 
-			int filesize = 0;
-			struct stat st;
-			stat(filename, &st);
-			filesize = st.st_size;
+			// 다운로드는 서버가 논블로킹으로 쓰는 쪽을 열 수 있도록 읽는 쪽을 먼저 열어둡니다.
+			if (!use_session && !job_is_upload(&jobs, i) && (fifo_fds[i] = open(fifo_paths[i], O_RDONLY | O_NONBLOCK)) < 0)
+			{
+				perror("cannot open I/O fifo..");
+				goto cleanup;
+			}
 
-			// request message <- 1/0: upload/download, filesize, file name, fifo path
-			int buffer_string_count = sprintf(temp, "%d %d %s %s\n", i < upload_cnt, filesize, filename, fifo_paths[i]);
-			temp = temp + buffer_string_count;
-			write_count += buffer_string_count;
+			struct stat st;
+			req_view v;
+			memset(&v, 0, sizeof(v));
+			v.flags = (file_idx < upload_cnt? REQ_FLAG_UPLOAD: 0) | (use_checksum? REQ_FLAG_CHECKSUM: 0);
+			v.request_id = i;
+			v.stripe_idx = i % stripe_cnt;
+			v.stripe_cnt = stripe_cnt;
+			if (file_idx < upload_cnt && stat(filepath, &st) == 0)
+				v.filesize = st.st_size;
+			v.name = filename;
+			v.name_len = strlen(filename);
+			v.key = use_session? "": fifo_paths[i];
+			v.key_len = strlen(v.key);
+			if (i >= jobs.batch_base)
+				job_batch_request(&jobs, i, &v);
+
+			// request frame <- upload flag, request id, filesize, file name, fifo path
+			if ((use_session? session_send_request(i, &v): req_writer_add(&writer, &v)) < 0)
+			{
+				fprintf(stderr, "Fail to send request(%s)..\n", filename);
+				goto cleanup;
+			}
 		}
 
-		// 버퍼에 저장된 모든 요청 정보를 한꺼번에 보냅니다.
-		if (write(rqfifo_id, buffer, write_count) < 0)
+		// 남은 요청을 보냅니다.
+		if (req_writer_flush(&writer) < 0)
 		{
 			perror("fail to send request message..");
 			goto cleanup;
 		}
 
-		threads = (pthread_t*)malloc(cnt * sizeof(pthread_t));
-		for (int i = 0; i < cnt; i++)
+		// 세션이면 다운로드는 .down 을 읽는 쓰레드 하나가 모두 받습니다.
+		if (use_session)
+			pthread_create(&session_receiver, NULL, session_receive, NULL);
+
+		if (worker_cnt <= 0)
+			worker_cnt = work_pool_default_workers();
+		if (worker_cnt > job_cnt)
+			worker_cnt = job_cnt;
+		// 대기 작업 수를 작업 수로 잡아서 제출하는 main 은 잠들지 않습니다.
+		if (work_pool_init(&pool, worker_cnt, job_cnt, WORK_POOL_WAIT) < 0)
+		{
+			perror("fail to start workers..");
+			goto cleanup;
+		}
+		for (int i = 0; i < job_cnt; i++)
 		{
+			if (job_batched(&jobs, i) || (use_session && !job_is_upload(&jobs, i)))
+				continue;
 			int *pi = (int*)malloc(sizeof(int));
 			*pi = i;
-			pthread_create(threads + i, NULL, file_task, pi);
+			work_pool_submit(&pool, file_task, pi);
 		}
 
-		// 처리 할 때까지 상태 출력하며 대기
-		while(1)
+		// 모든 작업이 끝날 때까지 잠들어 있다가 간격마다 진행 상황을 그립니다.
+		progress_wait(&prog, draw_state);
+		// 결과는 모두 기록되었고, 워커들이 자원을 놓고 끝날 때까지 기다립니다.
+		work_pool_shutdown(&pool);
+
+		// .up 을 닫으면 서버가 .down 을 닫고, .down 을 읽던 쓰레드가 끝납니다.
+		if (use_session)
 		{
-			int check = 1;
-			for (int i = 0; i < cnt; i++)
-				if (result_flag[i] == 0)
-					check = 0;
-				
-			system("clear");
-			print_current_state();
-
-			if (check)	break;
-			else		sleep(1);
+			close(fifo_fds[SESSION_UP]);
+			fifo_fds[SESSION_UP] = -1;
+			pthread_join(session_receiver, NULL);
 		}
 
-		system("clear");
-		// 처리 끝 난 후 출력
-		for (int i = 0; i < cnt; i++)
+		// 처리 끝 난 후 출력, JSON 모드에서는 끝난 파일들을 이미 출력했습니다.
+		for (int i = 0; prog.mode != PROGRESS_JSON && i < cnt; i++)
 		{
 			char* filename;
 
@@ -401,17 +883,18 @@ int main(int argc, char** argv)
 					i, 
 					(i < upload_cnt? "upload  ": "download"), 
 					filename, 
-					result_flag[i] == 1? "success!": "fail..");
+					job_file_result(&jobs, result_flag, i) == 1? "success!": "fail..");
 		}
 
 		close(rqfifo_id);
 	}
 
 cleanup:
-	SAFE_FREE(result_flag);
-	SAFE_FREE(threads);
-	
 	cleanup_fifo();
+	progress_destroy(&prog);
+	result_flag = NULL;
+	SAFE_FREE(session_streams);
+	job_table_destroy(&jobs);
 	interpreted_input_cleanup();
 
 	return 0;
@@ -431,7 +914,7 @@ int interpreted_input_cleanup()
 // 업로드 / 다운로드에 따라서 인자들을 원하는 메모리 레이아웃으로 매핑
 int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_path_ref, int* download_cnt_ref, char*** download_path_ref, char** download_path_parent_ref)
 {
-	char buffer[256];
+	char* buffer;
 	int state = 0;
 	for (int i = 1; i < argc; i++)
 	{
@@ -445,6 +928,20 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 					state = 2;
 				else if (strcmp(argv[i], "dpath") == 0)
 					state = 3;
+				else if (strcmp(argv[i], "json") == 0)
+					progress_mode = PROGRESS_JSON;
+				else if (strcmp(argv[i], "batch") == 0)
+					use_batch = 1;
+				else if (strcmp(argv[i], "stripe") == 0)
+					state = 4;
+				else if (strcmp(argv[i], "threads") == 0)
+					state = 5;
+				else if (strcmp(argv[i], "copy") == 0)
+					use_splice = 0;
+				else if (strcmp(argv[i], "checksum") == 0)
+					use_checksum = 1;
+				else if (strcmp(argv[i], "session") == 0)
+					use_session = 1;
 				else
 				{
 					fprintf(stderr, "Argument%d:%s is not behaviour..", i, argv[i]);
@@ -453,8 +950,8 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 				break;
 			case 1:
 				{
-					strcpy(buffer, item);
-					buffer[strlen(item)] = '\0';
+					// 파일 목록은 얼마든지 길 수 있으므로 복사해서 자릅니다.
+					buffer = strdup(item);
 					
 					char* token = strtok(buffer, ",");
 					int fd;
@@ -478,13 +975,14 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 						}
 						token = strtok(NULL, ",");
 					}
+					free(buffer);
 					state = 0;
 				}
 				break;
 			case 2:
 				{
-					strcpy(buffer, item);
-					buffer[strlen(item)] = '\0';
+					// 파일 목록은 얼마든지 길 수 있으므로 복사해서 자릅니다.
+					buffer = strdup(item);
 					
 					char* token = strtok(buffer, ",");
 					int fd;
@@ -508,6 +1006,7 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 						}
 						token = strtok(NULL, ",");
 					}
+					free(buffer);
 					state = 0;
 				}
 				break;
@@ -520,6 +1019,24 @@ int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_p
 					state = 0;
 				}
 				break;
+			case 4:
+				stripe_cnt = atoi(item);
+				if (stripe_cnt < 1 || stripe_cnt > REQ_STRIPE_MAX)
+				{
+					fprintf(stderr, "stripe count must be 1..%d\n", REQ_STRIPE_MAX);
+					exit(1);
+				}
+				state = 0;
+				break;
+			case 5:
+				worker_cnt = atoi(item);
+				if (worker_cnt < 1)
+				{
+					fprintf(stderr, "thread count must be at least 1\n");
+					exit(1);
+				}
+				state = 0;
+				break;
 		}
 
 	}
@@ -0,0 +1,696 @@
+/*
+	client_shm.c
+	공유 메모리를 사용한 파일 전송 클라이언트 소스입니다.
+	사용의 전제는 다음과 같습니다.
+		1. 서버 프로그램이 같은 경로에 존재함.
+		2. 서버 프로그램이 클라이언트를 킬 시 반드시 켜져 있어야함.
+		3. 파일은 단순히 이름으로 올라가기만 합니다.
+		4. 중복되는 이름은 서버/클라이언트에서 처리할 수 없습니다.
+
+	위의 전제를 사용해 클라이언트는 서버에게 파일 전송을 요청하는 정보를 보낸 후,
+	이를 처리하는 작업들을 워커 쓰레드(work_pool.c)에게 나누어 줍니다. 파일과 작업의 대응은 client_jobs.c 에 있습니다.
+	전송마다 공유 메모리 링버퍼(shm_ring.c)를 하나씩 만들어 서버에게 이름을 넘겨줍니다.
+	송신단에서는 파일을 링 메모리로 바로 읽어 넣고, 링이 가득 차면 futex 로 잠듭니다.
+	수신단에서는 링 메모리에서 바로 파일로 써줍니다.
+
+	이러한 동작은 서버가 요청을 받아서 문제없이 처리한다는 가정하에 이루어집니다.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <fcntl.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+
+#define SAFE_FREE(x) \
+if(x) \
+{ \
+	free(x); \
+	x = NULL; \
+}
+#define SAFE_FREE_PTR_ARRAY(x,len) \
+if(x) \
+{ \
+	for(int i = 0; i < len; i++) \
+		SAFE_FREE(x[i]); \
+	SAFE_FREE(x); \
+} 
+
+#include "file_util.h"
+#include "shm_ring.h"
+#include "request_proto.h"
+#include "batch_util.h"
+#include "progress.h"
+#include "client_jobs.h"
+#include "crc32c.h"
+#include "work_pool.h"
+
+void fatal(const char* msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+int upload_cnt;
+char **upload_path;
+int download_cnt;
+char **download_path;
+char *download_path_parent;
+
+int interpreted_input_cleanup();
+int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_path_ref, int* download_cnt_ref, char*** download_path_ref, char** download_path_parent_ref);
+
+// 작업들은 고정된 수의 워커가 나누어 처리하고, 끝나면 join 으로 기다립니다. 기본은 코어 수입니다.
+work_pool pool;
+int worker_cnt;
+
+// 서버의 요청 큐입니다. lazy_request 이면 요청을 main 에서 모아 보내지 않고 워커가 하나씩 보냅니다.
+int request_qid = -1;
+int lazy_request;
+// 작업마다의 결과는 progress 가 가지고, result_flag 는 그 배열을 가리킵니다.
+// 작업 쓰레드는 progress_done 으로만 결과를 기록합니다.
+progress prog;
+int progress_mode = -1;
+int* result_flag;
+
+// 파일 하나를 stripe_cnt 개의 조각으로 나누어 조각마다 채널과 쓰레드를 따로 씁니다.
+int stripe_cnt = 1;
+// batch 인자를 주면 작은 업로드 파일들을 묶음(batch_util.c)으로 모아 전송 하나로 보냅니다.
+int use_batch;
+// checksum 인자를 주면 전송마다 맡은 구간의 CRC32C 를 링의 데이터 뒤에 붙여 확인합니다.
+int use_checksum;
+// 파일들과 전송 작업들의 대응입니다(client_jobs.c).
+job_table jobs;
+
+// 공유 메모리 변수 및 함수, 정의
+#define REQ_SHM_KEY 		60070
+#define REQ_MPQ_PERM 		0666
+
+#define MSG_BUFFER_SZ		2048
+struct msg_buf
+{
+	long mtype;
+	char message[MSG_BUFFER_SZ];
+};
+
+int shm_cnt;
+char** shm_names;
+shm_ring** shm_rings;
+
+// 공유 메모리 자원 정리
+void cleanup_shm()
+{
+	if (shm_names)
+		for (int i = 0; i < shm_cnt; i++)
+			if (shm_names[i])
+				shm_ring_unlink(shm_names[i]);
+
+	if (shm_rings)
+		for (int i = 0; i < shm_cnt; i++)
+			shm_ring_close(shm_rings[i]);
+
+	SAFE_FREE_PTR_ARRAY(shm_names, shm_cnt);
+	SAFE_FREE(shm_rings);
+}
+
+void signal_handler(int signal)
+{
+	cleanup_shm();
+	exit(1);
+}
+// 공유 메모리 변수 및 함수, 정의
+
+int download(char* filename, int idx);
+int upload(char* filename, int idx);
+int send_job_request(int idx);
+
+void* file_task(void* pidx)
+{
+	int idx = *(int*)pidx, file_idx = idx / stripe_cnt;
+	// 서버의 워커는 전송을 맡으면 링을 기다리며 잠들므로,
+	// 아직 시작하지 않은 작업의 요청을 미리 보내면 서버와 클라이언트의 워커가 서로를 기다릴 수 있습니다.
+	int result = lazy_request? send_job_request(idx): 0;
+	if (result == 0 && job_is_upload(&jobs, idx))
+		result = upload(idx < jobs.batch_base? upload_path[file_idx]: NULL, idx);
+	else if (result == 0)
+		result = download(download_path[file_idx-upload_cnt], idx);
+	progress_done(&prog, idx, result);
+	free(pidx);
+
+	return NULL;
+}
+
+
+// 서버가 링에 넣어준 데이터를 링 메모리에서 바로 파일에 써줍니다.
+// 스트라이프 전송이면 크기 헤더로 맡은 구간을 구해서 그 위치에만 씁니다.
+int download(char* filename, int idx)
+{
+	char path_buffer[512];
+	if (download_path_parent != NULL)
+		sprintf(path_buffer, "%s/%s", download_path_parent, filename);
+	else
+		sprintf(path_buffer, "%s", filename);
+
+	shm_ring* ring = shm_rings[idx];
+	if (!ring)
+		return -1;
+
+	int make_fd = open(path_buffer, O_RDWR | O_CREAT, 0666);
+	if (make_fd < 0)
+	{
+		shm_ring_close_read(ring);
+		return -2;
+	}
+
+	int64_t filesize = 0;
+	off_t accum = 0;
+	if (shm_ring_read_full(ring, &filesize, sizeof(int64_t)) < 0)
+	{
+		close(make_fd);
+		unlink(path_buffer);
+		return -3;
+	}
+
+	// 다른 조각이 이미 쓴 내용을 지우지 않도록 O_TRUNC 대신 최종 크기로 맞춥니다.
+	if (ftruncate(make_fd, filesize) < 0)
+	{
+		shm_ring_close_read(ring);
+		close(make_fd);
+		return -4;
+	}
+
+	uint64_t offset, range_len;
+	req_stripe_range(filesize, idx % stripe_cnt, stripe_cnt, &offset, &range_len);
+	progress_total(&prog, idx, range_len);
+
+	uint32_t sum = 0;
+	while(accum < range_len)
+	{
+		const void* data;
+		size_t len = shm_ring_read_acquire(ring, &data);
+		if (!len)
+		{
+			close(make_fd);
+			return -3;
+		}
+		// 구간 뒤에 이어 오는 CRC32C 는 따로 읽습니다.
+		if (len > range_len - accum)
+			len = range_len - accum;
+		if (use_checksum)
+			sum = crc32c_update(sum, data, len);
+
+		if (pwrite(make_fd, data, len, offset + accum) != (ssize_t)len)
+		{
+			shm_ring_close_read(ring);
+			close(make_fd);
+			return -4;
+		}
+		shm_ring_read_release(ring, len);
+		accum += len;
+		progress_add(&prog, idx, len);
+	}
+
+	close(make_fd);
+
+	// checksum 요청이면 서버가 맡은 구간 뒤에 붙인 CRC32C 와 받은 데이터를 비교합니다.
+	if (!use_checksum)
+		return 1;
+	uint32_t server_sum;
+	if (shm_ring_read_full(ring, &server_sum, CRC32C_SIZE) < 0)
+		return -3;
+	if (server_sum != sum)
+		return -8;
+	return 1;
+}
+
+// 파일에서 링 메모리로 바로 읽어 넣어줍니다. 링이 가득 차면 futex 로 잠듭니다.
+// 스트라이프 전송이면 맡은 구간만 넣습니다.
+// 다 넣은 뒤 서버가 모두 읽어갈 때까지 기다렸다가 끝냅니다.
+int upload(char* filename, int idx)
+{
+	shm_ring* ring = shm_rings[idx];
+	if (!ring)
+		return -1;
+
+	int file_fd = job_open_upload(&jobs, filename, idx);
+	if (file_fd < 0)
+	{
+		shm_ring_close_write(ring);
+		return -2;
+	}
+
+	struct stat st;
+	if (fstat(file_fd, &st) < 0)
+	{
+		close(file_fd);
+		shm_ring_close_write(ring);
+		return -2;
+	}
+
+	uint64_t offset, len;
+	job_range(&jobs, idx, st.st_size, &offset, &len);
+	progress_total(&prog, idx, len);
+
+	off_t sent = 0;
+	uint32_t sum = 0;
+	while(sent < len)
+	{
+		void* data;
+		size_t space = shm_ring_write_reserve(ring, &data);
+		if (!space)
+		{
+			close(file_fd);
+			return -4;
+		}
+		if (space > len - sent)
+			space = len - sent;
+
+		ssize_t read_len = pread(file_fd, data, space, offset + sent);
+		if (!read_len) break;
+		if (read_len < 0)
+		{
+			close(file_fd);
+			shm_ring_close_write(ring);
+			return -3;
+		}
+		if (use_checksum)
+			sum = crc32c_update(sum, data, read_len);
+		shm_ring_write_commit(ring, read_len);
+		sent += read_len;
+		progress_add(&prog, idx, read_len);
+	}
+
+	close(file_fd);
+	// 다 넣었으면 서버가 확인하도록 CRC32C 를 뒤에 붙이고, 파일이 줄어서 못 넣었으면 그대로 닫아서 잘린 것을 알립니다.
+	if (use_checksum && sent >= len && shm_ring_write(ring, &sum, CRC32C_SIZE) < 0)
+	{
+		shm_ring_close_write(ring);
+		return -4;
+	}
+	shm_ring_close_write(ring);
+
+	if (shm_ring_wait_drained(ring) < 0)
+		return -5;
+
+	return 1;
+}
+
+char* flag_to_state(int flag)
+{
+	if (flag == 0)
+		return "In progress..";
+	else if(flag < 0)
+	{
+		switch(flag)
+		{
+			case -1:
+				return "Fail to get shared memory..";
+			case -2:
+				return "Fail to open file..";
+			case -3:
+				return "Fail to read..";
+			case -4:
+				return "Fail to write..";
+			case -5:
+				return "Fail to drain shared memory..";
+			case -8:
+				return "Checksum mismatch..";
+		}
+		return "Fail to process file..";
+	}
+	return "Success!";
+}
+
+void draw_state(progress* p, int final)
+{
+	job_draw(&jobs, p, flag_to_state, final);
+}
+
+char* get_last_filename(char* directory)
+{
+	char* filename = directory, *temp;
+	while((temp = strchr(filename, '/')))
+		filename = temp+1;
+	return filename;
+}
+
+// 요청 MESSAGE QUEUE 로 모아둔 요청 프레임들을 보냅니다.
+struct request_sender
+{
+	int qid;
+	struct msg_buf* msg;
+};
+
+int send_requests(void* ctx, const char* buf, size_t len)
+{
+	struct request_sender* sender = (struct request_sender*)ctx;
+	return msgsnd(sender->qid, sender->msg, len, 0);
+}
+
+// 작업 i 의 링을 만들고 요청을 채웁니다. 묶음의 이름은 batch_name 에 만듭니다.
+int job_request(int i, req_view* v, char* batch_name)
+{
+	int file_idx = i / stripe_cnt;
+	char* filename = job_path(&jobs, i, batch_name);
+
+	// 공유 메모리 링 생성
+	shm_rings[i] = shm_ring_create(shm_names[i], SHM_RING_CAPACITY);
+	if (!shm_rings[i])
+		return -1;
+
+	struct stat st;
+	memset(v, 0, sizeof(req_view));
+	v->flags = (file_idx < upload_cnt? REQ_FLAG_UPLOAD: 0) | (use_checksum? REQ_FLAG_CHECKSUM: 0);
+	v->request_id = i;
+	v->stripe_idx = i % stripe_cnt;
+	v->stripe_cnt = stripe_cnt;
+	if (file_idx < upload_cnt && stat(filename, &st) == 0)
+		v->filesize = st.st_size;
+	v->name = get_last_filename(filename);
+	v->name_len = strlen(v->name);
+	v->key = shm_names[i];
+	v->key_len = strlen(shm_names[i]);
+	if (i >= jobs.batch_base)
+		job_batch_request(&jobs, i, v);
+	return 0;
+}
+
+// 워커가 작업을 시작할 때 그 작업의 요청 하나만 보냅니다.
+int send_job_request(int idx)
+{
+	struct msg_buf buffer;
+	char batch_name[32];
+	req_view v;
+	if (job_request(idx, &v, batch_name) < 0)
+		return -1;
+
+	buffer.mtype = getpid();
+	struct request_sender sender = { request_qid, &buffer };
+	req_writer writer;
+	req_writer_init(&writer, buffer.message, MSG_BUFFER_SZ, send_requests, &sender);
+	if (req_writer_add(&writer, &v) < 0 || req_writer_flush(&writer) < 0)
+		return -4;
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		puts("usage: client_shm [checksum] [batch] [json] [stripe N] [threads N] ([upload|download] [filepath|filepath,..] )*");
+		return 1;
+	}
+
+	signal(SIGINT, signal_handler);
+	signal(SIGABRT, signal_handler);
+	signal(SIGHUP, signal_handler);
+
+	// 파일 경로 처리
+	interpret_input(argc, argv, &upload_cnt, &upload_path, &download_cnt, &download_path, &download_path_parent);
+
+	if (job_table_init(&jobs, upload_cnt, upload_path, download_cnt, download_path, stripe_cnt, use_batch) < 0)
+	{
+		perror("fail to pack small files..");
+		job_table_destroy(&jobs);
+		interpreted_input_cleanup();
+		return 1;
+	}
+
+	int cnt = upload_cnt + download_cnt;
+	int job_cnt = shm_cnt = job_table_count(&jobs);
+	struct msg_buf buffer;
+	memset(&buffer, 0, sizeof(struct msg_buf));
+	buffer.mtype = getpid();
+
+	if (progress_mode < 0)
+		progress_mode = progress_default_mode();
+	progress_init(&prog, job_cnt, progress_mode);
+	result_flag = prog.results;
+
+	// 공유 메모리 이름 할당
+	shm_names = (char**)malloc(shm_cnt * sizeof(char*));
+	shm_rings = (shm_ring**)malloc(shm_cnt * sizeof(shm_ring*));
+	for (int i = 0; i < shm_cnt; i++)
+	{
+		char name[64];
+		sprintf(name, "/ftipc_%d_%d", getpid(), i);
+		shm_names[i] = strdup(name);
+		shm_rings[i] = NULL;
+	}
+
+	if (cnt > 0)
+	{
+		// 서버에서 요청 MSGQ 이 생성된 전제하에 단순히 열기만 합니다.
+		request_qid = msgget(REQ_SHM_KEY, REQ_MPQ_PERM);
+		if (request_qid < 0)
+		{
+			perror("cannot open request message queue..");
+			goto cleanup;
+		}
+
+		printf("GET MSG Q: %x:%d\n", REQ_SHM_KEY, request_qid);
+
+		// 작업마다 워커가 있으면 요청을 모두 모아서 먼저 보내고, 작업이 더 많으면 워커가 시작할 때 보냅니다.
+		if (worker_cnt <= 0)
+			worker_cnt = work_pool_default_workers();
+		if (worker_cnt > job_cnt)
+			worker_cnt = job_cnt;
+		lazy_request = job_cnt > worker_cnt;
+
+		// 요청이 메세지 하나에 다 들어가지 않으면 여러 메세지로 나누어 보냅니다.
+		struct request_sender sender = { request_qid, &buffer };
+		req_writer writer;
+		req_writer_init(&writer, buffer.message, MSG_BUFFER_SZ, send_requests, &sender);
+
+		// CLI 레벨에서 들어온 데이터에 따라서 공유 메모리와 여러 것들을 초기화합니다.
+		for (int i = 0; i < job_cnt; i++)
+		{
+			// 묶음에 들어간 파일은 묶음 작업의 결과를 따릅니다.
+			if (job_batched(&jobs, i))
+			{
+				progress_done(&prog, i, 1);
+				continue;
+			}
+			if (lazy_request)
+				continue;
+
+			char batch_name[32];
+			req_view v;
+			if (job_request(i, &v, batch_name) < 0)
+			{
+				perror("cannot make shared memory..");
+				goto cleanup;
+			}
+
+			// request frame <- upload flag, request id, filesize, file name, shm name
+			if (req_writer_add(&writer, &v) < 0)
+			{
+				fprintf(stderr, "Fail to send request(%s)..\n", v.name);
+				goto cleanup;
+			}
+		}
+
+		// 남은 요청을 보냅니다.
+		if (req_writer_flush(&writer) < 0)
+		{
+			perror("fail to send request message..");
+			goto cleanup;
+		}
+
+		// 대기 작업 수를 작업 수로 잡아서 제출하는 main 은 잠들지 않습니다.
+		if (work_pool_init(&pool, worker_cnt, job_cnt, WORK_POOL_WAIT) < 0)
+		{
+			perror("fail to start workers..");
+			goto cleanup;
+		}
+		for (int i = 0; i < job_cnt; i++)
+		{
+			if (job_batched(&jobs, i))
+				continue;
+			int *pi = (int*)malloc(sizeof(int));
+			*pi = i;
+			work_pool_submit(&pool, file_task, pi);
+		}
+
+		// 모든 작업이 끝날 때까지 잠들어 있다가 간격마다 진행 상황을 그립니다.
+		progress_wait(&prog, draw_state);
+		// 결과는 모두 기록되었고, 워커들이 자원을 놓고 끝날 때까지 기다립니다.
+		work_pool_shutdown(&pool);
+
+		// 처리 끝 난 후 출력, JSON 모드에서는 끝난 파일들을 이미 출력했습니다.
+		for (int i = 0; prog.mode != PROGRESS_JSON && i < cnt; i++)
+		{
+			char* filename;
+
+			if (i < upload_cnt)
+				filename = upload_path[i];
+			else
+				filename = download_path[i-upload_cnt];
+
+			printf("%d. %4s, %4s, %4s\n",
+					i,
+					(i < upload_cnt? "upload  ": "download"),
+					filename,
+					job_file_result(&jobs, result_flag, i) == 1? "success!": "fail..");
+		}
+	}
+
+cleanup:
+	progress_destroy(&prog);
+	result_flag = NULL;
+
+	cleanup_shm();
+	job_table_destroy(&jobs);
+	interpreted_input_cleanup();
+
+	return 0;
+}
+
+// 파라미터 정보 정리
+int interpreted_input_cleanup()
+{
+	SAFE_FREE_PTR_ARRAY(upload_path, upload_cnt);
+	SAFE_FREE_PTR_ARRAY(download_path, download_cnt);
+	SAFE_FREE(download_path_parent);
+
+	return 0;
+}
+
+// 업로드 / 다운로드에 따라서 인자들을 원하는 메모리 레이아웃으로 매핑
+int interpret_input(int argc, char** argv, int* upload_cnt_ref, char*** upload_path_ref, int* download_cnt_ref, char*** download_path_ref, char** download_path_parent_ref)
+{
+	char* buffer;
+	int state = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		char* item = argv[i];
+		switch(state)
+		{
+			case 0:
+				if (strcmp(argv[i], "upload") == 0)
+					state = 1;
+				else if (strcmp(argv[i], "download") == 0)
+					state = 2;
+				else if (strcmp(argv[i], "dpath") == 0)
+					state = 3;
+				else if (strcmp(argv[i], "json") == 0)
+					progress_mode = PROGRESS_JSON;
+				else if (strcmp(argv[i], "batch") == 0)
+					use_batch = 1;
+				else if (strcmp(argv[i], "checksum") == 0)
+					use_checksum = 1;
+				else if (strcmp(argv[i], "stripe") == 0)
+					state = 4;
+				else if (strcmp(argv[i], "threads") == 0)
+					state = 5;
+				else
+				{
+					fprintf(stderr, "Argument%d:%s is not behaviour..", i, argv[i]);
+					exit(1);
+				}
+				break;
+			case 1:
+				{
+					// 파일 목록은 얼마든지 길 수 있으므로 복사해서 자릅니다.
+					buffer = strdup(item);
+					
+					char* token = strtok(buffer, ",");
+					int fd;
+
+					while(token != NULL)
+					{
+						if (*upload_path_ref == NULL)
+						{
+							*upload_path_ref = (char**)malloc(sizeof(char*));
+							(*upload_path_ref)[0] = (char*)malloc(sizeof(char)*(strlen(token)+1));
+							strcpy((*upload_path_ref[0]), token);
+							(*upload_path_ref)[0][strlen(token)] = '\0';
+							*upload_cnt_ref = 1;
+						}
+						else
+						{
+							*upload_path_ref = (char**)realloc(*upload_path_ref, sizeof(char*)*++(*upload_cnt_ref));
+							(*upload_path_ref)[*upload_cnt_ref-1] = (char*)malloc(sizeof(char)*(strlen(token)+1));
+							strcpy((*upload_path_ref)[*upload_cnt_ref-1], token);
+							(*upload_path_ref)[*upload_cnt_ref-1][strlen(token)] = '\0';
+						}
+						token = strtok(NULL, ",");
+					}
+					free(buffer);
+					state = 0;
+				}
+				break;
+			case 2:
+				{
+					// 파일 목록은 얼마든지 길 수 있으므로 복사해서 자릅니다.
+					buffer = strdup(item);
+					
+					char* token = strtok(buffer, ",");
+					int fd;
+
+					while(token != NULL)
+					{
+						if (*download_path_ref == NULL)
+						{
+							*download_path_ref = (char**)malloc(sizeof(char*));
+							(*download_path_ref)[0] = (char*)malloc(sizeof(char)*(strlen(token)+1));
+							strcpy((*download_path_ref[0]), token);
+							(*download_path_ref)[0][strlen(token)] = '\0';
+							*download_cnt_ref = 1;
+						}
+						else
+						{
+							*download_path_ref = (char**)realloc(*download_path_ref, sizeof(char*)*++(*download_cnt_ref));
+							(*download_path_ref)[*download_cnt_ref-1] = (char*)malloc(sizeof(char)*(strlen(token)+1));
+							strcpy((*download_path_ref)[*download_cnt_ref-1], token);
+							(*download_path_ref)[*download_cnt_ref-1][strlen(token)] = '\0';
+						}
+						token = strtok(NULL, ",");
+					}
+					free(buffer);
+					state = 0;
+				}
+				break;
+			case 3:
+				{
+					int len = strlen(argv[i]);
+					*download_path_parent_ref = (char*)malloc(sizeof(char)*(len+1));
+					strcpy(*download_path_parent_ref, argv[i]);
+					(*download_path_parent_ref)[strlen(*download_path_parent_ref)] = '\0';
+					state = 0;
+				}
+				break;
+			case 4:
+				stripe_cnt = atoi(item);
+				if (stripe_cnt < 1 || stripe_cnt > REQ_STRIPE_MAX)
+				{
+					fprintf(stderr, "stripe count must be 1..%d\n", REQ_STRIPE_MAX);
+					exit(1);
+				}
+				state = 0;
+				break;
+			case 5:
+				worker_cnt = atoi(item);
+				if (worker_cnt < 1)
+				{
+					fprintf(stderr, "thread count must be at least 1\n");
+					exit(1);
+				}
+				state = 0;
+				break;
+		}
+
+	}
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+	crc32c.c
+	전송하는 데이터의 CRC32C(Castagnoli) 를 구하는 함수입니다.
+	보내는 쪽과 받는 쪽이 데이터를 옮기면서 같이 구하므로, 데이터를 다시 읽지 않고 캐시에 있을 때 계산합니다.
+	splice 경로만은 데이터가 사용자 공간을 거치지 않으므로 페이지 캐시를 매핑해서 한번 더 읽습니다(file_map_crc32c).
+	그 비용이 splice 와 공유 메모리의 복사를 줄인 이득을 거의 없애므로, 클라이언트가 checksum 인자로 요청할 때만 구합니다.
+	x86-64 에서 SSE4.2 를 지원하면 crc32 명령어를 쓰고, 큰 구간은 세 부분으로 나누어 동시에 구한 뒤 합칩니다.
+	crc32 명령어는 매 사이클 하나씩 시작할 수 있지만 결과는 3 사이클 뒤에 나오므로, 서로 의존하지 않는 셋을 섞어야 다 씁니다.
+	나눈 부분들은 뒤에 오는 길이만큼 0 을 이어붙인 값으로 옮겨서 합치며, 그 연산은 처음에 표로 만들어 둡니다.
+	명령어가 없으면 slicing-by-8 표로 8바이트씩 구합니다.
+	checksum 전송의 데이터는 모두 지나가므로 디버그 빌드(-O0)에서도 이 파일은 최적화해서 컴파일합니다.
+ */
+
+#pragma GCC optimize("O2")
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+// 반사된 CRC32C 다항식
+#define CRC32C_POLY		0x82f63b78
+
+// 세 부분으로 나누어 구할 때 한 부분의 길이, 큰 구간과 작은 구간 두 가지입니다.
+#define CRC32C_LONG		8192
+#define CRC32C_SHORT	256
+
+static uint32_t crc_table[8][256];
+static uint32_t (*crc_kernel)(uint32_t crc, const unsigned char* p, size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc_sw(uint32_t crc, const unsigned char* p, size_t len)
+{
+	while (len && ((uintptr_t)p & 7))
+	{
+		crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len >= 8)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		v ^= crc;
+		crc = crc_table[7][v & 0xff] ^ crc_table[6][(v >> 8) & 0xff] ^
+			crc_table[5][(v >> 16) & 0xff] ^ crc_table[4][(v >> 24) & 0xff] ^
+			crc_table[3][(v >> 32) & 0xff] ^ crc_table[2][(v >> 40) & 0xff] ^
+			crc_table[1][(v >> 48) & 0xff] ^ crc_table[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+#endif
+	while (len--)
+		crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+// crc 뒤에 CRC32C_LONG, CRC32C_SHORT 바이트의 0 을 이어붙인 값을 바이트마다 찾는 표
+static uint32_t shift_long[4][256], shift_short[4][256];
+
+static uint32_t gf2_times(const uint32_t* mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+	return sum;
+}
+
+static void gf2_square(uint32_t* square, const uint32_t* mat)
+{
+	for (int n = 0; n < 32; n++)
+		square[n] = gf2_times(mat, mat[n]);
+}
+
+// 0 바이트 len 개(2의 거듭제곱)를 이어붙이는 연산을 32x32 행렬로 만들고, 바이트마다 찾는 표로 펼칩니다.
+static void build_shift(uint32_t shift[4][256], size_t len)
+{
+	uint32_t even[32], odd[32];
+
+	// 0 비트 하나를 붙이는 연산에서 시작해서 제곱할 때마다 붙이는 길이가 두배가 됩니다.
+	odd[0] = CRC32C_POLY;
+	for (int n = 1; n < 32; n++)
+		odd[n] = 1u << (n - 1);
+	gf2_square(even, odd);
+	gf2_square(odd, even);
+
+	uint32_t* op = odd;
+	while (1)
+	{
+		gf2_square(even, odd);
+		op = even;
+		if (!(len >>= 1))
+			break;
+		gf2_square(odd, even);
+		op = odd;
+		if (!(len >>= 1))
+			break;
+	}
+
+	for (uint32_t n = 0; n < 256; n++)
+	{
+		shift[0][n] = gf2_times(op, n);
+		shift[1][n] = gf2_times(op, n << 8);
+		shift[2][n] = gf2_times(op, n << 16);
+		shift[3][n] = gf2_times(op, n << 24);
+	}
+}
+
+static inline __attribute__((always_inline)) uint32_t crc_shift(uint32_t shift[4][256], uint32_t crc)
+{
+	return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff] ^ shift[2][(crc >> 16) & 0xff] ^ shift[3][crc >> 24];
+}
+
+static inline __attribute__((always_inline)) uint64_t load64(const unsigned char* p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+// 길이 block 인 세 부분을 동시에 구해서 합칩니다.
+#define CRC_3WAY(block, shift)														\
+	while (len >= (block) * 3)														\
+	{																				\
+		uint64_t crc1 = 0, crc2 = 0;												\
+		const unsigned char* end = p + (block);										\
+		do																			\
+		{																			\
+			crc0 = _mm_crc32_u64(crc0, load64(p));									\
+			crc1 = _mm_crc32_u64(crc1, load64(p + (block)));						\
+			crc2 = _mm_crc32_u64(crc2, load64(p + (block) * 2));					\
+			p += 8;																	\
+		} while (p < end);															\
+		crc0 = crc_shift(shift, crc0) ^ crc1;										\
+		crc0 = crc_shift(shift, crc0) ^ crc2;										\
+		p += (block) * 2;															\
+		len -= (block) * 3;															\
+	}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_hw(uint32_t crc, const unsigned char* p, size_t len)
+{
+	uint64_t crc0 = crc;
+	while (len && ((uintptr_t)p & 7))
+	{
+		crc0 = _mm_crc32_u8(crc0, *p++);
+		len--;
+	}
+
+	CRC_3WAY(CRC32C_LONG, shift_long)
+	CRC_3WAY(CRC32C_SHORT, shift_short)
+
+	for (; len >= 8; p += 8, len -= 8)
+		crc0 = _mm_crc32_u64(crc0, load64(p));
+	while (len--)
+		crc0 = _mm_crc32_u8(crc0, *p++);
+	return crc0;
+}
+#endif
+
+static void crc_init()
+{
+	for (uint32_t n = 0; n < 256; n++)
+	{
+		uint32_t crc = n;
+		for (int k = 0; k < 8; k++)
+			crc = crc & 1? (crc >> 1) ^ CRC32C_POLY: crc >> 1;
+		crc_table[0][n] = crc;
+	}
+	for (uint32_t n = 0; n < 256; n++)
+		for (int k = 1; k < 8; k++)
+			crc_table[k][n] = crc_table[0][crc_table[k - 1][n] & 0xff] ^ (crc_table[k - 1][n] >> 8);
+
+	crc_kernel = crc_sw;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+	{
+		build_shift(shift_long, CRC32C_LONG);
+		build_shift(shift_short, CRC32C_SHORT);
+		crc_kernel = crc_hw;
+	}
+#endif
+}
+
+uint32_t crc32c_update(uint32_t crc, const void* data, size_t len)
+{
+	pthread_once(&crc_once, crc_init);
+	return ~crc_kernel(~crc, (const unsigned char*)data, len);
+}
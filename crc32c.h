@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// checksum 요청(REQ_FLAG_CHECKSUM)이면 전송마다 맡은 구간의 CRC32C 를 같이 보내서 받는 쪽이 확인합니다.
+// 조각(메세지)마다가 아니라 전송마다 하나이므로 메세지가 늘지 않고 4바이트만 더 보내지만,
+// 틀리면 어느 조각이 깨졌는지 모르므로 그 조각만 다시 보낼 수 없고 전송 전체가 -8 로 실패합니다.
+#define CRC32C_SIZE		sizeof(uint32_t)
+
+// crc 에 data 를 이어서 구한 값을 돌려줍니다. 처음에는 0 을 넘깁니다.
+uint32_t crc32c_update(uint32_t crc, const void* data, size_t len);
@@ -0,0 +1,210 @@
+/*
+	fifo_util.c
+	논블로킹 FIFO 입출력 함수들입니다.
+	FIFO 가 가득 차거나 비어 있으면 poll 로 커널에서 잠들기 때문에
+	남은 크기를 확인하며 스핀할 필요가 없습니다.
+	splice 함수들은 파일과 FIFO 사이를 커널 안에서만 옮겨서
+	데이터가 사용자 공간으로 올라오지 않습니다.
+	세션 프레임 함수들은 FIFO 하나에 여러 전송을 PIPE_BUF 이하의 프레임으로 섞어서 주고받습니다.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fifo_util.h"
+
+int fifo_set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// fd 가 events 상태가 될 때까지 잠듭니다.
+// 상대방이 닫은 경우에도 깨어나며, 그 처리는 호출한 쪽의 read/write 에 맡깁니다.
+int fifo_wait(int fd, short events)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = events;
+
+	while (poll(&pfd, 1, -1) < 0)
+		if (errno != EINTR)
+			return -1;
+	return 0;
+}
+
+// 버퍼를 모두 씁니다. FIFO 에 공간이 없으면 POLLOUT 까지 잠듭니다.
+int fifo_write_all(int fd, const void* buf, size_t len)
+{
+	const char* src = (const char*)buf;
+	while (len > 0)
+	{
+		ssize_t n = write(fd, src, len);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				if (fifo_wait(fd, POLLOUT) < 0)
+					return -1;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		src += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// 읽을 수 있는 만큼 읽습니다. 데이터가 없으면 POLLIN 까지 잠듭니다.
+// 쓰는 쪽이 모두 닫고 비었으면 0 을 돌려줍니다.
+ssize_t fifo_read_some(int fd, void* buf, size_t len)
+{
+	while(1)
+	{
+		ssize_t n = read(fd, buf, len);
+		if (n >= 0)
+			return n;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			if (fifo_wait(fd, POLLIN) < 0)
+				return -1;
+			continue;
+		}
+		if (errno != EINTR)
+			return -1;
+	}
+}
+
+// 정확히 len 만큼 읽습니다. 그 전에 끝나면 -1 을 돌려줍니다.
+int fifo_read_full(int fd, void* buf, size_t len)
+{
+	char* dst = (char*)buf;
+	while (len > 0)
+	{
+		ssize_t n = fifo_read_some(fd, dst, len);
+		if (n <= 0)
+			return -1;
+		dst += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// 세션 프레임 하나를 한번의 write 로 씁니다. 공간이 없으면 POLLOUT 까지 잠듭니다.
+int fifo_write_frame(int fd, uint32_t stream_id, int type, const void* payload, size_t len)
+{
+	char frame[FIFO_FRAME_MAX];
+	struct fifo_frame_hdr hdr;
+
+	if (len > FIFO_FRAME_PAYLOAD_MAX)
+		return -1;
+	hdr.stream_id = stream_id;
+	hdr.type = type;
+	hdr.len = len;
+	memcpy(frame, &hdr, sizeof(hdr));
+	if (len)
+		memcpy(frame + sizeof(hdr), payload, len);
+
+	return fifo_write_all(fd, frame, sizeof(hdr) + len);
+}
+
+// 세션 프레임 하나를 읽습니다. payload 는 FIFO_FRAME_PAYLOAD_MAX 만큼 있어야 합니다.
+// 쓰는 쪽이 닫았거나 길이가 맞지 않으면 -1 을 돌려줍니다.
+int fifo_read_frame(int fd, struct fifo_frame_hdr* hdr, void* payload)
+{
+	if (fifo_read_full(fd, hdr, sizeof(*hdr)) < 0)
+		return -1;
+	if (hdr->len > FIFO_FRAME_PAYLOAD_MAX)
+		return -1;
+	return hdr->len? fifo_read_full(fd, payload, hdr->len): 0;
+}
+
+// FIFO 를 size 까지 늘려봅니다. 권한이 없으면 줄여가며 시도합니다.
+// 실제로 설정된 크기를 돌려줍니다.
+int fifo_grow(int fd, int size)
+{
+	int current = fcntl(fd, F_GETPIPE_SZ);
+	for (; size > current; size >>= 1)
+	{
+		int result = fcntl(fd, F_SETPIPE_SZ, size);
+		if (result >= 0)
+			return result;
+	}
+	return current;
+}
+
+// 파일의 offset 부터 FIFO 로 len 만큼 splice 하고 offset 을 옮긴 만큼 늘립니다.
+// FIFO 가 가득 차면 POLLOUT 까지 잠듭니다.
+// 옮긴 크기를 돌려주며, 첫 splice 부터 지원되지 않으면 FIFO_SPLICE_UNSUPPORTED 입니다.
+ssize_t fifo_splice_from_file(int fifo, int file_fd, loff_t* offset, size_t len)
+{
+	size_t moved = 0;
+	while (moved < len)
+	{
+		size_t chunk = len - moved;
+		if (chunk > INT_MAX)
+			chunk = INT_MAX;
+
+		ssize_t n = splice(file_fd, offset, fifo, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+		if (n < 0)
+		{
+			if (errno == EAGAIN)
+			{
+				if (fifo_wait(fifo, POLLOUT) < 0)
+					return -1;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			if (!moved && (errno == EINVAL || errno == ENOSYS))
+				return FIFO_SPLICE_UNSUPPORTED;
+			return -1;
+		}
+		if (!n) break;
+		moved += n;
+	}
+	return moved;
+}
+
+// FIFO 에서 파일의 offset 으로 len 만큼 splice 하고 offset 을 옮긴 만큼 늘립니다.
+// FIFO 가 비어 있으면 POLLIN 까지 잠들고, 쓰는 쪽이 닫으면 그때까지 옮긴 크기를 돌려줍니다.
+ssize_t fifo_splice_to_file(int file_fd, loff_t* offset, int fifo, size_t len)
+{
+	size_t moved = 0;
+	while (moved < len)
+	{
+		size_t chunk = len - moved;
+		if (chunk > INT_MAX)
+			chunk = INT_MAX;
+
+		ssize_t n = splice(fifo, NULL, file_fd, offset, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+		if (n < 0)
+		{
+			if (errno == EAGAIN)
+			{
+				if (fifo_wait(fifo, POLLIN) < 0)
+					return -1;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			if (!moved && (errno == EINVAL || errno == ENOSYS))
+				return FIFO_SPLICE_UNSUPPORTED;
+			return -1;
+		}
+		if (!n) break;
+		moved += n;
+	}
+	return moved;
+}
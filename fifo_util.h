@@ -0,0 +1,44 @@
+#pragma once
+
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// F_SETPIPE_SZ 로 늘려볼 FIFO 크기
+#define FIFO_PIPE_SZ		(1 << 20)
+
+// splice 를 쓸 수 없는 fd 인 경우 돌려주는 값
+#define FIFO_SPLICE_UNSUPPORTED	-2
+
+int fifo_set_nonblock(int fd);
+int fifo_wait(int fd, short events);
+int fifo_write_all(int fd, const void* buf, size_t len);
+ssize_t fifo_read_some(int fd, void* buf, size_t len);
+int fifo_read_full(int fd, void* buf, size_t len);
+
+int fifo_grow(int fd, int size);
+ssize_t fifo_splice_from_file(int fifo, int file_fd, loff_t* offset, size_t len);
+ssize_t fifo_splice_to_file(int file_fd, loff_t* offset, int fifo, size_t len);
+
+// 세션 FIFO 에 여러 전송이 섞여서 오가는 프레임의 종류
+#define FIFO_FRAME_REQUEST	1	// 요청 프레임(request_proto) 하나
+#define FIFO_FRAME_SIZE		2	// 다운로드할 파일 전체 크기, int64_t
+#define FIFO_FRAME_DATA		3
+#define FIFO_FRAME_END		4	// 스트림의 끝, 보낸 구간의 CRC32C 를 담고, 업로드는 서버가 다 썼다는 응답으로 빈 채로 돌아옵니다.
+#define FIFO_FRAME_FAIL		5	// 서버의 결과 코드, int32_t
+
+// 프레임 하나는 PIPE_BUF 를 넘지 않으므로, 논블로킹 FIFO 에 여러 쓰레드가 써도
+// 한번에 통째로 들어가거나 EAGAIN 이 되어서 서로 섞이지 않습니다.
+#define FIFO_FRAME_MAX		PIPE_BUF
+
+struct fifo_frame_hdr
+{
+	uint32_t stream_id;
+	uint16_t type;
+	uint16_t len;
+};
+
+#define FIFO_FRAME_PAYLOAD_MAX	(FIFO_FRAME_MAX - (int)sizeof(struct fifo_frame_hdr))
+
+int fifo_write_frame(int fd, uint32_t stream_id, int type, const void* payload, size_t len);
+int fifo_read_frame(int fd, struct fifo_frame_hdr* hdr, void* payload);
@@ -0,0 +1,258 @@
+/*
+	file_cache.c
+	서버가 다운로드할 파일들을 열어둔 채로 나누어 쓰는 캐시입니다.
+	같은 파일을 여러 클라이언트가 받으면 요청마다 열고 매핑하지 않고, 처음 연 요청의 fd 와 매핑을 참조 수를 세어서 같이 씁니다.
+	두번째 요청부터는 stat 한번으로 파일이 바뀌지 않았는지만 보고 바로 보내므로, 많은 클라이언트가 받아도 디스크가 아니라 메모리에서 나갑니다.
+	캐시에 넣은 파일은 전체를 미리 읽어두라고 알려줍니다.
+	캐시는 파일 크기의 합과 항목 수로 제한하며, 넘치면 아무도 쓰지 않는 항목을 오래된 것부터 닫습니다.
+	파일이 바뀌면(inode, 크기, 수정 시각) 다음 요청에서 새로 열고, 옛 항목은 쓰던 요청이 모두 놓으면 닫습니다.
+	항목 수가 적으므로 목록을 그대로 훑어서 찾습니다.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "file_cache.h"
+#include "metrics.h"
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static file_cache_entry *lru_head, *lru_tail;
+static size_t cache_limit = FILE_CACHE_BYTES, cache_bytes;
+static int cache_cnt;
+static unsigned long hit_cnt, miss_cnt, evict_cnt;
+
+// 캐시에 넣을 수 있는 파일 크기의 합을 정합니다. 0 이면 캐시하지 않고 요청마다 엽니다.
+void file_cache_init(size_t max_bytes)
+{
+	pthread_mutex_lock(&cache_lock);
+	cache_limit = max_bytes;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static int same_file(const file_cache_entry* e, const struct stat* st)
+{
+	return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size &&
+		e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void lru_unlink(file_cache_entry* e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		lru_head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		lru_tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void lru_push_front(file_cache_entry* e)
+{
+	e->prev = NULL;
+	e->next = lru_head;
+	if (lru_head)
+		lru_head->prev = e;
+	else
+		lru_tail = e;
+	lru_head = e;
+}
+
+static void entry_free(file_cache_entry* e)
+{
+	file_map_close(&e->map);
+	close(e->fd);
+	free(e->path);
+	free(e);
+}
+
+// 목록에서만 뺍니다. 닫는 것은 잠금 밖에서 합니다.
+static void uncache(file_cache_entry* e)
+{
+	lru_unlink(e);
+	e->cached = 0;
+	cache_bytes -= e->size;
+	cache_cnt--;
+}
+
+// 넘치는 만큼 아무도 쓰지 않는 항목을 오래된 것부터 빼서, 닫을 항목들을 next 로 이어서 돌려줍니다.
+static file_cache_entry* evict()
+{
+	file_cache_entry *freed = NULL, *prev;
+	for (file_cache_entry* e = lru_tail; e && (cache_bytes > cache_limit || cache_cnt > FILE_CACHE_ENTRIES); e = prev)
+	{
+		prev = e->prev;
+		if (e->refcnt)
+			continue;
+		uncache(e);
+		evict_cnt++;
+		e->next = freed;
+		freed = e;
+	}
+	return freed;
+}
+
+static void free_list(file_cache_entry* e)
+{
+	while (e)
+	{
+		file_cache_entry* next = e->next;
+		entry_free(e);
+		e = next;
+	}
+}
+
+// path 의 항목을 찾습니다. 같은 경로지만 파일이 바뀌었으면 목록에서 빼고,
+// 아무도 쓰지 않으면 *stale 로 넘겨서 닫게 합니다.
+static file_cache_entry* lookup(const char* path, const struct stat* st, file_cache_entry** stale)
+{
+	for (file_cache_entry* e = lru_head; e; e = e->next)
+	{
+		if (strcmp(e->path, path))
+			continue;
+		if (same_file(e, st))
+			return e;
+
+		uncache(e);
+		if (!e->refcnt)
+			*stale = e;
+		return NULL;
+	}
+	return NULL;
+}
+
+// path 의 파일을 열어둔 항목을 돌려줍니다. 다 쓰면 file_cache_put 으로 놓아야 합니다.
+// 열 수 없으면 NULL 입니다.
+file_cache_entry* file_cache_get(const char* path)
+{
+	struct stat st;
+	file_cache_entry *e, *stale = NULL;
+
+	if (stat(path, &st) == 0)
+	{
+		pthread_mutex_lock(&cache_lock);
+		e = lookup(path, &st, &stale);
+		if (e)
+		{
+			e->refcnt++;
+			lru_unlink(e);
+			lru_push_front(e);
+			hit_cnt++;
+		}
+		pthread_mutex_unlock(&cache_lock);
+
+		if (stale)
+			entry_free(stale);
+		if (e)
+			return e;
+	}
+
+	// 없으면 새로 엽니다. 그 사이에 파일이 바뀔 수 있으므로 연 fd 의 fstat 을 기준으로 삼습니다.
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || !(e = (file_cache_entry*)calloc(1, sizeof(file_cache_entry))))
+	{
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	e->path = strdup(path);
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	e->size = st.st_size;
+	e->mtime = st.st_mtim;
+	e->fd = fd;
+	e->refcnt = 1;
+	// 매핑할 수 없는 파일이면 fd 에서 pread 로 읽습니다.
+	file_map_open(&e->map, fd, 0, e->size);
+
+	// 같은 파일을 다른 쓰레드가 먼저 넣었으면 그것을 씁니다.
+	file_cache_entry *found, *freed = NULL;
+	stale = NULL;
+	pthread_mutex_lock(&cache_lock);
+	miss_cnt++;
+	if ((found = lookup(path, &st, &stale)))
+		found->refcnt++;
+	else if (cache_limit && (size_t)e->size <= cache_limit)
+	{
+		e->cached = 1;
+		lru_push_front(e);
+		cache_bytes += e->size;
+		cache_cnt++;
+		freed = evict();
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	free_list(freed);
+	if (stale)
+		entry_free(stale);
+	if (found)
+	{
+		entry_free(e);
+		return found;
+	}
+
+	// 캐시에 남길 파일은 다음 요청들을 위해 전체를 미리 읽어둡니다.
+	if (e->cached)
+		file_map_willneed(&e->map, 0, e->size);
+	return e;
+}
+
+void file_cache_put(file_cache_entry* e)
+{
+	pthread_mutex_lock(&cache_lock);
+	int drop = --e->refcnt == 0 && !e->cached;
+	// 쓰던 항목 때문에 넘쳐 있던 만큼을 이제 정리합니다.
+	file_cache_entry* freed = evict();
+	pthread_mutex_unlock(&cache_lock);
+
+	free_list(freed);
+	if (drop)
+		entry_free(e);
+}
+
+// 이 요청이 읽을 구간의 앞부분을 미리 읽어두라고 알려줍니다.
+void file_cache_advise(file_cache_entry* e, off_t offset, off_t len)
+{
+	if (len > FILE_MAP_WILLNEED)
+		len = FILE_MAP_WILLNEED;
+	if (e->map.base)
+		file_map_willneed(&e->map, offset, len);
+	else if (len > 0)
+		posix_fadvise(e->fd, offset, len, POSIX_FADV_WILLNEED);
+}
+
+// 파일의 offset 부터 len 만큼 dst 로 읽습니다. 매핑이 있으면 매핑에서 복사하고, 없으면 pread 입니다.
+// 복사한 크기를 돌려주며, 그 사이에 파일이 줄어들었으면 -1 입니다.
+ssize_t file_cache_read(file_cache_entry* e, void* dst, off_t offset, size_t len)
+{
+	if (e->map.base)
+		return file_map_copy(&e->map, dst, offset, len) < 0? -1: (ssize_t)len;
+	return pread(e->fd, dst, len, offset);
+}
+
+void file_cache_write_metrics(FILE* out)
+{
+	pthread_mutex_lock(&cache_lock);
+	unsigned long hits = hit_cnt, misses = miss_cnt, evictions = evict_cnt;
+	size_t bytes = cache_bytes;
+	int entries = cache_cnt;
+	pthread_mutex_unlock(&cache_lock);
+
+	metrics_header(out, "ipc_file_cache_hits_total", "counter", "Downloads that reused an open file from the cache.");
+	metrics_value(out, "ipc_file_cache_hits_total", NULL, hits);
+	metrics_header(out, "ipc_file_cache_misses_total", "counter", "Downloads that had to open the file.");
+	metrics_value(out, "ipc_file_cache_misses_total", NULL, misses);
+	metrics_header(out, "ipc_file_cache_evictions_total", "counter", "Idle files closed to stay within the cache limit.");
+	metrics_value(out, "ipc_file_cache_evictions_total", NULL, evictions);
+	metrics_header(out, "ipc_file_cache_entries", "gauge", "Files held open by the cache.");
+	metrics_value(out, "ipc_file_cache_entries", NULL, entries);
+	metrics_header(out, "ipc_file_cache_bytes", "gauge", "Total size of the files held by the cache.");
+	metrics_value(out, "ipc_file_cache_bytes", NULL, bytes);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "file_map.h"
+
+// 캐시에 매핑해 둘 수 있는 파일 크기의 합과 항목 수의 기본값
+// 이보다 큰 파일은 캐시에 넣지 않고 그 요청에서만 씁니다.
+#define FILE_CACHE_BYTES	(256L * 1024 * 1024)
+#define FILE_CACHE_ENTRIES	64
+
+// 다운로드할 파일 하나입니다. 같은 파일을 받는 요청들은 같은 항목의 fd 와 매핑을 나누어 씁니다.
+// 경로, inode, 크기, 수정 시각이 모두 같아야 같은 파일로 봅니다.
+// fd 는 splice 나 pread 에서 항상 위치를 주고 쓰므로 여러 쓰레드가 같이 써도 됩니다.
+typedef struct file_cache_entry
+{
+	// 최근에 쓴 순서의 목록, 앞쪽이 최근입니다.
+	struct file_cache_entry *prev, *next;
+	char* path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	int fd;
+	// 파일 전체의 매핑, 빈 파일이거나 매핑할 수 없으면 map.base 가 NULL 입니다.
+	file_map map;
+	int refcnt;
+	// 캐시 목록에 들어 있는지, 아니면 마지막 사용자가 놓을 때 지울 항목인지입니다.
+	int cached;
+} file_cache_entry;
+
+void file_cache_init(size_t max_bytes);
+file_cache_entry* file_cache_get(const char* path);
+void file_cache_put(file_cache_entry* e);
+void file_cache_advise(file_cache_entry* e, off_t offset, off_t len);
+ssize_t file_cache_read(file_cache_entry* e, void* dst, off_t offset, size_t len);
+void file_cache_write_metrics(FILE* out);
@@ -0,0 +1,135 @@
+/*
+	file_map.c
+	서버가 다운로드할 파일을 mmap 으로 읽는 함수들입니다.
+	맡은 구간을 한번에 매핑하고 순차 접근과 앞부분을 미리 읽으라는 힌트를 주므로,
+	조각마다 read 를 부르지 않고 커널의 페이지 캐시에서 바로 가져갑니다.
+	여러 클라이언트가 같은 파일을 받아도 같은 페이지 캐시를 나누어 씁니다.
+	매핑한 뒤에 파일이 줄어들면 접근할 때 SIGBUS 가 오므로, file_map_copy 는 그 경우를 잡아서 실패로 돌려줍니다.
+ */
+
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "file_map.h"
+#include "crc32c.h"
+
+// 복사하는 동안만 걸어두는 쓰레드별 복귀 지점
+static _Thread_local sigjmp_buf* copy_guard;
+static pthread_once_t sigbus_once = PTHREAD_ONCE_INIT;
+
+static void on_sigbus(int signal)
+{
+	if (copy_guard)
+		siglongjmp(*copy_guard, 1);
+	// 매핑을 복사하던 중이 아니면 원래대로 죽습니다.
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGBUS, &sa, NULL);
+	raise(SIGBUS);
+}
+
+static void install_sigbus()
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_sigbus;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGBUS, &sa, NULL);
+}
+
+// fd 의 [offset, offset + len) 을 매핑합니다. len 이 0 이면 매핑하지 않습니다.
+int file_map_open(file_map* m, int fd, off_t offset, size_t len)
+{
+	memset(m, 0, sizeof(file_map));
+	if (!len)
+		return 0;
+
+	pthread_once(&sigbus_once, install_sigbus);
+
+	long page = sysconf(_SC_PAGESIZE);
+	off_t start = offset / page * page;
+	m->map_len = len + (offset - start);
+	m->base = mmap(NULL, m->map_len, PROT_READ, MAP_SHARED, fd, start);
+	if (m->base == MAP_FAILED)
+	{
+		m->base = NULL;
+		return -1;
+	}
+	m->data = (const char*)m->base + (offset - start);
+	m->len = len;
+
+	// 앞에서부터 한번씩만 읽으므로 커널이 크게 미리 읽고, 읽은 페이지는 먼저 내보내도 됩니다.
+	posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+	posix_madvise(m->base, m->map_len, POSIX_MADV_SEQUENTIAL);
+	file_map_willneed(m, 0, len < FILE_MAP_WILLNEED? len: FILE_MAP_WILLNEED);
+	return 0;
+}
+
+// 매핑의 [off, off + len) 을 미리 읽어두라고 알려줍니다. madvise 는 페이지에 맞춘 주소를 받습니다.
+void file_map_willneed(const file_map* m, size_t off, size_t len)
+{
+	if (!m->base || off >= m->len)
+		return;
+	if (len > m->len - off)
+		len = m->len - off;
+
+	long page = sysconf(_SC_PAGESIZE);
+	size_t start = (m->data - (const char*)m->base) + off;
+	size_t aligned = start / page * page;
+	posix_madvise((char*)m->base + aligned, len + (start - aligned), POSIX_MADV_WILLNEED);
+}
+
+// SIGBUS 로 빠져나온 뒤에 부릅니다. 시그널 마스크를 저장하면 sigsetjmp 를 부를 때마다
+// 시스템 콜이 생기므로 저장하지 않고, 핸들러에서 막힌 채로 나온 SIGBUS 만 다시 풉니다.
+static void recover_sigbus()
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGBUS);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	copy_guard = NULL;
+}
+
+// 매핑의 off 부터 len 만큼 dst 로 복사합니다. 그 사이에 파일이 줄어들었으면 -1 입니다.
+int file_map_copy(const file_map* m, void* dst, size_t off, size_t len)
+{
+	sigjmp_buf env;
+	if (sigsetjmp(env, 0))
+	{
+		recover_sigbus();
+		return -1;
+	}
+	copy_guard = &env;
+	memcpy(dst, m->data + off, len);
+	copy_guard = NULL;
+	return 0;
+}
+
+// 매핑의 off 부터 len 만큼의 CRC32C 를 *crc 에 이어서 구합니다. 그 사이에 파일이 줄어들었으면 -1 입니다.
+// splice 로 옮겨서 사용자 공간을 거치지 않은 데이터를 페이지 캐시에서 바로 확인할 때 씁니다.
+int file_map_crc32c(const file_map* m, size_t off, size_t len, uint32_t* crc)
+{
+	sigjmp_buf env;
+	if (sigsetjmp(env, 0))
+	{
+		recover_sigbus();
+		return -1;
+	}
+	copy_guard = &env;
+	*crc = crc32c_update(*crc, m->data + off, len);
+	copy_guard = NULL;
+	return 0;
+}
+
+void file_map_close(file_map* m)
+{
+	if (m->base)
+		munmap(m->base, m->map_len);
+	memset(m, 0, sizeof(file_map));
+}
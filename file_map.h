@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// 매핑한 뒤 미리 읽어두라고 알려주는 앞부분의 크기
+#define FILE_MAP_WILLNEED	(4 * 1024 * 1024)
+
+// 다운로드할 파일의 한 구간을 읽기 전용으로 매핑한 것입니다.
+// data 는 구간의 시작, base 는 페이지에 맞춘 실제 매핑의 시작입니다.
+typedef struct file_map
+{
+	void* base;
+	size_t map_len;
+	const char* data;
+	size_t len;
+} file_map;
+
+int file_map_open(file_map* m, int fd, off_t offset, size_t len);
+void file_map_willneed(const file_map* m, size_t off, size_t len);
+int file_map_copy(const file_map* m, void* dst, size_t off, size_t len);
+int file_map_crc32c(const file_map* m, size_t off, size_t len, uint32_t* crc);
+void file_map_close(file_map* m);
@@ -0,0 +1,176 @@
+/*
+	file_writer.c
+	서버가 받은 업로드를 파일에 쓰는 함수들입니다.
+	file_writer_prepare 는 파일을 최종 크기로 맞추고 맡은 구간의 블록을 fallocate 로 미리 잡아서,
+	파일이 조금씩 늘어나며 조각나지 않게 하고 디스크가 모자라면 받기 전에 실패하게 합니다.
+	file_writer 는 작은 조각들을 FILE_WRITER_BUF 만큼 모아서 정렬된 pwrite 한번으로 씁니다.
+	O_DIRECT 를 켜면 정렬된 가운데 부분은 페이지 캐시를 거치지 않고 쓰고, 정렬되지 않은 앞뒤만 일반 쓰기로 씁니다.
+	파일 시스템이 O_DIRECT 를 받지 않으면(tmpfs 등) 일반 쓰기로 돌아갑니다.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "file_writer.h"
+
+#define ALIGN_DOWN(v)	((v) / FILE_WRITER_ALIGN * FILE_WRITER_ALIGN)
+#define ALIGN_UP(v)		ALIGN_DOWN((v) + FILE_WRITER_ALIGN - 1)
+
+// 다른 조각이 이미 쓴 내용을 지우지 않도록 O_TRUNC 대신 최종 크기로 맞추고,
+// 이 요청이 맡은 구간만 미리 잡습니다. fallocate 를 받지 않는 파일 시스템이면 크기만 맞춥니다.
+int file_writer_prepare(int fd, off_t filesize, off_t offset, off_t len)
+{
+	if (ftruncate(fd, filesize) < 0)
+		return -1;
+	if (len > 0 && fallocate(fd, 0, offset, len) < 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+		return -1;
+	return 0;
+}
+
+int file_writer_init(file_writer* w, int fd, off_t offset, int direct)
+{
+	memset(w, 0, sizeof(file_writer));
+	if (posix_memalign((void**)&w->buf, FILE_WRITER_ALIGN, FILE_WRITER_BUF))
+	{
+		w->buf = NULL;
+		return -1;
+	}
+	w->fd = fd;
+	w->base = ALIGN_DOWN(offset);
+	w->start = w->end = offset - w->base;
+	w->direct = direct;
+	return 0;
+}
+
+static int set_direct(file_writer* w, int on)
+{
+	if (w->direct_on == on)
+		return 0;
+	int flags = fcntl(w->fd, F_GETFL);
+	if (flags < 0 || fcntl(w->fd, F_SETFL, on? flags | O_DIRECT: flags & ~O_DIRECT) < 0)
+		return -1;
+	w->direct_on = on;
+	return 0;
+}
+
+// buf 의 [from, to) 를 씁니다. 정렬된 구간이고 O_DIRECT 를 쓰기로 했으면 O_DIRECT 로 씁니다.
+static int write_span(file_writer* w, size_t from, size_t to)
+{
+	if (from == to)
+		return 0;
+
+	int aligned = from % FILE_WRITER_ALIGN == 0 && to % FILE_WRITER_ALIGN == 0;
+	if (w->direct && set_direct(w, aligned) < 0)
+	{
+		// O_DIRECT 를 받지 않는 파일이면 이후로는 일반 쓰기만 합니다.
+		w->direct = 0;
+		set_direct(w, 0);
+	}
+
+	while (from < to)
+	{
+		ssize_t n = pwrite(w->fd, w->buf + from, to - from, w->base + from);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		from += n;
+	}
+	return 0;
+}
+
+// 모아둔 것을 씁니다. 앞의 정렬되지 않은 부분, 정렬된 가운데, final 이면 뒤에 남은 부분 순서입니다.
+// final 이 아니면 정렬되지 않은 끝은 다음 조각들과 합쳐서 쓰도록 남깁니다.
+static int drain(file_writer* w, int final)
+{
+	size_t head = ALIGN_UP(w->start) < w->end? ALIGN_UP(w->start): w->end;
+	size_t body = ALIGN_DOWN(w->end) > head? ALIGN_DOWN(w->end): head;
+
+	if (write_span(w, w->start, head) < 0 || write_span(w, head, body) < 0)
+		return -1;
+	w->start = body;
+	if (final)
+	{
+		if (write_span(w, w->start, w->end) < 0)
+			return -1;
+		w->start = w->end;
+	}
+
+	// 버퍼를 다 썼으면 다음 구간으로 넘어갑니다. 남은 끝은 정렬 단위 하나보다 작으므로 앞으로 옮깁니다.
+	if (w->end == FILE_WRITER_BUF || final)
+	{
+		size_t keep_from = ALIGN_DOWN(w->start);
+		memmove(w->buf, w->buf + keep_from, w->end - keep_from);
+		w->base += keep_from;
+		w->start -= keep_from;
+		w->end -= keep_from;
+	}
+	return 0;
+}
+
+// 버퍼의 빈 곳을 돌려줍니다. read 로 바로 받은 뒤 file_writer_commit 으로 받은 만큼 넘기면 복사가 없습니다.
+size_t file_writer_space(file_writer* w, char** ptr)
+{
+	*ptr = w->buf + w->end;
+	return FILE_WRITER_BUF - w->end;
+}
+
+int file_writer_commit(file_writer* w, size_t len)
+{
+	w->end += len;
+	if (w->end == FILE_WRITER_BUF)
+		return drain(w, 0);
+	return 0;
+}
+
+int file_writer_put(file_writer* w, const void* data, size_t len)
+{
+	const char* p = (const char*)data;
+	while (len > 0)
+	{
+		char* dst;
+		size_t n = file_writer_space(w, &dst);
+		if (n > len)
+			n = len;
+		memcpy(dst, p, n);
+		p += n;
+		len -= n;
+
+		if (file_writer_commit(w, n) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+// 남은 것을 모두 씁니다. 파일을 닫거나 읽기 전에 부릅니다.
+int file_writer_flush(file_writer* w)
+{
+	int result = drain(w, 1);
+	if (w->direct_on)
+		set_direct(w, 0);
+	return result;
+}
+
+// 다음에 쓸 위치를 offset 으로 옮깁니다. 이어지는 위치가 아니면 모아둔 것을 먼저 모두 씁니다.
+// 중복 제거 업로드처럼 받은 데이터가 구간의 여러 자리로 나뉘어 갈 때 씁니다.
+int file_writer_seek(file_writer* w, off_t offset)
+{
+	if (offset == w->base + (off_t)w->end)
+		return 0;
+	if (file_writer_flush(w) < 0)
+		return -1;
+	w->base = ALIGN_DOWN(offset);
+	w->start = w->end = offset - w->base;
+	return 0;
+}
+
+void file_writer_destroy(file_writer* w)
+{
+	free(w->buf);
+	w->buf = NULL;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// 받은 조각들을 모아서 한번에 쓰는 크기와 쓰기의 정렬 단위
+// O_DIRECT 는 메모리 주소, 파일 위치, 크기가 모두 FILE_WRITER_ALIGN 의 배수여야 합니다.
+#define FILE_WRITER_BUF		(256 * 1024)
+#define FILE_WRITER_ALIGN	4096
+
+// 파일의 한 구간에 앞에서부터 차례로 쓰는 버퍼입니다.
+// buf[0] 은 파일의 base 위치에 해당하고 base 는 항상 정렬되어 있으므로,
+// 버퍼 안의 위치와 파일 위치의 정렬이 같아서 가운데의 정렬된 부분은 그대로 O_DIRECT 로 쓸 수 있습니다.
+typedef struct file_writer
+{
+	int fd;
+	char* buf;
+	off_t base;
+	// buf 에서 아직 쓰지 않은 부분은 [start, end) 입니다.
+	size_t start, end;
+	// direct 는 O_DIRECT 를 쓰기로 했는지, direct_on 은 지금 fd 에 켜져 있는지입니다.
+	int direct, direct_on;
+} file_writer;
+
+int file_writer_prepare(int fd, off_t filesize, off_t offset, off_t len);
+
+int file_writer_init(file_writer* w, int fd, off_t offset, int direct);
+size_t file_writer_space(file_writer* w, char** ptr);
+int file_writer_commit(file_writer* w, size_t len);
+int file_writer_put(file_writer* w, const void* data, size_t len);
+int file_writer_flush(file_writer* w);
+int file_writer_seek(file_writer* w, off_t offset);
+void file_writer_destroy(file_writer* w);
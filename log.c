@@ -0,0 +1,235 @@
+/*
+	log.c
+	서버의 작업 쓰레드들이 stdout 의 lock 을 두고 다투지 않도록 기록을 모아서 쓰는 함수들입니다.
+	쓰레드는 처음 기록할 때 자기 링(log_ring)을 만들어 목록에 걸고, 그 뒤로는 lock 없이 링에 넣기만 합니다.
+	메세지는 넣는 쓰레드가 칸 안에서 바로 형식화하므로, 쓰는 쓰레드가 읽을 때 원래 문자열이 사라졌어도 괜찮습니다.
+	쓰는 쓰레드는 LOG_FLUSH_MS 마다 모든 링을 비워서 한번에 쓰고 fflush 합니다.
+	log_level 보다 낮은 단계의 기록은 매크로에서 바로 걸러지므로 형식화 비용도 들지 않습니다.
+	log_init 을 부르기 전에는 printf 처럼 바로 씁니다.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+
+int log_level = LOG_INFO;
+
+static int log_format = LOG_TEXT;
+static int started;
+
+// 링 목록과 링을 비우는 쪽은 이 lock 하나로 지킵니다. 넣는 쪽은 링을 처음 만들 때만 잡습니다.
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_ring* rings;
+static int next_ring_id;
+
+static pthread_key_t ring_key;
+static _Thread_local log_ring* my_ring;
+
+static const char* level_names[] = { "debug", "info", "warn", "error" };
+
+int log_parse_level(const char* name)
+{
+	for (int i = LOG_DEBUG; i <= LOG_ERROR; i++)
+		if (strcmp(name, level_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+// 쓰레드가 끝날 때 불립니다. 링은 쓰는 쓰레드가 남은 기록을 쓴 뒤 지웁니다.
+static void ring_release(void* p)
+{
+	atomic_store(&((log_ring*)p)->closed, 1);
+}
+
+static log_ring* ring_register()
+{
+	log_ring* r = (log_ring*)malloc(sizeof(log_ring));
+	if (!r)
+		return NULL;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->dropped, 0);
+	atomic_init(&r->closed, 0);
+
+	pthread_mutex_lock(&rings_lock);
+	r->id = next_ring_id++;
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&rings_lock);
+
+	pthread_setspecific(ring_key, r);
+	my_ring = r;
+	return r;
+}
+
+void log_write(int level, const char* fmt, ...)
+{
+	va_list ap;
+	if (!started)
+	{
+		va_start(ap, fmt);
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	log_ring* r = my_ring? my_ring: ring_register();
+	if (!r)
+		return;
+
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	if (head - tail >= LOG_RING_SLOTS)
+	{
+		atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	log_record* rec = &r->slots[head % LOG_RING_SLOTS];
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	rec->level = level;
+
+	va_start(ap, fmt);
+	int len = vsnprintf(rec->text, LOG_TEXT_MAX, fmt, ap);
+	va_end(ap);
+	rec->len = len < 0? 0: len >= LOG_TEXT_MAX? LOG_TEXT_MAX - 1: len;
+
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+static void write_json_string(const char* s, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+}
+
+static void write_record(const log_ring* r, const log_record* rec)
+{
+	const char* text = rec->text;
+	int len = rec->len;
+
+	if (log_format == LOG_TEXT)
+	{
+		fwrite(text, 1, len, stdout);
+		// 잘린 메세지는 줄바꿈이 없으므로 붙여줍니다.
+		if (!len || text[len - 1] != '\n')
+			putchar('\n');
+		return;
+	}
+
+	// JSON 에서는 사람이 보라고 붙인 ">> " 와 줄바꿈을 뺍니다.
+	if (len >= 3 && memcmp(text, ">> ", 3) == 0)
+	{
+		text += 3;
+		len -= 3;
+	}
+	while (len > 0 && text[len - 1] == '\n')
+		len--;
+
+	printf("{\"ts_ns\":%llu,\"level\":\"%s\",\"thread\":%d,\"msg\":\"", (unsigned long long)rec->ts_ns, level_names[rec->level], r->id);
+	write_json_string(text, len);
+	printf("\"}\n");
+}
+
+// 모든 링을 비워서 씁니다. 쓰는 쓰레드와 log_flush 가 같이 부를 수 있습니다.
+// 쓰레드 사이의 순서가 맞도록 링마다 지금 있는 기록까지만 정해두고, 시간이 가장 이른 것부터 골라 씁니다.
+static void drain()
+{
+	pthread_mutex_lock(&rings_lock);
+
+	// 닫혔는지를 먼저 봐야 닫기 전에 넣은 기록을 모두 쓰고 지웁니다.
+	for (log_ring* r = rings; r; r = r->next)
+	{
+		r->drain_closed = atomic_load(&r->closed);
+		r->drain_end = atomic_load_explicit(&r->head, memory_order_acquire);
+	}
+
+	while(1)
+	{
+		log_ring* first = NULL;
+		for (log_ring* r = rings; r; r = r->next)
+		{
+			uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+			if (tail != r->drain_end && (!first ||
+				r->slots[tail % LOG_RING_SLOTS].ts_ns < first->slots[atomic_load_explicit(&first->tail, memory_order_relaxed) % LOG_RING_SLOTS].ts_ns))
+				first = r;
+		}
+		if (!first)
+			break;
+
+		uint32_t tail = atomic_load_explicit(&first->tail, memory_order_relaxed);
+		write_record(first, &first->slots[tail % LOG_RING_SLOTS]);
+		atomic_store_explicit(&first->tail, tail + 1, memory_order_release);
+	}
+
+	log_ring** link = &rings;
+	while (*link)
+	{
+		log_ring* r = *link;
+		unsigned long dropped = atomic_exchange(&r->dropped, 0);
+		if (dropped)
+			printf(">> log: ring of thread %d was full, dropped %lu records\n", r->id, dropped);
+
+		if (r->drain_closed)
+		{
+			*link = r->next;
+			free(r);
+		}
+		else
+			link = &r->next;
+	}
+	fflush(stdout);
+	pthread_mutex_unlock(&rings_lock);
+}
+
+static void* writer_loop(void* p)
+{
+	struct timespec interval = { 0, LOG_FLUSH_MS * 1000000L };
+	while(1)
+	{
+		nanosleep(&interval, NULL);
+		drain();
+	}
+	return NULL;
+}
+
+// 남은 기록을 모두 씁니다. 끝나기 전에 다른 출력과 순서를 맞출 때 부릅니다.
+void log_flush()
+{
+	if (started)
+		drain();
+}
+
+int log_init(int level, int format)
+{
+	log_level = level;
+	log_format = format;
+
+	if (pthread_key_create(&ring_key, ring_release))
+		return -1;
+
+	pthread_t writer;
+	if (pthread_create(&writer, NULL, writer_loop, NULL))
+		return -1;
+	pthread_detach(writer);
+
+	started = 1;
+	// exit 로 끝나도 링에 남은 기록을 씁니다.
+	atexit(log_flush);
+	return 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// 기록의 단계, log_init 에 준 단계보다 낮은 기록은 형식화하지도 않고 버립니다.
+#define LOG_DEBUG		0
+#define LOG_INFO		1
+#define LOG_WARN		2
+#define LOG_ERROR		3
+
+// 출력 형식
+#define LOG_TEXT		0	// 메세지만 한 줄씩 씁니다. printf 로 쓰던 출력과 같습니다.
+#define LOG_JSON		1	// 시간, 단계, 쓰레드 번호, 메세지를 JSON 한 줄로 씁니다.
+
+// 쓰레드마다 가지는 링의 칸 수와 칸 하나에 담을 수 있는 메세지 길이
+#define LOG_RING_SLOTS	256
+#define LOG_TEXT_MAX	240
+// 쓰는 쓰레드가 링들을 비우는 간격
+#define LOG_FLUSH_MS	10
+
+typedef struct log_record
+{
+	uint64_t ts_ns;
+	int level;
+	int len;
+	char text[LOG_TEXT_MAX];
+} log_record;
+
+// 한 쓰레드만 넣고(head), 쓰는 쓰레드만 꺼내는(tail) 링입니다.
+// 링이 가득 차면 기다리지 않고 기록을 버린 뒤 그 수만 셉니다.
+typedef struct log_ring
+{
+	_Atomic uint32_t head, tail;
+	atomic_ulong dropped;
+	// 쓰레드가 끝나면 켜고, 쓰는 쓰레드가 남은 기록을 쓴 뒤 링을 지웁니다.
+	atomic_int closed;
+	int id;
+	struct log_ring* next;
+	// 쓰는 쪽이 한번 비울 때 정해두는 끝 위치와 닫힘 여부
+	uint32_t drain_end;
+	int drain_closed;
+	log_record slots[LOG_RING_SLOTS];
+} log_ring;
+
+extern int log_level;
+
+int log_parse_level(const char* name);
+int log_init(int level, int format);
+void log_write(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_flush();
+
+#define log_debug(...)	do { if (log_level <= LOG_DEBUG) log_write(LOG_DEBUG, __VA_ARGS__); } while (0)
+#define log_info(...)	do { if (log_level <= LOG_INFO) log_write(LOG_INFO, __VA_ARGS__); } while (0)
+#define log_warn(...)	do { if (log_level <= LOG_WARN) log_write(LOG_WARN, __VA_ARGS__); } while (0)
+#define log_error(...)	do { if (log_level <= LOG_ERROR) log_write(LOG_ERROR, __VA_ARGS__); } while (0)
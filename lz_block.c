@@ -0,0 +1,219 @@
+/*
+	lz_block.c
+	전송 중에 데이터를 압축하는 블록 압축기입니다. 외부 라이브러리 없이 LZ4 블록 형식을 그대로 씁니다.
+	블록은 시퀀스들로 이루어지며, 시퀀스 하나는 토큰(리터럴 길이 4비트, 매치 길이 4비트),
+	리터럴, 2바이트 매치 거리, 그리고 15 를 넘는 길이의 나머지 바이트들입니다. 마지막 시퀀스에는 매치가 없습니다.
+	압축은 4바이트 해시 표 하나로 가장 최근 위치만 찾는 빠른 방식이고,
+	매치를 오래 찾지 못하면 건너뛰는 간격을 늘려서 압축되지 않는 데이터는 빨리 지나갑니다.
+	모든 전송의 데이터가 지나가므로 디버그 빌드(-O0)에서도 이 파일은 최적화해서 컴파일합니다.
+ */
+
+#pragma GCC optimize("O2")
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz_block.h"
+
+#define LZ_MINMATCH			4
+// 블록의 마지막 LZ_LAST_LITERALS 바이트는 리터럴이고, 마지막 매치는 끝에서 LZ_MFLIMIT 바이트 앞에서 시작해야 합니다.
+#define LZ_LAST_LITERALS	5
+#define LZ_MFLIMIT			12
+#define LZ_HASH_LOG			12
+// 매치를 못 찾은 횟수가 2^LZ_SKIP_TRIGGER 번 쌓일 때마다 건너뛰는 간격이 1 늘어납니다.
+#define LZ_SKIP_TRIGGER		6
+
+static inline __attribute__((always_inline)) uint32_t read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline __attribute__((always_inline)) uint64_t read64(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+// 매치를 limit 까지 8바이트씩 비교해서 늘립니다. 다른 바이트는 XOR 의 가장 낮은 비트로 찾습니다.
+static inline __attribute__((always_inline)) const uint8_t* extend_match(const uint8_t* mp, const uint8_t* rp, const uint8_t* limit)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (mp + 8 <= limit)
+	{
+		uint64_t diff = read64(mp) ^ read64(rp);
+		if (diff)
+			return mp + (__builtin_ctzll(diff) >> 3);
+		mp += 8;
+		rp += 8;
+	}
+#endif
+	while (mp < limit && *mp == *rp)
+		mp++, rp++;
+	return mp;
+}
+
+static inline __attribute__((always_inline)) uint32_t hash32(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+// 15 이상인 길이의 나머지를 255 단위로 씁니다.
+static inline __attribute__((always_inline)) uint8_t* put_len(uint8_t* op, size_t n)
+{
+	for (; n >= 255; n -= 255)
+		*op++ = 255;
+	*op++ = (uint8_t)n;
+	return op;
+}
+
+static inline __attribute__((always_inline)) int get_len(const uint8_t** ip, const uint8_t* iend, size_t* n)
+{
+	uint8_t b;
+	do
+	{
+		if (*ip >= iend)
+			return -1;
+		b = *(*ip)++;
+		*n += b;
+	} while (b == 255);
+	return 0;
+}
+
+// src 의 len 바이트를 dst 에 압축하고 크기를 돌려줍니다.
+// 압축한 크기가 cap 을 넘으면 0 을 돌려주므로, cap 을 원래 크기보다 작게 주면 압축할 가치가 없는 블록을 걸러냅니다.
+int lz_compress(const void* src, size_t len, void* dst, size_t cap)
+{
+	const uint8_t *base = (const uint8_t*)src, *ip = base, *anchor = base;
+	const uint8_t *iend = base + len, *mflimit = iend - LZ_MFLIMIT, *matchlimit = iend - LZ_LAST_LITERALS;
+	uint8_t *op = (uint8_t*)dst, *oend = op + cap;
+	// 블록 안의 위치만 담으므로 16비트로 충분합니다. 0 으로 채운 칸은 확인에서 걸러집니다.
+	uint16_t table[1 << LZ_HASH_LOG];
+	size_t lit_len;
+
+	if (len > LZ_BLOCK_MAX)
+		return 0;
+	memset(table, 0, sizeof(table));
+
+	if (len >= LZ_MFLIMIT)
+	{
+		ip++;
+		while (ip < mflimit)
+		{
+			const uint8_t* ref;
+			unsigned search = 1 << LZ_SKIP_TRIGGER;
+			size_t step = 1;
+			while (1)
+			{
+				uint32_t h = hash32(read32(ip));
+				ref = base + table[h];
+				table[h] = (uint16_t)(ip - base);
+				if (ref < ip && read32(ref) == read32(ip))
+					break;
+				ip += step;
+				step = search++ >> LZ_SKIP_TRIGGER;
+				if (ip >= mflimit)
+					goto last_literals;
+			}
+
+			// 매치를 앞뒤로 늘립니다.
+			while (ip > anchor && ref > base && ip[-1] == ref[-1])
+				ip--, ref--;
+			const uint8_t* mp = extend_match(ip + LZ_MINMATCH, ref + LZ_MINMATCH, matchlimit);
+
+			lit_len = ip - anchor;
+			size_t match_len = mp - ip - LZ_MINMATCH;
+			// 시퀀스와 마지막 리터럴 토큰이 들어갈 자리가 있어야 합니다.
+			if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 + 1 + LZ_LAST_LITERALS)
+				return 0;
+
+			uint8_t* token = op++;
+			*token = (uint8_t)((lit_len >= 15? 15: lit_len) << 4);
+			if (lit_len >= 15)
+				op = put_len(op, lit_len - 15);
+			memcpy(op, anchor, lit_len);
+			op += lit_len;
+
+			size_t dist = ip - ref;
+			*op++ = (uint8_t)dist;
+			*op++ = (uint8_t)(dist >> 8);
+			*token |= (uint8_t)(match_len >= 15? 15: match_len);
+			if (match_len >= 15)
+				op = put_len(op, match_len - 15);
+
+			ip = anchor = mp;
+			// 매치 끝 바로 앞의 위치도 넣어두면 이어지는 반복을 더 잘 찾습니다.
+			if (ip < mflimit)
+				table[hash32(read32(ip - 2))] = (uint16_t)(ip - 2 - base);
+		}
+	}
+
+last_literals:
+	lit_len = iend - anchor;
+	if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len)
+		return 0;
+	*op++ = (uint8_t)((lit_len >= 15? 15: lit_len) << 4);
+	if (lit_len >= 15)
+		op = put_len(op, lit_len - 15);
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+	return op - (uint8_t*)dst;
+}
+
+// src 의 압축된 len 바이트를 dst 에 풀고 크기를 돌려줍니다.
+// 받은 데이터이므로 모든 길이와 거리를 확인하며, 형식이 맞지 않거나 cap 을 넘으면 -1 입니다.
+int lz_decompress(const void* src, size_t len, void* dst, size_t cap)
+{
+	const uint8_t *ip = (const uint8_t*)src, *iend = ip + len;
+	uint8_t *op = (uint8_t*)dst, *oend = op + cap;
+
+	while (ip < iend)
+	{
+		uint8_t token = *ip++;
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && get_len(&ip, iend, &lit_len) < 0)
+			return -1;
+		if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+			return -1;
+		// 짧은 리터럴은 앞뒤로 여유가 있으면 16바이트를 한번에 넘치게 복사합니다. 넘친 부분은 다음 복사가 덮어씁니다.
+		if (lit_len <= 16 && iend - ip >= 16 && oend - op >= 16)
+			memcpy(op, ip, 16);
+		else
+			memcpy(op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+
+		// 마지막 시퀀스에는 매치가 없습니다.
+		if (ip == iend)
+			break;
+		if (iend - ip < 2)
+			return -1;
+		size_t dist = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (!dist || dist > (size_t)(op - (uint8_t*)dst))
+			return -1;
+
+		size_t match_len = token & 15;
+		if (match_len == 15 && get_len(&ip, iend, &match_len) < 0)
+			return -1;
+		match_len += LZ_MINMATCH;
+		if (match_len > (size_t)(oend - op))
+			return -1;
+
+		// 거리가 8 이상이면 8바이트씩 옮겨도 아직 쓰지 않은 바이트를 읽지 않습니다.
+		// 거리가 길이보다 짧으면 방금 쓴 바이트를 다시 읽어야 하므로 앞에서부터 하나씩 옮깁니다.
+		const uint8_t* ref = op - dist;
+		if (dist >= 8 && (size_t)(oend - op) >= match_len + 8)
+			for (size_t n = 0; n < match_len; n += 8)
+				memcpy(op + n, ref + n, 8);
+		else if (dist >= match_len)
+			memcpy(op, ref, match_len);
+		else
+			for (size_t n = 0; n < match_len; n++)
+				op[n] = ref[n];
+		op += match_len;
+	}
+	return op - (uint8_t*)dst;
+}
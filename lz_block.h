@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+
+// 블록 하나의 최대 크기, 블록 안의 위치를 16비트로 찾으므로 64KB 를 넘을 수 없습니다.
+#define LZ_BLOCK_MAX		(64 * 1024)
+
+int lz_compress(const void* src, size_t len, void* dst, size_t cap);
+int lz_decompress(const void* src, size_t len, void* dst, size_t cap);
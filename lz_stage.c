@@ -0,0 +1,304 @@
+/*
+	lz_stage.c
+	전송 중에 데이터를 압축하고 푸는 파이프라인 단계입니다.
+	압축은 전송 쓰레드가 아닌 전송마다 하나씩 만드는 압축 쓰레드에서 하므로, 다음 블록을 압축하는 동안 앞 블록을 보냅니다.
+	두 쓰레드 사이에는 LZ_STAGE_SLOTS 개의 블록 링을 두고, 링이 가득 차거나 비면 조건 변수로 잠듭니다.
+	보낼 때는 파일에서 LZ_STAGE_BLOCK 씩 읽어 압축한 블록(헤더와 본문)을 전송 쓰레드가 메세지 크기로 나누어 보냅니다.
+	메세지 하나는 블록 하나의 일부만 담고, 블록의 첫 메세지는 항상 헤더로 시작합니다.
+	받을 때는 전송 쓰레드가 메세지들로 블록을 모아서 넘기고, 압축 쓰레드가 풀어서 파일에 씁니다.
+	압축해서 1/8 이상 줄지 않는 블록은 그대로 보내고, 그 뒤로는 압축해보지 않을 블록 수를 두배씩(LZ_STAGE_SKIP_MAX 까지) 늘립니다.
+	CRC32C 는 압축 쓰레드가 원래 데이터로 구하므로 압축과 상관없이 같은 값을 확인합니다.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "lz_stage.h"
+#include "crc32c.h"
+
+static atomic_ulong raw_total, wire_total, packed_blocks, stored_blocks;
+
+static lz_stage_slot* tail_slot(lz_stage* z)
+{
+	return &z->slots[(z->head - z->full + LZ_STAGE_SLOTS) % LZ_STAGE_SLOTS];
+}
+
+// 채우는 쪽이 빈 칸을 기다립니다. 비우는 쪽이 그만두었으면 NULL 입니다.
+static lz_stage_slot* wait_empty(lz_stage* z)
+{
+	pthread_mutex_lock(&z->lock);
+	while (z->full == LZ_STAGE_SLOTS && !z->stop)
+		pthread_cond_wait(&z->empty_cond, &z->lock);
+	lz_stage_slot* slot = z->stop? NULL: &z->slots[z->head];
+	pthread_mutex_unlock(&z->lock);
+	return slot;
+}
+
+static void publish(lz_stage* z)
+{
+	pthread_mutex_lock(&z->lock);
+	z->head = (z->head + 1) % LZ_STAGE_SLOTS;
+	z->full++;
+	pthread_cond_signal(&z->full_cond);
+	pthread_mutex_unlock(&z->lock);
+}
+
+// 비우는 쪽이 채워진 칸을 기다립니다. 채우는 쪽이 끝났고 남은 칸이 없으면 NULL 입니다.
+static lz_stage_slot* wait_full(lz_stage* z)
+{
+	pthread_mutex_lock(&z->lock);
+	while (!z->full && !z->done)
+		pthread_cond_wait(&z->full_cond, &z->lock);
+	lz_stage_slot* slot = z->full? tail_slot(z): NULL;
+	pthread_mutex_unlock(&z->lock);
+	return slot;
+}
+
+static void release(lz_stage* z)
+{
+	pthread_mutex_lock(&z->lock);
+	z->full--;
+	pthread_cond_signal(&z->empty_cond);
+	pthread_mutex_unlock(&z->lock);
+}
+
+static void set_header(char* frame, uint32_t raw_len, uint32_t body_len)
+{
+	memcpy(frame, &raw_len, sizeof(uint32_t));
+	memcpy(frame + sizeof(uint32_t), &body_len, sizeof(uint32_t));
+}
+
+// 보낼 때의 압축 쓰레드입니다. 구간을 블록으로 읽어 압축해서 링에 채웁니다.
+static void* encode_main(void* p)
+{
+	lz_stage* z = (lz_stage*)p;
+	int skip = 0, backoff = 1;
+
+	for (uint64_t pos = 0; pos < z->len;)
+	{
+		lz_stage_slot* slot = wait_empty(z);
+		if (!slot)
+			break;
+
+		size_t n = z->len - pos < LZ_STAGE_BLOCK? z->len - pos: LZ_STAGE_BLOCK;
+		if (z->io(z->ctx, slot->raw, z->offset + pos, n) != (ssize_t)n)
+		{
+			z->error = LZ_STAGE_EIO;
+			break;
+		}
+		z->sum = crc32c_update(z->sum, slot->raw, n);
+
+		int packed = 0;
+		if (skip)
+			skip--;
+		else if ((packed = lz_compress(slot->raw, n, slot->frame + LZ_STAGE_HDR, n - n / 8)) > 0)
+			backoff = 1;
+		else
+		{
+			skip = backoff;
+			backoff = backoff * 2 > LZ_STAGE_SKIP_MAX? LZ_STAGE_SKIP_MAX: backoff * 2;
+		}
+
+		if (packed > 0)
+		{
+			set_header(slot->frame, n, packed);
+			atomic_fetch_add(&packed_blocks, 1);
+		}
+		else
+		{
+			set_header(slot->frame, n | LZ_STAGE_STORED, n);
+			memcpy(slot->frame + LZ_STAGE_HDR, slot->raw, n);
+			atomic_fetch_add(&stored_blocks, 1);
+		}
+		slot->frame_len = LZ_STAGE_HDR + (packed > 0? packed: n);
+		z->raw_bytes += n;
+		z->wire_bytes += slot->frame_len;
+		pos += n;
+		publish(z);
+	}
+
+	pthread_mutex_lock(&z->lock);
+	z->done = 1;
+	pthread_cond_broadcast(&z->full_cond);
+	pthread_mutex_unlock(&z->lock);
+	return NULL;
+}
+
+// 받을 때의 압축 쓰레드입니다. 모인 블록을 풀어서 씁니다.
+// 실패한 뒤에도 전송 쓰레드가 막히지 않도록 남은 블록을 끝까지 비웁니다.
+static void* decode_main(void* p)
+{
+	lz_stage* z = (lz_stage*)p;
+	uint64_t pos = 0;
+	lz_stage_slot* slot;
+
+	while ((slot = wait_full(z)))
+	{
+		uint32_t raw_len, body_len;
+		memcpy(&raw_len, slot->frame, sizeof(uint32_t));
+		memcpy(&body_len, slot->frame + sizeof(uint32_t), sizeof(uint32_t));
+		const char* body = slot->frame + LZ_STAGE_HDR;
+		const char* data = body;
+		int stored = (raw_len & LZ_STAGE_STORED) != 0;
+		raw_len &= ~LZ_STAGE_STORED;
+
+		if (!z->error && !stored)
+		{
+			if (lz_decompress(body, body_len, slot->raw, LZ_STAGE_BLOCK) != (int)raw_len)
+				z->error = LZ_STAGE_EFORMAT;
+			data = slot->raw;
+		}
+		if (!z->error)
+		{
+			z->sum = crc32c_update(z->sum, data, raw_len);
+			if (z->io(z->ctx, (void*)data, z->offset + pos, raw_len) != (ssize_t)raw_len)
+				z->error = LZ_STAGE_EIO;
+		}
+		atomic_fetch_add(stored? &stored_blocks: &packed_blocks, 1);
+		z->raw_bytes += raw_len;
+		z->wire_bytes += slot->frame_len;
+		pos += raw_len;
+		release(z);
+	}
+	return NULL;
+}
+
+static void free_slots(lz_stage* z)
+{
+	for (int i = 0; i < LZ_STAGE_SLOTS; i++)
+	{
+		free(z->slots[i].raw);
+		free(z->slots[i].frame);
+	}
+}
+
+// 파일의 offset 부터 len 만큼을 압축해서 보내거나(LZ_STAGE_ENCODE) 받아서 풀어 쓰는(LZ_STAGE_DECODE) 단계를 시작합니다.
+// 압축 쓰레드는 io 로 원래 데이터를 읽거나 씁니다.
+int lz_stage_start(lz_stage* z, int mode, lz_stage_io io, void* ctx, off_t offset, uint64_t len)
+{
+	memset(z, 0, sizeof(lz_stage));
+	z->mode = mode;
+	z->io = io;
+	z->ctx = ctx;
+	z->offset = offset;
+	z->len = len;
+
+	for (int i = 0; i < LZ_STAGE_SLOTS; i++)
+		if (!(z->slots[i].raw = (char*)malloc(LZ_STAGE_BLOCK)) || !(z->slots[i].frame = (char*)malloc(LZ_STAGE_HDR + LZ_STAGE_BLOCK)))
+		{
+			free_slots(z);
+			return -1;
+		}
+
+	pthread_mutex_init(&z->lock, NULL);
+	pthread_cond_init(&z->full_cond, NULL);
+	pthread_cond_init(&z->empty_cond, NULL);
+	if (pthread_create(&z->thread, NULL, mode == LZ_STAGE_ENCODE? encode_main: decode_main, z) != 0)
+	{
+		pthread_cond_destroy(&z->empty_cond);
+		pthread_cond_destroy(&z->full_cond);
+		pthread_mutex_destroy(&z->lock);
+		free_slots(z);
+		return -1;
+	}
+	return 0;
+}
+
+// 보낼 때/ 다음 메세지에 담을 데이터를 msg 에 cap 까지 채우고 크기를 돌려줍니다.
+// cap 은 LZ_STAGE_HDR 보다 커야 합니다. 다 보냈으면 0, 압축 쓰레드가 실패했으면 -1 입니다.
+ssize_t lz_stage_emit(lz_stage* z, void* msg, size_t cap)
+{
+	if (!z->cur)
+	{
+		if (!(z->cur = wait_full(z)))
+			return z->error? -1: 0;
+		z->cur_pos = 0;
+	}
+
+	size_t n = z->cur->frame_len - z->cur_pos;
+	if (n > cap)
+		n = cap;
+	memcpy(msg, z->cur->frame + z->cur_pos, n);
+	z->cur_pos += n;
+	if (z->cur_pos == z->cur->frame_len)
+	{
+		z->cur = NULL;
+		release(z);
+	}
+	return n;
+}
+
+// 받을 때/ 받은 메세지 하나를 블록에 모읍니다. 블록이 다 모이면 압축 쓰레드에게 넘깁니다.
+// 헤더가 맞지 않거나, 메세지가 블록을 넘거나, 블록이 구간을 넘으면 -1 입니다.
+int lz_stage_feed(lz_stage* z, const void* msg, size_t len)
+{
+	const char* p = (const char*)msg;
+	if (!z->cur)
+	{
+		uint32_t raw_len, body_len;
+		if (len < LZ_STAGE_HDR)
+			return -1;
+		memcpy(&raw_len, p, sizeof(uint32_t));
+		memcpy(&body_len, p + sizeof(uint32_t), sizeof(uint32_t));
+		int stored = (raw_len & LZ_STAGE_STORED) != 0;
+		raw_len &= ~LZ_STAGE_STORED;
+		if (!raw_len || raw_len > LZ_STAGE_BLOCK || body_len > LZ_STAGE_BLOCK || (stored && body_len != raw_len) || raw_len > z->len - z->fed)
+			return -1;
+
+		if (!(z->cur = wait_empty(z)))
+			return -1;
+		z->cur->frame_len = LZ_STAGE_HDR + body_len;
+		z->cur->raw_len = raw_len;
+		z->cur_pos = 0;
+	}
+
+	if (len > z->cur->frame_len - z->cur_pos)
+		return -1;
+	memcpy(z->cur->frame + z->cur_pos, p, len);
+	z->cur_pos += len;
+	if (z->cur_pos == z->cur->frame_len)
+	{
+		z->fed += z->cur->raw_len;
+		z->cur = NULL;
+		publish(z);
+	}
+	return 0;
+}
+
+// 단계를 끝내고 압축 쓰레드를 기다립니다. 받을 때는 넘긴 블록을 모두 쓴 뒤에 돌아옵니다.
+// 실패가 없었으면 0 이고, z->sum 에 원래 데이터의 CRC32C 가 남습니다.
+int lz_stage_finish(lz_stage* z)
+{
+	pthread_mutex_lock(&z->lock);
+	if (z->mode == LZ_STAGE_ENCODE)
+	{
+		z->stop = 1;
+		pthread_cond_broadcast(&z->empty_cond);
+	}
+	else
+	{
+		z->done = 1;
+		pthread_cond_broadcast(&z->full_cond);
+	}
+	pthread_mutex_unlock(&z->lock);
+	pthread_join(z->thread, NULL);
+
+	pthread_cond_destroy(&z->empty_cond);
+	pthread_cond_destroy(&z->full_cond);
+	pthread_mutex_destroy(&z->lock);
+	free_slots(z);
+
+	atomic_fetch_add(&raw_total, z->raw_bytes);
+	atomic_fetch_add(&wire_total, z->wire_bytes);
+	return z->error;
+}
+
+// 서버의 metrics 에 쓰는 누적값입니다. 블록 수는 압축해서 보낸 것과 그대로 보낸 것입니다.
+void lz_stage_totals(unsigned long* raw, unsigned long* wire, unsigned long* packed, unsigned long* stored)
+{
+	*raw = atomic_load(&raw_total);
+	*wire = atomic_load(&wire_total);
+	*packed = atomic_load(&packed_blocks);
+	*stored = atomic_load(&stored_blocks);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "lz_block.h"
+
+// 압축 단계가 한번에 다루는 원래 데이터의 크기와, 전송 쓰레드와 압축 쓰레드 사이에 둘 블록 수
+#define LZ_STAGE_BLOCK		LZ_BLOCK_MAX
+#define LZ_STAGE_SLOTS		4
+// 블록 헤더, 원래 크기(맨 위 비트가 켜져 있으면 압축하지 않은 블록)와 뒤에 오는 본문의 크기입니다.
+#define LZ_STAGE_HDR		(2 * sizeof(uint32_t))
+#define LZ_STAGE_STORED		0x80000000u
+// 압축해서 1/8 이상 줄지 않으면 그대로 보내고, 그 뒤로 몇 블록은 압축해보지 않습니다.
+#define LZ_STAGE_SKIP_MAX	8
+
+#define LZ_STAGE_ENCODE		0
+#define LZ_STAGE_DECODE		1
+
+// lz_stage_finish 가 돌려주는 실패
+#define LZ_STAGE_EIO		-1	// 원본을 읽거나 풀어낸 데이터를 쓰지 못했습니다.
+#define LZ_STAGE_EFORMAT	-2	// 받은 블록의 형식이 맞지 않습니다.
+
+// 압축 쓰레드가 원래 데이터를 읽고 쓰는 함수입니다. 파일의 off 부터 len 만큼이고 옮긴 크기를 돌려줍니다.
+typedef ssize_t (*lz_stage_io)(void* ctx, void* buf, off_t off, size_t len);
+
+typedef struct lz_stage_slot
+{
+	// raw 는 원래 데이터, frame 은 헤더와 본문입니다.
+	char* raw;
+	char* frame;
+	size_t frame_len;
+	// 받을 때 헤더에 적힌 원래 크기
+	size_t raw_len;
+} lz_stage_slot;
+
+// 전송 쓰레드와 압축 쓰레드 사이의 블록 링입니다.
+// 보낼 때는 압축 쓰레드가 파일에서 읽어 압축한 블록을 채우고, 전송 쓰레드가 메세지로 나누어 보냅니다.
+// 받을 때는 전송 쓰레드가 메세지들로 블록을 모으고, 압축 쓰레드가 풀어서 씁니다.
+typedef struct lz_stage
+{
+	int mode;
+	lz_stage_io io;
+	void* ctx;
+	off_t offset;
+	uint64_t len;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t full_cond, empty_cond;
+	lz_stage_slot slots[LZ_STAGE_SLOTS];
+	// head 는 압축 쓰레드 쪽(보낼 때) 또는 전송 쓰레드 쪽(받을 때)이 채울 칸, full 은 채워진 칸 수입니다.
+	int head, full;
+	// done 은 채우는 쪽이 끝났다는 것, stop 은 비우는 쪽이 그만두었다는 것입니다.
+	int done, stop;
+	int error;
+
+	// 전송 쓰레드가 나누어 보내거나 모으고 있는 블록과 그 안의 위치
+	lz_stage_slot* cur;
+	size_t cur_pos;
+	// 받을 때 다 모아서 넘긴 블록들의 원래 크기 합
+	uint64_t fed;
+
+	// 압축 쓰레드가 원래 데이터로 구한 CRC32C 와, 원래/보낸 크기
+	uint32_t sum;
+	uint64_t raw_bytes, wire_bytes;
+} lz_stage;
+
+int lz_stage_start(lz_stage* z, int mode, lz_stage_io io, void* ctx, off_t offset, uint64_t len);
+ssize_t lz_stage_emit(lz_stage* z, void* msg, size_t cap);
+int lz_stage_feed(lz_stage* z, const void* msg, size_t len);
+int lz_stage_finish(lz_stage* z);
+void lz_stage_totals(unsigned long* raw, unsigned long* wire, unsigned long* packed, unsigned long* stored);
@@ -0,0 +1,261 @@
+/*
+	metrics.c
+	서버의 상태를 로컬 유닉스 도메인 소켓으로 보여주는 함수들입니다.
+	metrics_start 가 띄운 쓰레드가 소켓에서 연결을 받을 때마다 Prometheus 텍스트 형식으로
+	전송 누적값(xfer_stats.c)과 서버가 넘겨준 값들을 쓰고 연결을 닫습니다.
+	socat - UNIX-CONNECT:<경로> 처럼 연결만 하면 본문만 쓰고,
+	curl --unix-socket <경로> http://localhost/metrics 처럼 HTTP 로 물어보면 응답 헤더를 붙입니다.
+	부하를 주는 동안 값을 읽어도 전송 쓰레드들은 누적값의 lock 을 잠깐 기다리는 것 외에는 영향을 받지 않습니다.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "xfer_stats.h"
+
+static int listen_fd = -1;
+static char sock_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static char transport_name[32];
+static metrics_fn extra_fn;
+static uint64_t start_ns;
+
+void metrics_header(FILE* out, const char* name, const char* type, const char* help)
+{
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_value(FILE* out, const char* name, const char* labels, double value)
+{
+	fprintf(out, "%s{transport=\"%s\"%s%s} %.15g\n", name, transport_name, labels? ",": "", labels? labels: "", value);
+}
+
+// /proc/self/status 의 Threads 줄에서 프로세스의 쓰레드 수를 읽습니다.
+static int process_threads()
+{
+	char line[256];
+	int threads = 0;
+	FILE* fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return 0;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "Threads: %d", &threads) == 1)
+			break;
+	fclose(fp);
+	return threads;
+}
+
+// 방향마다 하나씩 쓰는 값들입니다.
+enum
+{
+	M_ACTIVE, M_IN_FLIGHT, M_MOVED, M_TRANSFERS, M_FAILED, M_WAIT, M_COPY, M_COUNT
+};
+
+static const struct
+{
+	const char* name;
+	const char* type;
+	const char* help;
+} totals_metrics[M_COUNT] =
+{
+	{ "ipc_transfers_active", "gauge", "Transfers in progress." },
+	{ "ipc_bytes_in_flight", "gauge", "Bytes moved so far by transfers still in progress." },
+	{ "ipc_bytes_total", "counter", "Bytes moved, including transfers still in progress." },
+	{ "ipc_transfers_total", "counter", "Finished transfers." },
+	{ "ipc_transfer_errors_total", "counter", "Finished transfers that failed." },
+	{ "ipc_wait_seconds_total", "counter", "Time finished transfers spent blocked on the channel." },
+	{ "ipc_copy_seconds_total", "counter", "Time finished transfers spent moving data." },
+};
+
+static double totals_value(const xfer_totals* t, int which)
+{
+	switch(which)
+	{
+		case M_ACTIVE:		return t->active;
+		case M_IN_FLIGHT:	return t->in_flight;
+		case M_MOVED:		return t->moved;
+		case M_TRANSFERS:	return t->transfers;
+		case M_FAILED:		return t->failed;
+		case M_WAIT:		return t->wait_ns / 1e9;
+		case M_COPY:		return t->copy_ns / 1e9;
+	}
+	return 0;
+}
+
+static void write_summary(FILE* out, const char* name, const char* help, const xfer_totals* t, size_t hist_off)
+{
+	static const char* dirs[2] = { "upload", "download" };
+	static const double quantiles[3] = { 0.5, 0.9, 0.99 };
+	char labels[128], metric[96];
+
+	metrics_header(out, name, "summary", help);
+	for (int d = 0; d < 2; d++)
+	{
+		const xfer_hist* h = (const xfer_hist*)((const char*)&t[d] + hist_off);
+		for (int q = 0; q < 3; q++)
+		{
+			sprintf(labels, "direction=\"%s\",quantile=\"%g\"", dirs[d], quantiles[q]);
+			metrics_value(out, name, labels, xfer_hist_percentile(h, quantiles[q] * 100) / 1e9);
+		}
+		sprintf(labels, "direction=\"%s\"", dirs[d]);
+		sprintf(metric, "%s_sum", name);
+		metrics_value(out, metric, labels, h->sum / 1e9);
+		sprintf(metric, "%s_count", name);
+		metrics_value(out, metric, labels, h->count);
+	}
+}
+
+static void render(FILE* out)
+{
+	static const char* dirs[2] = { "upload", "download" };
+	xfer_totals t[2];
+	char labels[64];
+
+	for (int d = 0; d < 2; d++)
+		xfer_totals_snapshot(d, &t[d]);
+
+	metrics_header(out, "ipc_uptime_seconds", "gauge", "Seconds since the server started.");
+	metrics_value(out, "ipc_uptime_seconds", NULL, (xfer_now_ns() - start_ns) / 1e9);
+	metrics_header(out, "ipc_threads", "gauge", "Threads in the server process.");
+	metrics_value(out, "ipc_threads", NULL, process_threads());
+
+	for (int m = 0; m < M_COUNT; m++)
+	{
+		metrics_header(out, totals_metrics[m].name, totals_metrics[m].type, totals_metrics[m].help);
+		for (int d = 0; d < 2; d++)
+		{
+			sprintf(labels, "direction=\"%s\"", dirs[d]);
+			metrics_value(out, totals_metrics[m].name, labels, totals_value(&t[d], m));
+		}
+	}
+
+	write_summary(out, "ipc_chunk_latency_seconds", "Time to send or receive one chunk.", t, offsetof(xfer_totals, chunk_hist));
+	write_summary(out, "ipc_transfer_duration_seconds", "Time from the start to the end of one transfer.", t, offsetof(xfer_totals, transfer_hist));
+
+	if (extra_fn)
+		extra_fn(out);
+}
+
+static int send_all(int fd, const char* buf, size_t len)
+{
+	while (len > 0)
+	{
+		// 읽는 쪽이 먼저 끊어도 SIGPIPE 로 서버가 죽지 않도록 합니다.
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void serve(int fd)
+{
+	// HTTP 요청이 오는지 잠깐 기다려봅니다. 아무것도 보내지 않으면 본문만 씁니다.
+	char request[1024];
+	int http = 0;
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	if (poll(&pfd, 1, METRICS_REQUEST_MS) > 0)
+	{
+		ssize_t n = read(fd, request, sizeof(request));
+		http = n >= 4 && memcmp(request, "GET ", 4) == 0;
+	}
+
+	char* body = NULL;
+	size_t len = 0;
+	FILE* out = open_memstream(&body, &len);
+	if (!out)
+		return;
+	render(out);
+	fclose(out);
+
+	if (http)
+	{
+		char header[128];
+		int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+		if (send_all(fd, header, header_len) < 0)
+		{
+			free(body);
+			return;
+		}
+	}
+	send_all(fd, body, len);
+	free(body);
+}
+
+static void* metrics_loop(void* p)
+{
+	while(1)
+	{
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("metrics: accept ");
+			break;
+		}
+		serve(fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+// path 에 소켓을 만들고 연결을 받는 쓰레드를 띄웁니다.
+// 지난번에 비정상 종료하며 남은 소켓 파일은 지우고 다시 만듭니다.
+int metrics_start(const char* path, const char* transport, metrics_fn extra)
+{
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		return -1;
+
+	unlink(path);
+	if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0)
+	{
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+
+	strcpy(sock_path, path);
+	snprintf(transport_name, sizeof(transport_name), "%s", transport);
+	extra_fn = extra;
+	start_ns = xfer_now_ns();
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, metrics_loop, NULL))
+	{
+		metrics_stop();
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+void metrics_stop()
+{
+	if (sock_path[0])
+		unlink(sock_path);
+	sock_path[0] = '\0';
+}
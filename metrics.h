@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdio.h>
+
+// 소켓 경로의 기본값, %s 에는 전송 방식의 이름이 들어갑니다.
+#define METRICS_PATH_FMT	"./metrics_%s.sock"
+// 연결한 쪽이 HTTP 요청을 보내는지 기다려보는 시간
+#define METRICS_REQUEST_MS	100
+
+// 서버마다 다른 값(큐 깊이, 워커 수 등)을 써주는 함수입니다. 연결마다 metrics 쓰레드에서 불립니다.
+typedef void (*metrics_fn)(FILE* out);
+
+int metrics_start(const char* path, const char* transport, metrics_fn extra);
+void metrics_stop();
+
+void metrics_header(FILE* out, const char* name, const char* type, const char* help);
+void metrics_value(FILE* out, const char* name, const char* labels, double value);
@@ -0,0 +1,179 @@
+/*
+	mp_util.c
+	MESSAGE QUEUE 로 파일 데이터를 옮길 때 쓰는 함수들입니다.
+	데이터 메세지 하나는 커널의 msgmax 까지 키울 수 있고, 요청마다 크기를 정합니다.
+	큐가 담을 수 있는 크기(msg_qbytes)는 권한이 있으면 IPC_SET 으로 늘립니다.
+	mp_sweep_chunk 는 이 호스트에서 어떤 메세지 크기가 가장 빠른지 직접 재어봅니다.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <pthread.h>
+
+#include "mp_util.h"
+
+static pthread_once_t msgmax_once = PTHREAD_ONCE_INIT;
+static int msgmax_value;
+
+static void read_msgmax()
+{
+	int value = 0;
+	FILE* fp = fopen("/proc/sys/kernel/msgmax", "r");
+	if (fp)
+	{
+		if (fscanf(fp, "%d", &value) != 1)
+			value = 0;
+		fclose(fp);
+	}
+	msgmax_value = value > 0? value: MP_MSGMAX_DEFAULT;
+}
+
+// 메세지 하나의 최대 크기입니다. 한번만 읽어둡니다.
+int mp_msgmax()
+{
+	pthread_once(&msgmax_once, read_msgmax);
+	return msgmax_value;
+}
+
+// 요청한 크기를 이 호스트에서 쓸 수 있는 크기로 맞춥니다. 0 이하이면 msgmax 입니다.
+int mp_chunk_size(int requested)
+{
+	int max = mp_msgmax();
+	if (requested <= 0 || requested > max)
+		return max;
+	if (requested < MP_CHUNK_MIN)
+		return max < MP_CHUNK_MIN? max: MP_CHUNK_MIN;
+	return requested;
+}
+
+struct mp_msg* mp_msg_alloc(int chunk)
+{
+	return (struct mp_msg*)malloc(sizeof(struct mp_msg) + chunk);
+}
+
+// 큐가 qbytes 만큼 담을 수 있도록 늘립니다.
+// msgmnb 보다 크게 늘리는 것은 권한이 있어야 하므로, 실패하면 원래 크기로 둡니다.
+// 실제로 적용된 크기를 돌려줍니다.
+size_t mp_grow_queue(int qid, size_t qbytes)
+{
+	struct msqid_ds ds;
+	if (msgctl(qid, IPC_STAT, &ds) < 0)
+		return 0;
+	if (ds.msg_qbytes >= qbytes)
+		return ds.msg_qbytes;
+
+	msglen_t old = ds.msg_qbytes;
+	ds.msg_qbytes = qbytes;
+	if (msgctl(qid, IPC_SET, &ds) < 0)
+		return old;
+	return qbytes;
+}
+
+struct sweep_reader
+{
+	int qid, chunk;
+	size_t total;
+};
+
+static void* sweep_read(void* p)
+{
+	struct sweep_reader* r = (struct sweep_reader*)p;
+	struct mp_msg* msg = mp_msg_alloc(r->chunk);
+	size_t received = 0;
+
+	while (received < r->total)
+	{
+		ssize_t n = msgrcv(r->qid, msg, r->chunk, 0, MSG_NOERROR);
+		if (n <= 0)
+			break;
+		received += n;
+	}
+
+	free(msg);
+	return NULL;
+}
+
+// MP_CHUNK_MIN 부터 msgmax 까지 메세지 크기를 두배씩 늘려가며,
+// 쓰레드 두개가 큐 하나로 total 바이트를 주고받는 시간을 잽니다.
+// 크기마다 처리량을 출력하고 가장 빠른 크기를 돌려줍니다. 큐를 만들거나 보내지 못하면 -1 입니다.
+int mp_sweep_chunk(size_t total, size_t qbytes)
+{
+	int max = mp_msgmax(), best = 0;
+	double best_rate = 0;
+
+	printf("msgmax=%d, %zu bytes per size\n", max, total);
+	int chunk = MP_CHUNK_MIN < max? MP_CHUNK_MIN: max;
+	while(1)
+	{
+		int qid = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
+		if (qid < 0)
+		{
+			perror("Fail to make sweep queue.. ");
+			return -1;
+		}
+		size_t applied = mp_grow_queue(qid, qbytes);
+
+		struct mp_msg* msg = mp_msg_alloc(chunk);
+		memset(msg->message, 0, chunk);
+		msg->mtype = 1;
+
+		struct sweep_reader reader = { qid, chunk, total };
+		pthread_t thread;
+		struct timespec tstart, tend;
+
+		clock_gettime(CLOCK_MONOTONIC, &tstart);
+		if (pthread_create(&thread, NULL, sweep_read, &reader))
+		{
+			perror("Fail to start sweep reader.. ");
+			msgctl(qid, IPC_RMID, NULL);
+			free(msg);
+			return -1;
+		}
+		int failed = 0;
+		for (size_t sent = 0; sent < total; sent += chunk)
+		{
+			size_t len = total - sent < (size_t)chunk? total - sent: (size_t)chunk;
+			if (msgsnd(qid, msg, len, 0) < 0)
+			{
+				perror("Fail to msgsnd on sweep.. ");
+				failed = 1;
+				break;
+			}
+		}
+		// 읽는 쓰레드는 나머지를 기다리며 막혀 있으므로, 큐를 지워서 msgrcv 가 EIDRM 으로 끝나게 합니다.
+		if (failed)
+		{
+			msgctl(qid, IPC_RMID, NULL);
+			pthread_join(thread, NULL);
+			free(msg);
+			return -1;
+		}
+		pthread_join(thread, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &tend);
+
+		msgctl(qid, IPC_RMID, NULL);
+		free(msg);
+
+		double sec = (tend.tv_sec - tstart.tv_sec) + (tend.tv_nsec - tstart.tv_nsec) / 1e9;
+		double rate = sec > 0? total / sec / (1024 * 1024): 0;
+		printf("chunk %6d: %9.1f MB/s (qbytes=%zu)\n", chunk, rate, applied);
+
+		if (rate > best_rate)
+		{
+			best_rate = rate;
+			best = chunk;
+		}
+		if (chunk == max)
+			break;
+		chunk = chunk * 2 < max? chunk * 2: max;
+	}
+
+	printf("best chunk: %d\n", best);
+	return best;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 데이터 메세지 하나의 크기에 대한 정의들
+// 요청에 크기가 없으면 커널의 msgmax 를 그대로 씁니다.
+#define MP_CHUNK_MIN		512
+#define MP_MSGMAX_DEFAULT	8192
+
+// 전송 큐가 한번에 담을 수 있도록 늘려볼 메세지 수
+#define MP_QUEUE_CHUNKS		16
+// 세션 큐에서 전송 하나가 쓰는 mtype 의 간격입니다. 전송 idx 의 메세지 종류 t 는 MP_STREAM_MTYPE(idx) + t 입니다.
+#define MP_MTYPE_STRIDE		8
+#define MP_STREAM_MTYPE(id)	(((long)(id) + 1) * MP_MTYPE_STRIDE)
+// 다운로드의 크기 헤더에 붙여서 서버가 압축해서 보낸다고 알려주는 값, 헤더는 파일 크기와 이 값입니다.
+#define MP_COMPRESS_LZ		1
+#define MP_SIZE_HDR_LZ		(sizeof(int64_t) + sizeof(uint32_t))
+// 메세지 크기마다 재어볼 데이터 크기
+#define MP_SWEEP_BYTES		(64 * 1024 * 1024)
+
+// 크기가 정해지지 않은 데이터 메세지입니다. mp_msg_alloc 으로 만듭니다.
+struct mp_msg
+{
+	long mtype;
+	char message[];
+};
+
+int mp_msgmax();
+int mp_chunk_size(int requested);
+struct mp_msg* mp_msg_alloc(int chunk);
+
+size_t mp_grow_queue(int qid, size_t qbytes);
+
+int mp_sweep_chunk(size_t total, size_t qbytes);
@@ -0,0 +1,240 @@
+/*
+	progress.c
+	클라이언트의 전송 진행 상황을 모으고 보여주는 함수들입니다.
+	작업 쓰레드는 옮긴 크기를 원자 변수에 더하고, 끝나면 결과를 lock 안에서 한번 기록합니다.
+	메인 쓰레드는 조건 변수에서 잠들어 있다가 PROGRESS_INTERVAL_MS 마다, 또는 마지막 작업이 끝나면 깨어나
+	화면을 다시 그립니다. 쉘을 띄워서 화면을 지우지 않고 ANSI 코드로 커서만 옮기며,
+	JSON 모드에서는 전체 처리량과 끝난 파일만 한 줄씩 출력합니다.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "progress.h"
+
+int progress_default_mode()
+{
+	return isatty(STDOUT_FILENO)? PROGRESS_ANSI: PROGRESS_QUIET;
+}
+
+int progress_init(progress* p, int job_cnt, int mode)
+{
+	memset(p, 0, sizeof(progress));
+	p->job_cnt = job_cnt;
+	p->mode = mode;
+	p->results = (int*)calloc(job_cnt > 0? job_cnt: 1, sizeof(int));
+	p->bytes = (_Atomic uint64_t*)calloc(job_cnt > 0? job_cnt: 1, sizeof(_Atomic uint64_t));
+	p->totals = (_Atomic uint64_t*)calloc(job_cnt > 0? job_cnt: 1, sizeof(_Atomic uint64_t));
+	if (!p->results || !p->bytes || !p->totals)
+		return -1;
+
+	// 시스템 시간이 바뀌어도 간격이 틀어지지 않도록 단조 시계로 기다립니다.
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&p->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&p->lock, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &p->start);
+	p->last = p->start;
+	return 0;
+}
+
+void progress_destroy(progress* p)
+{
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p->results);
+	free((void*)p->bytes);
+	free((void*)p->totals);
+	free(p->reported);
+	p->results = NULL;
+	p->bytes = p->totals = NULL;
+	p->reported = NULL;
+}
+
+void progress_add(progress* p, int idx, uint64_t bytes)
+{
+	atomic_fetch_add_explicit(&p->bytes[idx], bytes, memory_order_relaxed);
+}
+
+// 작업이 옮길 전체 크기입니다. 다운로드는 크기 헤더를 받은 뒤에 알 수 있습니다.
+void progress_total(progress* p, int idx, uint64_t total)
+{
+	atomic_store_explicit(&p->totals[idx], total, memory_order_relaxed);
+}
+
+uint64_t progress_bytes(progress* p, int idx)
+{
+	return atomic_load_explicit(&p->bytes[idx], memory_order_relaxed);
+}
+
+uint64_t progress_job_total(progress* p, int idx)
+{
+	return atomic_load_explicit(&p->totals[idx], memory_order_relaxed);
+}
+
+// 작업의 결과를 기록합니다. 먼저 기록된 결과가 있으면 바꾸지 않습니다.
+// 마지막 작업이 끝나면 메인 쓰레드를 깨웁니다.
+void progress_done(progress* p, int idx, int result)
+{
+	if (!result)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	if (!p->results[idx])
+	{
+		p->results[idx] = result;
+		if (++p->done == p->job_cnt)
+			pthread_cond_signal(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+static double elapsed(const struct timespec* from, const struct timespec* to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+// 모든 작업이 끝날 때까지 잠들어 있다가 간격마다 draw 를 불러줍니다.
+// draw 는 lock 을 잡은 채로 불리므로 results 를 그대로 읽어도 됩니다.
+void progress_wait(progress* p, void (*draw)(progress* p, int final))
+{
+	pthread_mutex_lock(&p->lock);
+	while (p->done < p->job_cnt)
+	{
+		draw(p, 0);
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += PROGRESS_INTERVAL_MS * 1000000L;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+
+		while (p->done < p->job_cnt)
+			if (pthread_cond_timedwait(&p->cond, &p->lock, &deadline))
+				break;
+	}
+	draw(p, 1);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void format_size(char* buf, double bytes)
+{
+	const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+	int unit = 0;
+	while (bytes >= 1024 && unit < 4)
+	{
+		bytes /= 1024;
+		unit++;
+	}
+	sprintf(buf, "%.1f %s", bytes, units[unit]);
+}
+
+static void render_ansi(progress* p, const progress_item* items, int n, uint64_t sum, uint64_t sum_total, double rate, double sec)
+{
+	char done_buf[32], total_buf[32], rate_buf[32];
+	int lines = 0;
+
+	// 지난번에 그린 줄들 위로 올라가서 덮어씁니다.
+	if (p->drawn_lines)
+		printf("\033[%dA", p->drawn_lines);
+
+	format_size(done_buf, sum);
+	format_size(total_buf, sum_total);
+	format_size(rate_buf, rate);
+	printf("\033[2K[%d/%d] %s / %s, %s/s\n", p->done, p->job_cnt, done_buf, total_buf, rate_buf);
+	lines++;
+
+	for (int i = 0; i < n && lines <= PROGRESS_ANSI_ROWS; i++)
+	{
+		if (items[i].result)
+			continue;
+		int percent = items[i].total? (int)(items[i].bytes * 100 / items[i].total): 0;
+		format_size(rate_buf, sec > 0? items[i].bytes / sec: 0);
+		printf("\033[2K%-8s %3d%% %10s/s  %s\n", items[i].kind, percent, rate_buf, items[i].name);
+		lines++;
+	}
+
+	// 이전보다 줄이 줄었으면 남은 줄을 지웁니다.
+	for (int i = lines; i < p->drawn_lines; i++)
+		printf("\033[2K\n");
+	if (p->drawn_lines > lines)
+		printf("\033[%dA", p->drawn_lines - lines);
+
+	p->drawn_lines = lines;
+}
+
+// 파일 이름에 따옴표나 제어 문자가 있어도 JSON 이 깨지지 않도록 씁니다.
+static void print_json_string(const char* str)
+{
+	putchar('"');
+	for (; *str; str++)
+	{
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+static void render_json(progress* p, const progress_item* items, int n, uint64_t sum, double rate, double sec, int final)
+{
+	if (p->item_cnt != n)
+	{
+		free(p->reported);
+		p->reported = (char*)calloc(n > 0? n: 1, 1);
+		p->item_cnt = n;
+	}
+
+	// 항목은 끝났을 때 한번만 출력합니다.
+	for (int i = 0; i < n; i++)
+	{
+		if (!items[i].result || p->reported[i])
+			continue;
+		p->reported[i] = 1;
+		printf("{\"t\":%.3f,\"kind\":\"%s\",\"name\":", sec, items[i].kind);
+		print_json_string(items[i].name);
+		printf(",\"result\":%d,\"state\":", items[i].result);
+		print_json_string(items[i].state);
+		printf(",\"bytes\":%llu,\"rate\":%.0f}\n", (unsigned long long)items[i].bytes, sec > 0? items[i].bytes / sec: 0);
+	}
+
+	printf("{\"t\":%.3f,\"done\":%d,\"jobs\":%d,\"bytes\":%llu,\"rate\":%.0f%s}\n",
+			sec, p->done, p->job_cnt, (unsigned long long)sum, rate, final? ",\"final\":true": "");
+}
+
+// 클라이언트가 만든 항목들로 화면을 그립니다. lock 을 잡은 draw 콜백 안에서 부릅니다.
+void progress_render(progress* p, const progress_item* items, int n, int final)
+{
+	if (p->mode == PROGRESS_QUIET)
+		return;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	uint64_t sum = 0, sum_total = 0;
+	for (int i = 0; i < n; i++)
+	{
+		sum += items[i].bytes;
+		sum_total += items[i].total;
+	}
+
+	double sec = elapsed(&p->start, &now), dt = elapsed(&p->last, &now);
+	double rate = final? (sec > 0? sum / sec: 0): (dt > 0? (sum - p->last_bytes) / dt: 0);
+	p->last = now;
+	p->last_bytes = sum;
+
+	if (p->mode == PROGRESS_ANSI)
+		render_ansi(p, items, n, sum, sum_total, rate, sec);
+	else
+		render_json(p, items, n, sum, rate, sec, final);
+	fflush(stdout);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+// 진행 상황을 보여주는 방식
+#define PROGRESS_QUIET		0	// 끝난 뒤의 결과만 출력합니다. 터미널이 아닐 때의 기본값입니다.
+#define PROGRESS_ANSI		1	// 터미널에서 제자리에 다시 그립니다.
+#define PROGRESS_JSON		2	// 한 줄에 JSON 하나씩 출력합니다.
+
+// 다시 그리는 간격과, ANSI 모드에서 보여줄 진행 중인 파일 수
+#define PROGRESS_INTERVAL_MS	200
+#define PROGRESS_ANSI_ROWS		16
+
+// 화면에 보여줄 항목(파일) 하나입니다. 작업 여러개를 묶어서 클라이언트가 만들어줍니다.
+typedef struct progress_item
+{
+	const char* name;
+	const char* kind;
+	const char* state;
+	// 0 이면 진행 중, 양수면 성공, 음수면 실패입니다.
+	int result;
+	uint64_t bytes, total;
+} progress_item;
+
+// 작업들의 진행 상황입니다.
+// 작업 쓰레드들은 옮긴 크기를 원자적으로 더하기만 하고, 결과는 lock 안에서 한번만 기록합니다.
+// 메인 쓰레드는 progress_wait 에서 잠들어 있다가 주기적으로, 또는 모든 작업이 끝나면 깨어나 그립니다.
+typedef struct progress
+{
+	int job_cnt;
+	int* results;
+	_Atomic uint64_t* bytes;
+	_Atomic uint64_t* totals;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;
+
+	int mode;
+	struct timespec start, last;
+	uint64_t last_bytes;
+	int drawn_lines;
+	// JSON 모드에서 이미 끝났다고 출력한 항목들
+	char* reported;
+	int item_cnt;
+} progress;
+
+int progress_default_mode();
+int progress_init(progress* p, int job_cnt, int mode);
+void progress_destroy(progress* p);
+
+void progress_add(progress* p, int idx, uint64_t bytes);
+void progress_total(progress* p, int idx, uint64_t total);
+void progress_done(progress* p, int idx, int result);
+
+uint64_t progress_bytes(progress* p, int idx);
+uint64_t progress_job_total(progress* p, int idx);
+
+void progress_wait(progress* p, void (*draw)(progress* p, int final));
+void progress_render(progress* p, const progress_item* items, int n, int final);
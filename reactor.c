@@ -0,0 +1,71 @@
+/*
+	reactor.c
+	epoll 하나와 쓰레드 하나로 이루어진 이벤트 루프입니다.
+	등록된 fd 에 이벤트가 오면 해당 핸들러를 이 쓰레드에서 불러주므로,
+	하나의 fd 는 항상 하나의 쓰레드에서만 처리됩니다.
+	fd 의 등록은 다른 쓰레드에서 해도 됩니다.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "reactor.h"
+
+int reactor_init(reactor* r)
+{
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	return r->epfd < 0? -1: 0;
+}
+
+static void* reactor_loop(void* p)
+{
+	reactor* r = (reactor*)p;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while(1)
+	{
+		int n = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			reactor_handler* handler = (reactor_handler*)events[i].data.ptr;
+			handler->on_event(handler, events[i].events);
+		}
+	}
+
+	return NULL;
+}
+
+int reactor_start(reactor* r)
+{
+	return pthread_create(&r->thread, NULL, reactor_loop, r) ? -1: 0;
+}
+
+int reactor_add(reactor* r, int fd, uint32_t events, reactor_handler* handler)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = handler;
+	return epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int reactor_mod(reactor* r, int fd, uint32_t events, reactor_handler* handler)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = handler;
+	return epoll_ctl(r->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int reactor_del(reactor* r, int fd)
+{
+	struct epoll_event ev;
+	return epoll_ctl(r->epfd, EPOLL_CTL_DEL, fd, &ev);
+}
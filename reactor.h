@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+// 한번의 epoll_wait 로 가져올 최대 이벤트 수
+#define REACTOR_MAX_EVENTS	64
+
+// 이벤트를 받을 구조체에 첫번째 멤버로 넣어두면, 이벤트가 오면 on_event 가 불립니다.
+typedef struct reactor_handler
+{
+	void (*on_event)(struct reactor_handler* handler, uint32_t events);
+} reactor_handler;
+
+typedef struct reactor
+{
+	int epfd;
+	pthread_t thread;
+} reactor;
+
+int reactor_init(reactor* r);
+int reactor_start(reactor* r);
+int reactor_add(reactor* r, int fd, uint32_t events, reactor_handler* handler);
+int reactor_mod(reactor* r, int fd, uint32_t events, reactor_handler* handler);
+int reactor_del(reactor* r, int fd);
@@ -0,0 +1,144 @@
+/*
+	request_proto.c
+	클라이언트가 서버에게 보내는 요청 프레임을 만들고 읽는 함수들입니다.
+	요청은 고정 헤더 뒤에 길이가 붙은 파일 이름과 전송 키로 이루어집니다.
+	읽을 때는 복사 없이 받은 버퍼 안을 가리키는 req_view 를 돌려주고,
+	메세지 하나에 다 들어가지 않는 요청들은 여러 메세지로 나누어 보냅니다.
+ */
+
+#include <string.h>
+
+#include "request_proto.h"
+
+int req_encode(char* buf, size_t cap, const req_view* v)
+{
+	if (v->name_len > REQ_NAME_MAX || v->key_len > REQ_KEY_MAX)
+		return -1;
+
+	size_t frame_len = sizeof(struct req_frame_hdr) + v->name_len + v->key_len;
+	if (frame_len > cap)
+		return -1;
+
+	struct req_frame_hdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = REQ_MAGIC;
+	hdr.version = REQ_VERSION;
+	hdr.flags = v->flags;
+	hdr.hdr_len = sizeof(hdr);
+	hdr.name_len = v->name_len;
+	hdr.key_len = v->key_len;
+	hdr.stripe_idx = v->stripe_idx;
+	hdr.stripe_cnt = v->stripe_cnt;
+	hdr.request_id = v->request_id;
+	hdr.filesize = v->filesize;
+	hdr.chunk_sz = v->chunk_sz;
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), v->name, v->name_len);
+	memcpy(buf + sizeof(hdr) + v->name_len, v->key, v->key_len);
+
+	return frame_len;
+}
+
+// 파일 이름은 ./file 아래의 이름 하나여야 합니다.
+static int valid_name(const char* name, size_t len)
+{
+	if (!len || memchr(name, '/', len) || memchr(name, '\0', len))
+		return 0;
+	if ((len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.'))
+		return 0;
+	return 1;
+}
+
+// 버퍼 앞의 요청 하나를 읽습니다.
+// 읽은 프레임의 크기를 돌려주며, 아직 다 오지 않았으면 0, 잘못된 프레임이면 -1 입니다.
+int req_decode(const char* buf, size_t len, req_view* v)
+{
+	struct req_frame_hdr hdr;
+	if (len < sizeof(hdr))
+		return 0;
+	memcpy(&hdr, buf, sizeof(hdr));
+
+	if (hdr.magic != REQ_MAGIC || hdr.version < REQ_VERSION || hdr.hdr_len < sizeof(hdr))
+		return -1;
+	if (hdr.name_len > REQ_NAME_MAX || hdr.key_len > REQ_KEY_MAX)
+		return -1;
+	if (hdr.stripe_cnt && hdr.stripe_idx >= hdr.stripe_cnt)
+		return -1;
+
+	size_t frame_len = (size_t)hdr.hdr_len + hdr.name_len + hdr.key_len;
+	if (len < frame_len)
+		return 0;
+
+	v->flags = hdr.flags;
+	v->stripe_idx = hdr.stripe_idx;
+	v->stripe_cnt = hdr.stripe_cnt;
+	v->request_id = hdr.request_id;
+	v->filesize = hdr.filesize;
+	v->chunk_sz = hdr.chunk_sz;
+	v->name = buf + hdr.hdr_len;
+	v->name_len = hdr.name_len;
+	v->key = v->name + hdr.name_len;
+	v->key_len = hdr.key_len;
+
+	if (!valid_name(v->name, v->name_len))
+		return -1;
+
+	return frame_len;
+}
+
+// 스트라이프가 맡을 파일 구간을 구합니다. 클라이언트와 서버가 파일 크기만으로 같은 구간을 얻습니다.
+// 조각은 REQ_STRIPE_ALIGN 단위로 나누므로 작은 파일에서는 뒤쪽 스트라이프의 구간이 비어 있을 수 있습니다.
+void req_stripe_range(uint64_t filesize, int stripe_idx, int stripe_cnt, uint64_t* offset, uint64_t* len)
+{
+	if (stripe_cnt <= 1)
+	{
+		*offset = 0;
+		*len = filesize;
+		return;
+	}
+
+	uint64_t chunk = (filesize + stripe_cnt - 1) / stripe_cnt;
+	chunk = (chunk + REQ_STRIPE_ALIGN - 1) / REQ_STRIPE_ALIGN * REQ_STRIPE_ALIGN;
+
+	uint64_t begin = chunk * stripe_idx;
+	if (begin > filesize)
+		begin = filesize;
+	*offset = begin;
+	*len = filesize - begin < chunk? filesize - begin: chunk;
+}
+
+void req_writer_init(req_writer* w, char* buf, size_t cap, int (*flush)(void*, const char*, size_t), void* ctx)
+{
+	w->buf = buf;
+	w->cap = cap;
+	w->len = 0;
+	w->flush = flush;
+	w->ctx = ctx;
+}
+
+int req_writer_flush(req_writer* w)
+{
+	if (!w->len)
+		return 0;
+
+	int result = w->flush(w->ctx, w->buf, w->len);
+	w->len = 0;
+	return result;
+}
+
+int req_writer_add(req_writer* w, const req_view* v)
+{
+	int n = req_encode(w->buf + w->len, w->cap - w->len, v);
+	if (n < 0)
+	{
+		// 자리가 없으면 지금까지 모은 요청을 보내고 다시 시도합니다.
+		if (!w->len || req_writer_flush(w) < 0)
+			return -1;
+		n = req_encode(w->buf, w->cap, v);
+		if (n < 0)
+			return -1;
+	}
+	w->len += n;
+	return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 요청 프레임에 대한 정의들
+#define REQ_MAGIC			0x4654	// "FT"
+#define REQ_VERSION			1
+
+#define REQ_FLAG_UPLOAD		0x01
+// 전송마다 채널을 만들지 않고 클라이언트의 세션 채널 하나에 섞어서 보냅니다.
+#define REQ_FLAG_SESSION	0x02
+// 작은 파일 여러개를 묶은 스트림(batch_util.h)입니다. 서버는 다 받은 뒤 한번에 풀어줍니다.
+#define REQ_FLAG_BATCH		0x04
+// 데이터를 압축해서 주고받자는 제안입니다(lz_stage.c). 다운로드는 서버가 받아들일지 정해서 알려줍니다.
+#define REQ_FLAG_COMPRESS	0x08
+// 업로드할 조각들의 해시를 먼저 보내서 서버에 없는 조각만 보냅니다(chunk_store.c).
+#define REQ_FLAG_DEDUP		0x10
+// 데이터를 보내는 쪽이 맡은 구간의 CRC32C 를 끝에 붙이고, 받는 쪽이 확인합니다(crc32c.c).
+#define REQ_FLAG_CHECKSUM	0x20
+
+#define REQ_NAME_MAX		255
+#define REQ_KEY_MAX			255
+
+// 파일 하나를 나눌 수 있는 최대 조각 수와, 조각 크기를 맞추는 단위
+#define REQ_STRIPE_MAX		64
+#define REQ_STRIPE_ALIGN	(64 * 1024)
+
+// 요청 하나의 고정 헤더입니다. 뒤에 파일 이름과 전송 키가 길이만큼 붙습니다.
+// hdr_len 은 버전이 올라가며 헤더가 늘어나도 이름과 키를 찾을 수 있게 해줍니다.
+struct req_frame_hdr
+{
+	uint16_t magic;
+	uint8_t version;
+	uint8_t flags;
+	uint16_t hdr_len;
+	uint16_t name_len;
+	uint16_t key_len;
+	// 파일 하나를 여러 채널로 나누어 보낼 때 몇번째 조각인지, 0 이면 나누지 않습니다.
+	uint8_t stripe_idx;
+	uint8_t stripe_cnt;
+	uint32_t request_id;
+	uint64_t filesize;
+	// 데이터를 나누어 보내는 전송에서 원하는 메세지 하나의 크기, 0 이면 서버가 정합니다.
+	uint32_t chunk_sz;
+	uint32_t reserved;
+};
+
+// 파싱한 요청입니다. name 과 key 는 받은 버퍼를 그대로 가리키며 NUL 로 끝나지 않습니다.
+typedef struct req_view
+{
+	uint8_t flags;
+	uint8_t stripe_idx, stripe_cnt;
+	uint32_t request_id;
+	uint64_t filesize;
+	uint32_t chunk_sz;
+	const char* name;
+	uint16_t name_len;
+	const char* key;
+	uint16_t key_len;
+} req_view;
+
+int req_encode(char* buf, size_t cap, const req_view* v);
+int req_decode(const char* buf, size_t len, req_view* v);
+
+void req_stripe_range(uint64_t filesize, int stripe_idx, int stripe_cnt, uint64_t* offset, uint64_t* len);
+
+// 여러 요청을 메세지 크기에 맞추어 모아서 보내주는 writer 입니다.
+// 다음 요청이 들어갈 자리가 없으면 flush 로 지금까지 모은 것을 보냅니다.
+typedef struct req_writer
+{
+	char* buf;
+	size_t cap, len;
+	int (*flush)(void* ctx, const char* buf, size_t len);
+	void* ctx;
+} req_writer;
+
+void req_writer_init(req_writer* w, char* buf, size_t cap, int (*flush)(void*, const char*, size_t), void* ctx);
+int req_writer_add(req_writer* w, const req_view* v);
+int req_writer_flush(req_writer* w);
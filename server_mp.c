@@ -9,8 +9,9 @@
 	
 	위의 전제를 사용해 클라이언트는 서버에게 파일 전송을 요청하는 정보를 보낸 후,
 	이를 처리하는 쓰레드를 생성합니다.
-	송신단에서는 파이프의 크기제한을 고려하여 spinlock 이 필요하면 걸어줍니다.
-	수신단에서는 간단하게 값을 받아옵니다.
+	서버는 요청을 워커 풀(work_pool.c)에 넣고, 데이터는 클라이언트가 전송마다 만든 큐로 주고 받습니다.
+	송신단에서는 블로킹 msgsnd 와 크레딧 윈도우로 흐름을 제어하므로 스핀하지 않습니다.
+	수신단에서는 값을 받아온 뒤, 다 받았다는 ACK 메세지를 보내줍니다.
 
 	이러한 동작은 서버가 요청을 받아서 문제없이 처리한다는 가정하에 이루어집니다.
  */
@@ -23,6 +24,7 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
 
@@ -30,18 +32,47 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 
 #include "file_util.h"
+#include "work_pool.h"
+#include "request_proto.h"
+#include "batch_util.h"
+#include "xfer_stats.h"
+#include "metrics.h"
+#include "log.h"
+#include "server_signal.h"
+#include "file_writer.h"
+#include "file_cache.h"
+#include "crc32c.h"
+#include "lz_stage.h"
+#include "chunk_store.h"
+#include "mp_util.h"
 
 // MESSAGE PASSING 에 대한 정의들
 #define REQ_MP_KEY 			60050
 #define REQ_MPQ_PERM 		0666
 
-#define IO_MP_KEY_BASE		60051
-#define IO_MPQ_PERM			0666
 
+// 요청 메세지의 크기, 데이터 메세지의 크기는 요청마다 정합니다(mp_util.c).
 #define MSG_BUFFER_SZ		2048
 
+// 하나의 큐를 양방향으로 쓰기 때문에 mtype 으로 메세지 종류를 구분합니다.
+#define MSG_TYPE_DATA		1
+#define MSG_TYPE_CREDIT		2
+#define MSG_TYPE_ACK		3
+#define MSG_TYPE_GRANT		4
+// checksum 요청이면 데이터를 다 보낸 쪽이 맡은 구간의 CRC32C 를 보냅니다(crc32c.c).
+#define MSG_TYPE_SUM		5
+// 중복 제거 업로드에서 클라이언트가 조각 해시들을 보내고, 서버가 가진 조각을 비트로 답합니다.
+#define MSG_TYPE_HAVE		6
+#define MSG_TYPE_GOT		7
+
+// 송신단은 크레딧 없이 MP_WINDOW_CHUNKS 개까지만 보낼 수 있고,
+// 수신단은 MP_CREDIT_CHUNKS 개를 받을 때마다 크레딧을 하나 돌려줍니다.
+#define MP_WINDOW_CHUNKS	32
+#define MP_CREDIT_CHUNKS	8
+
 struct msg_buf
 {
 	long mtype;
@@ -49,11 +80,33 @@ struct msg_buf
 };
 // MESSAGE PASSING 에 대한 정의들
 
-void signal_handler(int signal)
+// 워커 풀에 쌓일 수 있는 대기 작업 수의 기본값
+#define POOL_DEPTH_LIMIT	256
+
+work_pool pool;
+int request_qid = -1;
+// 1 이면 업로드를 O_DIRECT 로 씁니다(-D 옵션).
+int use_direct = 0;
+// 0 이면 클라이언트가 압축을 제안해도 다운로드를 압축하지 않습니다(-Z 옵션).
+int allow_compress = 1;
+// 워커 풀이 가득 차서 거절한 요청 수
+atomic_ulong rejected_cnt;
+
+// 요청 큐를 지웁니다. abort 핸들러에서도 부르므로 시스템 콜만 씁니다.
+void remove_endpoint()
 {
 	struct msqid_ds msqstat;
 	int msgq = msgget(REQ_MP_KEY, REQ_MPQ_PERM); 
 	msgctl(msgq, IPC_RMID, &msqstat);
+}
+
+// 끝내는 시그널을 받으면 시그널을 기다리는 쓰레드(server_signal.c)에서 불립니다.
+void stop_server(int signal)
+{
+	remove_endpoint();
+	metrics_stop();
+	log_flush();
+	xfer_totals_print();
 	exit(1);
 }
 
@@ -66,32 +119,70 @@ void fatal(const char* msg)
 typedef struct file_request
 {
 	int is_uploaded;
-	int filesize;
+	// 작은 파일들을 묶은 스트림이면 다 받은 뒤 ./file 에 풀어줍니다.
+	int is_batch;
+	off_t filesize;
 	char* filename;
-	// IPC KEY
-	int mp_ipc_key;
+	uint32_t request_id;
+	// 파일을 나누어 받을 때 이 요청이 맡은 조각, stripe_cnt 가 0 이면 파일 전체입니다.
+	int stripe_idx, stripe_cnt;
+	// 데이터 메세지 하나의 크기, 클라이언트가 요청한 크기를 msgmax 에 맞춘 값입니다.
+	int chunk_sz;
+	// 클라이언트가 IPC_PRIVATE 로 만든 전송 큐의 아이디
+	int msqid;
+	// 세션 큐에 섞여 오는 전송이면 이 전송의 메세지들은 mtype_base 만큼 떨어진 mtype 을 씁니다.
+	int session;
+	long mtype_base;
+	// 클라이언트가 압축을 제안했습니다. 업로드는 압축되어 옵니다.
+	int compress;
+	// 서버에 없는 조각만 받는 업로드입니다.
+	int dedup;
+	// 데이터를 다 보낸 쪽이 CRC32C 를 보내서 받는 쪽이 확인합니다.
+	int checksum;
 } file_req;
 
-int receive_upload(file_req* pr);
-int send_download(file_req* pr);
+int receive_upload(file_req* pr, struct mp_msg* buffer, xfer_stats* stats);
+int send_download(file_req* pr, struct mp_msg* buffer, xfer_stats* stats);
+
+// 클라이언트가 IPC_PRIVATE 로 만든 큐는 키가 없으므로 받은 아이디를 그대로 씁니다.
+// 그 사이에 지워진 큐가 아닌지만 확인합니다.
+int open_msg_queue_io(int msqid)
+{
+	struct msqid_ds msqstat;
+	return msgctl(msqid, IPC_STAT, &msqstat) < 0? -1: msqid;
+}
 
 void* file_task(void* p)
 {
 	file_req* preq = (file_req*)p;
-	int result = preq->is_uploaded? receive_upload(preq): send_download(preq);
+	struct mp_msg* buffer = mp_msg_alloc(preq->chunk_sz);
+	xfer_stats stats;
+	xfer_stats_begin(&stats, preq->is_uploaded? XFER_UPLOAD: XFER_DOWNLOAD);
+	int result = preq->is_uploaded? receive_upload(preq, buffer, &stats): send_download(preq, buffer, &stats);
+	free(buffer);
+
+	xfer_stats_end(&stats, result);
+	if (!result)
+		xfer_stats_print(preq->is_uploaded? "receive_upload": "send_download", preq->filename, &stats);
 
 	if (result < 0)
 	{
 		switch(result)
 		{
 			case -1:
-				printf(">> file_task: file(%s) cannot open..\n", preq->filename);
+				log_error(">> file_task: file(%s) cannot open..\n", preq->filename);
 				break;
 			case -2:
-				printf(">> file_task: ipc_key(%d) cannot open..\n", preq->mp_ipc_key);
+				log_error(">> file_task: msqid(%d) cannot open..\n", preq->msqid);
+				break;
+			case -7:
+				log_error(">> file_task: batch(%s) cannot unpack..\n", preq->filename);
+				break;
+			case -8:
+				log_error(">> file_task: file(%s) checksum mismatch..\n", preq->filename);
 				break;
 			default:
-				printf(">> file_task: unknown error(%d)\n", result);
+				log_error(">> file_task: unknown error(%d)\n", result);
 				break;
 		}
 	}
@@ -102,225 +193,654 @@ void* file_task(void* p)
 	return NULL;
 }
 
+// 전송이 끝난 큐를 정리합니다. 세션 큐는 클라이언트의 다른 전송과 같이 쓰므로 지우지 않습니다.
+void release_queue(file_req* pr, int msgq_id)
+{
+	struct msqid_ds msqstat;
+	if (!pr->session)
+		msgctl(msgq_id, IPC_RMID, &msqstat);
+}
+
+// 전송을 시작하지 못했다고 클라이언트에게 알려줍니다.
+// 세션이 아니면 큐를 지우고, 세션이면 업로드는 GRANT 에, 다운로드는 크기 헤더에 -1 을 넣어 보냅니다.
+void fail_stream(file_req* pr, int msgq_id, struct mp_msg* buffer)
+{
+	if (!pr->session)
+	{
+		release_queue(pr, msgq_id);
+		return;
+	}
+
+	if (pr->is_uploaded)
+	{
+		buffer->mtype = pr->mtype_base + MSG_TYPE_GRANT;
+		*(int*)buffer->message = -1;
+		msgsnd(msgq_id, buffer, sizeof(int), 0);
+	}
+	else
+	{
+		buffer->mtype = pr->mtype_base + MSG_TYPE_DATA;
+		*(int64_t*)buffer->message = -1;
+		msgsnd(msgq_id, buffer, sizeof(int64_t), 0);
+	}
+}
+
+// 받은 업로드 데이터를 쓰는 곳입니다. 중복 제거 업로드면 plan 에 따라 조각마다 자리를 옮겨서 씁니다.
+typedef struct upload_sink
+{
+	file_writer* writer;
+	chunk_plan* plan;
+	// 받는 데이터의 off 는 offset 부터 센 스트림 위치입니다.
+	off_t offset;
+} upload_sink;
+
+// 받은 업로드 데이터(압축이면 압축 쓰레드가 푼 것)를 구간에 씁니다.
+ssize_t writer_sink(void* ctx, void* buf, off_t off, size_t len)
+{
+	upload_sink* s = (upload_sink*)ctx;
+	if (!s->plan)
+		return file_writer_put(s->writer, buf, len) < 0? -1: (ssize_t)len;
+
+	for (size_t done = 0; done < len;)
+	{
+		size_t room;
+		off_t at = chunk_plan_map(s->plan, off - s->offset + done, &room);
+		size_t n = len - done < room? len - done: room;
+		if (file_writer_seek(s->writer, at) < 0 || file_writer_put(s->writer, (char*)buf + done, n) < 0)
+			return -1;
+		done += n;
+	}
+	return len;
+}
+
+// 압축 쓰레드가 다운로드할 파일을 읽습니다.
+ssize_t cache_source(void* ctx, void* buf, off_t off, size_t len)
+{
+	return file_cache_read((file_cache_entry*)ctx, buf, off, len);
+}
+
+// 중복 제거 업로드/ 클라이언트가 HAVE 로 보낸 조각 해시들을 받아서, 가진 조각은 받는 파일의 제자리에 놓고 GOT 으로 알려줍니다.
+// 클라이언트는 답을 받은 뒤에 다음 HAVE 를 보내므로 큐에는 둘 중 하나만 있습니다.
+// 클라이언트가 해시를 다 구하지 못하면 빈 HAVE 를 보내며, 그때는 데이터도 오지 않으므로 -6 입니다.
+int receive_hashes(file_req* pr, int msgq_id, struct mp_msg* buffer, chunk_plan* plan, chunk_placer* placer)
+{
+	uint32_t per = chunk_plan_per_msg(pr->chunk_sz);
+	for (uint32_t from = 0; from < plan->count; from += per)
+	{
+		uint32_t n = plan->count - from < per? plan->count - from: per;
+		ssize_t got = msgrcv(msgq_id, buffer, pr->chunk_sz, pr->mtype_base + MSG_TYPE_HAVE, 0);
+		if (!got)
+			return -6;
+		if (got != (ssize_t)n * SHA256_SIZE)
+			return -3;
+		memcpy(plan->hashes[from], buffer->message, got);
+
+		for (uint32_t i = from; i < from + n; i++)
+		{
+			off_t at;
+			size_t len;
+			chunk_plan_span(plan, i, &at, &len);
+			plan->have[i] = chunk_place(placer, plan->hashes[i], at, len);
+		}
+
+		buffer->mtype = pr->mtype_base + MSG_TYPE_GOT;
+		if (msgsnd(msgq_id, buffer, chunk_plan_pack(plan, from, n, buffer->message), 0) < 0)
+			return -3;
+	}
+	chunk_plan_finish(plan);
+	return 0;
+}
+
 // 업로드/ 클라이언트에서 보낸 MESSAGE QUEUE 에 있던 데이터를 FILE에 넣어줍니다.
-int receive_upload(file_req* pr)
+// 스트라이프 요청이면 맡은 구간에만 쓰므로, 같은 파일의 다른 조각과 동시에 돌 수 있습니다.
+// 세션 모드에서는 GRANT 를 보내서 클라이언트가 이제 보내도 된다는 것을 알려줍니다.
+// 압축된 업로드는 받은 메세지들을 블록으로 모아서 압축 쓰레드에게 넘기고, 압축 쓰레드가 풀어서 씁니다.
+// 중복 제거 업로드는 먼저 조각 해시들을 주고받고(receive_hashes), 그 뒤로는 없는 조각들만 이어붙여 받습니다.
+// 다 받은 뒤에는 ACK 를 보내고, 큐는 클라이언트가 정리합니다.
+int receive_upload(file_req* pr, struct mp_msg* buffer, xfer_stats* stats)
 {
-	struct timespec tstart, tend;
+	log_info(">> receive_upload(fs=%lld,name=\"%s\",msqid=%d,stripe=%d/%d) start!\n", (long long)pr->filesize, pr->filename, pr->msqid, pr->stripe_idx, pr->stripe_cnt);
 
-	printf(">> receive_upload(fs=%d,name=\"%s\",key=%d) start!\n", pr->filesize, pr->filename, pr->mp_ipc_key);
+	int msgq_id = open_msg_queue_io(pr->msqid);
+	if (msgq_id < 0)
+		return -2;
 
-	struct msg_buf buffer;
-	buffer.mtype = 0;
-	sprintf(buffer.message, "./file/%s", pr->filename);
-	int newfile = open(buffer.message, O_WRONLY | O_CREAT);
-	int msgq_id = msgget(pr->mp_ipc_key, IO_MPQ_PERM);
+	char path[512];
+	sprintf(path, "./file/%s", pr->filename);
+	uint64_t offset, len;
+	req_stripe_range(pr->filesize, pr->stripe_idx, pr->stripe_cnt, &offset, &len);
 
-	if (newfile < 0)
+	// 중복 제거 업로드는 같은 자리의 옛 조각과 비교하도록 받기 전의 크기를 보고, 놓은 조각을 다시 읽으므로 읽기도 엽니다.
+	// 중복 제거 없이 덮어쓰는 파일과 지워졌다가 새로 올리는 파일은 조각 목록과 맞지 않으므로,
+	// 어느 스트라이프도 옛 색인을 쓰기 전에 목록과 색인 항목들을 버립니다.
+	struct stat st;
+	int existed = pr->dedup && stat(path, &st) == 0;
+	if (!pr->is_batch && !existed)
+		chunk_store_forget(pr->filename);
+
+	// 맡은 구간을 미리 잡아두고(file_writer.c), 받은 메세지들은 모아서 큰 pwrite 로 씁니다.
+	// 묶음은 이름 없는 임시 파일로 받아서 다 받은 뒤에 풉니다.
+	file_writer writer;
+	chunk_plan plan = { 0 };
+	upload_sink sink = { &writer, NULL, offset };
+	int newfile = pr->is_batch? batch_tmpfile("./file"): open(path, (pr->dedup? O_RDWR: O_WRONLY) | O_CREAT, 0666);
+	if (newfile < 0 || file_writer_prepare(newfile, pr->filesize, offset, len) < 0 || file_writer_init(&writer, newfile, offset, use_direct) < 0 ||
+		(pr->dedup && chunk_plan_init(&plan, offset, len) < 0))
+	{
+		if (newfile >= 0)
+			close(newfile);
+		fail_stream(pr, msgq_id, buffer);
 		return -1;
-	if (pipe < 0)
-		return -2;
+	}
 
-	int loop_cnt = 0;
-	long accum_time = 0;
-	int read_len = 0, accum = 0;
-	while(1)
+	lz_stage z;
+	if (pr->compress && lz_stage_start(&z, LZ_STAGE_DECODE, writer_sink, &sink, offset, len) < 0)
 	{
-		clock_gettime(CLOCK_REALTIME, &tstart);
-		read_len = msgrcv(msgq_id, &buffer, MSG_BUFFER_SZ, 0, MSG_NOERROR);
-		clock_gettime(CLOCK_REALTIME, &tend);
+		chunk_plan_destroy(&plan);
+		file_writer_destroy(&writer);
+		close(newfile);
+		fail_stream(pr, msgq_id, buffer);
+		return -1;
+	}
 
-		if (tend.tv_nsec - tstart.tv_nsec > 0)
-			accum_time += tend.tv_nsec - tstart.tv_nsec;
+	if (pr->session)
+	{
+		buffer->mtype = pr->mtype_base + MSG_TYPE_GRANT;
+		*(int*)buffer->message = 0;
+		if (msgsnd(msgq_id, buffer, sizeof(int), 0) < 0)
+		{
+			if (pr->compress)
+				lz_stage_finish(&z);
+			chunk_plan_destroy(&plan);
+			file_writer_destroy(&writer);
+			close(newfile);
+			return -4;
+		}
+	}
 
-		if (!read_len) break;
+	// 가진 조각들을 먼저 놓고, 그 뒤로 받는 데이터는 없는 조각들을 이어붙인 want 바이트입니다.
+	// 압축 단계의 크기는 블록 크기를 확인하는 데만 쓰므로 구간 전체로 시작해 두어도 됩니다.
+	int read_len = 0, result = 0;
+	uint64_t want = len;
+	if (pr->dedup)
+	{
+		chunk_placer placer;
+		int ret = chunk_placer_init(&placer, newfile, pr->filename, existed? &st: NULL, pr->stripe_cnt <= 1) < 0? -3: receive_hashes(pr, msgq_id, buffer, &plan, &placer);
+		chunk_placer_destroy(&placer);
+		if (ret == -3)
+		{
+			release_queue(pr, msgq_id);
+			if (pr->compress)
+				lz_stage_finish(&z);
+			chunk_plan_destroy(&plan);
+			file_writer_destroy(&writer);
+			close(newfile);
+			return -3;
+		}
+		// 클라이언트가 그만두었으면 데이터와 CRC32C 없이 ACK 만 보냅니다.
+		if (ret < 0)
+		{
+			result = ret;
+			want = 0;
+		}
+		else
+		{
+			sink.plan = &plan;
+			want = plan.stream_len;
+			log_debug(">> receive_upload(name=\"%s\",msqid=%d) reused %u of %u chunks\n", pr->filename, pr->msqid, placer.placed, plan.count);
+		}
+	}
+
+	off_t accum = 0;
+	uint32_t sum = 0;
+	while(accum < want)
+	{
+		// msgrcv 에서 잠든 시간은 클라이언트를 기다린 시간, 버퍼에 모으고 쓰는 시간은 옮긴 시간입니다.
+		uint64_t t0 = xfer_now_ns();
+		read_len = msgrcv(msgq_id, buffer, pr->chunk_sz, pr->mtype_base + MSG_TYPE_DATA, 0);
+		uint64_t t1 = xfer_now_ns();
+
+		// 클라이언트가 파일을 끝까지 읽지 못했습니다.
+		if (!read_len)
+		{
+			result = -6;
+			break;
+		}
 		if (read_len < 0)
 		{
-			struct msqid_ds msqstat;
-			msgctl(msgq_id, IPC_RMID, &msqstat);
+			release_queue(pr, msgq_id);
+			if (pr->compress)
+				lz_stage_finish(&z);
+			chunk_plan_destroy(&plan);
+			file_writer_destroy(&writer);
+			close(newfile);
 			return -3;
 		}
-		write(newfile, buffer.message, read_len);
+		// 압축된 업로드는 다 모은 블록들의 원래 크기만큼 받은 것입니다. CRC32C 와 쓰기는 압축 쓰레드가 합니다.
+		if (pr->compress)
+		{
+			if (lz_stage_feed(&z, buffer->message, read_len) < 0)
+			{
+				result = -3;
+				break;
+			}
+			accum = z.fed;
+			xfer_stats_chunk(stats, read_len, t1 - t0, xfer_now_ns() - t1);
+			continue;
+		}
+		if (pr->checksum)
+			sum = crc32c_update(sum, buffer->message, read_len);
+		// 세션 모드에서는 쓰지 못해도 큐가 막히지 않도록 끝까지 받아서 버립니다.
+		if (!result && writer_sink(&sink, buffer->message, offset + accum, read_len) < 0)
+		{
+			result = -5;
+			if (!pr->session)
+			{
+				release_queue(pr, msgq_id);
+				chunk_plan_destroy(&plan);
+				file_writer_destroy(&writer);
+				close(newfile);
+				return result;
+			}
+		}
 		accum += read_len;
+		xfer_stats_chunk(stats, read_len, t1 - t0, xfer_now_ns() - t1);
+	}
 
-		if (accum == pr->filesize)
-			break;
+	// 압축 쓰레드가 넘긴 블록을 모두 쓸 때까지 기다립니다.
+	if (pr->compress)
+	{
+		int ret = lz_stage_finish(&z);
+		if (!result && ret < 0)
+			result = ret == LZ_STAGE_EIO? -5: -3;
+		sum = z.sum;
+		log_debug(">> receive_upload(name=\"%s\",msqid=%d) compressed %llu -> %llu bytes\n", pr->filename, pr->msqid, (unsigned long long)z.raw_bytes, (unsigned long long)z.wire_bytes);
+	}
+
+	// 맡은 구간을 다 보낸 클라이언트는 그 CRC32C 를 보내므로, 받은 것과 다르면 쓰거나 풀지 않고 실패를 알립니다.
+	// 중복 제거 업로드의 CRC32C 는 받은 스트림의 것입니다. 놓은 조각들은 놓을 때 해시로 확인했습니다.
+	if (pr->checksum && accum >= want && result != -6)
+	{
+		if (msgrcv(msgq_id, buffer, CRC32C_SIZE, pr->mtype_base + MSG_TYPE_SUM, 0) != CRC32C_SIZE)
+		{
+			release_queue(pr, msgq_id);
+			chunk_plan_destroy(&plan);
+			file_writer_destroy(&writer);
+			close(newfile);
+			return -3;
+		}
+		if (!result && *(uint32_t*)buffer->message != sum)
+			result = -8;
 	}
 
+	if (!result && file_writer_flush(&writer) < 0)
+		result = -5;
+	file_writer_destroy(&writer);
+	if (!result && pr->is_batch && batch_unpack(newfile, "./file") < 0)
+		result = -7;
 	close(newfile);
 
-	struct msqid_ds msqstat;
-	msgctl(msgq_id, IPC_RMID, &msqstat);
+	// 다 받은 파일의 조각들을 색인에 더합니다. 목록을 쓰지 못해도 받은 파일은 온전합니다.
+	if (!result && pr->dedup && chunk_store_commit(pr->filename, pr->filesize, &plan) < 0)
+		log_warn(">> receive_upload(name=\"%s\",msqid=%d) cannot write chunk manifest\n", pr->filename, pr->msqid);
+	chunk_plan_destroy(&plan);
 
-	printf(">> receive_upload(fs=%d,name=\"%s\",key=%d) end(%ld)!\n", pr->filesize, pr->filename, pr->mp_ipc_key, tend.tv_nsec - tstart.tv_nsec);
-	return 0;
+	// ACK 에는 결과를 담아서 클라이언트가 서버의 실패를 알 수 있게 합니다.
+	buffer->mtype = pr->mtype_base + MSG_TYPE_ACK;
+	*(int*)buffer->message = result;
+	if (msgsnd(msgq_id, buffer, sizeof(int), 0) < 0)
+		return -4;
+
+	if (!result)
+		log_info(">> receive_upload(fs=%lld,name=\"%s\",msqid=%d) end!\n", (long long)pr->filesize, pr->filename, pr->msqid);
+	return result;
 }
 
-// 다운로드/ 클라이언트가 요청한 파일을 MESSAGE QUEUE에 넣어줍니다. 
-// 여기서도 스핀락으로 파이프 크기에 따라 조절합니다.
-int send_download(file_req* pr)
+// 윈도우를 다 쓰면 크레딧이 올 때까지 잠든 뒤 데이터 메세지 하나를 보냅니다.
+// 크레딧을 받지 못하면 -1, 메세지를 보내지 못하면 -2 입니다.
+int send_windowed(file_req* pr, int msgq_id, struct mp_msg* buffer, int len, int* in_flight)
 {
-	struct timespec tstart, tend;
-
-	printf(">> send_download(fs=%d,name=\"%s\",key=%d) start!\n", pr->filesize, pr->filename, pr->mp_ipc_key);
+	if (*in_flight >= MP_WINDOW_CHUNKS)
+	{
+		struct msg_buf credit;
+		if (msgrcv(msgq_id, &credit, 0, pr->mtype_base + MSG_TYPE_CREDIT, MSG_NOERROR) < 0)
+			return -1;
+		*in_flight -= MP_CREDIT_CHUNKS;
+	}
 
-	struct msqid_ds msqstat;
-	struct msg_buf buffer;
-	sprintf(buffer.message, "./file/%s", pr->filename);
-	int oldfile = open(buffer.message, O_RDONLY);
-	int msgq_id = msgget(pr->mp_ipc_key, IO_MPQ_PERM);
+	if (msgsnd(msgq_id, buffer, len, 0) < 0)
+		return -2;
+	(*in_flight)++;
+	return 0;
+}
 
-	struct stat st;
-	stat(buffer.message, &st);
-	pr->filesize = st.st_size;
-	
-	printf(">> send_download(fs=%d,name=\"%s\",key=%d) update fs\n", pr->filesize, pr->filename, pr->mp_ipc_key);
+// 다운로드/ 클라이언트가 요청한 파일을 MESSAGE QUEUE에 넣어줍니다.
+// 크기 헤더는 항상 파일 전체 크기이고, 스트라이프 요청이면 그 뒤에 맡은 구간만 보냅니다.
+// 압축하기로 했으면 크기 헤더에 MP_COMPRESS_LZ 를 붙이고, 압축 쓰레드가 채운 블록을 메세지로 나누어 보냅니다.
+// 큐가 가득 차면 msgsnd 가 커널에서 잠들고, 윈도우를 다 쓰면 크레딧이 올 때까지
+// msgrcv 로 잠듭니다. 마지막에는 클라이언트의 ACK 를 받고 큐를 정리합니다.
+int send_download(file_req* pr, struct mp_msg* buffer, xfer_stats* stats)
+{
+	log_info(">> send_download(fs=%lld,name=\"%s\",msqid=%d,stripe=%d/%d) start!\n", (long long)pr->filesize, pr->filename, pr->msqid, pr->stripe_idx, pr->stripe_cnt);
 
-	if (oldfile < 0)
-		return -1;
+	int msgq_id = open_msg_queue_io(pr->msqid);
 	if (msgq_id < 0)
 		return -2;
 
-	buffer.mtype = 1;
-	*(int*)buffer.message = pr->filesize;
+	// 같은 파일을 받는 요청들은 캐시(file_cache.c)에서 열어둔 파일과 매핑을 같이 씁니다.
+	char path[512];
+	sprintf(path, "./file/%s", pr->filename);
+	file_cache_entry* oldfile = file_cache_get(path);
+	if (!oldfile)
+	{
+		// 클라이언트가 기다리지 않도록 알려줍니다.
+		fail_stream(pr, msgq_id, buffer);
+		return -1;
+	}
+	pr->filesize = oldfile->size;
+	
+	log_debug(">> send_download(fs=%lld,name=\"%s\",msqid=%d) update fs\n", (long long)pr->filesize, pr->filename, pr->msqid);
+
+	uint64_t offset, len;
+	req_stripe_range(pr->filesize, pr->stripe_idx, pr->stripe_cnt, &offset, &len);
+
+	// 조각마다 pread 를 부르지 않고 매핑에서 바로 메세지로 복사합니다.
+	file_cache_advise(oldfile, offset, len);
+
+	// 압축 쓰레드를 시작하지 못하면 압축하지 않고 보냅니다.
+	lz_stage z;
+	int use_lz = pr->compress && allow_compress && lz_stage_start(&z, LZ_STAGE_ENCODE, cache_source, oldfile, offset, len) == 0;
 
-	if (msgsnd(msgq_id, &buffer, 4, 0) < 0)
+	// 크기 헤더는 2GB 가 넘는 파일을 위해 64비트로 보냅니다.
+	buffer->mtype = pr->mtype_base + MSG_TYPE_DATA;
+	*(int64_t*)buffer->message = pr->filesize;
+	*(uint32_t*)(buffer->message + sizeof(int64_t)) = MP_COMPRESS_LZ;
+
+	if (msgsnd(msgq_id, buffer, use_lz? MP_SIZE_HDR_LZ: sizeof(int64_t), 0) < 0)
 	{
-		struct msqid_ds msqstat;
-		msgctl(msgq_id, IPC_RMID, &msqstat);
+		if (use_lz)
+			lz_stage_finish(&z);
+		release_queue(pr, msgq_id);
+		file_cache_put(oldfile);
 		return -3;
 	}
 
-	int loop_cnt = 0;
-	long accum_time = 0;
-	int read_len = 0, accum = 0, idx = 0;
-	while(1)
+	int read_len = 0, in_flight = 0;
+	off_t sent = 0;
+	uint32_t sum = 0;
+	while(sent < len)
 	{
-		buffer.mtype = buffer.mtype + 1;
-
-		read_len = read(oldfile, buffer.message, MSG_BUFFER_SZ);
-		if (!read_len) break;
-		accum += read_len;
-
-		while(1)
+		// 파일에서 가져오는 시간은 옮긴 시간, 크레딧과 가득 찬 큐에서 잠든 시간은 클라이언트를 기다린 시간입니다.
+		uint64_t t0 = xfer_now_ns();
+		buffer->mtype = pr->mtype_base + MSG_TYPE_DATA;
+		if (use_lz)
 		{
-			// 여유 공간이 있는지 확인
-			msgctl(msgq_id, IPC_STAT, &msqstat);
-			if (msqstat.msg_qbytes - msqstat.__msg_cbytes > MSG_BUFFER_SZ)
+			// 블록을 끝까지 보냈으면 구간 전체를 보낸 것이고, 압축 쓰레드가 파일을 읽지 못했으면 -1 입니다.
+			read_len = lz_stage_emit(&z, buffer->message, pr->chunk_sz);
+			if (!read_len)
+			{
+				sent = len;
 				break;
+			}
+		}
+		else
+		{
+			read_len = len - sent < pr->chunk_sz? len - sent: pr->chunk_sz;
+			read_len = file_cache_read(oldfile, buffer->message, offset + sent, read_len);
+		}
+		// 파일이 줄어들었거나 읽지 못하면 빈 메세지로 끝을 알립니다.
+		if (read_len <= 0)
+			read_len = 0;
+		if (!use_lz)
+		{
+			if (pr->checksum)
+				sum = crc32c_update(sum, buffer->message, read_len);
+			sent += read_len;
 		}
+		uint64_t t1 = xfer_now_ns();
 
-		clock_gettime(CLOCK_REALTIME, &tstart);
-		if (msgsnd(msgq_id, &buffer, read_len, 0) < 0)
+		int ret = send_windowed(pr, msgq_id, buffer, read_len, &in_flight);
+		if (ret < 0)
 		{
-			msgctl(msgq_id, IPC_RMID, &msqstat);
+			if (use_lz)
+				lz_stage_finish(&z);
+			if (ret == -2)
+				release_queue(pr, msgq_id);
+			file_cache_put(oldfile);
 			return -4;
 		}
-		clock_gettime(CLOCK_REALTIME, &tend);
-		
-		if (tend.tv_nsec - tstart.tv_nsec > 0)
-			accum_time += tend.tv_nsec - tstart.tv_nsec;
+		xfer_stats_chunk(stats, read_len, xfer_now_ns() - t1, t1 - t0);
+
+		if (!read_len)
+			break;
 	}
-	
-	close(oldfile);
 
-	printf(">> send_download(fs=%d,name=\"%s\",key=%d) on idle\n", pr->filesize, pr->filename, pr->mp_ipc_key);
+	// 압축 쓰레드가 파일을 다 읽은 뒤에 놓습니다. CRC32C 는 압축 쓰레드가 원래 데이터로 구했습니다.
+	if (use_lz)
+	{
+		lz_stage_finish(&z);
+		sum = z.sum;
+		log_debug(">> send_download(name=\"%s\",msqid=%d) compressed %llu -> %llu bytes\n", pr->filename, pr->msqid, (unsigned long long)z.raw_bytes, (unsigned long long)z.wire_bytes);
+	}
+	file_cache_put(oldfile);
 
-	while(1)
+	// 맡은 구간을 다 보냈으면 CRC32C 를 보내서 클라이언트가 확인하게 합니다.
+	if (pr->checksum && sent >= len)
 	{
-		if (msgctl(msgq_id, IPC_STAT, &msqstat) < 0)
-			return -3;
-		if (msqstat.__msg_cbytes == 0)
-			break;
+		buffer->mtype = pr->mtype_base + MSG_TYPE_SUM;
+		*(uint32_t*)buffer->message = sum;
+		if (msgsnd(msgq_id, buffer, CRC32C_SIZE, 0) < 0)
+		{
+			release_queue(pr, msgq_id);
+			return -4;
+		}
 	}
 
-	printf(">> send_download(fs=%d,name=\"%s\",key=%d) end(%ld)!\n", pr->filesize, pr->filename, pr->mp_ipc_key, accum_time);
+	log_debug(">> send_download(fs=%lld,name=\"%s\",msqid=%d) on idle\n", (long long)pr->filesize, pr->filename, pr->msqid);
 
-	return 0;
+	// 클라이언트가 다 받았다는 ACK 를 기다립니다.
+	// 세션 큐에서는 남은 크레딧이 다른 전송을 막지 않도록 모두 치웁니다.
+	if (msgrcv(msgq_id, buffer, 0, pr->mtype_base + MSG_TYPE_ACK, MSG_NOERROR) < 0)
+		return -3;
+	if (pr->session)
+		while (msgrcv(msgq_id, buffer, 0, pr->mtype_base + MSG_TYPE_CREDIT, MSG_NOERROR | IPC_NOWAIT) >= 0);
+	release_queue(pr, msgq_id);
+
+	log_info(">> send_download(fs=%lld,name=\"%s\",msqid=%d) end!\n", (long long)pr->filesize, pr->filename, pr->msqid);
+
+	return sent < len? -4: 0;
+}
+
+// 워커 풀이 가득 차서 받을 수 없는 요청입니다.
+// 큐를 지우거나(세션이면 실패를 보내서) 클라이언트가 기다리지 않고 실패를 받도록 합니다.
+void reject_request(file_req* preq)
+{
+	int msgq_id = open_msg_queue_io(preq->msqid);
+
+	log_warn(">> read_request: pool is full, reject(name=\"%s\",msqid=%d)\n", preq->filename, preq->msqid);
+	atomic_fetch_add(&rejected_cnt, 1);
+	if (msgq_id >= 0)
+	{
+		struct mp_msg* buffer = mp_msg_alloc(sizeof(int64_t));
+		fail_stream(preq, msgq_id, buffer);
+		free(buffer);
+	}
+
+	free(preq->filename);
+	free(preq);
 }
 
 // 메인쓰레드에서 수행되는 함수로, 
 // 요청 MESSAGE QUEUE  를 만들고, 이에 들어오는 모든 데이터를 읽어
-// 정리하고, 쓰레드를 할당해줍니다.
+// 정리하고, 워커 풀에 작업으로 넣어줍니다.
 void read_request(int rqid)
 {
 	struct msg_buf buffer;
-	buffer.mtype = 1;
-	int value, filesize, ipc_key;
-	char filename[512], path[512];
-
-	int read_count = 0,
-		scan_count = 0;
 
 	do
 	{
-		scan_count = 0;
-		read_count = msgrcv(rqid, &buffer, MSG_BUFFER_SZ, 0, MSG_NOERROR);
+		int read_count = msgrcv(rqid, &buffer, MSG_BUFFER_SZ, 0, MSG_NOERROR);
 
 		if (read_count < 0)
 		{
+			// 끝내는 중이면 요청 큐를 지운 것이므로 정리하는 쓰레드가 끝낼 때까지 기다립니다.
+			if (server_stopping())
+				pause();
 			fatal("Fail to msgrcv from request.. ");
 			return;
 		}
 
-		char* temp = buffer.message;
-		do
+		// 메세지에는 온전한 요청 프레임들만 들어 있습니다.
+		const char* temp = buffer.message;
+		while (read_count > 0)
 		{
-			temp[read_count] = '\0';
-			scan_count = sscanf(temp, "%d %d %s %d\n", &value, &filesize, filename, &ipc_key);
-
-			if (scan_count != 4) break;
+			req_view v;
+			int frame_len = req_decode(temp, read_count, &v);
+			if (frame_len <= 0 || v.key_len != sizeof(int))
+			{
+				log_warn(">> read_request: malformed request, drop %d bytes\n", read_count);
+				break;
+			}
 
-			int filename_len = strlen(filename), pipepath_len = strlen(path);
 			file_req* req = (file_req*)malloc(sizeof(file_req));
-			req->is_uploaded = value;
-			req->filesize = filesize;
-		
-			req->filename = (char*)malloc(sizeof(char)*(filename_len+1));
-			strcpy(req->filename, filename);
-			req->filename[filename_len] = '\0';
+			req->is_uploaded = v.flags & REQ_FLAG_UPLOAD;
+			req->is_batch = (v.flags & REQ_FLAG_BATCH) != 0;
+			req->filesize = v.filesize;
+			req->request_id = v.request_id;
+			req->stripe_idx = v.stripe_idx;
+			req->stripe_cnt = v.stripe_cnt;
+			req->chunk_sz = mp_chunk_size(v.chunk_sz);
+			req->session = (v.flags & REQ_FLAG_SESSION) != 0;
+			req->mtype_base = req->session? MP_STREAM_MTYPE(v.request_id): 0;
+			req->compress = (v.flags & REQ_FLAG_COMPRESS) != 0;
+			req->dedup = (v.flags & REQ_FLAG_DEDUP) && !req->is_batch;
+			req->checksum = (v.flags & REQ_FLAG_CHECKSUM) != 0;
+			req->filename = strndup(v.name, v.name_len);
+			memcpy(&req->msqid, v.key, sizeof(int));
+
+			// 대기 작업이 가득 차면 기본으로는 자리가 날 때까지 여기서 기다리고, -s 옵션이면 요청을 거절합니다.
+			if (work_pool_submit(&pool, file_task, req) < 0)
+				reject_request(req);
+
+			temp += frame_len;
+			read_count -= frame_len;
+		}
+	}
+	while(1);
+}
 
-			req->mp_ipc_key = ipc_key;
+// metrics 소켓에 워커 풀과 요청 큐의 상태를 더해줍니다.
+void write_metrics(FILE* out)
+{
+	int pending, running;
+	work_pool_load(&pool, &pending, &running);
+
+	metrics_header(out, "ipc_pool_workers", "gauge", "Worker threads in the pool.");
+	metrics_value(out, "ipc_pool_workers", NULL, pool.worker_cnt);
+	metrics_header(out, "ipc_pool_running", "gauge", "Tasks being run by the workers.");
+	metrics_value(out, "ipc_pool_running", NULL, running);
+	metrics_header(out, "ipc_pool_pending", "gauge", "Tasks waiting for a worker.");
+	metrics_value(out, "ipc_pool_pending", NULL, pending);
+	metrics_header(out, "ipc_requests_rejected_total", "counter", "Requests rejected because the pool was full.");
+	metrics_value(out, "ipc_requests_rejected_total", NULL, atomic_load(&rejected_cnt));
+	file_cache_write_metrics(out);
+
+	unsigned long raw, wire, packed, stored;
+	lz_stage_totals(&raw, &wire, &packed, &stored);
+	metrics_header(out, "ipc_compress_raw_bytes_total", "counter", "Bytes that went through the compression stage before compression.");
+	metrics_value(out, "ipc_compress_raw_bytes_total", NULL, raw);
+	metrics_header(out, "ipc_compress_wire_bytes_total", "counter", "Bytes the compression stage put on the wire, block headers included.");
+	metrics_value(out, "ipc_compress_wire_bytes_total", NULL, wire);
+	metrics_header(out, "ipc_compress_blocks_total", "counter", "Blocks through the compression stage by how they were sent.");
+	metrics_value(out, "ipc_compress_blocks_total", "kind=\"compressed\"", packed);
+	metrics_value(out, "ipc_compress_blocks_total", "kind=\"stored\"", stored);
+	chunk_store_write_metrics(out);
 
-			pthread_t pid;
-			pthread_create(&pid, NULL, file_task, req);
+	struct msqid_ds msqstat;
+	if (request_qid >= 0 && msgctl(request_qid, IPC_STAT, &msqstat) == 0)
+	{
+		metrics_header(out, "ipc_request_queue_messages", "gauge", "Messages waiting in the request queue.");
+		metrics_value(out, "ipc_request_queue_messages", NULL, msqstat.msg_qnum);
+	}
+}
 
-			for (int i = 0; i < strlen(temp); i++)
-			{
-				if (temp[i] == '\n')
+int main(int argc, char** argv)
+{
+	int opt, worker_cnt = work_pool_default_workers(), depth_limit = POOL_DEPTH_LIMIT, policy = WORK_POOL_WAIT;
+	int level = LOG_INFO, format = LOG_TEXT;
+	char metrics_path[108];
+	snprintf(metrics_path, sizeof(metrics_path), METRICS_PATH_FMT, "mp");
+	while ((opt = getopt(argc, argv, "w:q:sm:l:jDC:Z")) != -1)
+	{
+		switch(opt)
+		{
+			case 'w':
+				worker_cnt = atoi(optarg);
+				break;
+			case 'q':
+				depth_limit = atoi(optarg);
+				break;
+			case 's':
+				policy = WORK_POOL_SHED;
+				break;
+			case 'm':
+				snprintf(metrics_path, sizeof(metrics_path), "%s", optarg);
+				break;
+			case 'l':
+				if ((level = log_parse_level(optarg)) < 0)
 				{
-					temp += i;
-					break;
+					fprintf(stderr, "unknown log level: %s\n", optarg);
+					return 1;
 				}
-			}
-
-			if (*temp == '\n')
-			{
-				temp++;
-				continue;
-			}
-
-			break;
+				break;
+			case 'j':
+				format = LOG_JSON;
+				break;
+			case 'D':
+				use_direct = 1;
+				break;
+			case 'C':
+				file_cache_init((size_t)atol(optarg) * 1024 * 1024);
+				break;
+			case 'Z':
+				allow_compress = 0;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-w workers] [-q queue depth] [-s (reject requests when the queue is full)] [-m metrics socket] [-l debug|info|warn|error] [-j] [-D] [-C cache MB] [-Z]\n", argv[0]);
+				return 1;
 		}
-		while(1);
 	}
-	while(1);
-}
 
-int main()
-{
-	signal(SIGINT, signal_handler);
-	signal(SIGABRT, signal_handler);
-	signal(SIGHUP, signal_handler);
-	signal(SIGKILL, signal_handler);
+	// 끝내는 시그널은 여기서 막아서 뒤에 만드는 쓰레드들이 물려받게 하고, 따로 둔 쓰레드가 받아서 정리합니다.
+	if (server_signal_init(stop_server, remove_endpoint) < 0)
+		fatal("Fail to catch signals.. ");
+
+	// 워커들이 stdout 의 lock 을 두고 다투지 않도록 기록은 쓰레드마다 링에 모아서 씁니다.
+	if (log_init(level, format) < 0)
+		fatal("Fail to start logger.. ");
+
+	if (work_pool_init(&pool, worker_cnt, depth_limit, policy) < 0)
+		fatal("Fail to start worker pool.. ");
 
 	if (!is_dir("./file"))
 		system("mkdir ./file");
+	int chunk_cnt = chunk_store_init("./file");
+	if (chunk_cnt < 0)
+		log_error(">> main: fail to open chunk manifests in ./file/%s\n", CHUNK_STORE_DIR);
+	else
+		log_info(">> main: %d chunks indexed for deduplicating uploads\n", chunk_cnt);
 
 	int rqid = 0;
 	if ((rqid = msgget(REQ_MP_KEY, REQ_MPQ_PERM | IPC_CREAT)) < 0)
 		fatal("Fail to get request mq.. ");
 
 	printf("GEN MSG Q: %x:%d\n", REQ_MP_KEY, rqid);
+	request_qid = rqid;
+
+	if (metrics_start(metrics_path, "mp", write_metrics) < 0)
+		log_error(">> main: fail to open metrics socket(path=\"%s\")\n", metrics_path);
+	else
+		log_info(">> main: metrics on %s\n", metrics_path);
 
 	while(1)
 		read_request(rqid);
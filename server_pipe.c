@@ -9,8 +9,9 @@
 	
 	위의 전제를 사용해 클라이언트는 서버에게 파일 전송을 요청하는 정보를 보낸 후,
 	이를 처리하는 쓰레드를 생성합니다.
-	송신단에서는 파이프의 크기제한을 고려하여 spinlock 이 필요하면 걸어줍니다.
-	수신단에서는 간단하게 값을 받아옵니다.
+	전송들은 정해진 수의 epoll 리액터(reactor.c)에서 논블로킹 FIFO 로 처리하며, 스핀하지 않습니다.
+	기본으로는 파일과 FIFO 사이를 splice 로 옮기고, -c 옵션을 주면 버퍼로 복사합니다.
+	송신단이 FIFO 를 닫으면 수신단은 남은 데이터를 읽은 뒤 EOF 를 받습니다.
 
 	이러한 동작은 서버가 요청을 받아서 문제없이 처리한다는 가정하에 이루어집니다.
  */
@@ -23,25 +24,64 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 
 #include "file_util.h"
+#include "fifo_util.h"
+#include "reactor.h"
+#include "request_proto.h"
+#include "batch_util.h"
+#include "xfer_stats.h"
+#include "metrics.h"
+#include "log.h"
+#include "server_signal.h"
+#include "file_writer.h"
+#include "file_cache.h"
+#include "crc32c.h"
 
 #define REQ_MPQ_PERM 		0666
 #define IO_MPQ_PERM			0666
 #define MSG_BUFFER_SZ		2048	
 
-void signal_handler(int signal)
+// 리액터가 이벤트 한번에 옮길 최대 크기와 splice 한번의 크기
+#define REACTOR_BUDGET		(256 * 1024)
+#define REACTOR_SPLICE_SZ	(64 * 1024)
+
+// 0 이면 splice 를 쓰지 않고 버퍼로 복사합니다.
+int use_splice = 1;
+// 1 이면 복사 경로의 업로드를 O_DIRECT 로 씁니다(-D 옵션).
+int use_direct = 0;
+
+// 요청 FIFO, metrics 에서 읽히지 않은 요청의 크기를 볼 때 씁니다.
+int request_fd = -1;
+// 열려 있는 세션 수
+atomic_int sessions_active;
+
+// 요청 FIFO 를 지웁니다. abort 핸들러에서도 부르므로 시스템 콜만 씁니다.
+void remove_endpoint()
 {
 	unlink("./fifo/requests");
+}
+
+// 끝내는 시그널을 받으면 시그널을 기다리는 쓰레드(server_signal.c)에서 불립니다.
+void stop_server(int signal)
+{
+	remove_endpoint();
+	metrics_stop();
+	log_flush();
+	xfer_totals_print();
 	exit(1);
 }
 
@@ -54,267 +94,1148 @@ void fatal(const char* msg)
 typedef struct file_request
 {
 	int is_uploaded;
-	int filesize;
+	// 작은 파일들을 묶은 스트림이면 다 받은 뒤 ./file 에 풀어줍니다.
+	int is_batch;
+	off_t filesize;
 	char* filename;
+	uint32_t request_id;
+	// 파일을 나누어 받을 때 이 요청이 맡은 조각, stripe_cnt 가 0 이면 파일 전체입니다.
+	int stripe_idx, stripe_cnt;
 	// FIFO 파일 경로
 	char* fifopath;
+	// 데이터를 보내는 쪽이 구간 뒤에(세션이면 END 프레임에) CRC32C 를 붙입니다.
+	int checksum;
 } file_req;
 
-int receive_upload(file_req* pr, char* buffer);
-int send_download(file_req* pr, char* buffer);
-
-void* file_task(void* p)
+// 전송 하나의 상태입니다. 리액터 하나에 묶여서 그 쓰레드에서만 처리됩니다.
+typedef struct transfer
 {
+	reactor_handler handler;	// 반드시 첫번째 멤버
+	reactor* owner;
+	file_req* req;
+	int fifo, file;
+	// accum 은 FIFO 로 옮긴 크기, file_off 는 파일에서 다음으로 읽거나 쓸 위치
+	// range_len 은 이 전송이 맡은 구간의 크기입니다.
+	off_t accum, range_len;
+	loff_t file_off;
+	int no_splice;
+	// 복사 경로에서 FIFO 에 아직 못 쓴 버퍼
+	int buf_len, buf_off;
+	// 복사 경로의 업로드는 FIFO 에서 writer 의 버퍼로 바로 읽어서 모아 씁니다. 처음 복사할 때 만듭니다.
+	file_writer writer;
+	// 다운로드는 캐시(file_cache.c)의 항목을 쓰며, file 은 그 항목의 fd 입니다.
+	// 복사 경로는 항목의 매핑에서 FIFO 로 바로 쓰고, 매핑이 없으면 buffer 로 읽어서 씁니다.
+	file_cache_entry* entry;
+	// splice 로 받는 업로드는 받은 구간을 페이지 캐시에서 바로 확인하도록 매핑해 둡니다.
+	file_map map;
+	// 맡은 구간의 CRC32C 입니다. 업로드는 구간 뒤에 오는 클라이언트의 값을 peer_sum 에 sum_off 만큼 읽었습니다.
+	uint32_t sum, peer_sum;
+	int sum_off;
+	// blocked_at 은 FIFO 가 막혀서 다음 이벤트를 기다리기 시작한 시각입니다.
+	xfer_stats stats;
+	uint64_t blocked_at;
 	char buffer[MSG_BUFFER_SZ];
-	file_req* preq = (file_req*)p;
-	int result = preq->is_uploaded? receive_upload(preq, buffer): send_download(preq, buffer);
+} transfer;
 
+reactor* reactors;
+int reactor_cnt = 1;
+int next_reactor;
+
+void report_result(file_req* preq, int result)
+{
 	if (result < 0)
 	{
 		switch(result)
 		{
 			case -1:
-				printf(">> file_task: file(%s) cannot open..\n", preq->filename);
+				log_error(">> transfer: file(%s) cannot open..\n", preq->filename);
 				break;
 			case -2:
-				printf(">> file_task: fifo(%s) cannot open..\n", preq->fifopath);
+				log_error(">> transfer: fifo(%s) cannot open..\n", preq->fifopath);
+				break;
+			case -7:
+				log_error(">> transfer: batch(%s) cannot unpack..\n", preq->filename);
+				break;
+			case -8:
+				log_error(">> transfer: file(%s) checksum mismatch..\n", preq->filename);
 				break;
 			default:
-				printf(">> file_task: unknown error(%d)\n", result);
+				log_error(">> transfer: unknown error(%d)\n", result);
 				break;
 		}
 	}
+}
 
+void free_request(file_req* preq)
+{
 	free(preq->filename);
 	free(preq->fifopath);
 	free(preq);
-
-	return NULL;
 }
 
-// 업로드/ 클라이언트에서 보낸 FIFO 데이터를 FILE에 넣어줍니다.
-int receive_upload(file_req* pr, char* buffer)
+void transfer_finish(transfer* t, int result)
 {
-	struct timespec tstart, tend;
-	printf(">> receive_upload(fs=%d,name=\"%s\",fifo=\"%s\") start!\n", pr->filesize, pr->filename, pr->fifopath);
+	file_req* pr = t->req;
 
-	sprintf(buffer, "./file/%s", pr->filename);
-	int nwfd = open(buffer, O_WRONLY | O_CREAT);
-	int fifo = open(pr->fifopath, O_RDWR);
+	reactor_del(t->owner, t->fifo);
+	close(t->fifo);
 
-	if (nwfd < 0)
-		return -1;
-	if (pipe < 0)
-		return -2;
+	if (t->writer.buf)
+	{
+		if (!result && file_writer_flush(&t->writer) < 0)
+			result = -3;
+		file_writer_destroy(&t->writer);
+	}
+	file_map_close(&t->map);
 
-	int loop_cnt = 0;
-	long accum_time = 0;
-	int read_len = 0, accum = 0;
-	while(1)
+	// 묶음은 끝까지 받은 경우에만 풉니다.
+	if (pr->is_uploaded && pr->is_batch && !result && (t->accum < t->range_len || batch_unpack(t->file, "./file") < 0))
+		result = -7;
+	if (t->entry)
+		file_cache_put(t->entry);
+	else
+		close(t->file);
+	xfer_stats_end(&t->stats, result);
+
+	if (pr->is_uploaded)
 	{
-		clock_gettime(CLOCK_REALTIME, &tstart);
-		read_len = read(fifo, buffer, MSG_BUFFER_SZ);
-		clock_gettime(CLOCK_REALTIME, &tend);
+		unlink(pr->fifopath);
+		if (!result)
+			log_info(">> receive_upload(fs=%lld,name=\"%s\",fifo=\"%s\") end!\n", (long long)pr->filesize, pr->filename, pr->fifopath);
+	}
+	else if (!result)
+		log_info(">> send_download(fs=%lld,name=\"%s\",key=\"%s\") end!\n", (long long)pr->filesize, pr->filename, pr->fifopath);
+	if (!result)
+		xfer_stats_print(pr->is_uploaded? "receive_upload": "send_download", pr->filename, &t->stats);
+
+	report_result(pr, result);
+	free_request(pr);
+	free(t);
+}
 
-		if (tend.tv_nsec - tstart.tv_nsec > 0)
-			accum_time += tend.tv_nsec - tstart.tv_nsec;
+// 맡은 구간에서 남은 만큼만 옮기도록 한번에 옮길 크기를 줄여줍니다.
+size_t transfer_chunk(transfer* t, size_t max)
+{
+	off_t remain = t->range_len - t->accum;
+	return remain < (off_t)max? (size_t)remain: max;
+}
 
-		if (!read_len) break;
-		if (read_len < 0)
+// 업로드/ FIFO 에 데이터가 오면 리액터 쓰레드에서 불립니다.
+// 한번에 REACTOR_BUDGET 만큼만 옮기고 다른 전송에게 양보합니다.
+void on_upload_event(reactor_handler* h, uint32_t events)
+{
+	transfer* t = (transfer*)h;
+	int budget = REACTOR_BUDGET;
+	uint64_t t0 = xfer_now_ns();
+
+	// 지난번에 FIFO 가 막힌 뒤 이 이벤트가 오기까지 기다린 시간입니다.
+	t->stats.wait_ns += t0 - t->blocked_at;
+	while (budget > 0)
+	{
+		ssize_t n;
+		// 맡은 구간을 다 받았으면 뒤따라 오는 클라이언트의 CRC32C 를 읽어서 받은 것과 비교합니다.
+		if (t->req->checksum && t->accum >= t->range_len)
 		{
-			close(fifo);
-			unlink(pr->fifopath);
-			return -3;
+			n = read(t->fifo, (char*)&t->peer_sum + t->sum_off, CRC32C_SIZE - t->sum_off);
+			if (n < 0 && (errno == EAGAIN || errno == EINTR))
+				break;
+			// CRC32C 전에 닫았으면 클라이언트가 구간을 끝까지 보내지 못한 것입니다.
+			if (n <= 0)
+			{
+				transfer_finish(t, n < 0? -3: -6);
+				return;
+			}
+			if ((t->sum_off += n) == CRC32C_SIZE)
+			{
+				transfer_finish(t, t->peer_sum == t->sum? 0: -8);
+				return;
+			}
+			continue;
 		}
-		write(nwfd, buffer, read_len);
-		accum += read_len;
 
-		if (accum == pr->filesize)
-			break;
-	}
+		if (use_splice && !t->no_splice)
+		{
+			n = splice(t->fifo, NULL, t->file, &t->file_off, transfer_chunk(t, REACTOR_SPLICE_SZ), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0 && !t->accum && (errno == EINVAL || errno == ENOSYS))
+			{
+				t->no_splice = 1;
+				continue;
+			}
+			// 방금 쓴 페이지는 캐시에 있으므로 매핑에서 바로 확인합니다.
+			if (n > 0 && t->req->checksum && file_map_crc32c(&t->map, t->accum, n, &t->sum) < 0)
+			{
+				transfer_finish(t, -3);
+				return;
+			}
+		}
+		else
+		{
+			char* dst;
+			if (!t->writer.buf && file_writer_init(&t->writer, t->file, t->file_off, use_direct) < 0)
+			{
+				transfer_finish(t, -3);
+				return;
+			}
+			size_t room = file_writer_space(&t->writer, &dst);
+			n = read(t->fifo, dst, transfer_chunk(t, room));
+			if (n > 0)
+			{
+				// 버퍼가 차면 commit 이 써버리고 남은 것을 옮기므로 그 전에 구합니다.
+				if (t->req->checksum)
+					t->sum = crc32c_update(t->sum, dst, n);
+				if (file_writer_commit(&t->writer, n) < 0)
+				{
+					transfer_finish(t, -3);
+					return;
+				}
+				t->file_off += n;
+			}
+		}
 
-	close(nwfd);
-	
-	close(fifo);
-	unlink(pr->fifopath);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			transfer_finish(t, -3);
+			return;
+		}
 
-	printf(">> receive_upload(fs=%d,name=\"%s\",fifo=\"%s\") end(%ld)!\n", pr->filesize, pr->filename, pr->fifopath, accum_time);
-	return 0;
+		// 클라이언트가 FIFO 를 닫았습니다. 구간을 다 보내기 전이면 실패입니다.
+		if (!n)
+		{
+			transfer_finish(t, t->accum < t->range_len? -6: 0);
+			return;
+		}
+
+		t->accum += n;
+		budget -= n;
+
+		uint64_t t1 = xfer_now_ns();
+		xfer_stats_chunk(&t->stats, n, 0, t1 - t0);
+		t0 = t1;
+
+		// CRC32C 를 주고받지 않으면 구간을 다 받은 것으로 끝입니다.
+		if (!t->req->checksum && t->range_len > 0 && t->accum >= t->range_len)
+		{
+			transfer_finish(t, 0);
+			return;
+		}
+	}
+	t->blocked_at = xfer_now_ns();
 }
 
-int get_max_fifo_size(int fifofd)
+// 다운로드/ FIFO 에 공간이 생기면 리액터 쓰레드에서 불립니다.
+// 맡은 구간을 다 보내면 FIFO 를 닫아서 클라이언트에게 EOF 를 알립니다.
+void on_download_event(reactor_handler* h, uint32_t events)
 {
-	return fcntl(fifofd, F_GETPIPE_SZ);
+	transfer* t = (transfer*)h;
+	int budget = REACTOR_BUDGET;
+	uint64_t t0 = xfer_now_ns();
+
+	// 지난번에 FIFO 가 막힌 뒤 이 이벤트가 오기까지 기다린 시간입니다.
+	t->stats.wait_ns += t0 - t->blocked_at;
+	while (budget > 0)
+	{
+		ssize_t n;
+		// 구간을 다 보냈으면 CRC32C 를 붙이고 닫습니다. PIPE_BUF 보다 작으므로 한번에 들어갑니다.
+		if (t->accum >= t->range_len)
+		{
+			if (!t->req->checksum)
+			{
+				transfer_finish(t, 0);
+				return;
+			}
+			n = write(t->fifo, &t->sum, CRC32C_SIZE);
+			if (n < 0 && (errno == EAGAIN || errno == EINTR))
+				break;
+			transfer_finish(t, n == CRC32C_SIZE? 0: -4);
+			return;
+		}
+
+		if (use_splice && !t->no_splice)
+		{
+			n = splice(t->file, &t->file_off, t->fifo, NULL, transfer_chunk(t, REACTOR_SPLICE_SZ), SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+			if (n < 0 && !t->accum && (errno == EINVAL || errno == ENOSYS))
+			{
+				t->no_splice = 1;
+				continue;
+			}
+			// 보낸 페이지는 캐시의 매핑에서 바로 확인합니다.
+			if (n > 0 && t->req->checksum && file_map_crc32c(&t->entry->map, t->file_off - n, n, &t->sum) < 0)
+			{
+				transfer_finish(t, -4);
+				return;
+			}
+		}
+		else
+		{
+			// 복사 경로는 매핑에서 FIFO 로 바로 써서, pread 와 버퍼로의 복사를 없앱니다.
+			// 그 사이에 파일이 줄어들면 write 가 EFAULT 로 실패합니다.
+			if (t->entry->map.base)
+			{
+				n = write(t->fifo, t->entry->map.data + t->file_off, transfer_chunk(t, REACTOR_SPLICE_SZ));
+				if (n > 0)
+				{
+					if (t->req->checksum && file_map_crc32c(&t->entry->map, t->file_off, n, &t->sum) < 0)
+					{
+						transfer_finish(t, -4);
+						return;
+					}
+					t->file_off += n;
+				}
+			}
+			else
+			{
+				if (t->buf_off == t->buf_len)
+				{
+					t->buf_off = 0;
+					t->buf_len = pread(t->file, t->buffer, transfer_chunk(t, MSG_BUFFER_SZ), t->file_off);
+					if (t->buf_len < 0)
+					{
+						transfer_finish(t, -4);
+						return;
+					}
+					t->file_off += t->buf_len;
+					// 구간을 다 보내기 전에 파일이 줄어들었습니다.
+					if (!t->buf_len)
+					{
+						transfer_finish(t, -4);
+						return;
+					}
+					if (t->req->checksum)
+						t->sum = crc32c_update(t->sum, t->buffer, t->buf_len);
+				}
+
+				n = write(t->fifo, t->buffer + t->buf_off, t->buf_len - t->buf_off);
+				if (n > 0)
+					t->buf_off += n;
+			}
+		}
+
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			transfer_finish(t, -4);
+			return;
+		}
+
+		// splice 경로에서 구간을 다 보내기 전에 파일 끝에 도착했습니다.
+		if (!n)
+		{
+			transfer_finish(t, -4);
+			return;
+		}
+
+		t->accum += n;
+		budget -= n;
+
+		uint64_t t1 = xfer_now_ns();
+		xfer_stats_chunk(&t->stats, n, 0, t1 - t0);
+		t0 = t1;
+	}
+	t->blocked_at = xfer_now_ns();
 }
 
-int get_remain_fifo_size(int fifofd)
+transfer* transfer_create(file_req* pr, int fifo, int file, void (*on_event)(reactor_handler*, uint32_t))
 {
-	int sz = 0;
-	ioctl(fifofd, FIONREAD, &sz);
-	return fcntl(fifofd, F_GETPIPE_SZ) - sz;
+	transfer* t = (transfer*)malloc(sizeof(transfer));
+	memset(t, 0, offsetof(transfer, buffer));
+	t->handler.on_event = on_event;
+	xfer_stats_begin(&t->stats, pr->is_uploaded? XFER_UPLOAD: XFER_DOWNLOAD);
+	t->blocked_at = t->stats.start_ns;
+	t->req = pr;
+	t->fifo = fifo;
+	t->file = file;
+
+	uint64_t offset, len;
+	req_stripe_range(pr->filesize, pr->stripe_idx, pr->stripe_cnt, &offset, &len);
+	t->file_off = offset;
+	t->range_len = len;
+
+	// 리액터들에게 돌아가며 나누어 줍니다.
+	t->owner = &reactors[next_reactor++ % reactor_cnt];
+	return t;
 }
 
-// 다운로드/ 클라이언트가 요청한 파일을 FIFO에 넣어줍니다. 
-// 여기서도 스핀락으로 파이프 크기에 따라 조절합니다.
-int send_download(file_req* pr, char* buffer)
+// 업로드/ 클라이언트에서 보낸 FIFO 데이터를 FILE에 넣어주도록 리액터에 등록합니다.
+// 쓰는 쪽이 없어도 논블로킹으로 열리며, 클라이언트가 열고 쓰기 시작하면 이벤트가 옵니다.
+// 스트라이프 요청이면 맡은 구간에만 씁니다.
+int receive_upload(file_req* pr)
 {
-	struct timespec tstart, tend;
+	char path[512];
+	log_info(">> receive_upload(fs=%lld,name=\"%s\",fifo=\"%s\",stripe=%d/%d) start!\n", (long long)pr->filesize, pr->filename, pr->fifopath, pr->stripe_idx, pr->stripe_cnt);
 
-	printf(">> send_download(fs=%d,name=\"%s\",fifo=\"%s\") start!\n", pr->filesize, pr->filename, pr->fifopath);
+	int fifo = open(pr->fifopath, O_RDONLY | O_NONBLOCK);
+	if (fifo < 0)
+		return -2;
+
+	sprintf(path, "./file/%s", pr->filename);
+	// 맡은 구간을 미리 잡아둡니다(file_writer.c).
+	// 묶음은 이름 없는 임시 파일로 받아서 다 받은 뒤에 풉니다.
+	uint64_t offset, len;
+	req_stripe_range(pr->filesize, pr->stripe_idx, pr->stripe_cnt, &offset, &len);
+	// splice 로 받은 구간은 매핑해서 확인하므로 읽기로도 엽니다.
+	int nwfd = pr->is_batch? batch_tmpfile("./file"): open(path, O_RDWR | O_CREAT, 0666);
+	if (nwfd < 0 || file_writer_prepare(nwfd, pr->filesize, offset, len) < 0)
+	{
+		if (nwfd >= 0)
+			close(nwfd);
+		close(fifo);
+		unlink(pr->fifopath);
+		return -1;
+	}
 
-	sprintf(buffer, "./file/%s", pr->filename);
-	int odfd = open(buffer, O_RDONLY);
-	int fifo = open(pr->fifopath, O_RDWR);
+	fifo_grow(fifo, FIFO_PIPE_SZ);
 
-	struct stat st;
-	stat(buffer, &st);
-	pr->filesize = st.st_size;
-	
-	printf(">> send_download(fs=%d,name=\"%s\",fifo=\"%s\") update fs\n", pr->filesize, pr->filename, pr->fifopath);
+	transfer* t = transfer_create(pr, fifo, nwfd, on_upload_event);
+	// 확인할 구간을 매핑할 수 없으면 받는 데이터를 직접 보는 복사 경로로 받습니다.
+	if (use_splice && pr->checksum && file_map_open(&t->map, nwfd, t->file_off, t->range_len) < 0)
+		t->no_splice = 1;
+	if (reactor_add(t->owner, fifo, EPOLLIN, &t->handler) < 0)
+	{
+		file_map_close(&t->map);
+		close(fifo);
+		close(nwfd);
+		unlink(pr->fifopath);
+		xfer_stats_end(&t->stats, -3);
+		free(t);
+		return -3;
+	}
+	return 0;
+}
 
-	if (odfd < 0)
-		return -1;
+// 다운로드/ 클라이언트가 요청한 파일을 FIFO에 넣어주도록 리액터에 등록합니다.
+// 클라이언트는 요청 전에 읽는 쪽을 열어두므로 논블로킹으로 바로 열 수 있습니다.
+// 크기 헤더는 항상 파일 전체 크기이고, 스트라이프 요청이면 그 뒤에 맡은 구간만 보냅니다.
+int send_download(file_req* pr)
+{
+	char path[512];
+
+	log_info(">> send_download(fs=%lld,name=\"%s\",fifo=\"%s\",stripe=%d/%d) start!\n", (long long)pr->filesize, pr->filename, pr->fifopath, pr->stripe_idx, pr->stripe_cnt);
+
+	int fifo = open(pr->fifopath, O_WRONLY | O_NONBLOCK);
 	if (fifo < 0)
 		return -2;
 
-	*(int*)buffer = pr->filesize;
+	// 같은 파일을 받는 전송들은 캐시에서 열어둔 파일과 매핑을 같이 씁니다.
+	// splice 와 pread 는 항상 위치를 주고 읽으므로 fd 를 나누어 써도 됩니다.
+	sprintf(path, "./file/%s", pr->filename);
+	file_cache_entry* entry = file_cache_get(path);
+	if (!entry)
+	{
+		// 크기 없이 닫아서 클라이언트가 기다리지 않도록 합니다.
+		close(fifo);
+		return -1;
+	}
+	pr->filesize = entry->size;
+
+	log_debug(">> send_download(fs=%lld,name=\"%s\",fifo=\"%s\") update fs\n", (long long)pr->filesize, pr->filename, pr->fifopath);
 
-	if (write(fifo, buffer, 4) < 0)
+	// 새 FIFO 는 비어 있으므로 크기 헤더는 한번에 들어갑니다.
+	// 2GB 가 넘는 파일을 위해 64비트로 보냅니다.
+	int64_t size_hdr = pr->filesize;
+	if (write(fifo, &size_hdr, sizeof(int64_t)) != sizeof(int64_t))
 	{
+		file_cache_put(entry);
 		close(fifo);
 		return -3;
 	}
 
-	int loop_cnt = 0;
-	long accum_time = 0;
-	int read_len = 0, accum = 0, idx = 0;
-	while(1)
+	fifo_grow(fifo, FIFO_PIPE_SZ);
+	transfer* t = transfer_create(pr, fifo, entry->fd, on_download_event);
+	t->entry = entry;
+	// splice 로 보낸 데이터는 매핑에서 확인하므로, 확인할 때 매핑이 없으면 복사 경로로 보냅니다.
+	if (pr->checksum && !entry->map.base)
+		t->no_splice = 1;
+	// 커널이 맡은 구간을 미리 읽어두도록 해서 리액터의 파일 읽기가 디스크를 기다리지 않게 합니다.
+	file_cache_advise(entry, t->file_off, t->range_len);
+	if (reactor_add(t->owner, fifo, EPOLLOUT, &t->handler) < 0)
 	{
-		read_len = read(odfd, buffer, MSG_BUFFER_SZ);
-		if (!read_len) break;
-		accum += read_len;
+		close(fifo);
+		file_cache_put(entry);
+		xfer_stats_end(&t->stats, -4);
+		free(t);
+		return -4;
+	}
+	return 0;
+}
 
-		while(1)
-			if (get_remain_fifo_size(fifo) >= read_len)
+void start_transfer(file_req* preq)
+{
+	int result = preq->is_uploaded? receive_upload(preq): send_download(preq);
+
+	if (result < 0)
+	{
+		report_result(preq, result);
+		free_request(preq);
+	}
+}
+
+// 세션 안의 전송 하나입니다. 세션을 맡은 리액터 쓰레드에서만 다룹니다.
+typedef struct session_stream
+{
+	struct session_stream* next;
+	uint32_t id;
+	file_req* req;
+	int file;
+	off_t accum, range_len, file_off;
+	int result;
+	int phase;
+	xfer_stats stats;
+	// 업로드의 DATA 프레임들을 모아서 씁니다.
+	file_writer writer;
+	// 다운로드는 캐시(file_cache.c)의 항목에서 프레임마다 pread 없이 복사합니다.
+	file_cache_entry* entry;
+	// 옮긴 DATA 프레임들의 CRC32C, END 프레임에 담아 보내거나 클라이언트가 담아 보낸 값과 비교합니다.
+	uint32_t sum;
+} session_stream;
+
+// 세션 스트림이 다음에 할 일입니다.
+enum
+{
+	STREAM_RECV,		// 업로드 데이터를 받는 중
+	STREAM_SEND_SIZE,	// 다운로드 크기 프레임을 보낼 차례
+	STREAM_SEND_DATA,
+	STREAM_SEND_END		// 결과(END/FAIL) 프레임을 보낼 차례
+};
+
+// 클라이언트 하나의 세션입니다. 클라이언트가 만든 <base>.up 으로 요청과 업로드 데이터가 오고,
+// <base>.down 으로 다운로드 데이터와 결과가 나갑니다.
+// 두 FIFO 는 같은 리액터에 묶이며, 각자의 핸들러가 자기 fd 를 빼고, 나중에 빼는 쪽이 세션을 지웁니다.
+typedef struct session
+{
+	reactor_handler in_handler;		// 반드시 첫번째 멤버
+	reactor_handler out_handler;
+	reactor* owner;
+	char* base;
+	int up, down;
+	int up_closed, down_closed;
+	uint32_t out_events;
+	// 데이터를 받고 있는 업로드 스트림들
+	session_stream* recv;
+	// 보낼 프레임이 있는 스트림들, 앞에서부터 한 프레임씩 돌아가며 보냅니다.
+	session_stream* send_head, *send_tail;
+	int in_len;
+	int out_len, out_off;
+	char in_buf[FIFO_FRAME_MAX * 4];
+	char out_buf[FIFO_FRAME_MAX];
+} session;
+
+void stream_finish(session* s, session_stream* st)
+{
+	file_req* pr = st->req;
+
+	file_writer_destroy(&st->writer);
+	if (st->entry)
+		file_cache_put(st->entry);
+	if (st->file >= 0)
+		close(st->file);
+	xfer_stats_end(&st->stats, st->result);
+	if (!st->result)
+	{
+		log_info(">> %s(fs=%lld,name=\"%s\",session=\"%s\") end!\n", pr->is_uploaded? "receive_upload": "send_download", (long long)pr->filesize, pr->filename, s->base);
+		xfer_stats_print(pr->is_uploaded? "receive_upload": "send_download", pr->filename, &st->stats);
+	}
+
+	report_result(pr, st->result);
+	free_request(pr);
+	free(st);
+}
+
+void session_push_send(session* s, session_stream* st)
+{
+	// 결과를 보낼 곳이 없으면 바로 정리합니다.
+	if (s->down_closed)
+	{
+		stream_finish(s, st);
+		return;
+	}
+
+	st->next = NULL;
+	if (s->send_tail)
+		s->send_tail->next = st;
+	else
+		s->send_head = st;
+	s->send_tail = st;
+}
+
+session_stream* session_find_recv(session* s, uint32_t id, int unlink_it)
+{
+	for (session_stream** pp = &s->recv; *pp; pp = &(*pp)->next)
+	{
+		if ((*pp)->id != id)
+			continue;
+
+		session_stream* st = *pp;
+		if (unlink_it)
+			*pp = st->next;
+		return st;
+	}
+	return NULL;
+}
+
+void session_free(session* s)
+{
+	while (s->recv)
+	{
+		session_stream* st = s->recv;
+		s->recv = st->next;
+		stream_finish(s, st);
+	}
+	while (s->send_head)
+	{
+		session_stream* st = s->send_head;
+		s->send_head = st->next;
+		stream_finish(s, st);
+	}
+
+	close(s->up);
+	close(s->down);
+	log_info(">> session(\"%s\") end!\n", s->base);
+	free(s->base);
+	free(s);
+	atomic_fetch_sub(&sessions_active, 1);
+}
+
+// 보낼 것이 있을 때만 .down 의 EPOLLOUT 을 받도록 합니다.
+// 클라이언트가 .up 을 닫은 뒤에는 정리하도록 한번 더 깨웁니다.
+void session_arm(session* s)
+{
+	if (s->down_closed)
+		return;
+
+	uint32_t events = (s->send_head || s->out_off < s->out_len || s->up_closed)? EPOLLOUT: 0;
+	if (events != s->out_events && reactor_mod(s->owner, s->down, events, &s->out_handler) == 0)
+		s->out_events = events;
+}
+
+// 세션 안에서 요청 하나를 시작합니다. 실패해도 스트림은 만들어서 클라이언트에게 FAIL 로 알립니다.
+void session_start_stream(session* s, uint32_t id, file_req* pr)
+{
+	char path[512];
+	session_stream* st = (session_stream*)calloc(1, sizeof(session_stream));
+	st->id = id;
+	st->req = pr;
+	st->file = -1;
+	xfer_stats_begin(&st->stats, pr->is_uploaded? XFER_UPLOAD: XFER_DOWNLOAD);
+
+	log_info(">> %s(fs=%lld,name=\"%s\",session=\"%s\",stripe=%d/%d) start!\n", pr->is_uploaded? "receive_upload": "send_download", (long long)pr->filesize, pr->filename, s->base, pr->stripe_idx, pr->stripe_cnt);
+
+	sprintf(path, "./file/%s", pr->filename);
+	uint64_t offset, len;
+	if (pr->is_uploaded)
+	{
+		// 맡은 구간을 미리 잡아두고, DATA 프레임들은 모아서 씁니다(file_writer.c).
+		req_stripe_range(pr->filesize, pr->stripe_idx, pr->stripe_cnt, &offset, &len);
+		st->file = pr->is_batch? batch_tmpfile("./file"): open(path, O_WRONLY | O_CREAT, 0666);
+		if (st->file < 0 || file_writer_prepare(st->file, pr->filesize, offset, len) < 0 ||
+			file_writer_init(&st->writer, st->file, offset, use_direct) < 0)
+			st->result = -1;
+	}
+	else
+	{
+		st->entry = file_cache_get(path);
+		if (!st->entry)
+			st->result = -1;
+		else
+			pr->filesize = st->entry->size;
+		req_stripe_range(pr->filesize, pr->stripe_idx, pr->stripe_cnt, &offset, &len);
+	}
+	st->file_off = offset;
+	st->range_len = len;
+
+	if (pr->is_uploaded)
+	{
+		// 업로드는 실패해도 뒤따라 오는 데이터를 버리기 위해 END 까지 받습니다.
+		st->phase = STREAM_RECV;
+		st->next = s->recv;
+		s->recv = st;
+		return;
+	}
+
+	if (!st->result)
+		file_cache_advise(st->entry, st->file_off, st->range_len);
+	st->phase = st->result? STREAM_SEND_END: STREAM_SEND_SIZE;
+	session_push_send(s, st);
+}
+
+void session_on_frame(session* s, const struct fifo_frame_hdr* hdr, const char* payload)
+{
+	session_stream* st;
+
+	switch(hdr->type)
+	{
+		case FIFO_FRAME_REQUEST:
+			{
+				req_view v;
+				if (req_decode(payload, hdr->len, &v) != hdr->len)
+				{
+					log_warn(">> session(\"%s\"): malformed request, drop\n", s->base);
+					break;
+				}
+
+				file_req* req = (file_req*)malloc(sizeof(file_req));
+				req->is_uploaded = v.flags & REQ_FLAG_UPLOAD;
+				req->is_batch = (v.flags & REQ_FLAG_BATCH) != 0;
+				req->filesize = v.filesize;
+				req->request_id = v.request_id;
+				req->stripe_idx = v.stripe_idx;
+				req->stripe_cnt = v.stripe_cnt;
+				req->filename = strndup(v.name, v.name_len);
+				req->fifopath = strdup(s->base);
+				req->checksum = (v.flags & REQ_FLAG_CHECKSUM) != 0;
+
+				session_start_stream(s, hdr->stream_id, req);
+			}
+			break;
+		case FIFO_FRAME_DATA:
+			st = session_find_recv(s, hdr->stream_id, 0);
+			if (!st)
 				break;
+			{
+				// 세션의 프레임은 리액터가 이미 읽어둔 것이므로 파일에 쓰는 시간만 잽니다.
+				uint64_t t0 = xfer_now_ns();
+				if (st->req->checksum)
+					st->sum = crc32c_update(st->sum, payload, hdr->len);
+				if (!st->result && file_writer_put(&st->writer, payload, hdr->len) < 0)
+					st->result = -3;
+				st->file_off += hdr->len;
+				st->accum += hdr->len;
+				xfer_stats_chunk(&st->stats, hdr->len, 0, xfer_now_ns() - t0);
+			}
+			break;
+		case FIFO_FRAME_END:
+			st = session_find_recv(s, hdr->stream_id, 1);
+			if (!st)
+				break;
+			if (!st->result && st->accum < st->range_len)
+				st->result = -3;
+			// 구간을 다 보낸 클라이언트는 END 에 CRC32C 를 담아 보냅니다.
+			if (!st->result && st->req->checksum && (hdr->len != CRC32C_SIZE || memcmp(payload, &st->sum, CRC32C_SIZE)))
+				st->result = -8;
+			if (!st->result && file_writer_flush(&st->writer) < 0)
+				st->result = -3;
+			if (!st->result && st->req->is_batch && batch_unpack(st->file, "./file") < 0)
+				st->result = -7;
+			st->phase = STREAM_SEND_END;
+			session_push_send(s, st);
+			break;
+	}
+}
 
+// 클라이언트가 .up 을 닫았습니다. END 를 받지 못한 업로드는 실패로 돌려줍니다.
+void session_close_up(session* s)
+{
+	reactor_del(s->owner, s->up);
+	s->up_closed = 1;
 
-		clock_gettime(CLOCK_REALTIME, &tstart);
-		if (write(fifo, buffer, read_len) < 0)
+	while (s->recv)
+	{
+		session_stream* st = s->recv;
+		s->recv = st->next;
+		if (!st->result)
+			st->result = -3;
+		st->phase = STREAM_SEND_END;
+		session_push_send(s, st);
+	}
+
+	if (s->down_closed)
+		session_free(s);
+	else
+		session_arm(s);
+}
+
+// .up 에 데이터가 오면 리액터 쓰레드에서 불립니다.
+// 한번에 REACTOR_BUDGET 만큼만 읽고, 완성된 프레임들을 처리합니다.
+void on_session_in_event(reactor_handler* h, uint32_t events)
+{
+	session* s = (session*)h;
+	int budget = REACTOR_BUDGET;
+
+	while (budget > 0)
+	{
+		ssize_t n = read(s->up, s->in_buf + s->in_len, sizeof(s->in_buf) - s->in_len);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			break;
+		if (n <= 0)
 		{
-			close(fifo);
-			return -4;
+			session_close_up(s);
+			return;
 		}
-		clock_gettime(CLOCK_REALTIME, &tend);
+		s->in_len += n;
+		budget -= n;
 
-		if (tend.tv_nsec - tstart.tv_nsec > 0)
-			accum_time += tend.tv_nsec - tstart.tv_nsec;
+		int off = 0;
+		while (s->in_len - off >= (int)sizeof(struct fifo_frame_hdr))
+		{
+			struct fifo_frame_hdr hdr;
+			memcpy(&hdr, s->in_buf + off, sizeof(hdr));
+			if (hdr.len > FIFO_FRAME_PAYLOAD_MAX)
+			{
+				// 클라이언트는 프레임을 한번에 쓰므로 여기로 오면 다시 맞출 수 없습니다.
+				log_warn(">> session(\"%s\"): malformed frame, close\n", s->base);
+				session_close_up(s);
+				return;
+			}
+			if (s->in_len - off < (int)sizeof(hdr) + hdr.len)
+				break;
+
+			session_on_frame(s, &hdr, s->in_buf + off + sizeof(hdr));
+			off += sizeof(hdr) + hdr.len;
+		}
+
+		s->in_len -= off;
+		memmove(s->in_buf, s->in_buf + off, s->in_len);
 	}
-	
-	close(odfd);
 
-	printf(">> send_download(fs=%d,name=\"%s\",fifo=\"%s\") on idle\n", pr->filesize, pr->filename, pr->fifopath);
+	session_arm(s);
+}
+
+// 보낼 스트림 하나에서 다음 프레임을 out_buf 에 만들고, 남은 것이 있으면 다시 뒤에 넣습니다.
+void session_next_frame(session* s)
+{
+	session_stream* st = s->send_head;
+	s->send_head = st->next;
+	if (!s->send_head)
+		s->send_tail = NULL;
+
+	struct fifo_frame_hdr hdr;
+	char* payload = s->out_buf + sizeof(hdr);
+	hdr.stream_id = st->id;
+	hdr.len = 0;
 
-	while(0)
+	if (st->phase == STREAM_SEND_SIZE)
 	{
-		if (get_max_fifo_size(fifo) == 0)
-			break;
+		// 크기는 항상 파일 전체 크기이고, 스트라이프 요청이면 그 뒤에 맡은 구간만 보냅니다.
+		int64_t size_hdr = st->req->filesize;
+		memcpy(payload, &size_hdr, sizeof(int64_t));
+		hdr.type = FIFO_FRAME_SIZE;
+		hdr.len = sizeof(int64_t);
+		st->phase = st->range_len > 0? STREAM_SEND_DATA: STREAM_SEND_END;
+	}
+	else if (st->phase == STREAM_SEND_DATA)
+	{
+		off_t remain = st->range_len - st->accum;
+		uint64_t t0 = xfer_now_ns();
+		ssize_t n = file_cache_read(st->entry, payload, st->file_off, remain < FIFO_FRAME_PAYLOAD_MAX? remain: FIFO_FRAME_PAYLOAD_MAX);
+		if (n <= 0)
+		{
+			st->result = -4;
+			st->phase = STREAM_SEND_END;
+		}
+		else
+		{
+			hdr.type = FIFO_FRAME_DATA;
+			hdr.len = n;
+			if (st->req->checksum)
+				st->sum = crc32c_update(st->sum, payload, n);
+			st->file_off += n;
+			st->accum += n;
+			xfer_stats_chunk(&st->stats, n, 0, xfer_now_ns() - t0);
+			if (st->accum >= st->range_len)
+				st->phase = STREAM_SEND_END;
+		}
 	}
 
-	close(fifo);
+	// 결과 프레임입니다. FAIL 에는 결과 코드를, 다운로드의 END 에는 보낸 구간의 CRC32C 를 담습니다.
+	int done = 0;
+	if (!hdr.len)
+	{
+		hdr.type = st->result? FIFO_FRAME_FAIL: FIFO_FRAME_END;
+		if (st->result)
+		{
+			int32_t code = st->result;
+			memcpy(payload, &code, sizeof(int32_t));
+			hdr.len = sizeof(int32_t);
+		}
+		else if (!st->req->is_uploaded && st->req->checksum)
+		{
+			memcpy(payload, &st->sum, CRC32C_SIZE);
+			hdr.len = CRC32C_SIZE;
+		}
+		done = 1;
+	}
+
+	memcpy(s->out_buf, &hdr, sizeof(hdr));
+	s->out_len = sizeof(hdr) + hdr.len;
+	s->out_off = 0;
+
+	if (done)
+		stream_finish(s, st);
+	else
+		session_push_send(s, st);
+}
 
- 	printf(">> send_download(fs=%d,name=\"%s\",key=\"%s\") end(%ld)!\n", pr->filesize, pr->filename, pr->fifopath, accum_time);
+// .down 에 공간이 생기면 리액터 쓰레드에서 불립니다.
+// 스트림들을 돌아가며 한 프레임씩 보내서 큰 다운로드가 작은 전송들을 막지 않게 합니다.
+void on_session_out_event(reactor_handler* h, uint32_t events)
+{
+	session* s = (session*)((char*)h - offsetof(session, out_handler));
+	int budget = REACTOR_BUDGET;
 
+	while (budget > 0)
+	{
+		if (s->out_off == s->out_len)
+		{
+			if (!s->send_head)
+				break;
+			session_next_frame(s);
+		}
+
+		ssize_t n = write(s->down, s->out_buf + s->out_off, s->out_len - s->out_off);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+
+			// 클라이언트가 .down 을 닫았습니다. 남은 결과는 보내지 않고 정리합니다.
+			reactor_del(s->owner, s->down);
+			s->down_closed = 1;
+			s->out_off = s->out_len = 0;
+			while (s->send_head)
+			{
+				session_stream* st = s->send_head;
+				s->send_head = st->next;
+				stream_finish(s, st);
+			}
+			s->send_tail = NULL;
+
+			if (s->up_closed)
+				session_free(s);
+			return;
+		}
+		s->out_off += n;
+		budget -= n;
+	}
+
+	// .up 이 닫혔고 더 보낼 것이 없으면 .down 을 닫아서 클라이언트에게 EOF 를 알립니다.
+	if (s->up_closed && !s->send_head && s->out_off == s->out_len)
+	{
+		reactor_del(s->owner, s->down);
+		s->down_closed = 1;
+		session_free(s);
+		return;
+	}
+
+	session_arm(s);
+}
+
+// 클라이언트가 세션을 열었습니다. 클라이언트는 .down 의 읽는 쪽을 먼저 열어두고
+// .up 을 쓰는 쪽으로 열며 기다리고 있으므로 둘 다 논블로킹으로 바로 열 수 있습니다.
+int session_start(const char* base, int len)
+{
+	char path[REQ_KEY_MAX + 16];
+	session* s = (session*)malloc(sizeof(session));
+	memset(s, 0, offsetof(session, in_buf));
+	s->in_handler.on_event = on_session_in_event;
+	s->out_handler.on_event = on_session_out_event;
+	s->base = strndup(base, len);
+
+	log_info(">> session(\"%s\") start!\n", s->base);
+
+	sprintf(path, "%s.down", s->base);
+	s->down = open(path, O_WRONLY | O_NONBLOCK);
+	sprintf(path, "%s.up", s->base);
+	s->up = open(path, O_RDONLY | O_NONBLOCK);
+	if (s->down < 0 || s->up < 0)
+	{
+		if (s->down >= 0)
+			close(s->down);
+		if (s->up >= 0)
+			close(s->up);
+		log_error(">> session(\"%s\"): fifo cannot open..\n", s->base);
+		free(s->base);
+		free(s);
+		return -2;
+	}
+
+	fifo_grow(s->up, FIFO_PIPE_SZ);
+	fifo_grow(s->down, FIFO_PIPE_SZ);
+
+	// .down 을 먼저 등록해야 .up 의 핸들러가 바로 EPOLLOUT 을 켤 수 있습니다.
+	s->owner = &reactors[next_reactor++ % reactor_cnt];
+	if (reactor_add(s->owner, s->down, 0, &s->out_handler) < 0)
+	{
+		close(s->down);
+		close(s->up);
+		free(s->base);
+		free(s);
+		return -3;
+	}
+	if (reactor_add(s->owner, s->up, EPOLLIN, &s->in_handler) < 0)
+	{
+		reactor_del(s->owner, s->down);
+		close(s->down);
+		close(s->up);
+		free(s->base);
+		free(s);
+		return -3;
+	}
+	atomic_fetch_add(&sessions_active, 1);
 	return 0;
 }
 
 // 메인쓰레드에서 수행되는 함수로, 
 // 요청 FIFO 를 만들고, 이에 들어오는 모든 데이터를 읽어
-// 정리하고, 쓰레드를 할당해줍니다.
+// 정리하고, 전송을 리액터에 등록해줍니다.
 void read_request()
 {
 	int rqid = 0, e;
 	if ((e = mkfifo("./fifo/requests", 0666)) < 0)
-		if (e != EEXIST)
+		if (errno != EEXIST)
 			fatal("Fail to make request fifo.. ");
 	if ((rqid = open("./fifo/requests", O_RDWR, 0666)) < 0)
 		fatal("Fail to open request fifo.. ");
+	request_fd = rqid;
 
-	int value, filesize, ipc_key;
-	char filename[512], path[512], buffer[MSG_BUFFER_SZ];
-
-	int read_count = 0,
-		scan_count = 0;
+	// FIFO 는 스트림이므로 읽기 한번에 프레임이 잘려서 올 수 있습니다.
+	// 남은 부분은 버퍼 앞으로 옮겨두고 다음 읽기에 이어붙입니다.
+	char buffer[MSG_BUFFER_SZ];
+	int buffered = 0;
 
 	do
 	{
-		read_count = read(rqid, buffer, MSG_BUFFER_SZ);
+		int read_count = read(rqid, buffer + buffered, MSG_BUFFER_SZ - buffered);
 
 		if (read_count < 0)
 		{
-			fatal("Fail to msgrcv from request.. ");
+			fatal("Fail to read from request.. ");
 			return;
 		}
+		buffered += read_count;
 
-		char* temp = buffer;
-		do
+		const char* temp = buffer;
+		while(1)
 		{
-			temp[read_count] = '\0';
-			scan_count = sscanf(temp, "%d %d %s %s\n", &value, &filesize, filename, path);
-
-			if (scan_count != 4) break;
-
-			int filename_len = strlen(filename), pipepath_len = strlen(path);
-			file_req* req = (file_req*)malloc(sizeof(file_req));
-			req->is_uploaded = value;
-			req->filesize = filesize;
-		
-			req->filename = (char*)malloc(sizeof(char)*(filename_len+1));
-			strcpy(req->filename, filename);
-			req->filename[filename_len] = '\0';
-
-			req->fifopath = (char*)malloc(sizeof(char)*(pipepath_len+1));
-			strcpy(req->fifopath, path);
-			req->fifopath[pipepath_len] = '\0';
-
-			pthread_t pid;
-			pthread_create(&pid, NULL, file_task, req);
-
-			for (int i = 0; i < strlen(temp); i++)
+			req_view v;
+			int frame_len = req_decode(temp, buffered - (temp - buffer), &v);
+			if (!frame_len) break;
+			if (frame_len < 0 || !v.key_len)
 			{
-				if (temp[i] == '\n')
-				{
-					temp += i;
-					break;
-				}
+				// 클라이언트는 요청을 PIPE_BUF 보다 작게 한번에 쓰므로 여기로 오면 다시 맞출 수 없습니다.
+				log_warn(">> read_request: malformed request, drop %d bytes\n", buffered);
+				temp = buffer + buffered;
+				break;
 			}
 
-			if (*temp == '\n')
+			// 세션 요청의 키는 클라이언트가 만든 세션 FIFO 들의 공통 경로입니다.
+			if (v.flags & REQ_FLAG_SESSION)
 			{
-				temp++;
+				session_start(v.key, v.key_len);
+				temp += frame_len;
 				continue;
 			}
 
-			break;
+			file_req* req = (file_req*)malloc(sizeof(file_req));
+			req->is_uploaded = v.flags & REQ_FLAG_UPLOAD;
+			req->is_batch = (v.flags & REQ_FLAG_BATCH) != 0;
+			req->filesize = v.filesize;
+			req->request_id = v.request_id;
+			req->stripe_idx = v.stripe_idx;
+			req->stripe_cnt = v.stripe_cnt;
+			req->filename = strndup(v.name, v.name_len);
+			req->fifopath = strndup(v.key, v.key_len);
+			req->checksum = (v.flags & REQ_FLAG_CHECKSUM) != 0;
+
+			start_transfer(req);
+
+			temp += frame_len;
 		}
-		while(1);
+
+		buffered -= temp - buffer;
+		memmove(buffer, temp, buffered);
 	}
 	while(1);
 
 }
 
-int main()
+// metrics 소켓에 리액터와 세션, 요청 FIFO 의 상태를 더해줍니다.
+void write_metrics(FILE* out)
 {
-	signal(SIGINT, signal_handler);
-	signal(SIGABRT, signal_handler);
-	signal(SIGHUP, signal_handler);
-	signal(SIGKILL, signal_handler);
+	metrics_header(out, "ipc_reactors", "gauge", "Reactor threads.");
+	metrics_value(out, "ipc_reactors", NULL, reactor_cnt);
+	metrics_header(out, "ipc_sessions_active", "gauge", "Open sessions.");
+	metrics_value(out, "ipc_sessions_active", NULL, atomic_load(&sessions_active));
+
+	int queued;
+	if (request_fd >= 0 && ioctl(request_fd, FIONREAD, &queued) == 0)
+	{
+		metrics_header(out, "ipc_request_fifo_bytes", "gauge", "Bytes waiting in the request fifo.");
+		metrics_value(out, "ipc_request_fifo_bytes", NULL, queued);
+	}
+	file_cache_write_metrics(out);
+}
+
+int main(int argc, char** argv)
+{
+	int opt, level = LOG_INFO, format = LOG_TEXT;
+	char metrics_path[108];
+	snprintf(metrics_path, sizeof(metrics_path), METRICS_PATH_FMT, "pipe");
+	while ((opt = getopt(argc, argv, "cr:m:l:jDC:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'c':
+				use_splice = 0;
+				break;
+			case 'r':
+				reactor_cnt = atoi(optarg);
+				break;
+			case 'm':
+				snprintf(metrics_path, sizeof(metrics_path), "%s", optarg);
+				break;
+			case 'l':
+				if ((level = log_parse_level(optarg)) < 0)
+				{
+					fprintf(stderr, "unknown log level: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'j':
+				format = LOG_JSON;
+				break;
+			case 'D':
+				use_direct = 1;
+				break;
+			case 'C':
+				file_cache_init((size_t)atol(optarg) * 1024 * 1024);
+				break;
+			default:
+				fprintf(stderr, "usage: server_pipe [-c] [-r reactors] [-m metrics socket] [-l debug|info|warn|error] [-j] [-D] [-C cache MB]\n");
+				return 1;
+		}
+	}
+	if (reactor_cnt < 1)
+		reactor_cnt = 1;
+
+	// 끝내는 시그널은 여기서 막아서 뒤에 만드는 쓰레드들이 물려받게 하고, 따로 둔 쓰레드가 받아서 정리합니다.
+	if (server_signal_init(stop_server, remove_endpoint) < 0)
+		fatal("Fail to catch signals.. ");
+
+	// 리액터와 워커가 stdout 의 lock 을 두고 다투지 않도록 기록은 쓰레드마다 링에 모아서 씁니다.
+	if (log_init(level, format) < 0)
+		fatal("Fail to start logger.. ");
+
+	// 클라이언트가 먼저 FIFO 를 닫아도 write 의 에러로 처리합니다.
+	signal(SIGPIPE, SIG_IGN);
 
 	if (!is_dir("./fifo"))
 		system("mkdir ./fifo");
 	if (!is_dir("./file"))
 		system("mkdir ./file");
 
+	// 모든 전송은 정해진 수의 리액터 쓰레드에서 처리됩니다.
+	reactors = (reactor*)malloc(reactor_cnt * sizeof(reactor));
+	for (int i = 0; i < reactor_cnt; i++)
+		if (reactor_init(&reactors[i]) < 0 || reactor_start(&reactors[i]) < 0)
+			fatal("Fail to start reactor.. ");
+
+	if (metrics_start(metrics_path, "pipe", write_metrics) < 0)
+		log_error(">> main: fail to open metrics socket(path=\"%s\")\n", metrics_path);
+	else
+		log_info(">> main: metrics on %s\n", metrics_path);
+
 	read_request();
 
 	return 0;
@@ -0,0 +1,489 @@
+/*
+	server_shm.c
+	공유 메모리를 사용한 파일 전송 서버 소스입니다.
+	사용의 전제는 다음과 같습니다.
+		1. 서버 프로그램이 같은 경로에 존재함.
+		2. 서버 프로그램이 클라이언트를 킬 시 반드시 켜져 있어야함.
+		3. 파일은 단순히 이름으로 올라가기만 합니다.
+		4. 중복되는 이름은 서버/클라이언트에서 처리할 수 없습니다.
+
+	위의 전제를 사용해 클라이언트는 서버에게 파일 전송을 요청하는 정보를 보낸 후,
+	이를 처리하는 쓰레드를 생성합니다.
+	요청은 MESSAGE QUEUE 로 받아 워커 풀(work_pool.c)에 넣고, 데이터는 전송마다 클라이언트가 만든
+	공유 메모리 링버퍼(shm_ring.c)로 주고 받습니다.
+	링이 가득 차거나 비면 futex 로 잠들기 때문에 스핀하지 않습니다.
+
+	이러한 동작은 서버가 요청을 받아서 문제없이 처리한다는 가정하에 이루어집니다.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "file_util.h"
+#include "shm_ring.h"
+#include "work_pool.h"
+#include "request_proto.h"
+#include "batch_util.h"
+#include "xfer_stats.h"
+#include "metrics.h"
+#include "log.h"
+#include "server_signal.h"
+#include "file_writer.h"
+#include "file_cache.h"
+#include "crc32c.h"
+
+// MESSAGE PASSING(요청) 에 대한 정의들
+#define REQ_SHM_KEY 		60070
+#define REQ_MPQ_PERM 		0666
+
+#define MSG_BUFFER_SZ		2048
+
+struct msg_buf
+{
+	long mtype;
+	char message[MSG_BUFFER_SZ];
+};
+// MESSAGE PASSING(요청) 에 대한 정의들
+
+// 워커 풀에 쌓일 수 있는 대기 작업 수의 기본값
+#define POOL_DEPTH_LIMIT	256
+
+work_pool pool;
+int request_qid = -1;
+// 워커 풀이 가득 차서 거절한 요청 수
+atomic_ulong rejected_cnt;
+
+// 요청 큐를 지웁니다. abort 핸들러에서도 부르므로 시스템 콜만 씁니다.
+void remove_endpoint()
+{
+	struct msqid_ds msqstat;
+	int msgq = msgget(REQ_SHM_KEY, REQ_MPQ_PERM);
+	msgctl(msgq, IPC_RMID, &msqstat);
+}
+
+// 끝내는 시그널을 받으면 시그널을 기다리는 쓰레드(server_signal.c)에서 불립니다.
+void stop_server(int signal)
+{
+	remove_endpoint();
+	metrics_stop();
+	log_flush();
+	xfer_totals_print();
+	exit(1);
+}
+
+void fatal(const char* msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+typedef struct file_request
+{
+	int is_uploaded;
+	// 작은 파일들을 묶은 스트림이면 다 받은 뒤 ./file 에 풀어줍니다.
+	int is_batch;
+	off_t filesize;
+	char* filename;
+	uint32_t request_id;
+	// 파일을 나누어 받을 때 이 요청이 맡은 조각, stripe_cnt 가 0 이면 파일 전체입니다.
+	int stripe_idx, stripe_cnt;
+	// 공유 메모리 이름
+	char* shmname;
+	// 데이터를 보내는 쪽이 구간 뒤에 CRC32C 를 붙입니다.
+	int checksum;
+} file_req;
+
+int receive_upload(file_req* pr, xfer_stats* stats);
+int send_download(file_req* pr, xfer_stats* stats);
+
+void* file_task(void* p)
+{
+	file_req* preq = (file_req*)p;
+	xfer_stats stats;
+	xfer_stats_begin(&stats, preq->is_uploaded? XFER_UPLOAD: XFER_DOWNLOAD);
+	int result = preq->is_uploaded? receive_upload(preq, &stats): send_download(preq, &stats);
+
+	xfer_stats_end(&stats, result);
+	if (!result)
+		xfer_stats_print(preq->is_uploaded? "receive_upload": "send_download", preq->filename, &stats);
+
+	if (result < 0)
+	{
+		switch(result)
+		{
+			case -1:
+				log_error(">> file_task: file(%s) cannot open..\n", preq->filename);
+				break;
+			case -2:
+				log_error(">> file_task: shm(%s) cannot open..\n", preq->shmname);
+				break;
+			case -7:
+				log_error(">> file_task: batch(%s) cannot unpack..\n", preq->filename);
+				break;
+			case -8:
+				log_error(">> file_task: file(%s) checksum mismatch..\n", preq->filename);
+				break;
+			default:
+				log_error(">> file_task: unknown error(%d)\n", result);
+				break;
+		}
+	}
+
+	free(preq->filename);
+	free(preq->shmname);
+	free(preq);
+
+	return NULL;
+}
+
+// 업로드/ 클라이언트가 링에 넣은 데이터를 링 메모리에서 바로 FILE에 써줍니다.
+// 스트라이프 요청이면 맡은 구간에만 씁니다.
+int receive_upload(file_req* pr, xfer_stats* stats)
+{
+	char path[512];
+
+	log_info(">> receive_upload(fs=%lld,name=\"%s\",shm=\"%s\",stripe=%d/%d) start!\n", (long long)pr->filesize, pr->filename, pr->shmname, pr->stripe_idx, pr->stripe_cnt);
+
+	sprintf(path, "./file/%s", pr->filename);
+	shm_ring* ring = shm_ring_open(pr->shmname);
+	if (!ring)
+		return -2;
+
+	uint64_t offset, range_len;
+	req_stripe_range(pr->filesize, pr->stripe_idx, pr->stripe_cnt, &offset, &range_len);
+
+	// 맡은 구간을 미리 잡아둡니다(file_writer.c). 링에서 한번에 꺼내는 크기가 이미 크므로
+	// 다시 모으지 않고 링 메모리에서 바로 씁니다.
+	// 묶음은 이름 없는 임시 파일로 받아서 다 받은 뒤에 풉니다.
+	int newfile = pr->is_batch? batch_tmpfile("./file"): open(path, O_WRONLY | O_CREAT, 0666);
+	if (newfile < 0 || file_writer_prepare(newfile, pr->filesize, offset, range_len) < 0)
+	{
+		if (newfile >= 0)
+			close(newfile);
+		shm_ring_close_read(ring);
+		shm_ring_close(ring);
+		return -1;
+	}
+
+	off_t accum = 0;
+	uint32_t sum = 0;
+	while(accum < range_len)
+	{
+		// 링이 비어서 잠든 시간은 클라이언트를 기다린 시간, pwrite 는 옮긴 시간입니다.
+		uint64_t t0 = xfer_now_ns();
+		const void* data;
+		size_t len = shm_ring_read_acquire(ring, &data);
+		if (!len) break;
+		uint64_t t1 = xfer_now_ns();
+		// 구간 뒤에 이어 오는 CRC32C 는 따로 읽습니다.
+		if (len > range_len - accum)
+			len = range_len - accum;
+
+		if (pr->checksum)
+			sum = crc32c_update(sum, data, len);
+		if (pwrite(newfile, data, len, offset + accum) != (ssize_t)len)
+		{
+			shm_ring_close_read(ring);
+			shm_ring_close(ring);
+			close(newfile);
+			return -3;
+		}
+		shm_ring_read_release(ring, len);
+		accum += len;
+		xfer_stats_chunk(stats, len, t1 - t0, xfer_now_ns() - t1);
+	}
+
+	// 클라이언트가 맡은 구간을 끝까지 보내지 못했으면 잘린 것이고,
+	// 다 보냈으면 그 뒤에 오는 CRC32C 가 받은 것과 같아야 합니다.
+	int result = 0;
+	uint32_t client_sum;
+	if (accum < range_len)
+		result = -6;
+	else if (!pr->checksum)
+		result = 0;
+	else if (shm_ring_read_full(ring, &client_sum, CRC32C_SIZE) < 0)
+		result = -3;
+	else if (client_sum != sum)
+		result = -8;
+	// 묶음은 끝까지 받은 경우에만 풉니다.
+	if (!result && pr->is_batch && batch_unpack(newfile, "./file") < 0)
+		result = -7;
+	close(newfile);
+	shm_ring_close(ring);
+	if (result < 0)
+		return result;
+
+	log_info(">> receive_upload(fs=%lld,name=\"%s\",shm=\"%s\") end!\n", (long long)pr->filesize, pr->filename, pr->shmname);
+	return 0;
+}
+
+// 다운로드/ 클라이언트가 요청한 파일을 링 메모리로 바로 읽어 넣어줍니다.
+// 크기 헤더는 항상 파일 전체 크기이고, 스트라이프 요청이면 그 뒤에 맡은 구간만 넣습니다.
+// 링이 가득 차면 클라이언트가 읽을 때까지 futex 로 잠듭니다.
+int send_download(file_req* pr, xfer_stats* stats)
+{
+	char path[512];
+
+	log_info(">> send_download(fs=%lld,name=\"%s\",shm=\"%s\",stripe=%d/%d) start!\n", (long long)pr->filesize, pr->filename, pr->shmname, pr->stripe_idx, pr->stripe_cnt);
+
+	sprintf(path, "./file/%s", pr->filename);
+	shm_ring* ring = shm_ring_open(pr->shmname);
+	if (!ring)
+		return -2;
+
+	// 같은 파일을 받는 요청들은 캐시(file_cache.c)에서 열어둔 파일과 매핑을 같이 씁니다.
+	file_cache_entry* oldfile = file_cache_get(path);
+	if (!oldfile)
+	{
+		// 클라이언트가 기다리지 않도록 크기 없이 닫아줍니다.
+		shm_ring_close_write(ring);
+		shm_ring_close(ring);
+		return -1;
+	}
+	pr->filesize = oldfile->size;
+
+	log_debug(">> send_download(fs=%lld,name=\"%s\",shm=\"%s\") update fs\n", (long long)pr->filesize, pr->filename, pr->shmname);
+
+	// 크기 헤더는 2GB 가 넘는 파일을 위해 64비트로 보냅니다.
+	int64_t size_hdr = pr->filesize;
+	if (shm_ring_write(ring, &size_hdr, sizeof(int64_t)) < 0)
+	{
+		file_cache_put(oldfile);
+		shm_ring_close(ring);
+		return -3;
+	}
+
+	uint64_t offset, len;
+	req_stripe_range(pr->filesize, pr->stripe_idx, pr->stripe_cnt, &offset, &len);
+
+	// pread 를 부르지 않고 매핑에서 링으로 바로 복사합니다.
+	file_cache_advise(oldfile, offset, len);
+
+	off_t sent = 0;
+	uint32_t sum = 0;
+	while(sent < len)
+	{
+		// 링이 가득 차서 잠든 시간은 클라이언트를 기다린 시간, 파일에서 가져오는 시간은 옮긴 시간입니다.
+		uint64_t t0 = xfer_now_ns();
+		void* data;
+		size_t space = shm_ring_write_reserve(ring, &data);
+		uint64_t t1 = xfer_now_ns();
+		if (!space)
+		{
+			file_cache_put(oldfile);
+			shm_ring_close(ring);
+			return -4;
+		}
+		if (space > len - sent)
+			space = len - sent;
+
+		ssize_t read_len = file_cache_read(oldfile, data, offset + sent, space);
+		if (read_len <= 0) break;
+		if (pr->checksum)
+			sum = crc32c_update(sum, data, read_len);
+		shm_ring_write_commit(ring, read_len);
+		sent += read_len;
+		xfer_stats_chunk(stats, read_len, t1 - t0, xfer_now_ns() - t1);
+	}
+
+	file_cache_put(oldfile);
+	// 맡은 구간을 다 넣었으면 클라이언트가 확인하도록 CRC32C 를 뒤에 붙입니다.
+	int result = 0;
+	if (pr->checksum && sent >= len && shm_ring_write(ring, &sum, CRC32C_SIZE) < 0)
+		result = -3;
+	shm_ring_close_write(ring);
+	shm_ring_close(ring);
+	if (result < 0)
+		return result;
+
+	log_info(">> send_download(fs=%lld,name=\"%s\",shm=\"%s\") end!\n", (long long)pr->filesize, pr->filename, pr->shmname);
+
+	return 0;
+}
+
+// 워커 풀이 가득 차서 받을 수 없는 요청입니다.
+// 링의 양쪽을 닫아서 클라이언트가 기다리지 않고 실패를 받도록 합니다.
+void reject_request(file_req* preq)
+{
+	log_warn(">> read_request: pool is full, reject(name=\"%s\",shm=\"%s\")\n", preq->filename, preq->shmname);
+	atomic_fetch_add(&rejected_cnt, 1);
+
+	shm_ring* ring = shm_ring_open(preq->shmname);
+	if (ring)
+	{
+		shm_ring_close_read(ring);
+		shm_ring_close_write(ring);
+		shm_ring_close(ring);
+	}
+
+	free(preq->filename);
+	free(preq->shmname);
+	free(preq);
+}
+
+// 메인쓰레드에서 수행되는 함수로,
+// 요청 MESSAGE QUEUE 에 들어오는 모든 데이터를 읽어
+// 정리하고, 워커 풀에 작업으로 넣어줍니다.
+void read_request(int rqid)
+{
+	struct msg_buf buffer;
+
+	do
+	{
+		int read_count = msgrcv(rqid, &buffer, MSG_BUFFER_SZ, 0, MSG_NOERROR);
+
+		if (read_count < 0)
+		{
+			// 끝내는 중이면 요청 큐를 지운 것이므로 정리하는 쓰레드가 끝낼 때까지 기다립니다.
+			if (server_stopping())
+				pause();
+			fatal("Fail to msgrcv from request.. ");
+			return;
+		}
+
+		// 메세지에는 온전한 요청 프레임들만 들어 있습니다.
+		const char* temp = buffer.message;
+		while (read_count > 0)
+		{
+			req_view v;
+			int frame_len = req_decode(temp, read_count, &v);
+			if (frame_len <= 0 || !v.key_len)
+			{
+				log_warn(">> read_request: malformed request, drop %d bytes\n", read_count);
+				break;
+			}
+
+			file_req* req = (file_req*)malloc(sizeof(file_req));
+			req->is_uploaded = v.flags & REQ_FLAG_UPLOAD;
+			req->is_batch = (v.flags & REQ_FLAG_BATCH) != 0;
+			req->checksum = (v.flags & REQ_FLAG_CHECKSUM) != 0;
+			req->filesize = v.filesize;
+			req->request_id = v.request_id;
+			req->stripe_idx = v.stripe_idx;
+			req->stripe_cnt = v.stripe_cnt;
+			req->filename = strndup(v.name, v.name_len);
+			req->shmname = strndup(v.key, v.key_len);
+
+			// 대기 작업이 가득 차면 기본으로는 자리가 날 때까지 여기서 기다리고, -s 옵션이면 요청을 거절합니다.
+			if (work_pool_submit(&pool, file_task, req) < 0)
+				reject_request(req);
+
+			temp += frame_len;
+			read_count -= frame_len;
+		}
+	}
+	while(1);
+}
+
+// metrics 소켓에 워커 풀과 요청 큐의 상태를 더해줍니다.
+void write_metrics(FILE* out)
+{
+	int pending, running;
+	work_pool_load(&pool, &pending, &running);
+
+	metrics_header(out, "ipc_pool_workers", "gauge", "Worker threads in the pool.");
+	metrics_value(out, "ipc_pool_workers", NULL, pool.worker_cnt);
+	metrics_header(out, "ipc_pool_running", "gauge", "Tasks being run by the workers.");
+	metrics_value(out, "ipc_pool_running", NULL, running);
+	metrics_header(out, "ipc_pool_pending", "gauge", "Tasks waiting for a worker.");
+	metrics_value(out, "ipc_pool_pending", NULL, pending);
+	metrics_header(out, "ipc_requests_rejected_total", "counter", "Requests rejected because the pool was full.");
+	metrics_value(out, "ipc_requests_rejected_total", NULL, atomic_load(&rejected_cnt));
+	file_cache_write_metrics(out);
+
+	struct msqid_ds msqstat;
+	if (request_qid >= 0 && msgctl(request_qid, IPC_STAT, &msqstat) == 0)
+	{
+		metrics_header(out, "ipc_request_queue_messages", "gauge", "Messages waiting in the request queue.");
+		metrics_value(out, "ipc_request_queue_messages", NULL, msqstat.msg_qnum);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int opt, worker_cnt = work_pool_default_workers(), depth_limit = POOL_DEPTH_LIMIT, policy = WORK_POOL_WAIT;
+	int level = LOG_INFO, format = LOG_TEXT;
+	char metrics_path[108];
+	snprintf(metrics_path, sizeof(metrics_path), METRICS_PATH_FMT, "shm");
+	while ((opt = getopt(argc, argv, "w:q:sm:l:jC:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'w':
+				worker_cnt = atoi(optarg);
+				break;
+			case 'q':
+				depth_limit = atoi(optarg);
+				break;
+			case 's':
+				policy = WORK_POOL_SHED;
+				break;
+			case 'm':
+				snprintf(metrics_path, sizeof(metrics_path), "%s", optarg);
+				break;
+			case 'l':
+				if ((level = log_parse_level(optarg)) < 0)
+				{
+					fprintf(stderr, "unknown log level: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'j':
+				format = LOG_JSON;
+				break;
+			case 'C':
+				file_cache_init((size_t)atol(optarg) * 1024 * 1024);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-w workers] [-q queue depth] [-s (reject requests when the queue is full)] [-m metrics socket] [-l debug|info|warn|error] [-j] [-C cache MB]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	// 끝내는 시그널은 여기서 막아서 뒤에 만드는 쓰레드들이 물려받게 하고, 따로 둔 쓰레드가 받아서 정리합니다.
+	if (server_signal_init(stop_server, remove_endpoint) < 0)
+		fatal("Fail to catch signals.. ");
+
+	// 워커들이 stdout 의 lock 을 두고 다투지 않도록 기록은 쓰레드마다 링에 모아서 씁니다.
+	if (log_init(level, format) < 0)
+		fatal("Fail to start logger.. ");
+
+	if (work_pool_init(&pool, worker_cnt, depth_limit, policy) < 0)
+		fatal("Fail to start worker pool.. ");
+
+	if (!is_dir("./file"))
+		system("mkdir ./file");
+
+	int rqid = 0;
+	if ((rqid = msgget(REQ_SHM_KEY, REQ_MPQ_PERM | IPC_CREAT)) < 0)
+		fatal("Fail to get request mq.. ");
+
+	printf("GEN MSG Q: %x:%d\n", REQ_SHM_KEY, rqid);
+	request_qid = rqid;
+
+	if (metrics_start(metrics_path, "shm", write_metrics) < 0)
+		log_error(">> main: fail to open metrics socket(path=\"%s\")\n", metrics_path);
+	else
+		log_info(">> main: metrics on %s\n", metrics_path);
+
+	while(1)
+		read_request(rqid);
+
+	struct msqid_ds msqstat;
+	msgctl(rqid, IPC_RMID, &msqstat);
+
+	return 0;
+}
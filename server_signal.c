@@ -0,0 +1,75 @@
+/*
+	server_signal.c
+	서버들이 끝내는 시그널(SIGINT, SIGHUP, SIGTERM)을 받는 함수들입니다.
+	시그널 핸들러는 어느 쓰레드든 끊고 들어가므로, 그 안에서 기록을 쓰면 기록을 쓰는 쓰레드가 잡고 있던
+	lock(log.c)이나 stdio 의 lock 을 다시 잡으려다 멈출 수 있습니다.
+	그래서 쓰레드들을 만들기 전에 시그널들을 막아 모든 쓰레드가 물려받게 하고, 따로 둔 쓰레드가 sigwait 로 받아서
+	보통의 문맥에서 정리합니다. abort 는 막을 수 없으므로 핸들러에서 시스템 콜로 IPC 자원만 지웁니다.
+ */
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "server_signal.h"
+
+static sigset_t stop_set;
+static server_stop_fn stop_fn;
+static server_abort_fn abort_fn;
+static atomic_int stopping;
+
+static void* signal_loop(void* p)
+{
+	int sig;
+	while (sigwait(&stop_set, &sig) != 0)
+		;
+	atomic_store(&stopping, 1);
+	stop_fn(sig);
+	return NULL;
+}
+
+static void abort_handler(int sig)
+{
+	abort_fn();
+}
+
+// 다른 쓰레드를 만들기 전에 main 에서 부릅니다.
+int server_signal_init(server_stop_fn stop, server_abort_fn on_abort)
+{
+	stop_fn = stop;
+	abort_fn = on_abort;
+	sigemptyset(&stop_set);
+	sigaddset(&stop_set, SIGINT);
+	sigaddset(&stop_set, SIGHUP);
+	sigaddset(&stop_set, SIGTERM);
+	if (pthread_sigmask(SIG_BLOCK, &stop_set, NULL))
+		return -1;
+
+	// 백그라운드로 띄운 서버는 SIGINT 를 무시하도록 물려받는데, 무시하는 시그널은 sigwait 에도 오지 않습니다.
+	struct sigaction dfl = { 0 };
+	dfl.sa_handler = SIG_DFL;
+	sigemptyset(&dfl.sa_mask);
+	sigaction(SIGINT, &dfl, NULL);
+	sigaction(SIGHUP, &dfl, NULL);
+	sigaction(SIGTERM, &dfl, NULL);
+
+	if (on_abort)
+	{
+		struct sigaction sa = { 0 };
+		sa.sa_handler = abort_handler;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGABRT, &sa, NULL);
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, signal_loop, NULL))
+		return -1;
+	pthread_detach(thread);
+	return 0;
+}
+
+// 정리하는 중이면 1 입니다. 요청 채널을 지워서 main 의 읽기가 실패할 때 에러로 끝내지 않도록 봅니다.
+int server_stopping()
+{
+	return atomic_load(&stopping);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// 끝내는 시그널을 받으면 부를 함수입니다. 시그널 핸들러가 아니라 기다리는 쓰레드에서 불리므로
+// lock 을 잡거나 stdio 를 쓰는 함수(log_flush 등)도 부를 수 있습니다.
+typedef void (*server_stop_fn)(int signal);
+// abort 로 죽을 때 부를 함수입니다. 핸들러에서 불리므로 unlink, msgctl 같은 시스템 콜만 씁니다.
+typedef void (*server_abort_fn)();
+
+int server_signal_init(server_stop_fn stop, server_abort_fn on_abort);
+int server_stopping();
@@ -0,0 +1,224 @@
+/*
+	sha256.c
+	업로드를 나눈 조각들의 내용으로 찾기 위한 SHA-256 입니다(chunk_store.c).
+	조각이 같은지 해시만 보고 정하므로 충돌을 걱정하지 않아도 되는 해시를 씁니다.
+	x86-64 에서 SHA 확장 명령어를 지원하면 그것으로 라운드를 돌리고, 없으면 C 로 구합니다.
+	업로드하는 파일 전체를 지나가므로 디버그 빌드(-O0)에서도 이 파일은 최적화해서 컴파일합니다.
+ */
+
+#pragma GCC optimize("O2")
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#include "sha256.h"
+
+static const uint32_t sha_k[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// 64바이트 블록 blocks 개를 state 에 더하는 함수, 처음 부를 때 명령어가 있는지 보고 고릅니다.
+static void (*sha_kernel)(uint32_t state[8], const uint8_t* data, size_t blocks);
+static pthread_once_t sha_once = PTHREAD_ONCE_INIT;
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha_sw(uint32_t state[8], const uint8_t* data, size_t blocks)
+{
+	for (; blocks--; data += 64)
+	{
+		uint32_t w[64];
+		for (int i = 0; i < 16; i++)
+			w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 | (uint32_t)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+		for (int i = 16; i < 64; i++)
+		{
+			uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; i++)
+		{
+			uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+			uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#if defined(__x86_64__)
+// 네 라운드씩 돌립니다. cur 는 이번 메세지 워드, next/prev 는 앞뒤 워드이고
+// 다음 워드들은 sha256msg1/msg2 로 미리 만들어 둡니다.
+#define SHA_ROUNDS(g, cur)																\
+	msg = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i*)&sha_k[(g) * 4]));		\
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+#define SHA_ROUNDS_END																	\
+	msg = _mm_shuffle_epi32(msg, 0x0e);													\
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+#define SHA_MSG2(next, cur, prev)														\
+	tmp = _mm_alignr_epi8(cur, prev, 4);												\
+	next = _mm_sha256msg2_epu32(_mm_add_epi32(next, tmp), cur);
+#define SHA_MSG1(prev, cur)																\
+	prev = _mm_sha256msg1_epu32(prev, cur);
+#define SHA_GROUP(g, cur, next, prev)													\
+	SHA_ROUNDS(g, cur) SHA_MSG2(next, cur, prev) SHA_ROUNDS_END SHA_MSG1(prev, cur)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha_ni(uint32_t state[8], const uint8_t* data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, msg, tmp, m0, m1, m2, m3;
+
+	// 명령어는 상태를 ABEF, CDGH 순서로 나누어 다룹니다.
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; blocks--; data += 64)
+	{
+		__m128i abef = state0, cdgh = state1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), mask);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+
+		SHA_ROUNDS(0, m0) SHA_ROUNDS_END
+		SHA_ROUNDS(1, m1) SHA_ROUNDS_END SHA_MSG1(m0, m1)
+		SHA_ROUNDS(2, m2) SHA_ROUNDS_END SHA_MSG1(m1, m2)
+		SHA_GROUP(3, m3, m0, m2)
+		SHA_GROUP(4, m0, m1, m3)
+		SHA_GROUP(5, m1, m2, m0)
+		SHA_GROUP(6, m2, m3, m1)
+		SHA_GROUP(7, m3, m0, m2)
+		SHA_GROUP(8, m0, m1, m3)
+		SHA_GROUP(9, m1, m2, m0)
+		SHA_GROUP(10, m2, m3, m1)
+		SHA_GROUP(11, m3, m0, m2)
+		SHA_GROUP(12, m0, m1, m3)
+		SHA_ROUNDS(13, m1) SHA_MSG2(m2, m1, m0) SHA_ROUNDS_END
+		SHA_ROUNDS(14, m2) SHA_MSG2(m3, m2, m1) SHA_ROUNDS_END
+		SHA_ROUNDS(15, m3) SHA_ROUNDS_END
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xf0));
+	_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+
+static void sha_init_kernel()
+{
+	sha_kernel = sha_sw;
+#if defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	// SHA 확장은 CPUID leaf 7 의 EBX 29번 비트입니다.
+	if (__builtin_cpu_supports("sse4.1") && __get_cpuid_max(0, NULL) >= 7)
+	{
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if (ebx & (1u << 29))
+			sha_kernel = sha_ni;
+	}
+#endif
+}
+
+void sha256_init(sha256_ctx* c)
+{
+	static const uint32_t iv[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	pthread_once(&sha_once, sha_init_kernel);
+	memcpy(c->state, iv, sizeof(iv));
+	c->total = 0;
+	c->buf_len = 0;
+}
+
+void sha256_update(sha256_ctx* c, const void* data, size_t len)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	c->total += len;
+
+	if (c->buf_len)
+	{
+		size_t n = 64 - c->buf_len < len? 64 - c->buf_len: len;
+		memcpy(c->buf + c->buf_len, p, n);
+		c->buf_len += n;
+		p += n;
+		len -= n;
+		if (c->buf_len < 64)
+			return;
+		sha_kernel(c->state, c->buf, 1);
+		c->buf_len = 0;
+	}
+
+	if (len >= 64)
+	{
+		sha_kernel(c->state, p, len / 64);
+		p += len / 64 * 64;
+		len %= 64;
+	}
+	memcpy(c->buf, p, len);
+	c->buf_len = len;
+}
+
+void sha256_final(sha256_ctx* c, uint8_t out[SHA256_SIZE])
+{
+	uint64_t bits = c->total * 8;
+	uint8_t pad[72] = { 0x80 };
+	size_t pad_len = (c->buf_len < 56? 56: 120) - c->buf_len;
+	for (int i = 0; i < 8; i++)
+		pad[pad_len + i] = (uint8_t)(bits >> (56 - i * 8));
+	sha256_update(c, pad, pad_len + 8);
+
+	for (int i = 0; i < 8; i++)
+	{
+		out[i * 4] = (uint8_t)(c->state[i] >> 24);
+		out[i * 4 + 1] = (uint8_t)(c->state[i] >> 16);
+		out[i * 4 + 2] = (uint8_t)(c->state[i] >> 8);
+		out[i * 4 + 3] = (uint8_t)c->state[i];
+	}
+}
+
+void sha256(const void* data, size_t len, uint8_t out[SHA256_SIZE])
+{
+	sha256_ctx c;
+	sha256_init(&c);
+	sha256_update(&c, data, len);
+	sha256_final(&c, out);
+}
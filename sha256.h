@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE		32
+
+typedef struct sha256_ctx
+{
+	uint32_t state[8];
+	uint64_t total;
+	uint8_t buf[64];
+	size_t buf_len;
+} sha256_ctx;
+
+void sha256_init(sha256_ctx* c);
+void sha256_update(sha256_ctx* c, const void* data, size_t len);
+void sha256_final(sha256_ctx* c, uint8_t out[SHA256_SIZE]);
+void sha256(const void* data, size_t len, uint8_t out[SHA256_SIZE]);
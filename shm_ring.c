@@ -0,0 +1,284 @@
+/*
+	shm_ring.c
+	POSIX 공유 메모리 위에 올린 단일 생산자/단일 소비자 링버퍼입니다.
+	생산자는 head 만, 소비자는 tail 만 움직이므로 락 없이 동작합니다.
+	링이 비거나 가득 차면 스핀하지 않고 futex 로 커널에서 잠듭니다.
+	상대방이 잠들어 있다고 표시한 경우에만 FUTEX_WAKE 를 호출합니다.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "shm_ring.h"
+
+static void futex_wait(atomic_uint* addr, unsigned int val)
+{
+	syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* addr)
+{
+	syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static shm_ring* shm_ring_map(int fd, size_t map_size)
+{
+	void* addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	shm_ring* ring = (shm_ring*)malloc(sizeof(shm_ring));
+	ring->shared = (struct shm_ring_shared*)addr;
+	ring->map_size = map_size;
+	return ring;
+}
+
+// 새 공유 메모리 세그먼트를 만들고 링을 초기화합니다.
+// capacity 는 2의 거듭제곱이어야 합니다.
+shm_ring* shm_ring_create(const char* name, uint32_t capacity)
+{
+	if (capacity == 0 || (capacity & (capacity - 1)))
+		return NULL;
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, SHM_PERM);
+	if (fd < 0)
+		return NULL;
+
+	size_t map_size = sizeof(struct shm_ring_shared) + capacity;
+	if (ftruncate(fd, map_size) < 0)
+	{
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	shm_ring* ring = shm_ring_map(fd, map_size);
+	if (!ring)
+	{
+		shm_unlink(name);
+		return NULL;
+	}
+
+	struct shm_ring_shared* s = ring->shared;
+	atomic_init(&s->head, 0);
+	atomic_init(&s->wseq, 0);
+	atomic_init(&s->wclosed, 0);
+	atomic_init(&s->tail, 0);
+	atomic_init(&s->rseq, 0);
+	atomic_init(&s->rclosed, 0);
+	atomic_init(&s->prod_waiting, 0);
+	atomic_init(&s->cons_waiting, 0);
+	s->capacity = capacity;
+
+	return ring;
+}
+
+// 상대방이 만든 세그먼트를 엽니다. 크기는 세그먼트에서 읽어옵니다.
+shm_ring* shm_ring_open(const char* name)
+{
+	int fd = shm_open(name, O_RDWR, SHM_PERM);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct shm_ring_shared))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	return shm_ring_map(fd, st.st_size);
+}
+
+void shm_ring_close(shm_ring* ring)
+{
+	if (!ring)
+		return;
+	munmap(ring->shared, ring->map_size);
+	free(ring);
+}
+
+int shm_ring_unlink(const char* name)
+{
+	return shm_unlink(name);
+}
+
+// 연속으로 쓸 수 있는 영역을 돌려줍니다. 공간이 없으면 소비자가 읽을 때까지 잠듭니다.
+// 소비자가 중단한 경우 0 을 돌려줍니다.
+size_t shm_ring_write_reserve(shm_ring* ring, void** ptr)
+{
+	struct shm_ring_shared* s = ring->shared;
+	uint32_t cap = s->capacity;
+
+	while(1)
+	{
+		unsigned int seq = atomic_load_explicit(&s->rseq, memory_order_acquire);
+		uint32_t head = atomic_load_explicit(&s->head, memory_order_relaxed);
+		uint32_t tail = atomic_load_explicit(&s->tail, memory_order_acquire);
+
+		if (atomic_load_explicit(&s->rclosed, memory_order_acquire))
+			return 0;
+
+		uint32_t space = cap - (head - tail);
+		if (space)
+		{
+			uint32_t off = head & (cap - 1);
+			*ptr = s->data + off;
+			return space < cap - off? space: cap - off;
+		}
+
+		// 잠들기 전에 표시하고 한번 더 확인합니다.
+		atomic_store(&s->prod_waiting, 1);
+		if (atomic_load(&s->tail) == tail && !atomic_load(&s->rclosed))
+			futex_wait(&s->rseq, seq);
+		atomic_store(&s->prod_waiting, 0);
+	}
+}
+
+void shm_ring_write_commit(shm_ring* ring, size_t len)
+{
+	struct shm_ring_shared* s = ring->shared;
+
+	atomic_store(&s->head, atomic_load_explicit(&s->head, memory_order_relaxed) + (uint32_t)len);
+	atomic_fetch_add(&s->wseq, 1);
+	if (atomic_load(&s->cons_waiting))
+		futex_wake(&s->wseq);
+}
+
+// 연속으로 읽을 수 있는 영역을 돌려줍니다. 데이터가 없으면 생산자가 쓸 때까지 잠듭니다.
+// 생산자가 닫고 모두 읽은 경우 0 을 돌려줍니다.
+size_t shm_ring_read_acquire(shm_ring* ring, const void** ptr)
+{
+	struct shm_ring_shared* s = ring->shared;
+	uint32_t cap = s->capacity;
+
+	while(1)
+	{
+		unsigned int seq = atomic_load_explicit(&s->wseq, memory_order_acquire);
+		uint32_t tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+		uint32_t head = atomic_load_explicit(&s->head, memory_order_acquire);
+
+		if (head != tail)
+		{
+			uint32_t off = tail & (cap - 1);
+			uint32_t avail = head - tail;
+			*ptr = s->data + off;
+			return avail < cap - off? avail: cap - off;
+		}
+
+		if (atomic_load_explicit(&s->wclosed, memory_order_acquire))
+		{
+			if (atomic_load(&s->head) == tail)
+				return 0;
+			continue;
+		}
+
+		atomic_store(&s->cons_waiting, 1);
+		if (atomic_load(&s->head) == tail && !atomic_load(&s->wclosed))
+			futex_wait(&s->wseq, seq);
+		atomic_store(&s->cons_waiting, 0);
+	}
+}
+
+void shm_ring_read_release(shm_ring* ring, size_t len)
+{
+	struct shm_ring_shared* s = ring->shared;
+
+	atomic_store(&s->tail, atomic_load_explicit(&s->tail, memory_order_relaxed) + (uint32_t)len);
+	atomic_fetch_add(&s->rseq, 1);
+	if (atomic_load(&s->prod_waiting))
+		futex_wake(&s->rseq);
+}
+
+// 버퍼를 링에 모두 복사합니다. 소비자가 중단하면 -1 을 돌려줍니다.
+int shm_ring_write(shm_ring* ring, const void* buf, size_t len)
+{
+	const char* src = (const char*)buf;
+	while (len > 0)
+	{
+		void* dst;
+		size_t n = shm_ring_write_reserve(ring, &dst);
+		if (!n)
+			return -1;
+		if (n > len)
+			n = len;
+		memcpy(dst, src, n);
+		shm_ring_write_commit(ring, n);
+		src += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// 정확히 len 만큼 읽습니다. 그 전에 생산자가 닫으면 -1 을 돌려줍니다.
+int shm_ring_read_full(shm_ring* ring, void* buf, size_t len)
+{
+	char* dst = (char*)buf;
+	while (len > 0)
+	{
+		const void* src;
+		size_t n = shm_ring_read_acquire(ring, &src);
+		if (!n)
+			return -1;
+		if (n > len)
+			n = len;
+		memcpy(dst, src, n);
+		shm_ring_read_release(ring, n);
+		dst += n;
+		len -= n;
+	}
+	return 0;
+}
+
+void shm_ring_close_write(shm_ring* ring)
+{
+	struct shm_ring_shared* s = ring->shared;
+
+	atomic_store(&s->wclosed, 1);
+	atomic_fetch_add(&s->wseq, 1);
+	futex_wake(&s->wseq);
+}
+
+void shm_ring_close_read(shm_ring* ring)
+{
+	struct shm_ring_shared* s = ring->shared;
+
+	atomic_store(&s->rclosed, 1);
+	atomic_fetch_add(&s->rseq, 1);
+	futex_wake(&s->rseq);
+}
+
+// 생산자가 소비자가 모두 읽어갈 때까지 기다립니다.
+// 소비자가 중간에 중단하면 -1 을 돌려줍니다.
+int shm_ring_wait_drained(shm_ring* ring)
+{
+	struct shm_ring_shared* s = ring->shared;
+
+	while(1)
+	{
+		unsigned int seq = atomic_load_explicit(&s->rseq, memory_order_acquire);
+		uint32_t tail = atomic_load(&s->tail);
+
+		if (tail == atomic_load_explicit(&s->head, memory_order_relaxed))
+			return 0;
+		if (atomic_load(&s->rclosed))
+			return -1;
+
+		atomic_store(&s->prod_waiting, 1);
+		if (atomic_load(&s->tail) == tail && !atomic_load(&s->rclosed))
+			futex_wait(&s->rseq, seq);
+		atomic_store(&s->prod_waiting, 0);
+	}
+}
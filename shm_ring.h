@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// 공유 메모리 SPSC 링버퍼에 대한 정의들
+#define SHM_CACHELINE			64
+#define SHM_RING_CAPACITY		(1 << 20)
+#define SHM_PERM				0666
+
+// 공유 메모리에 올라가는 헤더입니다.
+// head/tail 은 false sharing 을 피하기 위해 캐시라인 단위로 떨어뜨려 둡니다.
+struct shm_ring_shared
+{
+	_Alignas(SHM_CACHELINE) atomic_uint head;	// 생산자가 쓴 위치
+	atomic_uint wseq;							// 생산자 futex 워드
+	atomic_uint wclosed;						// 생산자 종료
+
+	_Alignas(SHM_CACHELINE) atomic_uint tail;	// 소비자가 읽은 위치
+	atomic_uint rseq;							// 소비자 futex 워드
+	atomic_uint rclosed;						// 소비자 중단
+
+	_Alignas(SHM_CACHELINE) atomic_uint prod_waiting;
+	atomic_uint cons_waiting;
+	uint32_t capacity;
+
+	_Alignas(SHM_CACHELINE) char data[];
+};
+
+// 프로세스마다 따로 가지는 핸들입니다.
+typedef struct shm_ring
+{
+	struct shm_ring_shared* shared;
+	size_t map_size;
+} shm_ring;
+
+shm_ring* shm_ring_create(const char* name, uint32_t capacity);
+shm_ring* shm_ring_open(const char* name);
+void shm_ring_close(shm_ring* ring);
+int shm_ring_unlink(const char* name);
+
+// 복사 없이 링 메모리를 직접 쓰고 읽는 함수들
+size_t shm_ring_write_reserve(shm_ring* ring, void** ptr);
+void shm_ring_write_commit(shm_ring* ring, size_t len);
+size_t shm_ring_read_acquire(shm_ring* ring, const void** ptr);
+void shm_ring_read_release(shm_ring* ring, size_t len);
+
+int shm_ring_write(shm_ring* ring, const void* buf, size_t len);
+int shm_ring_read_full(shm_ring* ring, void* buf, size_t len);
+
+void shm_ring_close_write(shm_ring* ring);
+void shm_ring_close_read(shm_ring* ring);
+int shm_ring_wait_drained(shm_ring* ring);
@@ -0,0 +1,61 @@
+#!/bin/bash
+# dedup_stripe.sh
+# 중복 제거로 올린 파일을 서버에서 지운 뒤 나누어 다시 올려도 원본과 같은지 봅니다.
+# 서버 폴더에는 목록과 색인이 지운 파일의 조각들을 가리키는 채로 남아 있으므로,
+# 스트라이프가 그 색인을 믿고 조각을 받지 않으면 아직 쓰지 않은 자리가 비어 있게 됩니다.
+# 워커가 하나인 서버로 스트라이프들을 차례로 받게 하고, 다시 시작한 서버로 한번 더 올립니다.
+# usage: test/dedup_stripe.sh [작업 폴더]
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${1:-/tmp/ipc_dedup_stripe}
+
+rm -rf "$WORK"
+mkdir -p "$WORK"
+cd "$WORK" || exit 1
+
+# 스트라이프마다 조각이 여럿 들어가는 크기입니다.
+head -c $((3 * 1024 * 1024 + 12345)) /dev/urandom > rnd.bin
+
+fail=0
+check()
+{
+	if [ $1 -ne 0 ] || ! cmp -s rnd.bin file/rnd.bin; then
+		echo "$2: FAIL"
+		fail=1
+	else
+		echo "$2: OK"
+	fi
+}
+
+server=
+start_server()
+{
+	"$REPO/server_mp" -w 1 > server_$1.log 2>&1 &
+	server=$!
+	sleep 1
+}
+stop_server()
+{
+	kill -INT $server
+	wait $server 2>/dev/null
+}
+
+start_server 1
+"$REPO/client_mp" dedup upload rnd.bin > upload_1.log 2>&1
+check $? "dedup upload"
+rm file/rnd.bin
+"$REPO/client_mp" stripe 3 dedup upload rnd.bin > upload_2.log 2>&1
+check $? "striped upload after delete"
+stop_server
+
+# 스트라이프들이 쓴 목록을 다시 읽은 서버도 그 조각들을 확인합니다.
+start_server 2
+rm file/rnd.bin
+"$REPO/client_mp" stripe 3 dedup upload rnd.bin > upload_3.log 2>&1
+check $? "striped upload after restart"
+"$REPO/client_mp" dedup upload rnd.bin > upload_4.log 2>&1
+check $? "whole upload after striped"
+stop_server
+
+[ $fail -eq 0 ] && rm -rf "$WORK"
+exit $fail
@@ -0,0 +1,51 @@
+#!/bin/bash
+# large_file.sh
+# 4GB 를 넘는 파일을 메세지 패싱과 FIFO 로 올리고 내려받아 원본과 같은지 봅니다.
+# 파일은 sparse 로 만들고, 2GB 와 4GB 경계에 걸친 자리와 파일 끝에만 데이터를 씁니다.
+# 올린 파일은 서버가 자리를 미리 잡으므로 전송 방식마다 파일 크기의 두배만큼 디스크를 씁니다.
+# usage: test/large_file.sh [작업 폴더]
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${1:-/tmp/ipc_large_file}
+SIZE=$((4 * 1024 * 1024 * 1024 + 700 * 1024 * 1024))
+MB=$((1024 * 1024))
+
+rm -rf "$WORK"
+mkdir -p "$WORK"
+cd "$WORK" || exit 1
+
+# 경계마다 앞뒤로 1MB 씩 걸치게 씁니다.
+truncate -s $SIZE big.bin
+for at in $((2 * 1024 - 1)) $((4 * 1024 - 1)) $((SIZE / MB - 1)); do
+	dd if=/dev/urandom of=big.bin bs=$MB seek=$at count=2 conv=notrunc status=none
+done
+truncate -s $SIZE big.bin
+
+fail=0
+for t in mp pipe; do
+	rm -rf file fifo down
+	mkdir down
+	"$REPO/server_$t" > server_$t.log 2>&1 &
+	server=$!
+	sleep 1
+
+	if ! "$REPO/client_$t" upload big.bin > upload_$t.log 2>&1 || ! cmp big.bin file/big.bin; then
+		echo "$t upload: FAIL"
+		fail=1
+	else
+		echo "$t upload: OK"
+	fi
+	if ! "$REPO/client_$t" download big.bin dpath down > download_$t.log 2>&1 || ! cmp big.bin down/big.bin; then
+		echo "$t download: FAIL"
+		fail=1
+	else
+		echo "$t download: OK"
+	fi
+
+	kill -INT $server
+	wait $server 2>/dev/null
+	rm -rf file down
+done
+
+[ $fail -eq 0 ] && rm -rf "$WORK"
+exit $fail
@@ -0,0 +1,225 @@
+/*
+	work_pool.c
+	고정된 수의 워커 쓰레드와 워커마다의 덱으로 이루어진 쓰레드 풀입니다.
+	작업은 워커들의 덱에 돌아가며 넣어주고, 자기 덱이 빈 워커는
+	다른 워커의 덱에서 작업을 훔쳐와서 처리합니다.
+	대기중인 작업 수가 depth_limit 에 닿으면 정책에 따라
+	제출하는 쪽을 기다리게 하거나 바로 실패를 돌려줍니다.
+	work_pool_shutdown 은 남은 작업을 모두 처리한 워커들을 join 으로 기다리고 자원을 정리합니다.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "work_pool.h"
+
+typedef struct worker_arg
+{
+	work_pool* pool;
+	int index;
+} worker_arg;
+
+int work_pool_default_workers()
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0? (int)cores: 1;
+}
+
+static int deque_push_back(work_deque* dq, work_item item)
+{
+	int result = -1;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->count < dq->capacity)
+	{
+		dq->items[(dq->head + dq->count) % dq->capacity] = item;
+		dq->count++;
+		result = 0;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return result;
+}
+
+static int deque_pop_back(work_deque* dq, work_item* item)
+{
+	int result = -1;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->count > 0)
+	{
+		dq->count--;
+		*item = dq->items[(dq->head + dq->count) % dq->capacity];
+		result = 0;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return result;
+}
+
+static int deque_steal_front(work_deque* dq, work_item* item)
+{
+	int result = -1;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->count > 0)
+	{
+		*item = dq->items[dq->head];
+		dq->head = (dq->head + 1) % dq->capacity;
+		dq->count--;
+		result = 0;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return result;
+}
+
+// 자기 덱을 먼저 보고, 비었으면 다음 워커들의 덱에서 훔쳐옵니다.
+static int find_work(work_pool* pool, int index, work_item* item)
+{
+	if (!deque_pop_back(&pool->deques[index], item))
+		return 0;
+
+	for (int i = 1; i < pool->worker_cnt; i++)
+		if (!deque_steal_front(&pool->deques[(index + i) % pool->worker_cnt], item))
+			return 0;
+
+	return -1;
+}
+
+static void* worker_loop(void* p)
+{
+	worker_arg* arg = (worker_arg*)p;
+	work_pool* pool = arg->pool;
+	int index = arg->index;
+	free(arg);
+
+	while(1)
+	{
+		work_item item;
+		if (find_work(pool, index, &item) < 0)
+		{
+			pthread_mutex_lock(&pool->lock);
+			while (pool->pending == 0 && !pool->stopping)
+				pthread_cond_wait(&pool->work_cond, &pool->lock);
+			// 모든 작업을 꺼내갔고 끝내라고 했으면 워커를 끝냅니다.
+			int done = pool->pending == 0 && pool->stopping;
+			pthread_mutex_unlock(&pool->lock);
+			if (done)
+				break;
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		pool->pending--;
+		pool->running++;
+		pthread_cond_signal(&pool->space_cond);
+		pthread_mutex_unlock(&pool->lock);
+
+		item.fn(item.arg);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->running--;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+int work_pool_init(work_pool* pool, int worker_cnt, int depth_limit, int policy)
+{
+	if (worker_cnt < 1)
+		worker_cnt = 1;
+	if (depth_limit < 1)
+		depth_limit = 1;
+
+	pool->worker_cnt = worker_cnt;
+	pool->depth_limit = depth_limit;
+	pool->policy = policy;
+	pool->pending = 0;
+	pool->running = 0;
+	pool->next_deque = 0;
+	pool->stopping = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->space_cond, NULL);
+
+	// 대기 작업 수가 depth_limit 을 넘지 않으므로 덱 하나도 그 이상은 필요 없습니다.
+	pool->deques = (work_deque*)malloc(worker_cnt * sizeof(work_deque));
+	for (int i = 0; i < worker_cnt; i++)
+	{
+		pthread_mutex_init(&pool->deques[i].lock, NULL);
+		pool->deques[i].items = (work_item*)malloc(depth_limit * sizeof(work_item));
+		pool->deques[i].capacity = depth_limit;
+		pool->deques[i].head = 0;
+		pool->deques[i].count = 0;
+	}
+
+	pool->threads = (pthread_t*)malloc(worker_cnt * sizeof(pthread_t));
+	for (int i = 0; i < worker_cnt; i++)
+	{
+		worker_arg* arg = (worker_arg*)malloc(sizeof(worker_arg));
+		arg->pool = pool;
+		arg->index = i;
+		if (pthread_create(&pool->threads[i], NULL, worker_loop, arg))
+			return -1;
+	}
+
+	return 0;
+}
+
+// 작업을 제출합니다. 큐가 가득 차면 WORK_POOL_SHED 정책에서는 -1 을 돌려주고,
+// WORK_POOL_WAIT 정책에서는 워커가 작업을 가져갈 때까지 기다립니다.
+int work_pool_submit(work_pool* pool, work_fn fn, void* arg)
+{
+	work_item item;
+	item.fn = fn;
+	item.arg = arg;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending >= pool->depth_limit)
+	{
+		if (pool->policy == WORK_POOL_SHED)
+		{
+			pthread_mutex_unlock(&pool->lock);
+			return -1;
+		}
+		pthread_cond_wait(&pool->space_cond, &pool->lock);
+	}
+
+	// 대기 작업 수를 잠금 안에서 늘리므로 덱에는 항상 자리가 있습니다.
+	int index = pool->next_deque++ % pool->worker_cnt;
+	deque_push_back(&pool->deques[index], item);
+	pool->pending++;
+	pthread_cond_signal(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+// 대기 중인 작업 수와 실행 중인 작업 수를 읽습니다.
+void work_pool_load(work_pool* pool, int* pending, int* running)
+{
+	pthread_mutex_lock(&pool->lock);
+	*pending = pool->pending;
+	*running = pool->running;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// 남은 작업을 모두 처리한 뒤 워커들을 끝내고, join 으로 기다린 다음 자원을 정리합니다.
+// 더 이상 제출하지 않는 쪽에서만 부릅니다.
+void work_pool_shutdown(work_pool* pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->worker_cnt; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	for (int i = 0; i < pool->worker_cnt; i++)
+	{
+		pthread_mutex_destroy(&pool->deques[i].lock);
+		free(pool->deques[i].items);
+	}
+	free(pool->deques);
+	free(pool->threads);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->space_cond);
+}
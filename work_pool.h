@@ -0,0 +1,52 @@
+#pragma once
+
+#include <pthread.h>
+
+// 큐가 가득 찼을 때의 동작
+#define WORK_POOL_WAIT		0	// 자리가 날 때까지 제출하는 쪽이 기다립니다.
+#define WORK_POOL_SHED		1	// 바로 실패를 돌려줍니다.
+
+typedef void* (*work_fn)(void* arg);
+
+typedef struct work_item
+{
+	work_fn fn;
+	void* arg;
+} work_item;
+
+// 워커마다 하나씩 가지는 덱입니다.
+// 주인은 뒤에서 꺼내고, 다른 워커는 앞에서 훔쳐갑니다.
+typedef struct work_deque
+{
+	pthread_mutex_t lock;
+	work_item* items;
+	int capacity;
+	int head, count;
+} work_deque;
+
+typedef struct work_pool
+{
+	int worker_cnt;
+	pthread_t* threads;
+	work_deque* deques;
+
+	int depth_limit;
+	int policy;
+
+	// pending 은 덱에 들어가 있고 아직 실행되지 않은 작업 수입니다.
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t space_cond;
+	int pending;
+	// 워커가 꺼내서 실행하고 있는 작업 수
+	int running;
+	int next_deque;
+	// work_pool_shutdown 이 켜면 워커들은 남은 작업을 마치고 끝납니다.
+	int stopping;
+} work_pool;
+
+int work_pool_default_workers();
+int work_pool_init(work_pool* pool, int worker_cnt, int depth_limit, int policy);
+int work_pool_submit(work_pool* pool, work_fn fn, void* arg);
+void work_pool_load(work_pool* pool, int* pending, int* running);
+void work_pool_shutdown(work_pool* pool);
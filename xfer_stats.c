@@ -0,0 +1,197 @@
+/*
+	xfer_stats.c
+	서버의 전송마다 걸린 시간과 처리량을 재는 함수들입니다.
+	시간은 모두 CLOCK_MONOTONIC 의 나노초로 재므로 시스템 시간이 바뀌어도 틀어지지 않습니다.
+	조각 하나를 보내거나 받는 시간은 HDR 처럼 로그 구간을 잘게 나눈 히스토그램에 넣고,
+	채널이 막혀서 기다린 시간과 데이터를 옮긴 시간을 따로 더합니다.
+	전송이 끝나면 그 전송의 값을 출력하고, 서버 전체의 누적값에 방향별로 더합니다.
+	진행 중인 전송 수와 옮긴 크기는 원자 변수로 바로 더해서 metrics.c 가 전송 도중에도 볼 수 있습니다.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "xfer_stats.h"
+#include "log.h"
+
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static xfer_totals totals[2];
+
+// 진행 중인 전송 수, 진행 중인 전송들이 옮긴 크기, 끝나지 않은 전송까지 포함해서 옮긴 크기
+static atomic_llong live_active[2];
+static atomic_llong live_in_flight[2];
+static atomic_ullong live_moved[2];
+
+uint64_t xfer_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 2*XFER_HIST_SUB 보다 작은 값은 값 그대로 칸이 되고,
+// 그보다 크면 최상위 비트 아래 XFER_HIST_SUB_BITS 비트만 남겨서 칸을 정합니다.
+static int hist_bucket(uint64_t v)
+{
+	if (v < 2 * XFER_HIST_SUB)
+		return (int)v;
+	int shift = 63 - __builtin_clzll(v) - XFER_HIST_SUB_BITS;
+	return shift * XFER_HIST_SUB + (int)(v >> shift);
+}
+
+// 칸에 들어가는 가장 큰 값입니다.
+static uint64_t hist_bucket_max(int b)
+{
+	if (b < 2 * XFER_HIST_SUB)
+		return b;
+	int shift = b / XFER_HIST_SUB - 1;
+	uint64_t top = b % XFER_HIST_SUB + XFER_HIST_SUB;
+	return ((top + 1) << shift) - 1;
+}
+
+void xfer_hist_record(xfer_hist* h, uint64_t v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->buckets[hist_bucket(v)]++;
+}
+
+void xfer_hist_merge(xfer_hist* dst, const xfer_hist* src)
+{
+	if (!src->count)
+		return;
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (int b = 0; b < XFER_HIST_BUCKETS; b++)
+		dst->buckets[b] += src->buckets[b];
+}
+
+// pct(0~100) 번째 백분위 값입니다. 칸의 가장 큰 값으로 돌려주되 실제 최대값은 넘지 않습니다.
+uint64_t xfer_hist_percentile(const xfer_hist* h, double pct)
+{
+	if (!h->count)
+		return 0;
+
+	uint64_t rank = (uint64_t)(h->count * pct / 100.0 + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for (int b = 0; b < XFER_HIST_BUCKETS; b++)
+	{
+		seen += h->buckets[b];
+		if (seen >= rank)
+		{
+			uint64_t v = hist_bucket_max(b);
+			return v < h->max? v: h->max;
+		}
+	}
+	return h->max;
+}
+
+void xfer_stats_begin(xfer_stats* s, int direction)
+{
+	memset(s, 0, sizeof(xfer_stats));
+	s->direction = direction? XFER_DOWNLOAD: XFER_UPLOAD;
+	s->start_ns = xfer_now_ns();
+	atomic_fetch_add(&live_active[s->direction], 1);
+}
+
+// 조각 하나를 옮겼습니다. 조각의 지연은 기다린 시간과 옮긴 시간의 합입니다.
+void xfer_stats_chunk(xfer_stats* s, uint64_t bytes, uint64_t wait_ns, uint64_t copy_ns)
+{
+	s->bytes += bytes;
+	s->chunks++;
+	s->wait_ns += wait_ns;
+	s->copy_ns += copy_ns;
+	xfer_hist_record(&s->chunk_hist, wait_ns + copy_ns);
+
+	atomic_fetch_add_explicit(&live_in_flight[s->direction], bytes, memory_order_relaxed);
+	atomic_fetch_add_explicit(&live_moved[s->direction], bytes, memory_order_relaxed);
+}
+
+// 전송을 끝내고 서버 전체의 누적값에 더합니다.
+void xfer_stats_end(xfer_stats* s, int result)
+{
+	s->end_ns = xfer_now_ns();
+	atomic_fetch_sub(&live_in_flight[s->direction], s->bytes);
+	atomic_fetch_sub(&live_active[s->direction], 1);
+
+	xfer_totals* t = &totals[s->direction];
+	pthread_mutex_lock(&totals_lock);
+	t->transfers++;
+	if (result < 0)
+		t->failed++;
+	t->bytes += s->bytes;
+	t->busy_ns += s->end_ns - s->start_ns;
+	t->wait_ns += s->wait_ns;
+	t->copy_ns += s->copy_ns;
+	xfer_hist_merge(&t->chunk_hist, &s->chunk_hist);
+	xfer_hist_record(&t->transfer_hist, s->end_ns - s->start_ns);
+	pthread_mutex_unlock(&totals_lock);
+}
+
+static double mb_per_sec(uint64_t bytes, uint64_t ns)
+{
+	return ns? bytes / (ns / 1e9) / (1024 * 1024): 0;
+}
+
+void xfer_stats_print(const char* tag, const char* name, const xfer_stats* s)
+{
+	uint64_t elapsed = s->end_ns - s->start_ns;
+	const xfer_hist* h = &s->chunk_hist;
+
+	log_info(">> %s(name=\"%s\") stats: %llu bytes in %.3f ms (%.1f MB/s), %llu chunks p50=%.1fus p99=%.1fus max=%.1fus, wait=%.3f ms, copy=%.3f ms\n",
+			tag, name,
+			(unsigned long long)s->bytes, elapsed / 1e6, mb_per_sec(s->bytes, elapsed),
+			(unsigned long long)s->chunks,
+			xfer_hist_percentile(h, 50) / 1e3, xfer_hist_percentile(h, 99) / 1e3, h->max / 1e3,
+			s->wait_ns / 1e6, s->copy_ns / 1e6);
+}
+
+void xfer_totals_snapshot(int direction, xfer_totals* out)
+{
+	int d = direction? XFER_DOWNLOAD: XFER_UPLOAD;
+	pthread_mutex_lock(&totals_lock);
+	*out = totals[d];
+	pthread_mutex_unlock(&totals_lock);
+
+	out->active = atomic_load(&live_active[d]);
+	out->in_flight = atomic_load(&live_in_flight[d]);
+	out->moved = atomic_load(&live_moved[d]);
+}
+
+// 서버 전체의 누적값을 방향별로 출력합니다.
+// 처리량은 전송들이 돌고 있던 시간의 합으로 나눈 값이므로 전송 하나의 평균 처리량입니다.
+void xfer_totals_print()
+{
+	static const char* names[2] = { "upload", "download" };
+
+	for (int d = 0; d < 2; d++)
+	{
+		xfer_totals t;
+		xfer_totals_snapshot(d, &t);
+		if (!t.transfers)
+			continue;
+
+		printf(">> %s totals: %llu transfers (%llu failed), %llu bytes, %.1f MB/s per transfer, "
+				"chunk p50=%.1fus p99=%.1fus max=%.1fus, transfer p50=%.3f ms p99=%.3f ms, wait=%.3f ms, copy=%.3f ms\n",
+				names[d],
+				(unsigned long long)t.transfers, (unsigned long long)t.failed, (unsigned long long)t.bytes,
+				mb_per_sec(t.bytes, t.busy_ns),
+				xfer_hist_percentile(&t.chunk_hist, 50) / 1e3, xfer_hist_percentile(&t.chunk_hist, 99) / 1e3, t.chunk_hist.max / 1e3,
+				xfer_hist_percentile(&t.transfer_hist, 50) / 1e6, xfer_hist_percentile(&t.transfer_hist, 99) / 1e6,
+				t.wait_ns / 1e6, t.copy_ns / 1e6);
+	}
+}
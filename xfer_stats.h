@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+// 히스토그램은 2의 거듭제곱 구간마다 XFER_HIST_SUB 개의 칸으로 나눕니다.
+// 칸 하나의 폭은 그 구간 값의 1/XFER_HIST_SUB 이내이므로, 작은 값과 큰 값 모두 비슷한 상대 오차로 셉니다.
+#define XFER_HIST_SUB_BITS	3
+#define XFER_HIST_SUB		(1 << XFER_HIST_SUB_BITS)
+#define XFER_HIST_BUCKETS	((64 - XFER_HIST_SUB_BITS + 1) * XFER_HIST_SUB)
+
+// 서버 전체 누적값의 방향
+#define XFER_UPLOAD			0
+#define XFER_DOWNLOAD		1
+
+// 나노초 단위 값들의 분포입니다.
+typedef struct xfer_hist
+{
+	uint64_t count, sum, min, max;
+	uint64_t buckets[XFER_HIST_BUCKETS];
+} xfer_hist;
+
+// 전송 하나의 측정값입니다. 전송을 맡은 쓰레드 하나만 고치므로 잠그지 않습니다.
+// wait_ns 는 채널(큐, 링, FIFO)이 막혀서 기다린 시간, copy_ns 는 데이터를 옮긴 시간입니다.
+typedef struct xfer_stats
+{
+	int direction;
+	uint64_t start_ns, end_ns;
+	uint64_t bytes, chunks;
+	uint64_t wait_ns, copy_ns;
+	// 조각 하나를 채널로 보내거나 받는 데 걸린 시간
+	xfer_hist chunk_hist;
+} xfer_stats;
+
+// 서버 전체의 누적값입니다. 방향마다 하나씩 있고 끝난 전송의 값은 lock 안에서만 더합니다.
+// active, in_flight, moved 는 진행 중인 전송도 조각마다 바로 더하는 값으로, 스냅샷을 뜰 때 채웁니다.
+typedef struct xfer_totals
+{
+	int64_t active, in_flight;
+	uint64_t moved;
+	uint64_t transfers, failed;
+	uint64_t bytes, busy_ns, wait_ns, copy_ns;
+	xfer_hist chunk_hist;
+	// 전송 하나의 시작부터 끝까지의 시간
+	xfer_hist transfer_hist;
+} xfer_totals;
+
+uint64_t xfer_now_ns();
+
+void xfer_hist_record(xfer_hist* h, uint64_t v);
+void xfer_hist_merge(xfer_hist* dst, const xfer_hist* src);
+uint64_t xfer_hist_percentile(const xfer_hist* h, double pct);
+
+void xfer_stats_begin(xfer_stats* s, int direction);
+void xfer_stats_chunk(xfer_stats* s, uint64_t bytes, uint64_t wait_ns, uint64_t copy_ns);
+void xfer_stats_end(xfer_stats* s, int result);
+void xfer_stats_print(const char* tag, const char* name, const xfer_stats* s);
+
+void xfer_totals_snapshot(int direction, xfer_totals* out);
+void xfer_totals_print();